@@ -0,0 +1,236 @@
+#import "allocation.hpp"
+
+#import <mutex>
+#import <algorithm>
+#import <cassert>
+
+namespace Rope {
+
+#pragma mark - Size classes
+
+    /**
+     *  Header preceding every pooled block. Keeps the block's payload aligned for any object.
+     */
+    struct alignas(alignof(std::max_align_t)) __PoolHeader {
+        uint32_t size_class;
+        RopeArena *arena;
+    };
+
+    struct __PoolFree {
+        __PoolFree *next;
+    };
+
+    static size_t const pool_header_size = sizeof(__PoolHeader);
+    static size_t const pool_chunk_size = 64 * 1024;
+
+    /**
+     *  Classes step by a quarter of each power of two from 64 bytes to 16 KiB, so no more than a fifth of a block
+     *  goes unused and every block stays aligned. Larger blocks come straight from the system allocator.
+     */
+    static uint32_t const pool_class_count = 33;
+    static uint32_t const pool_class_heap = pool_class_count;
+    static uint32_t const pool_class_arena = pool_class_count + 1;
+
+    static uint32_t find_last_set(size_t n)
+    {
+        return 63 - __builtin_clzll(n);
+    }
+
+    static uint32_t pool_size_class(size_t size)
+    {
+        if (size <= 64) {
+            return 0;
+        }
+        uint32_t b = find_last_set(size - 1);
+        uint32_t sub = (uint32_t)((size - 1) >> (b - 2)) - 4;
+        return (b - 6) * 4 + sub + 1;
+    }
+
+    static size_t pool_class_size(uint32_t size_class)
+    {
+        if (size_class == 0) {
+            return 64;
+        }
+        uint32_t b = 6 + (size_class - 1) / 4;
+        uint32_t sub = (size_class - 1) % 4;
+        return ((size_t)1 << b) + (sub + 1) * ((size_t)1 << (b - 2));
+    }
+
+#pragma mark - Depot
+
+    /**
+     *  Free lists left behind by exited threads
+     */
+    static std::mutex pool_depot_mutex;
+    static __PoolFree *pool_depot[pool_class_count];
+
+    /**
+     *  The current thread's free lists and arena. Plain data with the initial-exec TLS model, so reaching them from
+     *  the shared library is a single offset from the thread pointer.
+     */
+#define ROPE_POOL_TLS thread_local __attribute__((tls_model("initial-exec")))
+
+    static ROPE_POOL_TLS __PoolFree *pool_free[pool_class_count];
+    static ROPE_POOL_TLS RopeArena *pool_arena;
+
+    /**
+     *  Moves a thread's free lists to the depot when the thread exits. Only threads that have refilled a free list
+     *  construct one.
+     */
+    struct __PoolExit {
+        ~__PoolExit()
+        {
+            std::lock_guard<std::mutex> lock(pool_depot_mutex);
+            for (uint32_t c = 0; c < pool_class_count; ++c) {
+                while (pool_free[c] != nullptr) {
+                    __PoolFree *block = pool_free[c];
+                    pool_free[c] = block->next;
+                    block->next = pool_depot[c];
+                    pool_depot[c] = block;
+                }
+            }
+        }
+    };
+
+    static thread_local __PoolExit pool_exit;
+
+    /**
+     *  Refill the current thread's free list for `size_class`, from the depot if it has any blocks and from a new
+     *  chunk otherwise
+     */
+    static void pool_refill(uint32_t size_class)
+    {
+        (void)&pool_exit;
+
+        {
+            std::lock_guard<std::mutex> lock(pool_depot_mutex);
+            if (pool_depot[size_class] != nullptr) {
+                pool_free[size_class] = pool_depot[size_class];
+                pool_depot[size_class] = nullptr;
+                return;
+            }
+        }
+
+        size_t block_size = pool_class_size(size_class);
+        size_t count = pool_chunk_size / block_size;
+        char *chunk = static_cast<char *>(::operator new(count * block_size));
+
+        __PoolFree *head = nullptr;
+        for (size_t i = count; i > 0; --i) {
+            __PoolFree *block = reinterpret_cast<__PoolFree *>(chunk + (i - 1) * block_size);
+            block->next = head;
+            head = block;
+        }
+        pool_free[size_class] = head;
+    }
+
+#pragma mark - RopePool
+
+    void *RopePool::allocate(size_t size)
+    {
+        size_t total = size + pool_header_size;
+        __PoolHeader *header;
+
+        if (pool_arena != nullptr) {
+            header = static_cast<__PoolHeader *>(pool_arena->allocate(total));
+            header->size_class = pool_class_arena;
+            header->arena = pool_arena;
+        } else {
+            uint32_t size_class = pool_size_class(total);
+            if (size_class >= pool_class_count) {
+                header = static_cast<__PoolHeader *>(::operator new(total));
+                header->size_class = pool_class_heap;
+            } else {
+                if (pool_free[size_class] == nullptr) {
+                    pool_refill(size_class);
+                }
+                __PoolFree *block = pool_free[size_class];
+                pool_free[size_class] = block->next;
+                header = reinterpret_cast<__PoolHeader *>(block);
+                header->size_class = size_class;
+            }
+            header->arena = nullptr;
+        }
+        return reinterpret_cast<char *>(header) + pool_header_size;
+    }
+
+    void RopePool::release(void *block)
+    {
+        __PoolHeader *header = reinterpret_cast<__PoolHeader *>(static_cast<char *>(block) - pool_header_size);
+        switch (header->size_class) {
+            case pool_class_arena: {
+                header->arena->live_blocks.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            case pool_class_heap: {
+                ::operator delete(header);
+                break;
+            }
+            default: {
+                uint32_t size_class = header->size_class;
+                __PoolFree *free = reinterpret_cast<__PoolFree *>(header);
+                free->next = pool_free[size_class];
+                pool_free[size_class] = free;
+            }
+        }
+    }
+
+#pragma mark - RopeArena
+
+    RopeArena::RopeArena(size_t chunk_size)
+    :   chunk_size(chunk_size),
+        chunks(nullptr),
+        cursor(nullptr),
+        limit(nullptr),
+        reserved_bytes(0),
+        live_blocks(0)
+    {}
+
+    RopeArena::~RopeArena()
+    {
+        assert(live_blocks == 0 && "ropes allocated from an arena must be released before it");
+        while (chunks != nullptr) {
+            Chunk *next = chunks->next;
+            ::operator delete(chunks);
+            chunks = next;
+        }
+    }
+
+    void *RopeArena::allocate(size_t size)
+    {
+        size_t align = alignof(std::max_align_t);
+        size = (size + align - 1) & ~(align - 1);
+
+        if (cursor == nullptr || (size_t)(limit - cursor) < size) {
+            size_t header = (sizeof(Chunk) + align - 1) & ~(align - 1);
+            size_t length = std::max(chunk_size, size + header);
+            Chunk *chunk = static_cast<Chunk *>(::operator new(length));
+            chunk->next = chunks;
+            chunks = chunk;
+            cursor = reinterpret_cast<char *>(chunk) + header;
+            limit = reinterpret_cast<char *>(chunk) + length;
+            reserved_bytes += length;
+        }
+
+        void *ret = cursor;
+        cursor += size;
+        live_blocks.fetch_add(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    RopeArena *RopeArena::current()
+    {
+        return pool_arena;
+    }
+
+    RopeArena::Scope::Scope(RopeArena &arena)
+    :   previous(pool_arena)
+    {
+        pool_arena = &arena;
+    }
+
+    RopeArena::Scope::~Scope()
+    {
+        pool_arena = previous;
+    }
+}
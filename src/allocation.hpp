@@ -0,0 +1,262 @@
+#ifndef ROPE_ALLOCATION_H
+#define ROPE_ALLOCATION_H
+
+#import <atomic>
+#import <memory>
+#import <new>
+#import <cstddef>
+#import <cstdint>
+#import <utility>
+
+namespace Rope {
+
+    class RopeArena;
+
+    /**
+     *  Thread-local size-class pool for rope nodes and slices.
+     *
+     *  Each thread keeps a free list per size class and refills it 64 KiB at a time, so allocating and releasing a
+     *  node is a pointer swap with no locking. Blocks may be released on any thread; they join the releasing
+     *  thread's free lists. A thread's free lists move to a shared depot when it exits, for other threads to reuse.
+     *  Memory taken by the pool is kept for reuse until the process exits.
+     *
+     *  While a `RopeArena::Scope` is active on the thread, allocations come from the arena instead.
+     */
+    class RopePool {
+    public:
+        /**
+         *  Allocate `size` bytes, aligned for any object
+         */
+        static void *allocate(size_t size);
+
+        /**
+         *  Release a block returned by `allocate`
+         */
+        static void release(void *block);
+    };
+
+    /**
+     *  Bump allocator for building and discarding temporary ropes in bulk.
+     *
+     *  Allocation is a pointer increment and releasing a block costs nothing; the arena's memory is returned when the
+     *  arena is destroyed. Everything allocated from the arena must be released before then.
+     */
+    class RopeArena {
+    public:
+        /**
+         *  Routes the current thread's pooled allocations to an arena for the lifetime of the scope
+         */
+        class Scope {
+        public:
+            Scope(RopeArena &arena);
+            ~Scope();
+
+        private:
+            RopeArena *previous;
+        };
+
+        RopeArena(size_t chunk_size = 64 * 1024);
+        ~RopeArena();
+
+        /**
+         *  The arena of the current thread's innermost active scope, or null
+         */
+        static RopeArena *current();
+
+        /**
+         *  The number of blocks allocated from the arena and not yet released
+         */
+        uintptr_t live() const { return live_blocks; }
+
+        /**
+         *  The number of bytes reserved by the arena
+         */
+        uintptr_t reserved() const { return reserved_bytes; }
+
+    private:
+        friend class RopePool;
+
+        struct Chunk {
+            Chunk *next;
+        };
+
+        void *allocate(size_t size);
+
+        size_t chunk_size;
+        Chunk *chunks;
+        char *cursor;
+        char *limit;
+        uintptr_t reserved_bytes;
+        std::atomic<uintptr_t> live_blocks;
+    };
+
+    /**
+     *  Base class for objects owned through `IntrusivePtr`, holding their reference count inline
+     */
+    class RefCounted {
+    public:
+        RefCounted() : __refcount(0) {}
+        RefCounted(RefCounted const &) : __refcount(0) {}
+        RefCounted &operator=(RefCounted const &) { return *this; }
+
+        void __retain() const { __refcount.fetch_add(1, std::memory_order_relaxed); }
+
+        /**
+         *  Drop a reference, returning true if it was the last one.
+         *  The sole owner can't race with anyone else, so it skips the atomic decrement.
+         */
+        bool __release() const
+        {
+            return __refcount.load(std::memory_order_acquire) == 1
+                || __refcount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+
+    private:
+        mutable std::atomic<uint32_t> __refcount;
+    };
+
+    /**
+     *  Owning pointer to a `RefCounted` object allocated from `RopePool`
+     */
+    template<typename T>
+    class IntrusivePtr {
+    public:
+        using element_type = T;
+
+        IntrusivePtr() : ptr(nullptr) {}
+        IntrusivePtr(std::nullptr_t) : ptr(nullptr) {}
+
+        /**
+         *  Take a reference to `p`, which must have been allocated from `RopePool`
+         */
+        explicit IntrusivePtr(T *p) : ptr(p) { retain(); }
+
+        IntrusivePtr(IntrusivePtr const &other) : ptr(other.ptr) { retain(); }
+        IntrusivePtr(IntrusivePtr &&other) : ptr(other.ptr) { other.ptr = nullptr; }
+
+        ~IntrusivePtr() { release(); }
+
+        IntrusivePtr &operator=(IntrusivePtr const &other)
+        {
+            other.retain();
+            release();
+            ptr = other.ptr;
+            return *this;
+        }
+
+        IntrusivePtr &operator=(IntrusivePtr &&other)
+        {
+            if (this != &other) {
+                release();
+                ptr = other.ptr;
+                other.ptr = nullptr;
+            }
+            return *this;
+        }
+
+        void reset() { release(); ptr = nullptr; }
+
+        T *get() const { return ptr; }
+        T &operator*() const { return *ptr; }
+        T *operator->() const { return ptr; }
+        explicit operator bool() const { return ptr != nullptr; }
+
+        friend bool operator==(IntrusivePtr const &lhs, IntrusivePtr const &rhs) { return lhs.ptr == rhs.ptr; }
+        friend bool operator!=(IntrusivePtr const &lhs, IntrusivePtr const &rhs) { return lhs.ptr != rhs.ptr; }
+        friend bool operator==(IntrusivePtr const &lhs, std::nullptr_t) { return lhs.ptr == nullptr; }
+        friend bool operator!=(IntrusivePtr const &lhs, std::nullptr_t) { return lhs.ptr != nullptr; }
+
+    private:
+        T *ptr;
+
+        void retain() const
+        {
+            if (ptr != nullptr) {
+                ptr->__retain();
+            }
+        }
+
+        void release()
+        {
+            if (ptr != nullptr && ptr->__release()) {
+                ptr->~T();
+                RopePool::release(ptr);
+            }
+        }
+    };
+
+    /**
+     *  Allocation policies decide how rope nodes and slices are allocated and owned:
+     *
+     *      template<typename T> using pointer;         owning pointer type
+     *      counted_base                                base class for owned objects
+     *      template<typename T> static pointer<T> make(Args...);
+     *      template<typename T> static T *create(Args...);  and  static void destroy(T *);  for unshared objects
+     *
+     *  `SharedAllocation` is the default, through `std::shared_ptr`.
+     */
+    struct SharedAllocation
+    {
+        template<typename T>
+        using pointer = std::shared_ptr<T>;
+
+        struct counted_base {};
+
+        template<typename T, typename... Args>
+        static pointer<T> make(Args &&... args) { return std::make_shared<T>(std::forward<Args>(args)...); }
+
+        template<typename T, typename... Args>
+        static T *create(Args &&... args) { return new T(std::forward<Args>(args)...); }
+
+        template<typename T>
+        static void destroy(T *p) { delete p; }
+    };
+
+    /**
+     *  Allocates from `RopePool` (or the thread's active `RopeArena`) and owns through `IntrusivePtr`, so a node costs
+     *  one pooled block and no separate control block.
+     */
+    struct PoolAllocation
+    {
+        template<typename T>
+        using pointer = IntrusivePtr<T>;
+
+        using counted_base = RefCounted;
+
+        template<typename T, typename... Args>
+        static pointer<T> make(Args &&... args) { return pointer<T>(create<T>(std::forward<Args>(args)...)); }
+
+        template<typename T, typename... Args>
+        static T *create(Args &&... args)
+        {
+            void *block = RopePool::allocate(sizeof(T));
+            try {
+                return new (block) T(std::forward<Args>(args)...);
+            } catch (...) {
+                RopePool::release(block);
+                throw;
+            }
+        }
+
+        template<typename T>
+        static void destroy(T *p)
+        {
+            if (p != nullptr) {
+                p->~T();
+                RopePool::release(p);
+            }
+        }
+    };
+
+    /**
+     *  Wraps a measure policy to allocate the rope's nodes and slices with `Allocation`
+     *  (e.g.: `Rope<char, PooledPolicy<UTF8MeasurePolicy>>`)
+     */
+    template<typename Policy, typename Allocation = PoolAllocation>
+    struct PooledPolicy : public Policy
+    {
+        using allocation_type = Allocation;
+    };
+};
+
+#endif // ROPE_ALLOCATION_H
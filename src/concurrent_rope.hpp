@@ -0,0 +1,101 @@
+#ifndef ROPE_CONCURRENT_ROPE_H
+#define ROPE_CONCURRENT_ROPE_H
+
+#import <atomic>
+#import <utility>
+#import <cstdint>
+
+#import "rope.hpp"
+#import "hazard_pointer.hpp"
+
+namespace Rope {
+
+    /**
+     *  A rope edited by one thread and read by any number of others, without locks.
+     *
+     *  The writer publishes each new version by swapping in a new root. A reader either takes a snapshot, which
+     *  keeps its version alive for as long as it's held, or `read`s the current version in place, which touches no
+     *  shared reference count. Either way the version stays valid and unchanged while edits continue, since ropes
+     *  are never modified in place; a replaced version is freed once no reader can still reach it.
+     */
+    template<typename Item, typename MeasureType>
+    class ConcurrentRope {
+    public:
+        using RopeType = Rope<Item, MeasureType>;
+
+        explicit ConcurrentRope(RopeType const &initial = RopeType())
+        :   root(new Version { initial, 0 })
+        {}
+
+        /**
+         *  No other thread may be using the rope
+         */
+        ~ConcurrentRope()
+        {
+            delete root.load(std::memory_order_acquire);
+        }
+
+        ConcurrentRope(ConcurrentRope const &) = delete;
+        ConcurrentRope &operator=(ConcurrentRope const &) = delete;
+
+        /**
+         *  The current version, kept alive by the returned rope
+         */
+        RopeType snapshot() const
+        {
+            HazardPointer hazard;
+            return hazard.protect(root)->rope;
+        }
+
+        /**
+         *  Call `f(rope)` with the current version and return its result. The version can't be freed until `f`
+         *  returns, but `f` mustn't keep references into it past then. Reads may nest `HazardPointer::slot_count`
+         *  deep on a thread.
+         */
+        template<typename F>
+        auto read(F f) const -> decltype(f(std::declval<RopeType const &>()))
+        {
+            HazardPointer hazard;
+            return f(hazard.protect(root)->rope);
+        }
+
+        /**
+         *  The number of versions published since the rope was created
+         */
+        uint64_t version() const
+        {
+            HazardPointer hazard;
+            return hazard.protect(root)->number;
+        }
+
+        /**
+         *  Make `rope` the current version. Only one thread may publish.
+         */
+        void publish(RopeType const &rope)
+        {
+            Version *previous = root.load(std::memory_order_relaxed);
+            root.store(new Version { rope, previous->number + 1 }, std::memory_order_seq_cst);
+            HazardPointer::retire(previous, [](void *version) { delete static_cast<Version *>(version); });
+        }
+
+        /**
+         *  Publish `f(rope)` for the current version `rope`. Only one thread may publish.
+         */
+        template<typename F>
+        void update(F f)
+        {
+            // Only the publishing thread frees versions, so it needs no protection of its own
+            publish(f(root.load(std::memory_order_relaxed)->rope));
+        }
+
+    private:
+        struct Version {
+            RopeType rope;
+            uint64_t number;
+        };
+
+        std::atomic<Version *> root;
+    };
+};
+
+#endif // ROPE_CONCURRENT_ROPE_H
@@ -1,9 +1,63 @@
+#ifndef ROPE_FIBONACCI_H
+#define ROPE_FIBONACCI_H
+
 #import <cstdint>
 
 namespace Rope {
     /**
-     *  Calculate which index in the Fibbonacci sequence a number appears at.
-     *  If `fibNum` is not a fibbonacci number, returns the largest fibbonacci number in [0, `fibNum`)
+     *  The number of Fibonacci numbers that fit in 64 bits
+     */
+    constexpr uintptr_t fibCount = 94;
+
+    /**
+     *  The Fibonacci sequence up to the largest number that fits in 64 bits, from F(0) = 0
      */
-    uintptr_t fibIndex(uintptr_t fibnum);
+    constexpr uint64_t fibTable[fibCount] = {
+        0ull, 1ull, 1ull, 2ull,
+        3ull, 5ull, 8ull, 13ull,
+        21ull, 34ull, 55ull, 89ull,
+        144ull, 233ull, 377ull, 610ull,
+        987ull, 1597ull, 2584ull, 4181ull,
+        6765ull, 10946ull, 17711ull, 28657ull,
+        46368ull, 75025ull, 121393ull, 196418ull,
+        317811ull, 514229ull, 832040ull, 1346269ull,
+        2178309ull, 3524578ull, 5702887ull, 9227465ull,
+        14930352ull, 24157817ull, 39088169ull, 63245986ull,
+        102334155ull, 165580141ull, 267914296ull, 433494437ull,
+        701408733ull, 1134903170ull, 1836311903ull, 2971215073ull,
+        4807526976ull, 7778742049ull, 12586269025ull, 20365011074ull,
+        32951280099ull, 53316291173ull, 86267571272ull, 139583862445ull,
+        225851433717ull, 365435296162ull, 591286729879ull, 956722026041ull,
+        1548008755920ull, 2504730781961ull, 4052739537881ull, 6557470319842ull,
+        10610209857723ull, 17167680177565ull, 27777890035288ull, 44945570212853ull,
+        72723460248141ull, 117669030460994ull, 190392490709135ull, 308061521170129ull,
+        498454011879264ull, 806515533049393ull, 1304969544928657ull, 2111485077978050ull,
+        3416454622906707ull, 5527939700884757ull, 8944394323791464ull, 14472334024676221ull,
+        23416728348467685ull, 37889062373143906ull, 61305790721611591ull, 99194853094755497ull,
+        160500643816367088ull, 259695496911122585ull, 420196140727489673ull, 679891637638612258ull,
+        1100087778366101931ull, 1779979416004714189ull, 2880067194370816120ull, 4660046610375530309ull,
+        7540113804746346429ull, 12200160415121876738ull
+    };
+
+    /**
+     *  The largest index in [`low`, `high`) whose Fibonacci number is at most `fibnum`, by binary search
+     */
+    constexpr uintptr_t __fibIndex(uint64_t fibnum, uintptr_t low, uintptr_t high)
+    {
+        return high - low <= 1 ? low
+             : fibTable[(low + high) / 2] <= fibnum ? __fibIndex(fibnum, (low + high) / 2, high)
+             : __fibIndex(fibnum, low, (low + high) / 2);
+    }
+
+    /**
+     *  Calculate which index in the Fibonacci sequence a number appears at.
+     *  If `fibnum` is not a Fibonacci number, returns the index of the largest Fibonacci number below it. Indices
+     *  start from 2, so 1 is at index 2.
+     */
+    constexpr uintptr_t fibIndex(uint64_t fibnum)
+    {
+        return __fibIndex(fibnum, 2, fibCount);
+    }
 }
+
+#endif // ROPE_FIBONACCI_H
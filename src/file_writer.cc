@@ -0,0 +1,90 @@
+#import "file_writer.hpp"
+
+#import <system_error>
+#import <cerrno>
+#import <cstdlib>
+#import <cstring>
+#import <cstdio>
+
+#import <unistd.h>
+#import <sys/stat.h>
+
+namespace Rope {
+
+    static size_t const __fileWriterBuffer = 1 << 20;
+
+    FileWriter::FileWriter(std::string const &path)
+    :   path(path),
+        temporary(path + ".XXXXXX"),
+        fd(-1),
+        written(0)
+    {
+        fd = mkstemp(&temporary[0]);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        // `mkstemp` makes the file private to its owner; keep the permissions of the file being replaced
+        struct stat info;
+        fchmod(fd, stat(path.c_str(), &info) == 0 ? info.st_mode & 07777 : 0644);
+        buffer.reserve(__fileWriterBuffer);
+    }
+
+    FileWriter::~FileWriter()
+    {
+        if (fd >= 0) {
+            close(fd);
+            unlink(temporary.c_str());
+        }
+    }
+
+    void FileWriter::write(void const *data, size_t length)
+    {
+        char const *bytes = static_cast<char const *>(data);
+        if (buffer.size() + length <= __fileWriterBuffer) {
+            buffer.insert(buffer.end(), bytes, bytes + length);
+            return;
+        }
+        flush();
+        if (length >= __fileWriterBuffer) {
+            write_all(bytes, length);
+            written += length;
+        } else {
+            buffer.insert(buffer.end(), bytes, bytes + length);
+        }
+    }
+
+    void FileWriter::commit()
+    {
+        flush();
+        int result = close(fd);
+        fd = -1;
+        if (result != 0 || rename(temporary.c_str(), path.c_str()) != 0) {
+            int error = errno;
+            unlink(temporary.c_str());
+            throw std::system_error(error, std::generic_category(), path);
+        }
+    }
+
+    void FileWriter::flush()
+    {
+        write_all(buffer.data(), buffer.size());
+        written += buffer.size();
+        buffer.clear();
+    }
+
+    void FileWriter::write_all(char const *bytes, size_t length)
+    {
+        while (length > 0) {
+            ssize_t count = ::write(fd, bytes, length);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+            bytes += count;
+            length -= count;
+        }
+    }
+}
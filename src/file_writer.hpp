@@ -0,0 +1,55 @@
+#ifndef ROPE_FILE_WRITER_H
+#define ROPE_FILE_WRITER_H
+
+#import <string>
+#import <vector>
+#import <cstddef>
+#import <cstdint>
+
+namespace Rope {
+
+    /**
+     *  A file written front to back through a buffer.
+     *
+     *  The bytes go to a new file beside `path`, which `commit` renames over it, so the file at `path` is replaced
+     *  whole or not at all, and any mapping of the file it replaces stays valid. A writer destroyed before `commit`
+     *  removes what it wrote. Every failure throws `std::system_error`.
+     */
+    class FileWriter {
+    public:
+        explicit FileWriter(std::string const &path);
+
+        ~FileWriter();
+
+        FileWriter(FileWriter const &) = delete;
+        FileWriter &operator=(FileWriter const &) = delete;
+
+        /**
+         *  Append `length` bytes. Runs longer than the buffer are written straight from `data`.
+         */
+        void write(void const *data, size_t length);
+
+        /**
+         *  The number of bytes appended so far
+         */
+        uint64_t offset() const { return written + buffer.size(); }
+
+        /**
+         *  Flush what's buffered and move the file into place
+         */
+        void commit();
+
+    private:
+        void flush();
+
+        void write_all(char const *bytes, size_t length);
+
+        std::string path;
+        std::string temporary;
+        int fd;
+        std::vector<char> buffer;
+        uint64_t written;
+    };
+};
+
+#endif // ROPE_FILE_WRITER_H
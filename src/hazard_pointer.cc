@@ -0,0 +1,146 @@
+#import "hazard_pointer.hpp"
+
+#import <mutex>
+#import <vector>
+#import <algorithm>
+#import <cassert>
+
+namespace Rope {
+
+    /**
+     *  A thread's slots. Records are never freed: a thread claims a free one, or adds one to the list, and hands
+     *  it back when it exits.
+     */
+    struct HazardPointer::Record {
+        std::atomic<void const *> slots[HazardPointer::slot_count];
+        std::atomic<bool> claimed;
+        Record *next;
+        uintptr_t depth;        // slots in use, only touched by the claiming thread
+    };
+
+    struct __HazardRetired {
+        void *pointer;
+        void (*deleter)(void *);
+    };
+
+    static std::atomic<HazardPointer::Record *> hazard_records(nullptr);
+
+    static std::mutex &hazard_retired_mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<__HazardRetired> &hazard_retired()
+    {
+        static std::vector<__HazardRetired> retired;
+        return retired;
+    }
+
+#pragma mark - Records
+
+    /**
+     *  Hands the thread's record back when the thread exits
+     */
+    struct __HazardOwner {
+        HazardPointer::Record *record;
+
+        ~__HazardOwner()
+        {
+            if (record != nullptr) {
+                record->claimed.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    static thread_local __HazardOwner hazard_owner;
+
+    static HazardPointer::Record *hazard_record()
+    {
+        if (hazard_owner.record != nullptr) {
+            return hazard_owner.record;
+        }
+        for (auto record = hazard_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            bool expected = false;
+            if (!record->claimed.load(std::memory_order_relaxed)
+                && record->claimed.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                record->depth = 0;
+                return hazard_owner.record = record;
+            }
+        }
+
+        auto record = new HazardPointer::Record();
+        for (auto &slot : record->slots) {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+        record->claimed.store(true, std::memory_order_relaxed);
+        record->depth = 0;
+        record->next = hazard_records.load(std::memory_order_relaxed);
+        while (!hazard_records.compare_exchange_weak(record->next, record, std::memory_order_release)) {}
+        return hazard_owner.record = record;
+    }
+
+    HazardPointer::HazardPointer()
+    {
+        Record *record = hazard_record();
+        assert(record->depth < slot_count);
+        slot = &record->slots[record->depth++];
+    }
+
+    HazardPointer::~HazardPointer()
+    {
+        slot->store(nullptr, std::memory_order_release);
+        --hazard_owner.record->depth;
+    }
+
+#pragma mark - Reclamation
+
+    void HazardPointer::retire(void *pointer, void (*deleter)(void *))
+    {
+        {
+            std::lock_guard<std::mutex> lock(hazard_retired_mutex());
+            hazard_retired().push_back(__HazardRetired { pointer, deleter });
+        }
+        reclaim();
+    }
+
+    void HazardPointer::reclaim()
+    {
+        std::vector<__HazardRetired> unprotected;
+        {
+            std::lock_guard<std::mutex> lock(hazard_retired_mutex());
+            auto &retired = hazard_retired();
+            if (retired.empty()) {
+                return;
+            }
+
+            std::vector<void const *> protected_pointers;
+            for (auto record = hazard_records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+                for (auto &slot : record->slots) {
+                    void const *pointer = slot.load(std::memory_order_seq_cst);
+                    if (pointer != nullptr) {
+                        protected_pointers.push_back(pointer);
+                    }
+                }
+            }
+            std::sort(protected_pointers.begin(), protected_pointers.end());
+
+            auto kept = std::partition(retired.begin(), retired.end(), [&](__HazardRetired const &entry) {
+                return std::binary_search(protected_pointers.begin(), protected_pointers.end(), entry.pointer);
+            });
+            unprotected.assign(kept, retired.end());
+            retired.erase(kept, retired.end());
+        }
+
+        // Outside the lock, so deleters may retire more
+        for (auto &entry : unprotected) {
+            entry.deleter(entry.pointer);
+        }
+    }
+
+    uintptr_t HazardPointer::retired()
+    {
+        std::lock_guard<std::mutex> lock(hazard_retired_mutex());
+        return hazard_retired().size();
+    }
+}
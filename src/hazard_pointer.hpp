@@ -0,0 +1,72 @@
+#ifndef ROPE_HAZARD_POINTER_H
+#define ROPE_HAZARD_POINTER_H
+
+#import <atomic>
+#import <cstdint>
+
+namespace Rope {
+
+    /**
+     *  Hazard pointers, for reading a pointer another thread may replace and free at any moment.
+     *
+     *  A reader announces the pointer it's about to use in a slot of its own, then checks the pointer hasn't moved
+     *  on since; a writer retires the objects it replaces instead of freeing them, and they're freed once no slot
+     *  holds them. Protecting a pointer takes no locks and writes only to the reader's own slot.
+     *
+     *  Each thread has `slot_count` slots, taken and returned in the order the guards nest.
+     */
+    class HazardPointer {
+    public:
+        static uintptr_t const slot_count = 4;
+
+        /**
+         *  A thread's slots
+         */
+        struct Record;
+
+        HazardPointer();
+        ~HazardPointer();
+
+        HazardPointer(HazardPointer const &) = delete;
+        HazardPointer &operator=(HazardPointer const &) = delete;
+
+        /**
+         *  Load `source` and keep what it points to from being freed until the guard is destroyed or protects
+         *  something else
+         */
+        template<typename T>
+        T *protect(std::atomic<T *> const &source)
+        {
+            T *pointer = source.load(std::memory_order_relaxed);
+            while (true) {
+                slot->store(pointer, std::memory_order_seq_cst);
+                T *current = source.load(std::memory_order_seq_cst);
+                if (current == pointer) {
+                    return pointer;
+                }
+                pointer = current;
+            }
+        }
+
+        /**
+         *  Call `deleter(pointer)` once no hazard pointer protects it. `pointer` must already be unreachable for
+         *  new readers. May free other retired pointers on the calling thread.
+         */
+        static void retire(void *pointer, void (*deleter)(void *));
+
+        /**
+         *  Free every retired pointer no longer protected
+         */
+        static void reclaim();
+
+        /**
+         *  The number of retired pointers not yet freed
+         */
+        static uintptr_t retired();
+
+    private:
+        std::atomic<void const *> *slot;
+    };
+};
+
+#endif // ROPE_HAZARD_POINTER_H
@@ -1,4 +1,8 @@
 #import "rope.hpp"
+#import "rope_history.hpp"
+#import "rope_diff.hpp"
+#import "rope_builder.hpp"
+#import "concurrent_rope.hpp"
 
 #import <iostream>
 #import <fstream>
@@ -6,11 +10,64 @@
 #import <memory>
 
 #import <ctime>
+#import <cstdlib>
+#import <cmath>
+#import <algorithm>
+#import <new>
+#import <atomic>
+#import <chrono>
+#import <thread>
+#import <mutex>
+#import <system_error>
+#import <cerrno>
+
+#import <unistd.h>
+#import <fcntl.h>
+
+#ifdef __APPLE__
+#import <malloc/malloc.h>
+#define allocation_size malloc_size
+#else
+#import <malloc.h>
+#define allocation_size malloc_usable_size
+#endif
 
 #import "utf8.hpp"
+#import "text_kernels.hpp"
+#import "thread_pool.hpp"
 
 #define ROPE_TEST_PRINT 1
 
+/**
+ *  Count every heap allocation made by the process, and the bytes held by live allocations, for the benchmarks.
+ *  The most bytes held at once is only approximate while several threads allocate.
+ */
+static std::atomic<uintptr_t> allocation_count(0);
+static std::atomic<intptr_t> allocated_bytes(0);
+static std::atomic<intptr_t> peak_bytes(0);
+
+void *operator new(size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ?: 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    intptr_t held = allocated_bytes.fetch_add(allocation_size(p), std::memory_order_relaxed) + allocation_size(p);
+    if (held > peak_bytes.load(std::memory_order_relaxed)) {
+        peak_bytes.store(held, std::memory_order_relaxed);
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p != nullptr) {
+        allocated_bytes.fetch_sub(allocation_size(p), std::memory_order_relaxed);
+    }
+    free(p);
+}
+
 using std::shared_ptr;
 using std::dynamic_pointer_cast;
 using std::cout;
@@ -22,6 +79,7 @@ using std::clock;
 using std::ifstream;
 using std::string;
 using std::cerr;
+using std::vector;
 
 using UTF8Measure = Rope::UTF8Measure;
 
@@ -29,6 +87,38 @@ using CRope = Rope::Rope<
     char,
     Rope::Measure<char>>;
 
+using PRope = Rope::Rope<
+    char,
+    Rope::UTF8MeasurePolicy>;
+
+using BytesRope = Rope::Rope<
+    char,
+    Rope::BytesMeasurePolicy>;
+
+using LineRope = Rope::Rope<
+    char,
+    Rope::LineMeasurePolicy>;
+
+using TextRope = Rope::Rope<
+    char,
+    Rope::TextMeasurePolicy>;
+
+using CharLineRope = Rope::Rope<
+    char,
+    Rope::CompositeMeasurePolicy<Rope::UTF8MeasurePolicy, Rope::LineMeasurePolicy>>;
+
+template<size_t Fanout, typename Policy = Rope::UTF8MeasurePolicy>
+using BTreeRope = Rope::Rope<
+    char,
+    Rope::BTreePolicy<Policy, Fanout>>;
+
+using PooledRope = Rope::Rope<
+    char,
+    Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>;
+
+template<size_t Fanout>
+using PooledBTreeRope = BTreeRope<Fanout, Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>;
+
 using GenericMeasureCallbacks = Rope::MeasureCallbacks<shared_ptr<Rope::Measure<char>>, char>;
 using GenericIteratorCallbacks = Rope::IteratorCallbacks<shared_ptr<Rope::Measure<char>>, char>;
 
@@ -43,6 +133,17 @@ GenericIteratorCallbacks iterCallbacks(
     GenericIteratorCallbacks::lift_predicate(UTF8Measure::getCount)
 );
 
+GenericMeasureCallbacks bytesCallbacks = GenericMeasureCallbacks(
+    GenericMeasureCallbacks::lift_join(Rope::BytesMeasure::add),
+    GenericMeasureCallbacks::lift_identity(Rope::BytesMeasure::identity),
+    GenericMeasureCallbacks::lift_accumulate(Rope::BytesMeasure::accumulate)
+);
+
+GenericIteratorCallbacks bytesIterCallbacks(
+    GenericIteratorCallbacks::lift_index(Rope::BytesMeasure::index),
+    GenericIteratorCallbacks::lift_predicate(Rope::BytesMeasure::getCount)
+);
+
 
 auto getCount = [](shared_ptr<Rope::Measure<char>> const &m) {
     return Rope::UTF8Measure::getCount(dynamic_pointer_cast<Rope::UTF8Measure>(m));
@@ -133,91 +234,3399 @@ void tests_with_rope(CRope rope)
     split_and_concat_tests(rope);
 }
 
-void run_tests()
+void policy_tests(string const &msg)
 {
-    string msg = u8"インターネットに接続していることを確認し";
-    
-    CRope rope(msg, callbacks);
+    PRope rope(msg);
+    CRope reference(msg, callbacks);
 
-    tests_with_rope(rope);
+    assert(rope.measure().count == dynamic_cast<UTF8Measure const &>(reference.measure()).count);
 
-    build_by_concat_tests(CRope(callbacks));
+    int i = 0;
+    for (auto it = rope.begin(); it < rope.end(); ++it, ++i) {
+        auto split = rope.splitBefore(it);
+        auto joined = get<0>(split).concat(get<1>(split)).balance();
+        assert(joined.size() == rope.size());
+        if (ROPE_TEST_PRINT) {
+            cout << "Policy split before index " << i << ": \"" << get<0>(split) << "\" -> \"" << get<1>(split) << "\"" << endl;
+        }
+    }
 }
 
-void speed_test()
+void multi_measure_tests()
 {
+    string line = u8"Ünïcödé 😀 line\n";
+    string text;
+    while (text.size() < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 5) {
+        text += line;
+    }
 
-    string s = "a";
+    TextRope rope(text);
+    PRope chars(text);
+    LineRope lines(text);
 
-    cout << "numSplits, elapsed, elapsed / numSplits" << endl;
+    assert(get<Rope::TextMeasureBytes>(rope.measure()).size() == text.size());
+    assert(get<Rope::TextMeasureCodePoints>(rope.measure()).count == chars.measure().count);
+    assert(get<Rope::TextMeasureLines>(rope.measure()).count == lines.measure().count);
 
-    while (s.size() < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 4) {
-        cerr << (double)s.size() * 100 / (double)(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 4) << endl;
+    uintptr_t units_per_line = 0;
+    uintptr_t points_per_line = 0;
+    for (unsigned char c : line) {
+        if ((c & 0xC0) != 0x80) {
+            points_per_line += 1;
+            units_per_line += (c & 0xF8) == 0xF0 ? 2 : 1;
+        }
+    }
+    assert(get<Rope::TextMeasureUTF16>(rope.measure()).count == units_per_line * (text.size() / line.size()));
 
-        CRope rope(s, callbacks);
-        rope.balance(callbacks);
+    for (uintptr_t i = 0; i < text.size() / line.size(); i += 17) {
+        auto by_line = rope.begin<Rope::TextMeasureLines>() + i;
+        auto by_point = rope.begin<Rope::TextMeasureCodePoints>() + i * points_per_line;
+        auto by_unit = rope.begin<Rope::TextMeasureUTF16>() + i * units_per_line;
+        assert(by_line.raw_index() == i * line.size());
+        assert(by_point.raw_index() == i * line.size());
+        assert(by_unit.raw_index() == i * line.size());
 
-        clock_t start = clock();
+        auto split = rope.splitBefore(by_line);
+        assert(get<Rope::TextMeasureLines>(get<0>(split).measure()).count == i);
+    }
 
-        auto numSplits = split_before_test(rope) ?: 1;
+    if (ROPE_TEST_PRINT) {
+        cout << "Multi-measure rope of " << rope.size() << " bytes, "
+             << get<Rope::TextMeasureLines>(rope.measure()).count << " lines" << endl;
+    }
+}
 
-        clock_t end = clock();
-        auto elapsed = (end - start) / (double)(CLOCKS_PER_SEC / 1000000);
+/**
+ *  The original byte-at-a-time UTF8Measure fold, kept as the reference for the vectorized kernels
+ */
+UTF8Measure utf8_fold_measure(char const *p, uintptr_t n)
+{
+    UTF8Measure acc;
+    for (uintptr_t i = 0; i < n; ++i) {
+        acc = UTF8Measure(acc, UTF8Measure(p[i]));
+    }
+    return acc;
+}
 
-        cout << rope.size() << ", " << elapsed << ", " << "--, " << elapsed / numSplits << endl;
+uintptr_t utf8_fold_index(char const *p, uintptr_t n, uintptr_t target)
+{
+    uintptr_t acc = -1;
+    uintptr_t i = 0;
+    UTF8Measure accm;
+    while (accm.count <= target) {
+        if (i == n) {
+            ++acc;
+            break;
+        }
+        accm = UTF8Measure(accm, UTF8Measure(p[i]));
+        ++acc;
+        ++i;
+    }
+    return acc;
+}
 
-        s += "a";
+void utf8_kernel_tests()
+{
+    char const alphabet[] = { 'a', '\n', '\0', (char)0x80, (char)0xbf, (char)0xc3, (char)0xe3, (char)0xf0 };
+    auto storage = std::make_shared<vector<char>>(1024);
+    srand(42);
+
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
+
+        for (int round = 0; round < 2000; ++round) {
+            // Skew some rounds towards continuation bytes so long runs reach the boundaries.
+            int spread = round % 3 == 0 ? 3 : 8;
+            for (auto &c : *storage) {
+                c = alphabet[rand() % spread + (spread == 3 ? 2 : 0)];
+            }
+            int start = rand() % 64;
+            int length = rand() % (storage->size() - start);
+            Rope::Slice<char> slice(storage, storage->begin() + start, storage->begin() + start + length);
+
+            UTF8Measure expected = utf8_fold_measure(slice.data(), length);
+            UTF8Measure actual = UTF8Measure::measure(slice);
+            assert(actual.count == expected.count);
+            assert(memcmp(actual.pre, expected.pre, 4) == 0);
+            assert(memcmp(actual.post, expected.post, 4) == 0);
+
+            for (uintptr_t target = 0; target <= expected.count + 1; target += 1 + target / 8) {
+                assert(UTF8Measure::index(slice, target) == utf8_fold_index(slice.data(), length, target));
+            }
+        }
     }
+
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
 }
 
-void file_speed_test(int argc, char **argv)
+/**
+ *  The byte-at-a-time LineMeasure fold, kept as the reference for the vectorized kernels
+ */
+Rope::LineMeasure line_fold_measure(char const *p, uintptr_t n)
 {
-    if (argc < 2) {
-        cout << "Expected a filename for argument 1" << endl;
-        return;
+    Rope::LineMeasure acc;
+    for (uintptr_t i = 0; i < n; ++i) {
+        acc = Rope::LineMeasure(acc, Rope::LineMeasure(p[i]));
     }
+    return acc;
+}
 
-    string *file_contents = new string;
+uintptr_t line_fold_index(char const *p, uintptr_t n, uintptr_t target)
+{
+    if (target == 0) return 0;
+    Rope::LineMeasure accm;
+    for (uintptr_t i = 0; i < n; ++i) {
+        accm = Rope::LineMeasure(accm, Rope::LineMeasure(p[i]));
+        // A CRLF ends at the LF
+        uintptr_t breaks = accm.count - (accm.rreturn && i + 1 < n && p[i + 1] == '\n' ? 1 : 0);
+        if (breaks >= target) {
+            return i + 1;
+        }
+    }
+    return n + 1;
+}
 
-    ifstream file(argv[1]);
-    if (file.is_open()) {
-        string line;
-        while (getline(file, line)) {
-            *file_contents += line;
+/**
+ *  Seek and step through the lines of `pieces` joined in order, a leaf or more each, with `pad` bytes inserted
+ *  before each piece's last byte so the pieces can't share leaves. Each piece's first and last bytes are kept, so
+ *  line endings are split across leaves, or end the rope.
+ */
+template<typename RopeType>
+void line_ending_tests(std::initializer_list<char const *> pieces, uintptr_t pad)
+{
+    RopeType rope;
+    string text;
+    for (string piece : pieces) {
+        piece.insert(piece.size() - 1, pad, '-');
+        rope = rope.concat(RopeType(piece));
+        text += piece;
+    }
+
+    vector<uintptr_t> starts { 0 };
+    for (uintptr_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\n' || (text[i] == '\r' && (i + 1 == text.size() || text[i + 1] != '\n'))) {
+            starts.push_back(i + 1);
         }
     }
+    assert(Rope::LineMeasurePolicy::predicate(rope.measure()) == starts.size());
 
-    CRope rope(*file_contents, callbacks);
-    
-    delete file_contents;
+    auto it = rope.begin();
+    for (uintptr_t line = 0; line < starts.size(); ++line, ++it) {
+        assert((rope.begin() + line).raw_index() == starts[line]);
+        assert(it.raw_index() == starts[line]);
+    }
+    assert(it == rope.end());
+}
 
-    clock_t start = clock();
+template<typename RopeType>
+void line_ending_tests()
+{
+    for (uintptr_t pad : { (uintptr_t)0, Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 3 / 4 }) {
+        line_ending_tests<RopeType>({ "abc\r", "\ndef", "x\r", "y", "\r\n", "z" }, pad);
+        line_ending_tests<RopeType>({ "ab\ncd\r", "ef\r", "\r" }, pad);
+        line_ending_tests<RopeType>({ "\r", "\n", "\r", "\r" }, pad);
+    }
 
-    cout << "numSplits, elapsed, elapsed / numSplits" << endl;
-    uintptr_t i = 0;
-    for (auto it = rope.begin(iterCallbacks); i < 10000 && it < rope.end(iterCallbacks); ++it, ++i) {
+    // Text ending in CR has as many lines as text ending in LF, the last of them empty
+    for (auto ending : { "\r", "\n", "\r\n" }) {
+        RopeType single(string("a") + ending);
+        assert(Rope::LineMeasurePolicy::predicate(single.measure()) == 2);
+        assert((single.begin() + 1).raw_index() == single.size());
+        assert(single.begin() + 1 != single.end());
+    }
+    assert(Rope::LineMeasurePolicy::predicate(RopeType(string("\r")).measure()) == 2);
+}
 
-        it.push_to_leaf();
-        
-        clock_t start_split = clock();
+void line_kernel_tests()
+{
+    char const alphabet[] = { 'a', '\r', '\n' };
+    auto storage = std::make_shared<vector<char>>(512);
+    srand(7);
 
-        auto split = rope.splitBefore(it, callbacks);
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
 
-        auto elapsed = (clock() - start_split) / (double)(CLOCKS_PER_SEC / 1000000);
-        
-        cout << i << ", " << elapsed << ", " << elapsed << endl;
+        for (int round = 0; round < 500; ++round) {
+            for (auto &c : *storage) {
+                c = alphabet[rand() % 3];
+            }
+            int start = rand() % 32;
+            int length = rand() % (storage->size() - start);
+            Rope::Slice<char> slice(storage, storage->begin() + start, storage->begin() + start + length);
+
+            Rope::LineMeasure expected = line_fold_measure(slice.data(), length);
+            Rope::LineMeasure actual = Rope::LineMeasure::measure(slice);
+            assert(actual.count == expected.count);
+            assert(actual.lfeed == expected.lfeed);
+            assert(actual.rreturn == expected.rreturn);
+            assert(actual.empty == expected.empty);
+
+            for (uintptr_t target = 0; target <= expected.count + 1; ++target) {
+                assert(Rope::LineMeasure::index(slice, target) == line_fold_index(slice.data(), length, target));
+            }
+        }
     }
 
-    double elapsed = (double)(clock() - start) / (double)(CLOCKS_PER_SEC);
-    cout << i << " operations completed, " << (elapsed > 0 ? (float)i / (float)elapsed : -1) << " ops / s" << endl;
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+
+    line_ending_tests<LineRope>();
+    line_ending_tests<BTreeRope<4, Rope::LineMeasurePolicy>>();
+    line_ending_tests<Rope::Rope<char, Rope::LazyPolicy<Rope::LineMeasurePolicy>>>();
+    line_ending_tests<BTreeRope<4, Rope::LazyPolicy<Rope::LineMeasurePolicy>>>();
 }
 
+/**
+ *  The one-pass text measure against each component measured by itself
+ */
+void text_kernel_tests()
+{
+    char const alphabet[] = {
+        'a', '\r', '\n', '\0', (char)0x80, (char)0xbf, (char)0xc3, (char)0xe3, (char)0xf0, (char)0xf7, (char)0xf8 };
+    auto storage = std::make_shared<vector<char>>(1024);
+    srand(11);
+
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
 
-int main(int argc, char **argv)
+        for (int round = 0; round < 1000; ++round) {
+            for (auto &c : *storage) {
+                c = alphabet[rand() % sizeof(alphabet)];
+            }
+            int start = rand() % 64;
+            int length = rand() % (storage->size() - start);
+            Rope::Slice<char> slice(storage, storage->begin() + start, storage->begin() + start + length);
+
+            auto actual = Rope::TextMeasurePolicy::accumulate(slice);
+            UTF8Measure points = UTF8Measure::measure(slice);
+            Rope::LineMeasure lines = Rope::LineMeasure::measure(slice);
+            assert(get<Rope::TextMeasureBytes>(actual).size() == (uintptr_t)length);
+            assert(get<Rope::TextMeasureCodePoints>(actual).count == points.count);
+            assert(memcmp(get<Rope::TextMeasureCodePoints>(actual).pre, points.pre, 4) == 0);
+            assert(memcmp(get<Rope::TextMeasureCodePoints>(actual).post, points.post, 4) == 0);
+            assert(get<Rope::TextMeasureLines>(actual).count == lines.count);
+            assert(get<Rope::TextMeasureLines>(actual).lfeed == lines.lfeed);
+            assert(get<Rope::TextMeasureLines>(actual).rreturn == lines.rreturn);
+            assert(get<Rope::TextMeasureLines>(actual).empty == lines.empty);
+            assert(get<Rope::TextMeasureUTF16>(actual).count == Rope::UTF16Measure::measure(slice).count);
+        }
+    }
+
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+}
+
+/**
+ *  Check the B+-tree shape invariants below `node`, returning its height
+ */
+template<typename Node>
+uintptr_t btree_check(Node const *node, size_t fanout, bool root)
 {
-    // file_speed_test(argc, argv);
-    
-    // speed_test();
+    if (node->node_type == Rope::RopeNodeTypeLeaf) {
+        assert(root || node->size > 0);
+        assert(node->size < Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+        return 0;
+    }
+
+    auto const &branch = *node->branch_data;
+    assert(branch.count <= fanout);
+    assert(branch.count >= (root ? 2 : fanout / 2));
+
+    uintptr_t offset = 0;
+    for (uintptr_t i = 0; i < branch.count; ++i) {
+        assert(btree_check(branch.children[i].get(), fanout, false) + 1 == node->height);
+        assert(branch.sizes[i] == branch.children[i]->size);
+        offset += branch.sizes[i];
+        assert(branch.offsets[i] == offset);
+    }
+    assert(offset == node->size);
+    return node->height;
+}
+
+template<size_t Fanout, typename Policy>
+string btree_check(BTreeRope<Fanout, Policy> &rope)
+{
+    btree_check(rope.rootNode.get(), Fanout, true);
+
+    string contents;
+    uintptr_t previous = Rope::ROPE_GLOBAL_MAX_LEAF_CAP;
+    rope.each_chunk([&](char const *s, uintptr_t l) {
+        assert(previous + l >= Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+        previous = l;
+        contents.append(s, l);
+    });
+    return contents;
+}
+
+template<typename Policy>
+void btree_tests()
+{
+    string line = u8"Ünïcödé 😀 line\n";
+    string text;
+    while (text.size() < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 40) {
+        text += line;
+    }
+
+    BTreeRope<8, Policy> rope(text);
+    assert(btree_check(rope) == text);
+    assert(rope.rootNode->height == 2);
+
+    PRope reference(text);
+    assert(rope.measure().count == reference.measure().count);
+    for (uintptr_t point = 0; point < reference.measure().count; point += 997) {
+        assert((rope.begin() + point).raw_index() == (reference.begin() + point).raw_index());
+    }
+
+    srand(11);
+    for (int round = 0; round < 200; ++round) {
+        uintptr_t offset = rand() % (text.size() + 1);
+        auto split = rope.splitBefore(rope.begin_items() + offset);
+        auto lhs = get<0>(split), rhs = get<1>(split);
+        assert(btree_check(lhs) == text.substr(0, offset));
+        assert(btree_check(rhs) == text.substr(offset));
+
+        switch (round % 3) {
+            case 0: {
+                rope = rhs.concat(lhs);
+                text = text.substr(offset) + text.substr(0, offset);
+                break;
+            }
+            case 1: {
+                string piece = line.substr(0, rand() % line.size());
+                rope = lhs.concat(BTreeRope<8, Policy>(piece)).concat(rhs);
+                text.insert(offset, piece);
+                break;
+            }
+            default: {
+                uintptr_t length = std::min<uintptr_t>(rand() % 64, rhs.size());
+                rope = lhs.concat(get<1>(rhs.splitBefore(rhs.begin_items() + length)));
+                text.erase(offset, length);
+                break;
+            }
+        }
+        assert(btree_check(rope) == text);
+        assert(rope.measure().count == PRope(text).measure().count);
+    }
+
+    uintptr_t count = rope.measure().count;
+    auto sub = rope.substr(rope.begin() + count / 3, rope.begin() + 2 * count / 3);
+    reference = PRope(text);
+    auto expected = reference.substr(reference.begin() + count / 3, reference.begin() + 2 * count / 3);
+    ostringstream expected_text;
+    expected_text << expected;
+    assert(btree_check(sub) == expected_text.str());
+
+    rope.balance();
+    assert(btree_check(rope) == text);
+
+    if (ROPE_TEST_PRINT) {
+        cout << "B-tree rope of " << rope.size() << " bytes in " << rope.rootNode->weight << " leaves" << endl;
+    }
+}
+
+void pool_tests(string const &msg)
+{
+    PooledRope rope(msg);
+    PRope reference(msg);
+
+    int i = 0;
+    for (auto it = rope.begin(); it < rope.end(); ++it, ++i) {
+        auto split = rope.splitBefore(it);
+        auto expected = reference.splitBefore(reference.begin() + i);
+        ostringstream lhs, rhs, expected_lhs, expected_rhs;
+        lhs << get<0>(split);
+        rhs << get<1>(split);
+        expected_lhs << get<0>(expected);
+        expected_rhs << get<1>(expected);
+        assert(lhs.str() == expected_lhs.str());
+        assert(rhs.str() == expected_rhs.str());
+        assert(get<0>(split).concat(get<1>(split)).balance().size() == rope.size());
+    }
+
+    // Everything built inside the scope comes from the arena, and has been released when the ropes go
+    Rope::RopeArena arena;
+    {
+        Rope::RopeArena::Scope scope(arena);
+        PooledRope temporary(msg);
+        for (int j = 0; j < 100; ++j) {
+            temporary = temporary.concat(PooledRope(msg));
+        }
+        temporary.balance();
+        assert(arena.live() > 0);
+        assert(temporary.size() == msg.size() * 101);
+    }
+    assert(arena.live() == 0);
+
+    if (ROPE_TEST_PRINT) {
+        cout << "Arena reserved " << arena.reserved() << " bytes" << endl;
+    }
+}
+
+template<typename Node>
+uintptr_t node_depth(Node const *node)
+{
+    if (node->node_type == Rope::RopeNodeTypeLeaf) {
+        return 1;
+    }
+    return 1 + std::max(node_depth(node->branch_data.left.get()), node_depth(node->branch_data.right.get()));
+}
+
+/**
+ *  Build a rope of `piece`-item leaves by joining each onto the last without rebalancing, leaving one leaf per level
+ */
+PRope lopsided_rope(string const &text, uintptr_t piece)
+{
+    using Node = PRope::NodePtr::element_type;
+    PRope rope;
+    for (uintptr_t i = 0; i < text.size(); i += piece) {
+        PRope rhs(text.substr(i, piece));
+        rope = PRope(std::make_shared<Node>(rope.rootNode, rhs.rootNode, PRope::CallbacksType()));
+    }
+    return rope;
+}
+
+/**
+ *  Walk a rope item by item in both directions, and by code point, and check each step against `text`
+ */
+template<typename RopeType>
+void iterator_tests(RopeType const &rope, string const &text)
+{
+    assert(rope.size() == text.size());
+
+    string forward;
+    auto end = rope.end_items();
+    for (auto it = rope.begin_items(); it < end; ++it) {
+        forward += *it;
+    }
+    assert(forward == text);
+
+    string backward;
+    auto begin = rope.begin_items();
+    for (auto it = rope.begin_items() + (text.size() - 1); ; --it) {
+        backward += *it;
+        if (!(begin < it)) {
+            break;
+        }
+    }
+    assert(string(backward.rbegin(), backward.rend()) == text);
+
+    // Stepping by code points must land on each code point in turn, where seeking from the start does
+    uintptr_t point = 0;
+    auto it = rope.begin();
+    for (uintptr_t i = 0; i < text.size(); ++i) {
+        if (((unsigned char)text[i] & 0xC0) == 0x80) {
+            continue;
+        }
+        assert(it.raw_index() == i);
+        assert(*it == text[i]);
+        if (point % 13 == 0) {
+            auto copy = it;
+            assert(copy == rope.begin() + point);
+            assert((copy + 1).raw_index() == (rope.begin() + (point + 1)).raw_index());
+        }
+        ++it;
+        ++point;
+    }
+    assert(!(it < rope.end()));
+}
+
+void iterator_tests()
+{
+    string unit = u8"Ünïcödé 😀 line\r\nand another ジャンプ\n";
+    string text;
+    while (text.size() < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 9) {
+        text += unit;
+    }
+
+    iterator_tests(PRope(text), text);
+    iterator_tests(BTreeRope<4>(text), text);
+    iterator_tests(PooledBTreeRope<16>(text), text);
+
+    // Unbalanced ropes are deeper than the iterator's inline path
+    PRope deep = lopsided_rope(text, 331);
+    assert(node_depth(deep.rootNode.get()) > Rope::ROPE_ITER_INLINE_DEPTH);
+    iterator_tests(deep, text);
+
+    // Lines step incrementally through a leaf; UTF-16 units are looked up from the start of the leaf
+    TextRope composite(text);
+    auto by_line = composite.begin<Rope::TextMeasureLines>();
+    auto by_unit = composite.begin<Rope::TextMeasureUTF16>();
+    uintptr_t units = 0;
+    for (uintptr_t i = 0; i < text.size(); ++i) {
+        unsigned char c = text[i];
+        if (i == 0 || text[i - 1] == '\n') {
+            assert(by_line.raw_index() == i);
+            ++by_line;
+        }
+        if ((c & 0xC0) != 0x80) {
+            assert(by_unit.raw_index() == i);
+            assert(by_unit == composite.begin<Rope::TextMeasureUTF16>() + units);
+            uintptr_t width = (c & 0xF8) == 0xF0 ? 2 : 1;
+            by_unit += width;
+            units += width;
+        }
+    }
+    assert(units == get<Rope::TextMeasureUTF16>(composite.measure()).count);
+}
+
+/**
+ *  Build a mixed ASCII / multibyte UTF-8 string of at least `size` bytes
+ */
+string bench_text(uintptr_t size)
+{
+    string unit = u8"The quick brown fox ジャンプ over the lazy dog.\n";
+    string s;
+    s.reserve(size + unit.size());
+    while (s.size() < size) {
+        s += unit;
+    }
+    return s;
+}
+
+/**
+ *  Check bounded chunk iteration, copies and stream output against `text`
+ */
+template<typename RopeType>
+void chunk_tests(RopeType const &rope, string const &text)
+{
+    srand(13);
+    for (int round = 0; round < 200; ++round) {
+        uintptr_t begin = rand() % (text.size() + 1);
+        uintptr_t end = begin + rand() % (text.size() + 1 - begin);
+
+        string joined;
+        rope.each_chunk(begin, end, [&](char const *items, uintptr_t count) {
+            assert(count > 0 && count < Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+            joined.append(items, count);
+        });
+        assert(joined == text.substr(begin, end - begin));
+
+        assert(rope.to_string(begin, end) == joined);
+        assert(rope.to_string(rope.begin_items() + begin, rope.begin_items() + end) == joined);
+    }
+
+    // Code point iterators bound the copy at the code points' first bytes
+    vector<char> buffer(text.size());
+    auto from = rope.begin() + 3;
+    auto to = rope.begin() + 1000;
+    uintptr_t copied = rope.copy_to(buffer.data(), from, to);
+    assert(string(buffer.data(), copied) == text.substr(from.raw_index(), to.raw_index() - from.raw_index()));
+
+    assert(rope.to_string(text.size(), text.size() + 10).empty());
+    assert(rope.to_string() == text);
+
+    ostringstream stream;
+    stream << rope;
+    assert(stream.str() == text);
+}
+
+void chunk_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 11);
+
+    chunk_tests(PRope(text), text);
+    chunk_tests(BTreeRope<4>(text), text);
+    chunk_tests(PooledRope(text), text);
+
+    PRope deep = lopsided_rope(text, 331);
+    chunk_tests(deep, text);
+    assert(PRope().to_string().empty());
+}
+
+/**
+ *  Write `text` to a new temporary file, returning its path
+ */
+string write_temporary(string const &text)
+{
+    char path[] = "/tmp/rope_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    ssize_t written = write(fd, text.data(), text.size());
+    assert(written == (ssize_t)text.size());
+    (void)written;
+    close(fd);
+    return path;
+}
+
+void file_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 64);
+    string path = write_temporary(text);
+
+    // Leaves point into the mapping, so building the rope only allocates nodes and slices
+    intptr_t allocated = allocated_bytes;
+    PRope rope = PRope::from_file(path);
+    assert(allocated_bytes - allocated < (intptr_t)text.size() / 4);
+    assert(rope.to_string() == text);
+    assert(rope.measure().count == PRope(text).measure().count);
+
+    // Pieces of a rope keep the file mapped after the rope is gone
+    BTreeRope<16> tail;
+    {
+        BTreeRope<16> btree = BTreeRope<16>::from_file(path);
+        assert(btree.to_string() == text);
+        tail = get<1>(btree.splitBefore(btree.begin_items() + 1000));
+        rope = get<0>(rope.splitBefore(rope.begin_items() + 5000));
+    }
+    unlink(path.c_str());
+    assert(tail.to_string() == text.substr(1000));
+    assert(rope.to_string() == text.substr(0, 5000));
+    assert(rope.concat(PRope(text.substr(5000))).balance().to_string() == text);
+
+    string empty = write_temporary("");
+    assert(PRope::from_file(empty).size() == 0);
+    unlink(empty.c_str());
+
+    bool thrown = false;
+    try {
+        PRope::from_file("/nonexistent/rope");
+    } catch (std::system_error const &error) {
+        thrown = error.code().value() == ENOENT;
+    }
+    assert(thrown);
+}
+
+/**
+ *  Ropes over a file too large for 32-bit offsets. The file is sparse and the ropes measure lazily, so only the
+ *  marked pages are read.
+ */
+void large_file_tests()
+{
+    using LazyRope = Rope::Rope<char, Rope::LazyPolicy<Rope::UTF8MeasurePolicy>>;
+    uintptr_t size = uintptr_t(5) << 30;
+    uintptr_t mark = 3000000000;
+    string path = write_temporary("");
+    int fd = open(path.c_str(), O_WRONLY);
+    assert(fd >= 0);
+    int truncated = ftruncate(fd, size);
+    assert(truncated == 0);
+    ssize_t written = pwrite(fd, "mark", 4, mark) + pwrite(fd, "tail", 4, size - 4);
+    assert(written == 8);
+    (void)truncated;
+    (void)written;
+    close(fd);
+
+    LazyRope rope = LazyRope::from_file(path);
+    assert(rope.size() == size);
+    assert(rope.to_string(mark, mark + 4) == "mark");
+    assert(rope.to_string(size - 4, size) == "tail");
+
+    // Iterators step past 2^31 items at once, either way
+    auto it = rope.begin_items() + mark;
+    assert(it.raw_index() == mark && *it == 'm');
+    it = rope.end_items() - (size - mark - 1);
+    assert(it.raw_index() == mark + 1 && *it == 'a');
+    it += intptr_t(size - mark - 5);
+    assert(*it == 't');
+    it -= intptr_t(size - mark - 6);
+    assert(*it == 'r');
+
+    // Edits spanning leaves split past 2^31 items
+    uintptr_t span = Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 3;
+    LazyRope erased = rope.erase(mark - span, mark);
+    assert(erased.size() == size - span);
+    assert(erased.to_string(mark - span, mark - span + 4) == "mark");
+    LazyRope replaced = rope.replace(mark - span, mark + 1, "M");
+    assert(replaced.size() == size - span);
+    assert(replaced.to_string(mark - span, mark - span + 4) == "Mark");
+    LazyRope inserted = rope.insert(mark, string(span, 'x'));
+    assert(inserted.size() == size + span);
+    assert(inserted.to_string(mark + span - 1, mark + span + 4) == "xmark");
+
+    // Leaves cut on a thread pool, by either layout, start at the same offsets
+    {
+        Rope::ThreadPool pool(3);
+        Rope::ThreadPool::Scope scope(pool);
+        LazyRope parallel = LazyRope::from_file(path);
+        assert(parallel.rootNode->weight == rope.rootNode->weight);
+        assert(parallel.to_string(mark, mark + 4) == "mark");
+        assert(parallel.to_string(size - 4, size) == "tail");
+
+        using LazyBTreeRope = BTreeRope<32, Rope::LazyPolicy<Rope::UTF8MeasurePolicy>>;
+        LazyBTreeRope btree = LazyBTreeRope::from_file(path);
+        assert(btree.size() == size);
+        assert(btree.to_string(mark, mark + 4) == "mark");
+        assert(btree.to_string(size - 4, size) == "tail");
+    }
+    unlink(path.c_str());
+}
+
+void thread_pool_tests()
+{
+    Rope::ThreadPool pool(3);
+
+    for (uintptr_t grain : { 1, 7, 1000, 5000 }) {
+        vector<std::atomic<uintptr_t>> hits(4321);
+        pool.parallel_for(hits.size(), [&](uintptr_t begin, uintptr_t end) {
+            assert(begin < end && end - begin <= grain);
+            for (uintptr_t i = begin; i < end; ++i) {
+                ++hits[i];
+            }
+        }, grain);
+        for (auto &hit : hits) {
+            assert(hit == 1);
+        }
+    }
+
+    // Tasks may run parallel_for themselves
+    std::atomic<uintptr_t> total(0);
+    pool.parallel_for(16, [&](uintptr_t begin, uintptr_t end) {
+        for (uintptr_t i = begin; i < end; ++i) {
+            pool.parallel_for(100, [&](uintptr_t b, uintptr_t e) { total += e - b; }, 10);
+        }
+    });
+    assert(total == 1600);
+
+    bool thrown = false;
+    try {
+        pool.parallel_for(64, [](uintptr_t begin, uintptr_t) {
+            if (begin == 40) {
+                throw std::runtime_error("task failed");
+            }
+        });
+    } catch (std::runtime_error const &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+template<typename RopeType>
+vector<uintptr_t> leaf_sizes(RopeType const &rope)
+{
+    vector<uintptr_t> sizes;
+    rope.each_chunk(0, rope.size(), [&](char const *, uintptr_t count) { sizes.push_back(count); });
+    return sizes;
+}
+
+/**
+ *  Build `text` on a single thread and on `pool`, and check both ropes have the same leaves and contents
+ */
+template<typename RopeType>
+std::pair<RopeType, RopeType> build_tests(string const &text, Rope::ThreadPool &pool)
+{
+    Rope::ThreadPool inline_pool(0);
+    RopeType serial = [&] { Rope::ThreadPool::Scope scope(inline_pool); return RopeType(text); }();
+    RopeType parallel = [&] { Rope::ThreadPool::Scope scope(pool); return RopeType(text); }();
+
+    assert(leaf_sizes(parallel) == leaf_sizes(serial));
+    assert(parallel.measure().count == serial.measure().count);
+    assert(parallel.to_string() == text);
+    return std::make_pair(serial, parallel);
+}
+
+void build_tests()
+{
+    Rope::ThreadPool pool(3);
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * (Rope::ROPE_GLOBAL_PARALLEL_MIN_LEAVES * 3 + 5) + 17);
+
+    auto binary = build_tests<PRope>(text, pool);
+    assert(node_depth(binary.second.rootNode.get()) == node_depth(binary.first.rootNode.get()));
+    auto pooled = build_tests<PooledRope>(text, pool);
+    assert(node_depth(pooled.second.rootNode.get()) == node_depth(pooled.first.rootNode.get()));
+
+    auto btree = build_tests<BTreeRope<16>>(text, pool);
+    assert(btree_check(btree.second) == text);
+    assert(btree.second.rootNode->height == btree.first.rootNode->height);
+    build_tests<PooledBTreeRope<4>>(text, pool);
+
+    // Arena allocations stay on the building thread
+    {
+        Rope::RopeArena arena;
+        Rope::RopeArena::Scope arena_scope(arena);
+        build_tests<PooledRope>(text, pool);
+    }
+
+    // Ropes built from files take the parallel path too
+    string path = write_temporary(text);
+    {
+        Rope::ThreadPool::Scope scope(pool);
+        assert(leaf_sizes(PRope::from_file(path)) == leaf_sizes(binary.first));
+    }
+    unlink(path.c_str());
+}
+
+/**
+ *  Check every branch below `node` is height-balanced and records its height, returning that height
+ */
+template<typename Node>
+uintptr_t avl_check(Node const *node)
+{
+    if (node->node_type == Rope::RopeNodeTypeLeaf) {
+        assert(node->height == 0);
+        return 0;
+    }
+    uintptr_t lhs = avl_check(node->branch_data.left.get());
+    uintptr_t rhs = avl_check(node->branch_data.right.get());
+    assert(lhs <= rhs + 1 && rhs <= lhs + 1);
+    assert(node->height == std::max(lhs, rhs) + 1);
+    return node->height;
+}
+
+void join_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 40);
+
+    // Appending piece by piece keeps the rope balanced without balance()
+    PRope appended;
+    for (uintptr_t i = 0; i < text.size(); i += 97) {
+        appended = appended.concat(PRope(text.substr(i, 97)));
+        if (i % (97 * 64) == 0) {
+            avl_check(appended.rootNode.get());
+        }
+    }
+    avl_check(appended.rootNode.get());
+    assert(appended.to_string() == text);
+    assert(appended.rootNode->height <= 1.45 * std::log2(appended.rootNode->weight + 2));
+
+    // Prepending, and splitting then joining at random offsets
+    PRope prepended;
+    for (uintptr_t i = text.size(); i > 0; i -= std::min<uintptr_t>(i, 1000)) {
+        prepended = PRope(text.substr(i - std::min<uintptr_t>(i, 1000), std::min<uintptr_t>(i, 1000))).concat(prepended);
+    }
+    avl_check(prepended.rootNode.get());
+    assert(prepended.to_string() == text);
+
+    srand(17);
+    string expected = text;
+    PRope edited = appended;
+    for (int round = 0; round < 300; ++round) {
+        uintptr_t at = rand() % (expected.size() + 1);
+        auto split = edited.splitBefore(edited.begin_items() + at);
+        avl_check(get<0>(split).rootNode.get());
+        avl_check(get<1>(split).rootNode.get());
+        assert(get<0>(split).size() == at);
+
+        string piece = (ostringstream() << "<" << round << ">").str();
+        edited = get<0>(split).concat(PRope(piece)).concat(get<1>(split));
+        expected.insert(at, piece);
+        avl_check(edited.rootNode.get());
+    }
+    assert(edited.to_string() == expected);
+
+    // Ropes that were never balanced still split and join correctly
+    PRope lopsided = lopsided_rope(text, 331);
+    auto split = lopsided.splitBefore(lopsided.begin_items() + 5000);
+    assert(get<0>(split).to_string() == text.substr(0, 5000));
+    assert(get<1>(split).to_string() == text.substr(5000));
+    assert(get<1>(split).concat(get<0>(split)).to_string() == text.substr(5000) + text.substr(0, 5000));
+
+    static_assert(Rope::fibIndex(1) == 2 && Rope::fibIndex(UINT64_MAX) == Rope::fibCount - 1, "Fibonacci table");
+    for (uintptr_t i = 2; i + 1 < Rope::fibCount; ++i) {
+        assert(Rope::fibIndex(Rope::fibTable[i]) == i);
+        assert(Rope::fibIndex(Rope::fibTable[i + 1] - 1) == i);
+    }
+
+    // Once its buffers have grown, balancing leaves over half the cap allocates just the new branches
+    uintptr_t piece = Rope::ROPE_GLOBAL_MAX_LEAF_CAP / 2 + 1;
+    PRope pieces = lopsided_rope(text, piece);
+    PRope balanced = pieces;
+    balanced.balance();
+    balanced = pieces;
+    uintptr_t allocations = allocation_count;
+    balanced.balance();
+    assert(allocation_count - allocations == (text.size() + piece - 1) / piece - 1);
+    assert(node_depth(balanced.rootNode.get()) < node_depth(pieces.rootNode.get()));
+    assert(balanced.to_string() == text);
+
+    // Shorter leaves are merged into leaves just under the cap
+    balanced = lopsided_rope(text, 97);
+    balanced.balance();
+    assert(balanced.rootNode->weight <= text.size() / (Rope::ROPE_GLOBAL_MAX_LEAF_CAP - 97) + 1);
+    assert(balanced.to_string() == text);
+}
+
+/**
+ *  Apply random inserts, erases and replacements to a rope built over `text`, checking each against a string
+ */
+template<typename RopeType, typename Check>
+void edit_tests(string const &text, Check check)
+{
+    RopeType rope(text);
+    string expected = text;
+
+    srand(23);
+    for (int round = 0; round < 600; ++round) {
+        uintptr_t begin = rand() % (expected.size() + 1);
+        uintptr_t end = begin + std::min<uintptr_t>(rand() % 8, expected.size() - begin);
+        string items = round % 3 == 0 ? string() : string(1 + rand() % 3, 'a' + round % 26);
+
+        switch (round % 4) {
+            case 0:
+                rope = rope.erase(begin, end);
+                expected.erase(begin, end - begin);
+                break;
+            case 1:
+            case 2:
+                rope = rope.insert(begin, items);
+                expected.insert(begin, items);
+                break;
+            default:
+                rope = rope.replace(begin, end, items);
+                expected.replace(begin, end - begin, items);
+        }
+        if (round % 50 == 0) {
+            check(rope);
+            assert(rope.to_string() == expected);
+        }
+    }
+    check(rope);
+    assert(rope.to_string() == expected);
+    assert(rope.measure().count == RopeType(expected).measure().count);
+
+    // Keystrokes are merged into existing leaves rather than adding leaves of their own
+    assert(rope.rootNode->weight <= 2 * rope.size() / Rope::ROPE_GLOBAL_MAX_LEAF_CAP + 2);
+
+    // Edits spanning leaves, and inserts bigger than a leaf
+    string large = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 3);
+    rope = rope.replace(100, 100 + Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 2, large);
+    expected.replace(100, Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 2, large);
+    check(rope);
+    assert(rope.to_string() == expected);
+
+    rope = rope.erase(0, expected.size() - 10);
+    expected.erase(0, expected.size() - 10);
+    check(rope);
+    assert(rope.to_string() == expected);
+
+    rope = rope.erase(0, 100).insert(0, "x");
+    check(rope);
+    assert(rope.to_string() == "x");
+    assert(RopeType().insert(0, large).to_string() == large);
+}
+
+void edit_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 20);
+
+    auto balanced = [](PRope const &rope) { avl_check(rope.rootNode.get()); };
+    edit_tests<PRope>(text, balanced);
+    edit_tests<PooledRope>(text, [](PooledRope const &) {});
+    edit_tests<BTreeRope<4>>(text, [](BTreeRope<4> &rope) { btree_check(rope); });
+    edit_tests<PooledBTreeRope<16>>(text, [](PooledBTreeRope<16> &rope) { btree_check(rope); });
+
+    // Positions may be given in any measure
+    PRope rope(text);
+    auto at = rope.begin() + 1000;
+    PRope edited = rope.insert(at, "<>").erase(rope.begin() + 10, rope.begin() + 20);
+    string expected = text;
+    expected.insert(at.raw_index(), "<>");
+    expected.erase((rope.begin() + 10).raw_index(), (rope.begin() + 20).raw_index() - (rope.begin() + 10).raw_index());
+    assert(edited.to_string() == expected);
+
+    TextRope lines(text);
+    auto line = lines.begin<Rope::TextMeasureLines>() + 7;
+    TextRope replaced = lines.replace(line, line + 1, "one line\n");
+    expected = text;
+    uintptr_t line_begin = line.raw_index();
+    uintptr_t line_end = (line + 1).raw_index();
+    expected.replace(line_begin, line_end - line_begin, "one line\n");
+    assert(replaced.to_string() == expected);
+    assert(get<Rope::TextMeasureLines>(replaced.measure()).count == get<Rope::TextMeasureLines>(lines.measure()).count);
+}
+
+/**
+ *  Random sorted, non-overlapping edits over `size` items, roughly one per `spacing` items
+ */
+vector<Rope::RopeEdit<char>> random_edits(uintptr_t size, uintptr_t spacing, unsigned seed)
+{
+    vector<Rope::RopeEdit<char>> edits;
+    srand(seed);
+    uintptr_t at = rand() % spacing;
+    while (at <= size) {
+        uintptr_t length = std::min<uintptr_t>(rand() % 3 == 0 ? rand() % (spacing / 2 + 1) : 0, size - at);
+        string items(rand() % 4 == 0 ? 0 : 1 + rand() % 5, 'A' + edits.size() % 26);
+        edits.push_back(Rope::RopeEdit<char> { at, at + length, items });
+        at += length + (rand() % 4 == 0 ? 0 : rand() % spacing);
+    }
+    return edits;
+}
+
+string apply_to_string(string text, vector<Rope::RopeEdit<char>> const &edits)
+{
+    for (auto it = edits.rbegin(); it != edits.rend(); ++it) {
+        text.replace(it->begin, it->end - it->begin, it->items);
+    }
+    return text;
+}
+
+template<typename RopeType, typename Check>
+void batch_tests(string const &text, Check check)
+{
+    RopeType rope(text);
+    for (uintptr_t spacing : { 3, 40, 700, 5000, 100000 }) {
+        auto edits = random_edits(text.size(), spacing, (unsigned)spacing);
+        RopeType edited = rope.apply_edits(edits);
+        check(edited);
+        assert(edited.to_string() == apply_to_string(text, edits));
+        assert(edited.measure().count == RopeType(edited.to_string()).measure().count);
+    }
+
+    // Edits that empty the rope, fill an empty one, and meet at the ends
+    assert(rope.apply_edits({ { 0, text.size(), "" } }).size() == 0);
+    RopeType filled = RopeType().apply_edits({ { 0, 0, "ab" }, { 0, 0, text } });
+    check(filled);
+    assert(filled.to_string() == "ab" + text);
+    RopeType ends = rope.apply_edits({ { 0, 0, "<" }, { 0, 5, "" }, { text.size(), text.size(), ">" } });
+    assert(ends.to_string() == "<" + text.substr(5) + ">");
+    assert(rope.apply_edits({}).rootNode == rope.rootNode);
+
+    // Subtrees away from the edits are shared
+    uintptr_t leaves = 0;
+    RopeType once = rope.apply_edits({ { text.size() / 2, text.size() / 2 + 1, "x" } });
+    auto original = leaf_sizes(rope);
+    once.each_chunk(0, once.size(), [&](char const *, uintptr_t) { ++leaves; });
+    assert(leaves <= original.size() + 1);
+}
+
+void batch_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 30 + 123);
+
+    batch_tests<PRope>(text, [](PRope const &rope) { avl_check(rope.rootNode.get()); });
+    batch_tests<PooledRope>(text, [](PooledRope const &) {});
+    batch_tests<BTreeRope<4>>(text, [](BTreeRope<4> &rope) { btree_check(rope); });
+    batch_tests<PooledBTreeRope<16>>(text, [](PooledBTreeRope<16> &rope) { btree_check(rope); });
+}
+
+template<typename History>
+void history_tests(string const &text)
+{
+    using RopeType = typename History::RopeType;
+
+    History history((RopeType(text)));
+    vector<string> expected = { text };
+    for (uintptr_t i = 1; i < 20; ++i) {
+        uintptr_t at = i * 7919 % expected.back().size();
+        auto id = history.commit(history.current().insert(at, std::to_string(i)));
+        assert(id == i);
+        expected.push_back(history.current().to_string());
+    }
+
+    // Undo to the start, redo to the end, and check out versions in any order
+    assert(!history.can_redo());
+    for (uintptr_t i = expected.size() - 1; i-- > 0;) {
+        string undone = history.undo().to_string();
+        assert(undone == expected[i]);
+    }
+    assert(!history.can_undo());
+    string first = history.undo().to_string();
+    assert(first == text);
+    for (uintptr_t i = 1; i < expected.size(); ++i) {
+        string redone = history.redo().to_string();
+        assert(redone == expected[i]);
+    }
+    for (uintptr_t i : { 3, 11 }) {
+        string checked_out = history.checkout(i).to_string();
+        assert(checked_out == expected[i]);
+    }
+
+    // Versions share everything but the paths their edits copied
+    auto usage = history.usage();
+    uintptr_t unique = 0;
+    for (uintptr_t i = 0; i < usage.unique.size(); ++i) {
+        assert(i == 0 || usage.unique[i] < 4 * Rope::ROPE_GLOBAL_MAX_LEAF_CAP + 4096);
+        unique += usage.unique[i];
+    }
+    assert(usage.total == usage.shared + unique);
+    assert(usage.total >= text.size() && usage.total < text.size() + 20 * (4 * Rope::ROPE_GLOBAL_MAX_LEAF_CAP + 4096));
+
+    // Committing after an undo forgets the versions that could have been redone
+    history.undo();
+    auto id = history.commit(history.current().erase(0, 1));
+    assert(id == 20);
+    assert(!history.can_redo() && history.size() == 12);
+    bool thrown = false;
+    try {
+        history.checkout(12);
+    } catch (std::out_of_range const &) {
+        thrown = true;
+    }
+    assert(thrown);
+    string latest = history.current().to_string();
+
+    // Coalescing thins out older versions: all of the 8 before the current one, then 8 per doubling of distance
+    auto history_copy = history;
+    for (uintptr_t i = 0; i < 60; ++i) {
+        history.commit(history.current().insert(i * 31 % history.current().size(), "c"));
+        expected.push_back(history.current().to_string());
+    }
+    uintptr_t total = history.usage().total;
+    history.prune(total - 1, Rope::HistoryPruning::Coalesce);
+    auto ids = history.version_ids();
+    assert(ids.size() == 1 + 8 + 7 + 8 + 8 + 1 && history.usage().total < total);
+    for (uintptr_t i = 0; i < ids.size(); ++i) {
+        assert(i + 16 < ids.size() || ids[i] == 80 - (ids.size() - 1 - i));
+        uintptr_t version = ids[i] <= 10 ? ids[i] : ids[i] == 20 ? 20 : ids[i] - 1;
+        string checked_out = history.checkout(ids[i]).to_string();
+        assert(checked_out == (ids[i] == 20 ? latest : expected[version]));
+    }
+
+    // Dropping the oldest versions keeps a newest run that fits
+    history_copy.checkout(5);
+    history_copy.prune(history_copy.usage().total - 1);
+    assert(history_copy.version_ids().front() > 0 && history_copy.current_version() == 5);
+    history_copy.prune(0);
+    assert(history_copy.version_ids().front() == 5 && history_copy.size() == 7);
+    assert(history_copy.current().to_string() == expected[5] && !history_copy.can_undo());
+}
+
+void history_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 30 + 123);
+
+    history_tests<Rope::RopeHistory<char, Rope::UTF8MeasurePolicy>>(text);
+    history_tests<Rope::RopeHistory<char, Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>>(text);
+    history_tests<Rope::RopeHistory<char, Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 4>>>(text);
+    history_tests<Rope::RopeHistory<char, Rope::BTreePolicy<Rope::PooledPolicy<Rope::UTF8MeasurePolicy>, 16>>>(text);
+}
+
+static std::atomic<uintptr_t> hazard_frees(0);
+
+template<typename Concurrent>
+void concurrent_tests(string const &block, uintptr_t edits)
+{
+    using RopeType = typename Concurrent::RopeType;
+
+    // Readers see whole blocks, in versions that only move forward, while the writer inserts more
+    Concurrent document;
+    std::atomic<bool> done(false);
+    vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&] {
+            uint64_t last = 0;
+            while (!done) {
+                uint64_t version = document.version();
+                assert(version >= last);
+                last = version;
+
+                RopeType snapshot = document.snapshot();
+                assert(snapshot.size() % block.size() == 0);
+                string copies;
+                for (uintptr_t i = 0; i < snapshot.size() / block.size(); ++i) {
+                    copies += block;
+                }
+                assert(snapshot.to_string() == copies);
+                assert(document.read([&](RopeType const &rope) { return rope.size() >= snapshot.size(); }));
+            }
+        });
+    }
+    for (uintptr_t i = 0; i < edits; ++i) {
+        document.update([&](RopeType const &rope) { return rope.insert(i * 7 % (i + 1) * block.size(), block); });
+    }
+    done = true;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    assert(document.version() == edits && document.snapshot().size() == edits * block.size());
+
+    Rope::HazardPointer::reclaim();
+    assert(Rope::HazardPointer::retired() == 0);
+}
+
+void concurrent_tests()
+{
+    // A retired pointer outlives the hazard pointers protecting it
+    std::atomic<int *> shared(new int(1));
+    {
+        Rope::HazardPointer hazard;
+        int *seen = hazard.protect(shared);
+        Rope::HazardPointer::retire(shared.exchange(new int(2)), [](void *p) {
+            delete static_cast<int *>(p);
+            ++hazard_frees;
+        });
+        assert(hazard_frees == 0 && *seen == 1);
+        {
+            Rope::HazardPointer nested;
+            int *current = nested.protect(shared);
+            assert(*current == 2);
+        }
+        Rope::HazardPointer::reclaim();
+        assert(hazard_frees == 0 && Rope::HazardPointer::retired() == 1);
+    }
+    Rope::HazardPointer::reclaim();
+    assert(hazard_frees == 1 && Rope::HazardPointer::retired() == 0);
+    delete shared.load();
+
+    concurrent_tests<Rope::ConcurrentRope<char, Rope::UTF8MeasurePolicy>>("snapshot ", 300);
+    concurrent_tests<Rope::ConcurrentRope<char, Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>>(u8"ロープ", 300);
+    concurrent_tests<Rope::ConcurrentRope<char, Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 4>>>("btree", 300);
+}
+
+/**
+ *  Measures code points like `UTF8MeasurePolicy`, counting the leaves it measures
+ */
+static std::atomic<uintptr_t> accumulate_count(0);
+
+struct CountingPolicy : public Rope::UTF8MeasurePolicy
+{
+    static UTF8Measure accumulate(Rope::Slice<char> const &slice)
+    {
+        ++accumulate_count;
+        return Rope::UTF8MeasurePolicy::accumulate(slice);
+    }
+};
+
+template<typename RopeType>
+void lazy_tests(string const &text)
+{
+    // Building, reading, seeking and editing by item measure nothing
+    accumulate_count = 0;
+    RopeType rope(text);
+    RopeType edited = rope.insert(777, u8"λ").erase(5000, 6000).replace(100, 101, "xyz");
+    auto split = edited.splitBefore(edited.begin_items() + 3000);
+    edited = get<1>(split).concat(get<0>(split));
+    assert(edited.to_string(100, 200) == edited.to_string().substr(100, 100));
+    assert(*(edited.begin_items() + 4000) == edited.to_string()[4000]);
+    assert(accumulate_count == 0);
+
+    // Measures match an eagerly measured rope, and each leaf is measured once
+    PRope eager(edited.to_string());
+    assert(edited.measure().count == eager.measure().count);
+    assert(accumulate_count == edited.rootNode->weight);
+    for (uintptr_t point = 0; point < eager.measure().count; point += 997) {
+        assert((edited.begin() + point).raw_index() == (eager.begin() + point).raw_index());
+    }
+    assert(accumulate_count == edited.rootNode->weight);
+
+    // Seeking near the start leaves the rest unmeasured
+    accumulate_count = 0;
+    RopeType fresh(text);
+    assert((fresh.begin() + 10).raw_index() == (eager.begin() + 10).raw_index());
+    assert(accumulate_count < fresh.rootNode->weight);
+
+    // Threads racing to measure the same nodes measure each leaf once between them
+    RopeType shared(text);
+    accumulate_count = 0;
+    uintptr_t count = PRope(text).measure().count;
+    vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&] {
+            uintptr_t measured = shared.measure().count;
+            assert(measured == count);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    assert(accumulate_count == shared.rootNode->weight);
+}
+
+void lazy_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 40 + 321);
+
+    lazy_tests<Rope::Rope<char, Rope::LazyPolicy<CountingPolicy>>>(text);
+    lazy_tests<Rope::Rope<char, Rope::LazyPolicy<Rope::PooledPolicy<CountingPolicy>>>>(text);
+    lazy_tests<Rope::Rope<char, Rope::BTreePolicy<Rope::LazyPolicy<CountingPolicy>, 4>>>(text);
+    lazy_tests<Rope::Rope<char, Rope::BTreePolicy<Rope::LazyPolicy<CountingPolicy>, 32>>>(text);
+}
+
+/**
+ *  Check find, rfind and find_all against std::string, for needles from single items to ones spanning several leaves
+ */
+template<typename RopeType>
+void search_tests(RopeType const &rope, string const &text)
+{
+    vector<string> needles = { "", "a", "b", "ab", "ba", "abc", "aab", "abba", "cab", "x", "aaaaaaaa", text.substr(0, 1),
+                               text.substr(text.size() - 9), text.substr(1000, 700), text.substr(3000, 9000),
+                               text.substr(text.size() - 5000), text + "a" };
+    for (int i = 0; i < 20; ++i) {
+        needles.push_back(text.substr(rand() % text.size(), 1 + rand() % 40));
+    }
+
+    for (auto &needle : needles) {
+        vector<uintptr_t> expected;
+        for (auto at = text.find(needle); at != string::npos && !needle.empty(); at = text.find(needle, at + 1)) {
+            expected.push_back(at);
+        }
+        if (!needle.empty()) {
+            assert(rope.find_all(needle) == expected);
+        }
+
+        for (uintptr_t from : { (uintptr_t)0, (uintptr_t)1, (uintptr_t)rand() % text.size(), (uintptr_t)text.size() - 1,
+                                (uintptr_t)text.size(), (uintptr_t)text.size() + 1 }) {
+            assert(rope.find(needle, from) == text.find(needle, from));
+            assert(rope.rfind(needle, from) == text.rfind(needle, from));
+        }
+        assert(rope.rfind(needle) == text.rfind(needle));
+    }
+    assert(rope.find_all("").size() == text.size() + 1);
+}
+
+void search_tests()
+{
+    // Few distinct letters make for many candidates and overlapping matches
+    srand(11);
+    string text;
+    for (uintptr_t i = 0; i < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 4; ++i) {
+        text += "aabc"[rand() % 4];
+    }
+    text += text.substr(0, 6000) + text;
+
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
+        search_tests(PRope(text), text);
+        search_tests(lopsided_rope(text, 7), text);
+        search_tests(BTreeRope<4>(text), text);
+    }
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+
+    // Offsets are in items, across multibyte text
+    PRope utf8(bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 3));
+    assert(utf8.find(u8"ジャンプ") == string(u8"The quick brown fox ").size());
+    assert(utf8.find_all(u8"dog.\nThe").size() == utf8.size() / string(u8"The quick brown fox ジャンプ over the lazy dog.\n").size() - 1);
+}
+
+template<size_t Fanout>
+using HashedBTreeRope = BTreeRope<Fanout, Rope::HashedPolicy<Rope::UTF8MeasurePolicy>>;
+
+/**
+ *  Check hashes of ranges against hashes of the flat text, through edits, and compare ranges within and across
+ *  ropes of either layout
+ */
+template<typename RopeType, typename OtherType>
+void hash_tests(string const &text)
+{
+    using Rope::RopeHash;
+
+    RopeType rope(text);
+    OtherType other(text);
+    assert(rope.hash() == RopeHash::of(text.data(), text.size()));
+    assert(rope.hash(5, 5) == RopeHash::identity());
+    assert(rope.hash(text.size() - 10, text.size() + 10) == RopeHash::of(text.data() + text.size() - 10, 10));
+    for (int i = 0; i < 200; ++i) {
+        uintptr_t begin = rand() % text.size();
+        uintptr_t end = begin + rand() % (text.size() - begin + 1);
+        RopeHash expected = RopeHash::of(text.data() + begin, end - begin);
+        assert(rope.hash(begin, end) == expected);
+        assert(other.hash(begin, end) == expected);
+        assert(Rope::equal_ranges(rope, begin, end, other, begin, end));
+    }
+
+    // Built from pieces, or edited, a rope hashes as its items do
+    RopeType pieces;
+    for (uintptr_t i = 0; i < text.size(); i += 331) {
+        pieces = pieces.concat(RopeType(text.substr(i, 331)));
+    }
+    assert(pieces.hash() == rope.hash());
+    RopeType edited = rope.insert(777, u8"λ").erase(5000, 6000).replace(100, 101, "xyz").apply_edits({
+        { 20000, 20100, "" }, { 30000, 30000, text.substr(0, 9000) } });
+    string flat = edited.to_string();
+    assert(edited.hash() == RopeHash::of(flat.data(), flat.size()));
+    assert(edited.balance().hash() == RopeHash::of(flat.data(), flat.size()));
+    auto split = edited.splitBefore(edited.begin_items() + 3000);
+    assert(get<0>(split).hash() == RopeHash::of(flat.data(), 3000));
+    assert(get<1>(split).hash() == RopeHash::of(flat.data() + 3000, flat.size() - 3000));
+
+    // Ranges equal with the same items, wherever they are
+    uintptr_t block = text.size() / 2;
+    assert(Rope::equal_ranges(rope, 30000, 40000, edited, 30000, 39000) == false);
+    assert(Rope::equal_ranges(rope, 0, 9000, edited, 29900, 38900));
+    for (int i = 0; i < 50; ++i) {
+        uintptr_t begin = rand() % text.size(), other_begin = rand() % flat.size(), length = rand() % 5000;
+        bool equal = text.compare(begin, length, flat, other_begin, length) == 0;
+        assert(Rope::equal_ranges(rope, begin, begin + length, edited, other_begin, other_begin + length) == equal);
+    }
+    assert(Rope::equal_ranges(rope, 0, 0, other, text.size(), text.size()));
+    assert(Rope::equal_ranges(rope, 9, 7, other, 3, 1));
+    assert(Rope::equal_ranges(rope, text.size() - 100, RopeType::npos, other, text.size() - 100, text.size()));
+
+    // Including within a shared subtree, or the same rope
+    RopeType far = rope.insert(text.size() - 1, "!");
+    assert(Rope::equal_ranges(rope, 1000, 1000 + block, far, 1000, 1000 + block));
+    assert(Rope::equal_ranges(rope, 0, text.size(), rope, 0, text.size()));
+
+    // A single changed item anywhere changes the hash
+    for (int i = 0; i < 50; ++i) {
+        uintptr_t at = rand() % text.size();
+        string changed = text;
+        changed[at] ^= 1 + rand() % 127;
+        RopeType mutated = rope.replace(at, at + 1, changed.substr(at, 1));
+        assert(mutated.hash() != rope.hash());
+        assert(!Rope::equal_ranges(rope, 0, text.size(), mutated, 0, text.size()));
+        assert(Rope::equal_ranges(other, 0, at, mutated, 0, at));
+        assert(Rope::equal_ranges(other, at + 1, text.size(), mutated, at + 1, text.size()));
+    }
+}
+
+void hash_tests()
+{
+    srand(17);
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 20 + 321);
+
+    using Hashed = Rope::HashedPolicy<Rope::UTF8MeasurePolicy>;
+    hash_tests<Rope::Rope<char, Hashed>, HashedBTreeRope<4>>(text);
+    hash_tests<HashedBTreeRope<4>, Rope::Rope<char, Hashed>>(text);
+    hash_tests<HashedBTreeRope<32>, HashedBTreeRope<4>>(text);
+    hash_tests<Rope::Rope<char, Rope::LazyPolicy<Rope::PooledPolicy<Hashed>>>, Rope::Rope<char, Hashed>>(text);
+}
+
+template<typename T>
+int sign(T value)
+{
+    return (value > 0) - (value < 0);
+}
+
+/**
+ *  The items the lockstep walk has to read to compare two ropes, once shared subtrees are skipped
+ */
+template<typename RopeType>
+uintptr_t compared_items(RopeType const &lhs, RopeType const &rhs)
+{
+    uintptr_t compared = 0;
+    auto differ = [&compared](char const *, char const *, uintptr_t count) {
+        compared += count;
+        return false;
+    };
+    Rope::__ropeLockstep(lhs.rootNode.get(), rhs.rootNode.get(), differ);
+    return compared;
+}
+
+/**
+ *  Check compare and the comparison operators against std::string, between ropes of different shapes and between
+ *  versions of one rope
+ */
+template<typename RopeType>
+void compare_tests(string const &text)
+{
+    RopeType rope(text);
+    vector<string> others = { "", text.substr(0, 1), text.substr(0, text.size() - 1), text + "a", text + "\xff",
+                              "\xff" + text, text.substr(1) };
+    for (int i = 0; i < 20; ++i) {
+        string changed = text;
+        changed[rand() % text.size()] ^= 1 + rand() % 255;
+        others.push_back(changed);
+    }
+
+    for (auto &other : others) {
+        RopeType flat(other);
+        int expected = sign(text.compare(other));
+        assert(sign(rope.compare(flat)) == expected);
+        assert(sign(flat.compare(rope)) == -expected);
+        assert((rope == flat) == (expected == 0));
+        assert((rope != flat) == (expected != 0));
+        assert((rope < flat) == (expected < 0));
+        assert((rope > flat) == (expected > 0));
+        assert((rope <= flat) == (expected <= 0));
+        assert((rope >= flat) == (expected >= 0));
+    }
+
+    // Ropes of the same items are equal, whatever their shapes
+    RopeType pieces;
+    for (uintptr_t i = 0; i < text.size(); i += 331) {
+        pieces = pieces.concat(RopeType(text.substr(i, 331)));
+    }
+    assert(pieces == rope && rope == pieces);
+    assert(RopeType() == RopeType(string()) && RopeType() < rope);
+    auto split = rope.splitBefore(rope.begin_items() + text.size() / 3);
+    assert(get<0>(split).concat(get<1>(split)) == rope);
+    assert(get<1>(split).concat(get<0>(split)) != rope);
+
+    // Versions sharing all but the path to an edit only read the leaves around it
+    RopeType version = rope;
+    for (int i = 0; i < 20; ++i) {
+        uintptr_t at = rand() % version.size();
+        RopeType edited = version.replace(at, at + 1, "#");
+        string flat = edited.to_string();
+        assert(sign(version.compare(edited)) == sign(version.to_string().compare(flat)));
+        assert(compared_items(version, edited) <= 4 * Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+        assert(edited == RopeType(flat));
+        version = edited;
+    }
+    assert(compared_items(rope, rope) == 0);
+    RopeType balanced = version;
+    balanced.balance();
+    assert(balanced == version);
+}
+
+void compare_tests()
+{
+    srand(19);
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 20 + 321);
+
+    compare_tests<PRope>(text);
+    compare_tests<PooledRope>(text);
+    compare_tests<BTreeRope<4>>(text);
+    compare_tests<BTreeRope<32>>(text);
+    assert(lopsided_rope(text, 7) == PRope(text));
+    assert(lopsided_rope(text, 7) < lopsided_rope(text + "a", 5));
+}
+
+/**
+ *  Check that applying the diff between two ropes to the first gives the second
+ */
+template<typename RopeType>
+vector<Rope::RopeEdit<char>> check_diff(RopeType const &from, RopeType const &to)
+{
+    auto edits = Rope::diff(from, to);
+    for (uintptr_t i = 0; i < edits.size(); ++i) {
+        assert(edits[i].begin <= edits[i].end && edits[i].end <= from.size());
+        assert(i == 0 || edits[i - 1].end < edits[i].begin);
+    }
+    assert(from.apply_edits(edits).to_string() == to.to_string());
+    return edits;
+}
+
+/**
+ *  The items an edit list removes and inserts
+ */
+uintptr_t edit_size(vector<Rope::RopeEdit<char>> const &edits)
+{
+    uintptr_t size = 0;
+    for (auto &edit : edits) {
+        size += edit.end - edit.begin + edit.items.size();
+    }
+    return size;
+}
+
+template<typename RopeType>
+void diff_tests(RopeType const &rope)
+{
+    uintptr_t size = rope.size();
+    assert(Rope::diff(rope, rope).empty());
+    assert(check_diff(rope, RopeType(rope.to_string())).empty());
+    assert(edit_size(check_diff(RopeType(), rope)) == size);
+    assert(edit_size(check_diff(rope, RopeType())) == size);
+
+    // Small edits give edits as small
+    for (int i = 0; i < 20; ++i) {
+        uintptr_t at = rand() % size;
+        assert(edit_size(check_diff(rope, rope.replace(at, at + 1, "#"))) == 2);
+        assert(edit_size(check_diff(rope, rope.insert(at, "#hello#"))) == 7);
+        assert(edit_size(check_diff(rope, rope.erase(at, std::min(at + 300, size)))) == std::min<uintptr_t>(300, size - at));
+    }
+
+    // Versions several edits apart, including ones moving text, and versions built separately
+    RopeType version = rope;
+    for (int i = 0; i < 30; ++i) {
+        RopeType next = version;
+        for (int edit = rand() % 6; edit >= 0; --edit) {
+            uintptr_t begin = rand() % (next.size() + 1);
+            uintptr_t end = std::min<uintptr_t>(next.size(), begin + rand() % 2000);
+            if (edit % 3 == 0) {
+                RopeType moved = next.substr(next.begin_items() + begin, next.begin_items() + end);
+                next = next.erase(begin, end);
+                uintptr_t to = rand() % (next.size() + 1);
+                auto split = next.splitBefore(next.begin_items() + to);
+                next = get<0>(split).concat(moved).concat(get<1>(split));
+            } else {
+                next = next.replace(begin, end, rope.to_string(end, end + rand() % 500));
+            }
+        }
+        check_diff(version, next);
+        check_diff(next, version);
+        check_diff(version, RopeType(next.to_string()));
+        version = next;
+    }
+    check_diff(rope, version);
+}
+
+void diff_tests()
+{
+    srand(23);
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 20 + 321);
+    for (uintptr_t i = 0; i < text.size(); i += 1 + rand() % 20) {
+        text[i] = 'a' + rand() % 26;
+    }
+
+    diff_tests(PRope(text));
+    diff_tests(lopsided_rope(text, 331));
+    diff_tests(PooledRope(text));
+    diff_tests(BTreeRope<4>(text));
+    diff_tests(BTreeRope<32>(text));
+    diff_tests(PRope(string("a")));
+
+    // Differences far apart in one window are still found item by item
+    string spaced(5000, 'x');
+    string changed = spaced;
+    changed[100] = 'y';
+    changed[4000] = 'z';
+    assert(check_diff(PRope(spaced), PRope(changed)).size() == 2);
+}
+
+/**
+ *  Save a rope, load it back and check it has the same items in the same shape
+ */
+template<typename RopeType>
+RopeType check_save(RopeType const &rope, string const &path, typename RopeType::CallbacksType const &callbacks
+                    = typename RopeType::CallbacksType())
+{
+    rope.save(path);
+    RopeType loaded = RopeType::load(path, callbacks);
+    assert(loaded.size() == rope.size());
+    assert(loaded.compare(rope) == 0);
+    assert(loaded.rootNode->weight == rope.rootNode->weight);
+    assert(loaded.rootNode->height == rope.rootNode->height);
+    return loaded;
+}
+
+template<typename Error>
+bool load_throws(string const &path)
+{
+    try {
+        PRope::load(path);
+    } catch (Error const &) {
+        return true;
+    }
+    return false;
+}
+
+void save_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 20 + 321);
+    string path = write_temporary("");
+
+    // Leaves keep their measures, so loading measures nothing
+    using CountingRope = Rope::Rope<char, CountingPolicy>;
+    using CountingBTreeRope = Rope::Rope<char, Rope::BTreePolicy<CountingPolicy, 4>>;
+    CountingRope counted(text);
+    CountingBTreeRope counted_btree(text);
+    accumulate_count = 0;
+    assert(check_save(counted, path).measure().count == counted.measure().count);
+    assert(check_save(counted_btree, path).measure().count == counted.measure().count);
+    assert(accumulate_count == 0);
+
+    PRope rope(text);
+    assert(check_save(rope, path).measure().count == rope.measure().count);
+    assert(check_save(lopsided_rope(text, 7), path).measure().count == rope.measure().count);
+    assert(check_save(PooledRope(text), path).measure().count == rope.measure().count);
+    assert(check_save(BTreeRope<32>(text), path).measure().count == rope.measure().count);
+    assert(check_save(PooledBTreeRope<16>(text), path).measure().count == rope.measure().count);
+    assert(check_save(Rope::Rope<char, Rope::LazyPolicy<Rope::UTF8MeasurePolicy>>(text), path).measure().count
+           == rope.measure().count);
+    assert(check_save(PRope(), path).size() == 0);
+    assert(check_save(BTreeRope<4>(), path).size() == 0);
+
+    TextRope text_rope(text);
+    TextRope text_loaded = check_save(text_rope, path);
+    assert(get<0>(text_loaded.measure()).size() == text.size());
+    assert(get<1>(text_loaded.measure()).count == rope.measure().count);
+    assert(get<2>(text_loaded.measure()).count == get<2>(text_rope.measure()).count);
+    assert(get<3>(text_loaded.measure()).count == get<3>(text_rope.measure()).count);
+    assert(get<1>(check_save(CharLineRope(text), path).measure()).count == get<2>(text_rope.measure()).count);
+
+    // Policies without hooks, and runtime callbacks, measure leaves again; so do ropes saved without measures
+    using UnserializedRope = Rope::Rope<char, Rope::StaticMeasurePolicy<UTF8Measure, char>>;
+    assert(check_save(UnserializedRope(text), path).measure()->count == rope.measure().count);
+    assert(PRope::load(path).measure().count == rope.measure().count);
+    assert(dynamic_cast<UTF8Measure const &>(check_save(CRope(text, callbacks), path, callbacks).measure()).count
+           == rope.measure().count);
+
+    // Hashes are found again
+    HashedBTreeRope<8> hashed(text);
+    assert(check_save(hashed, path).hash() == hashed.hash());
+
+    // Shared subtrees are saved once, and stay shared
+    PRope doubled = rope.concat(rope);
+    PRope doubled_loaded = check_save(doubled, path);
+    assert(doubled_loaded.rootNode->branch_data.left == doubled_loaded.rootNode->branch_data.right);
+    assert(Rope::MappedFile::open(path)->size() < text.size() * 2);
+
+    // A loaded rope can be edited, and saved back over the file it was loaded from
+    PRope edited = PRope::load(path).replace(100, 200, u8"λ").insert(text.size(), "middle");
+    edited.save(path);
+    assert(PRope::load(path) == edited);
+    assert(edited.to_string().substr(0, 100) == text.substr(0, 100));
+
+    // Ropes of another layout or policy, and files that aren't saved ropes, are refused
+    rope.save(path);
+    bool thrown = false;
+    try {
+        BTreeRope<4>::load(path);
+    } catch (std::runtime_error const &) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        UnserializedRope::load(path);
+    } catch (std::runtime_error const &) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    string plain = write_temporary(text);
+    assert(load_throws<std::runtime_error>(plain));
+    unlink(plain.c_str());
+    {
+        auto file = Rope::MappedFile::open(path);
+        string truncated = write_temporary(string(file->data(), file->size() - 100));
+        assert(load_throws<std::runtime_error>(truncated));
+        unlink(truncated.c_str());
+    }
+    unlink(path.c_str());
+    assert(load_throws<std::system_error>(path));
+
+    thrown = false;
+    try {
+        rope.save("/nonexistent/rope");
+    } catch (std::system_error const &error) {
+        thrown = error.code().value() == ENOENT;
+    }
+    assert(thrown);
+}
+
+/**
+ *  Check a rope built by `RopeBuilder` holds `text` in full leaves, each starting a UTF-8 sequence
+ */
+template<typename RopeType>
+RopeType const &check_built(RopeType const &rope, string const &text)
+{
+    assert(rope.size() == text.size());
+    assert(rope.to_string() == text);
+    uintptr_t leaves = 0;
+    rope.each_chunk(0, rope.size(), [&leaves](char const *items, uintptr_t) {
+        assert((static_cast<unsigned char>(items[0]) & 0xC0) != 0x80);
+        ++leaves;
+    });
+    assert(leaves <= text.size() / (Rope::ROPE_GLOBAL_MAX_LEAF_CAP - 4) + 1);
+    return rope;
+}
+
+void builder_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 300 + 123);
+    PRope expected(text);
+
+    // From a stream, across more than one block, as balanced as a rope built at once
+    std::istringstream stream(text);
+    Rope::RopeBuilder<char, Rope::UTF8MeasurePolicy> builder;
+    PRope rope = builder.read(stream).finish();
+    check_built(rope, text);
+    assert(rope.measure().count == expected.measure().count);
+    assert(node_depth(rope.rootNode.get()) <= node_depth(expected.rootNode.get()) + 1);
+
+    // The builder starts again empty
+    assert(builder.size() == 0);
+    assert(builder.finish().size() == 0);
+    builder.append(text.data(), 10);
+    assert(builder.finish().to_string() == text.substr(0, 10));
+
+    // From a file descriptor, holding little besides the rope
+    string path = write_temporary(text);
+    int fd = open(path.c_str(), O_RDONLY);
+    assert(fd >= 0);
+    intptr_t allocated = allocated_bytes;
+    BTreeRope<4> btree = Rope::RopeBuilder<char, Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 4>>().read(fd).finish();
+    assert(allocated_bytes - allocated < (intptr_t)text.size() * 5 / 4);
+    close(fd);
+    unlink(path.c_str());
+    check_built(btree, text);
+    assert(btree_check(btree) == text);
+    assert(btree.measure().count == expected.measure().count);
+
+    // From runs of any length, in blocks of a few leaves
+    srand(25);
+    Rope::RopeBuilder<char, Rope::TextMeasurePolicy> runs(Rope::TextMeasurePolicy(), Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 2 + 5);
+    for (uintptr_t at = 0; at < text.size();) {
+        uintptr_t length = std::min<uintptr_t>(rand() % (Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 3), text.size() - at);
+        runs.append(text.data() + at, length);
+        at += length;
+    }
+    assert(runs.size() == text.size());
+    TextRope text_rope = runs.finish();
+    check_built(text_rope, text);
+    TextRope text_expected(text);
+    assert(get<1>(text_rope.measure()).count == expected.measure().count);
+    assert(get<2>(text_rope.measure()).count == get<2>(text_expected.measure()).count);
+    assert(get<3>(text_rope.measure()).count == get<3>(text_expected.measure()).count);
+
+    Rope::RopeBuilder<char, Rope::Measure<char>> generic(callbacks);
+    generic.append(text.data(), text.size());
+    CRope crope = generic.finish();
+    check_built(crope, text);
+    assert(dynamic_cast<UTF8Measure const &>(crope.measure()).count == expected.measure().count);
+
+    Rope::RopeBuilder<char, Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 32>> small;
+    small.append("x", 1);
+    BTreeRope<32> one = small.finish();
+    assert(one.to_string() == "x");
+    assert(small.finish().size() == 0);
+
+    bool thrown = false;
+    try {
+        Rope::RopeBuilder<char, Rope::UTF8MeasurePolicy>().read(-1);
+    } catch (std::system_error const &error) {
+        thrown = error.code().value() == EBADF;
+    }
+    assert(thrown);
+}
+
+/**
+ *  A Fletcher-style checksum of a run of bytes, which combines with the checksum of the run after it
+ */
+struct Checksum {
+    uint64_t sum;           // of the bytes
+    uint64_t weighted;      // of the running sums
+    uint64_t length;
+
+    static Checksum of(char const *items, uintptr_t count)
+    {
+        Checksum checksum = { 0, 0, count };
+        for (uintptr_t i = 0; i < count; ++i) {
+            checksum.sum += (unsigned char)items[i];
+            checksum.weighted += checksum.sum;
+        }
+        return checksum;
+    }
+
+    Checksum then(Checksum const &next) const
+    {
+        return { sum + next.sum, weighted + next.weighted + sum * next.length, length + next.length };
+    }
+
+    bool operator==(Checksum const &other) const
+    {
+        return sum == other.sum && weighted == other.weighted && length == other.length;
+    }
+};
+
+/**
+ *  The words in a run of bytes, and whether a word runs into either end, so that runs can be combined
+ */
+struct WordCount {
+    uintptr_t words;
+    uintptr_t length;
+    bool starts_in_word;
+    bool ends_in_word;
+
+    // isspace() in the "C" locale, without the call per byte
+    static bool blank(char c)
+    {
+        return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+    }
+
+    static WordCount of(char const *items, uintptr_t count)
+    {
+        WordCount counted = { 0, count, count > 0 && !blank(items[0]), count > 0 && !blank(items[count - 1]) };
+        bool in_word = false;
+        for (uintptr_t i = 0; i < count; ++i) {
+            bool word = !blank(items[i]);
+            counted.words += word && !in_word;
+            in_word = word;
+        }
+        return counted;
+    }
+
+    WordCount then(WordCount const &next) const
+    {
+        if (length == 0 || next.length == 0) {
+            return length == 0 ? next : *this;
+        }
+        return { words + next.words - (ends_in_word && next.starts_in_word), length + next.length, starts_in_word, next.ends_in_word };
+    }
+};
+
+/**
+ *  The occurrences of a needle in a run of bytes, with the bytes at either end that an occurrence straddling the
+ *  run's boundaries could use
+ */
+struct Occurrences {
+    uintptr_t count;
+    string head;            // the first `m - 1` bytes, or the whole run if it's shorter
+    string tail;            // the last `m - 1` bytes
+
+    static Occurrences of(string const &needle, char const *items, uintptr_t count)
+    {
+        uintptr_t keep = std::min<uintptr_t>(count, needle.size() - 1);
+        Occurrences found = { 0, string(items, keep), string(items + count - keep, keep) };
+        for (uintptr_t at = 0; at < count; ++at) {
+            at += Rope::text_find(items + at, count - at, needle.data(), needle.size());
+            found.count += at < count;
+        }
+        return found;
+    }
+
+    Occurrences then(string const &needle, Occurrences const &next) const
+    {
+        uintptr_t keep = needle.size() - 1;
+        Occurrences joined = { count + next.count, head, next.tail };
+        string boundary = tail + next.head;
+        for (uintptr_t at = 0; at < tail.size() && at + needle.size() <= boundary.size(); ++at) {
+            joined.count += at + needle.size() > tail.size() && boundary.compare(at, needle.size(), needle) == 0;
+        }
+        if (joined.head.size() < keep) {
+            joined.head = (head + next.head).substr(0, keep);
+        }
+        if (joined.tail.size() < keep) {
+            string both = tail + next.tail;
+            joined.tail = both.substr(both.size() - std::min(both.size(), keep));
+        }
+        return joined;
+    }
+};
+
+/**
+ *  Check parallel reductions and visits against the same work done serially on `text`
+ */
+template<typename RopeType>
+void parallel_tests(RopeType const &rope, string const &text)
+{
+    for (uintptr_t grain : { (uintptr_t)1, (uintptr_t)1000, (uintptr_t)100000, (uintptr_t)text.size() }) {
+        auto checksum = rope.parallel_reduce(0, rope.size(), Checksum::of, [](Checksum const &a, Checksum const &b) {
+            return a.then(b);
+        }, grain);
+        assert(checksum == Checksum::of(text.data(), text.size()));
+
+        // Combining needn't be commutative
+        uintptr_t begin = rand() % text.size();
+        uintptr_t end = begin + rand() % (text.size() - begin);
+        auto copy = rope.parallel_reduce(begin, end, [](char const *items, uintptr_t count) {
+            return string(items, count);
+        }, [](string const &a, string const &b) {
+            return a + b;
+        }, grain);
+        assert(copy == text.substr(begin, end - begin));
+
+        auto words = rope.parallel_reduce(0, rope.size(), WordCount::of, [](WordCount const &a, WordCount const &b) {
+            return a.then(b);
+        }, grain);
+        assert(words.words == WordCount::of(text.data(), text.size()).words);
+
+        for (string needle : { string("d"), string("dog.\nThe"), text.substr(100, 5000) }) {
+            auto found = rope.parallel_reduce(0, rope.size(), [&](char const *items, uintptr_t count) {
+                return Occurrences::of(needle, items, count);
+            }, [&](Occurrences const &a, Occurrences const &b) {
+                return a.then(needle, b);
+            }, grain);
+            assert(found.count == rope.find_all(needle).size());
+        }
+
+        string visited(text.size(), '\0');
+        std::atomic<uintptr_t> chunks(0);
+        rope.parallel_for_each_chunk(begin, end, [&](char const *items, uintptr_t count, uintptr_t offset) {
+            std::copy(items, items + count, &visited[offset]);
+            ++chunks;
+        }, grain);
+        assert(visited.compare(begin, end - begin, text, begin, end - begin) == 0);
+        assert(chunks >= (end - begin) / Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+    }
+
+    assert(rope.parallel_reduce(5, 5, Checksum::of, [](Checksum const &a, Checksum const &) { return a; }).length == 0);
+}
+
+void parallel_tests()
+{
+    string text = bench_text(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 40 + 321);
+    srand(13);
+
+    Rope::ThreadPool pool(3);
+    Rope::ThreadPool::Scope scope(pool);
+    parallel_tests(PRope(text), text);
+    parallel_tests(lopsided_rope(text, 331), text);
+    parallel_tests(BTreeRope<4>(text), text);
+    parallel_tests(PooledBTreeRope<32>(text), text);
+}
+
+void run_tests()
+{
+    string msg = u8"インターネットに接続していることを確認し";
+    
+    CRope rope(msg, callbacks);
+
+    tests_with_rope(rope);
+
+    build_by_concat_tests(CRope(callbacks));
+
+    policy_tests(msg);
+
+    multi_measure_tests();
+
+    utf8_kernel_tests();
+
+    line_kernel_tests();
+
+    text_kernel_tests();
+
+    btree_tests<Rope::UTF8MeasurePolicy>();
+
+    btree_tests<Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>();
+
+    pool_tests(msg);
+
+    iterator_tests();
+
+    chunk_tests();
+
+    file_tests();
+
+    large_file_tests();
+
+    thread_pool_tests();
+
+    build_tests();
+
+    join_tests();
+
+    edit_tests();
+
+    batch_tests();
+
+    history_tests();
+
+    concurrent_tests();
+
+    lazy_tests();
+
+    search_tests();
+
+    parallel_tests();
+
+    hash_tests();
+
+    compare_tests();
+
+    diff_tests();
+
+    save_tests();
+
+    builder_tests();
+}
+
+void speed_test()
+{
+
+    string s = "a";
+
+    cout << "numSplits, elapsed, elapsed / numSplits" << endl;
+
+    while (s.size() < Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 4) {
+        cerr << (double)s.size() * 100 / (double)(Rope::ROPE_GLOBAL_MAX_LEAF_CAP * 4) << endl;
+
+        CRope rope(s, callbacks);
+        rope.balance(callbacks);
+
+        clock_t start = clock();
+
+        auto numSplits = split_before_test(rope) ?: 1;
+
+        clock_t end = clock();
+        auto elapsed = (end - start) / (double)(CLOCKS_PER_SEC / 1000000);
+
+        cout << rope.size() << ", " << elapsed << ", " << "--, " << elapsed / numSplits << endl;
+
+        s += "a";
+    }
+}
+
+void file_speed_test(int argc, char **argv)
+{
+    if (argc < 2) {
+        cout << "Expected a filename for argument 1" << endl;
+        return;
+    }
+
+    CRope rope = CRope::from_file(argv[1], callbacks);
+
+    clock_t start = clock();
+
+    cout << "numSplits, elapsed, elapsed / numSplits" << endl;
+    uintptr_t i = 0;
+    for (auto it = rope.begin(iterCallbacks); i < 10000 && it < rope.end(iterCallbacks); ++it, ++i) {
+
+        it.push_to_leaf();
+        
+        clock_t start_split = clock();
+
+        auto split = rope.splitBefore(it, callbacks);
+
+        auto elapsed = (clock() - start_split) / (double)(CLOCKS_PER_SEC / 1000000);
+        
+        cout << i << ", " << elapsed << ", " << elapsed << endl;
+    }
+
+    double elapsed = (double)(clock() - start) / (double)(CLOCKS_PER_SEC);
+    cout << i << " operations completed, " << (elapsed > 0 ? (float)i / (float)elapsed : -1) << " ops / s" << endl;
+}
+
+
+template<typename RopeType>
+void split_concat_bench(
+    char const *label,
+    string const &text,
+    typename RopeType::CallbacksType const &cbs,
+    typename RopeType::IterCallbacksType const &iter_cbs)
+{
+    RopeType rope(text, cbs);
+    rope.balance(cbs);
+
+    uintptr_t ops = 2000;
+    uintptr_t count = iter_cbs.predicate(rope.rootNode->measure());
+    uintptr_t depth = node_depth(rope.rootNode.get());
+
+    vector<typename RopeType::MeasureIterType> points;
+    for (uintptr_t i = 0; i < ops; ++i) {
+        points.push_back(rope.begin(iter_cbs) + (i * 7919) % count);
+    }
+
+    uintptr_t allocations = allocation_count;
+    clock_t start = clock();
+    for (uintptr_t i = 0; i < ops; ++i) {
+        auto split = rope.splitBefore(points[i], cbs);
+        auto joined = get<0>(split).concat(get<1>(split), cbs);
+        assert(joined.size() == rope.size());
+    }
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9;
+    allocations = allocation_count - allocations;
+
+    // Each split builds a new branch on both sides at every level, and the concat adds one more.
+    double nodes = (double)ops * (2 * depth + 1);
+    cout << label << ", " << rope.size() << ", " << depth << ", "
+         << elapsed / ops << ", " << elapsed / nodes << ", " << (double)allocations / ops << endl;
+}
+
+/**
+ *  Compare split + concat through `MeasureCallbacks` with the same operations through a compile-time policy.
+ *  The bytes measure makes leaf accumulation O(1), leaving the per-node cost of the tree operations.
+ *  Callbacks allocate each measure through `shared_ptr`; policies hold it inline in the node.
+ */
+void policy_bench()
+{
+    cout << "variant, bytes, depth, ns / split+concat, ns / node, allocations / split+concat" << endl;
+    for (uintptr_t size = 1 << 16; size <= 1 << 24; size <<= 4) {
+        string text = bench_text(size);
+        split_concat_bench<CRope>("utf8 callbacks", text, callbacks, iterCallbacks);
+        split_concat_bench<PRope>("utf8 policy", text, PRope::CallbacksType(), PRope::IterCallbacksType());
+        split_concat_bench<CRope>("bytes callbacks", text, bytesCallbacks, bytesIterCallbacks);
+        split_concat_bench<BytesRope>("bytes policy", text, BytesRope::CallbacksType(), BytesRope::IterCallbacksType());
+    }
+}
+
+template<typename RopeType, size_t Lines>
+void composite_edit_bench(char const *label, string const &text, uintptr_t ops)
+{
+    clock_t start = clock();
+    RopeType rope(text);
+    double build = (double)(clock() - start) / CLOCKS_PER_SEC * 1e3;
+
+    uintptr_t count = get<Lines>(rope.measure()).count;
+    start = clock();
+    for (uintptr_t i = 0; i < ops; ++i) {
+        auto line = rope.template begin<Lines>() + (i * 7919) % count;
+        auto split = rope.splitBefore(line);
+        auto joined = get<0>(split).concat(get<1>(split));
+    }
+    double edit = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ops;
+    cout << label << ", " << build << ", " << edit << endl;
+}
+
+/**
+ *  Compare keeping separate code point and line ropes with one rope carrying both measures
+ */
+void multi_measure_bench()
+{
+    string text = bench_text(1 << 24);
+    uintptr_t ops = 2000;
+
+    cout << "variant, build ms, ns / edit" << endl;
+
+    {
+        clock_t start = clock();
+        PRope chars(text);
+        LineRope lines(text);
+        double build = (double)(clock() - start) / CLOCKS_PER_SEC * 1e3;
+
+        uintptr_t count = lines.measure().count;
+        start = clock();
+        for (uintptr_t i = 0; i < ops; ++i) {
+            auto line = lines.begin() + (i * 7919) % count;
+            auto at = chars.begin_items() + line.raw_index();
+            auto lsplit = lines.splitBefore(line);
+            auto csplit = chars.splitBefore(at);
+            auto ljoined = get<0>(lsplit).concat(get<1>(lsplit));
+            auto cjoined = get<0>(csplit).concat(get<1>(csplit));
+        }
+        double edit = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ops;
+        cout << "two ropes, " << build << ", " << edit << endl;
+    }
+
+    composite_edit_bench<CharLineRope, 1>("code point + line rope", text, ops);
+    composite_edit_bench<TextRope, Rope::TextMeasureLines>("text measure rope", text, ops);
+}
+
+/**
+ *  Split `text` into slices of `leaf` bytes sharing one storage vector
+ */
+vector<Rope::Slice<char>> leaf_slices(string const &text, uintptr_t leaf)
+{
+    auto storage = std::make_shared<vector<char>>(text.begin(), text.end());
+    vector<Rope::Slice<char>> slices;
+    for (uintptr_t i = 0; i + leaf <= storage->size(); i += leaf) {
+        slices.push_back(Rope::Slice<char>(storage, storage->begin() + i, storage->begin() + i + leaf));
+    }
+    return slices;
+}
+
+/**
+ *  Throughput of a measure's accumulation and indexing over 4 KiB leaves, for each instruction set and for the
+ *  original byte-at-a-time fold. Index targets are drawn from [targets / 2, targets).
+ */
+template<typename M>
+void kernel_bench(
+    M (*fold_measure)(char const *, uintptr_t),
+    uintptr_t (*fold_index)(char const *, uintptr_t, uintptr_t),
+    uintptr_t targets)
+{
+    uintptr_t leaf = 4096;
+    auto slices = leaf_slices(bench_text(1 << 26), leaf);
+    uintptr_t half = targets / 2;
+
+    auto report = [&](string const &label, clock_t elapsed, uintptr_t bytes, uintptr_t check) {
+        double seconds = (double)elapsed / CLOCKS_PER_SEC;
+        cout << label << ", " << (double)bytes / seconds / 1e9 << " GB/s (" << check << ")" << endl;
+    };
+
+    cout << "kernel, throughput" << endl;
+
+    uintptr_t check = 0;
+    clock_t start = clock();
+    for (auto &slice : slices) {
+        check += fold_measure(slice.data(), leaf).count;
+    }
+    report("accumulate fold", clock() - start, slices.size() * leaf, check);
+
+    check = 0;
+    start = clock();
+    for (auto &slice : slices) {
+        check += fold_index(slice.data(), leaf, half + check % half);
+    }
+    report("index fold", clock() - start, check, check);
+
+    char const *names[] = { "scalar", "sse2", "avx2" };
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
+        string label = names[isa];
+
+        check = 0;
+        start = clock();
+        for (auto &slice : slices) {
+            check += M::measure(slice).count;
+        }
+        report(label + " accumulate", clock() - start, slices.size() * leaf, check);
+
+        check = 0;
+        start = clock();
+        for (auto &slice : slices) {
+            check += M::index(slice, half + check % half);
+        }
+        report(label + " index", clock() - start, check, check);
+    }
+
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+}
+
+void utf8_kernel_bench()
+{
+    kernel_bench<UTF8Measure>(utf8_fold_measure, utf8_fold_index, 2000);
+}
+
+void line_kernel_bench()
+{
+    kernel_bench<Rope::LineMeasure>(line_fold_measure, line_fold_index, 70);
+}
+
+/**
+ *  The one-pass `TextMeasurePolicy` against the same components accumulated one pass each: throughput over
+ *  4 KiB leaves for each instruction set, and the split + concat latency of a rope of each
+ */
+void text_kernel_bench()
+{
+    using ComponentPolicy = Rope::CompositeMeasurePolicy<
+        Rope::BytesMeasurePolicy,
+        Rope::UTF8MeasurePolicy,
+        Rope::LineMeasurePolicy,
+        Rope::UTF16MeasurePolicy>;
+    using ComponentRope = Rope::Rope<char, ComponentPolicy>;
+
+    uintptr_t leaf = 4096;
+    string text = bench_text(1 << 26);
+    auto slices = leaf_slices(text, leaf);
+
+    cout << "accumulate, throughput" << endl;
+
+    char const *names[] = { "scalar", "sse2", "avx2" };
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
+        string label = names[isa];
+
+        uintptr_t check = 0;
+        clock_t start = clock();
+        for (auto &slice : slices) {
+            check += get<Rope::TextMeasureUTF16>(ComponentPolicy::accumulate(slice)).count;
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        cout << label << " per component, " << (double)(slices.size() * leaf) / seconds / 1e9 << " GB/s (" << check << ")" << endl;
+
+        check = 0;
+        start = clock();
+        for (auto &slice : slices) {
+            check += get<Rope::TextMeasureUTF16>(Rope::TextMeasurePolicy::accumulate(slice)).count;
+        }
+        seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        cout << label << " one pass, " << (double)(slices.size() * leaf) / seconds / 1e9 << " GB/s (" << check << ")" << endl;
+    }
+
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+
+    cout << "variant, build ms, ns / edit" << endl;
+    text = bench_text(1 << 24);
+    composite_edit_bench<ComponentRope, Rope::TextMeasureLines>("per component", text, 2000);
+    composite_edit_bench<TextRope, Rope::TextMeasureLines>("one pass", text, 2000);
+}
+
+/**
+ *  Seek latency, split + concat latency and memory overhead of one tree layout.
+ *  The rope is built over storage allocated beforehand, so the overhead counts only nodes, slices and measures.
+ */
+template<typename RopeType>
+void layout_bench(char const *label, string const &text)
+{
+    using Node = typename decltype(RopeType::rootNode)::element_type;
+
+    auto storage = std::make_shared<vector<char>>(text.begin(), text.end());
+    auto slice = std::make_shared<Rope::Slice<char>>(storage, storage->begin(), storage->end());
+
+    intptr_t bytes = allocated_bytes;
+    RopeType rope(std::make_shared<Node>(slice, typename RopeType::CallbacksType()));
+    bytes = allocated_bytes - bytes;
+
+    auto first = rope.begin_items();
+    first.push_to_leaf();
+
+    uintptr_t seeks = 200000;
+    uintptr_t count = rope.measure().count;
+    uintptr_t check = 0;
+    clock_t start = clock();
+    for (uintptr_t i = 0; i < seeks; ++i) {
+        check += *(rope.begin() + (i * 7919 * 7919) % count);
+    }
+    double point_seek = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / seeks;
+
+    start = clock();
+    for (uintptr_t i = 0; i < seeks; ++i) {
+        check += *(rope.begin_items() + (i * 7919 * 7919) % rope.size());
+    }
+    double item_seek = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / seeks;
+
+    uintptr_t ops = 2000;
+    start = clock();
+    for (uintptr_t i = 0; i < ops; ++i) {
+        auto split = rope.splitBefore(rope.begin_items() + (i * 7919 * 7919) % rope.size());
+        auto joined = get<0>(split).concat(get<1>(split));
+        check += joined.size();
+    }
+    double edit = (double)(clock() - start) / CLOCKS_PER_SEC * 1e9 / ops;
+
+    cout << label << ", " << rope.size() << ", " << first.nodes.size() << ", "
+         << (double)bytes / rope.size() << ", " << point_seek << ", " << item_seek << ", " << edit
+         << " (" << check % 10 << ")" << endl;
+}
+
+/**
+ *  Compare the binary tree with B+-trees of several fanouts
+ */
+void btree_bench()
+{
+    cout << "layout, bytes, depth, overhead bytes / byte, ns / code point seek, ns / byte seek, ns / split+concat" << endl;
+    for (uintptr_t size = 1 << 20; size <= 1 << 26; size <<= 6) {
+        string text = bench_text(size);
+        layout_bench<PRope>("binary", text);
+        layout_bench<BTreeRope<8>>("btree 8", text);
+        layout_bench<BTreeRope<16>>("btree 16", text);
+        layout_bench<BTreeRope<32>>("btree 32", text);
+        layout_bench<BTreeRope<64>>("btree 64", text);
+    }
+}
+
+/**
+ *  Allocations and time per split + concat and per balance. With `arenas`, the split + concats allocate from arenas.
+ */
+template<typename RopeType>
+void allocation_bench(char const *label, string const &text, bool arenas)
+{
+    RopeType rope(text);
+
+    // An unbalanced rope of short pieces for balance() to repack
+    RopeType pieces;
+    for (uintptr_t i = 0; i < 512; ++i) {
+        pieces = pieces.concat(RopeType(text.substr(i * 64, 64)));
+    }
+
+    // Temporary ropes are built and discarded in batches, each batch in a fresh arena when `arenas` is set
+    uintptr_t ops = 20000;
+    uintptr_t batch = 250;
+    uintptr_t check = 0;
+    uintptr_t allocations = allocation_count;
+    clock_t start = clock();
+    for (uintptr_t i = 0; i < ops; i += batch) {
+        std::unique_ptr<Rope::RopeArena> arena(arenas ? new Rope::RopeArena() : nullptr);
+        std::unique_ptr<Rope::RopeArena::Scope> scope(arenas ? new Rope::RopeArena::Scope(*arena) : nullptr);
+        for (uintptr_t j = i; j < i + batch; ++j) {
+            auto split = rope.splitBefore(rope.begin_items() + (j * 7919 * 7919) % rope.size());
+            check += get<0>(split).concat(get<1>(split)).size();
+        }
+    }
+    double edit = (double)(clock() - start) / CLOCKS_PER_SEC;
+    double edit_allocations = (double)(allocation_count - allocations) / ops;
+
+    uintptr_t balances = 200;
+    allocations = allocation_count;
+    start = clock();
+    for (uintptr_t i = 0; i < balances; ++i) {
+        RopeType balanced = pieces;
+        check += balanced.balance().size();
+    }
+    double balance = (double)(clock() - start) / CLOCKS_PER_SEC;
+    double balance_allocations = (double)(allocation_count - allocations) / balances;
+
+    cout << label << ", " << edit_allocations << ", " << ops / edit << ", "
+         << balance_allocations << ", " << balances / balance << " (" << check % 10 << ")" << endl;
+}
+
+/**
+ *  Compare shared_ptr ownership with the pooled allocator and arenas, for both node layouts
+ */
+void allocation_bench()
+{
+    string text = bench_text(1 << 22);
+
+    cout << "variant, allocations / split+concat, split+concat / s, allocations / balance, balance / s" << endl;
+    allocation_bench<PRope>("binary shared_ptr", text, false);
+    allocation_bench<PooledRope>("binary pool", text, false);
+    allocation_bench<PooledRope>("binary arena", text, true);
+    allocation_bench<BTreeRope<16>>("btree 16 shared_ptr", text, false);
+    allocation_bench<PooledBTreeRope<16>>("btree 16 pool", text, false);
+    allocation_bench<PooledBTreeRope<16>>("btree 16 arena", text, true);
+}
+
+/**
+ *  Scan a rope item by item and code point by code point, against a plain loop over its chunks, then copy it out in
+ *  bulk
+ */
+template<typename RopeType>
+void iteration_bench(char const *label, string const &text)
+{
+    RopeType rope(text);
+    rope.balance();
+    double megabytes = (double)rope.size() / (1 << 20);
+    uintptr_t check = 0;
+
+    clock_t start = clock();
+    for (auto it = rope.begin_items(), end = rope.end_items(); it < end; ++it) {
+        check += *it;
+    }
+    double items = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    uintptr_t points = 0;
+    for (auto it = rope.begin(), end = rope.end(); it < end; ++it, ++points) {
+        check += *it;
+    }
+    double by_point = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    rope.each_chunk([&](char const *s, uintptr_t l) {
+        for (uintptr_t i = 0; i < l; ++i) {
+            check += s[i];
+        }
+    });
+    double chunks = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    // Bulk copies of a middle range, and of the whole rope through a stream
+    uintptr_t copies = 20;
+    start = clock();
+    for (uintptr_t i = 0; i < copies; ++i) {
+        check += rope.to_string(i, rope.size() - i).size();
+    }
+    double copy = (double)(clock() - start) / CLOCKS_PER_SEC / copies;
+
+    start = clock();
+    ostringstream stream;
+    stream << rope;
+    check += stream.str().size();
+    double streamed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    cout << label << ", " << rope.size() << ", " << megabytes / items << ", " << points / by_point / 1e6 << ", "
+         << megabytes / chunks << ", " << megabytes / copy << ", " << megabytes / streamed
+         << " (" << check % 10 << ")" << endl;
+}
+
+/**
+ *  Sequential iteration throughput for both node layouts
+ */
+void iteration_bench()
+{
+    string text = bench_text(1 << 24);
+
+    cout << "variant, bytes, items MB / s, code points M / s, chunk loop MB / s, to_string MB / s, operator<< MB / s"
+         << endl;
+    iteration_bench<PRope>("binary", text);
+    iteration_bench<BTreeRope<16>>("btree 16", text);
+    iteration_bench<PooledBTreeRope<16>>("btree 16 pool", text);
+}
+
+/**
+ *  Time and heap growth to build a rope from a file: read into a string and copied, or mapped with `from_file`
+ */
+template<typename RopeType>
+void file_bench(char const *label, string const &path)
+{
+    intptr_t allocated = allocated_bytes;
+    clock_t start = clock();
+    {
+        string contents;
+        ifstream file(path);
+        string line;
+        while (getline(file, line)) {
+            contents += line;
+            contents += '\n';
+        }
+        RopeType rope(contents);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        cout << label << " read + copy, " << rope.size() << ", " << elapsed * 1000 << ", "
+             << (double)(allocated_bytes - allocated) / rope.size() << endl;
+    }
+
+    allocated = allocated_bytes;
+    start = clock();
+    RopeType rope = RopeType::from_file(path);
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+    cout << label << " from_file, " << rope.size() << ", " << elapsed * 1000 << ", "
+         << (double)(allocated_bytes - allocated) / rope.size() << endl;
+}
+
+void file_bench()
+{
+    string path = write_temporary(bench_text(1 << 26));
+
+    cout << "variant, bytes, ms, heap bytes / byte" << endl;
+    file_bench<PRope>("binary", path);
+    file_bench<BTreeRope<32>>("btree 32", path);
+
+    unlink(path.c_str());
+}
+
+template<typename RopeType>
+void build_bench(char const *label, string const &path, uintptr_t size, unsigned workers)
+{
+    Rope::ThreadPool pool(workers);
+    Rope::ThreadPool::Scope scope(pool);
+
+    uintptr_t rounds = 5;
+    uintptr_t check = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uintptr_t i = 0; i < rounds; ++i) {
+        check += RopeType::from_file(path).size();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(check == rounds * size);
+    cout << label << ", " << workers + 1 << ", " << size * rounds / elapsed.count() / 1e6 << endl;
+}
+
+void build_bench()
+{
+    uintptr_t size = 1 << 26;
+    string path = write_temporary(bench_text(size).substr(0, size));
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 4u);
+
+    cout << "variant, threads, MB/s" << endl;
+    for (unsigned workers = 0; workers < threads; workers = workers * 2 + 1) {
+        build_bench<PRope>("binary", path, size, workers);
+        build_bench<BTreeRope<32>>("btree 32", path, size, workers);
+        build_bench<TextRope>("text", path, size, workers);
+    }
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Latencies of random single-item inserts (split, then two concats) on a 16 MiB rope, relying on the joins to
+ *  stay balanced and, as before, also calling balance() after every edit
+ */
+void edit_bench()
+{
+    string text = bench_text(1 << 24);
+
+    cout << "variant, edits, depth, p50 us, p99 us, max us" << endl;
+    for (bool rebalance : { false, true }) {
+        PRope rope(text);
+        uintptr_t edits = rebalance ? 200 : 20000;
+        vector<double> latencies;
+        srand(5);
+        for (uintptr_t i = 0; i < edits; ++i) {
+            uintptr_t at = rand() % (rope.size() + 1);
+            auto start = std::chrono::steady_clock::now();
+            auto split = rope.splitBefore(rope.begin_items() + at);
+            rope = get<0>(split).concat(PRope(string("x"))).concat(get<1>(split));
+            if (rebalance) {
+                rope.balance();
+            }
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            latencies.push_back(elapsed.count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        cout << (rebalance ? "join + balance()" : "join") << ", " << edits << ", " << node_depth(rope.rootNode.get())
+             << ", " << latencies[edits / 2] << ", " << latencies[edits * 99 / 100] << ", " << latencies.back() << endl;
+    }
+}
+
+template<typename RopeType>
+void keystroke_bench(char const *label, string const &path)
+{
+    RopeType document = RopeType::from_file(path);
+    uintptr_t edits = 20000;
+    vector<uintptr_t> offsets;
+    srand(29);
+    for (uintptr_t i = 0; i < edits; ++i) {
+        offsets.push_back(((uintptr_t)rand() * RAND_MAX + rand()) % document.size());
+    }
+
+    for (int variant = 0; variant < 3; ++variant) {
+        RopeType rope = document;
+        uintptr_t allocations = allocation_count;
+        auto start = std::chrono::steady_clock::now();
+        for (uintptr_t i = 0; i < edits; ++i) {
+            uintptr_t at = offsets[i];
+            if (variant == 0) {
+                auto split = rope.splitBefore(rope.begin_items() + at);
+                rope = get<0>(split).concat(RopeType(string("x"))).concat(get<1>(split));
+            } else if (variant == 1) {
+                rope = rope.insert(at, "x");
+            } else {
+                rope = rope.erase(at, at + 1);
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        char const *name = variant == 0 ? "split + concat" : variant == 1 ? "insert" : "erase";
+        cout << label << ", " << name << ", " << elapsed.count() / edits << ", "
+             << (double)(allocation_count - allocations) / edits << ", "
+             << (intptr_t)rope.rootNode->weight - (intptr_t)document.rootNode->weight << endl;
+    }
+}
+
+/**
+ *  Single-item edits at random offsets of a 100 MiB document
+ */
+void keystroke_bench()
+{
+    string path = write_temporary(bench_text(100 << 20));
+
+    cout << "variant, edit, ns / edit, allocations / edit, leaves added" << endl;
+    keystroke_bench<PRope>("binary", path);
+    keystroke_bench<PooledRope>("binary pooled", path);
+    keystroke_bench<BTreeRope<32>>("btree 32", path);
+    keystroke_bench<PooledBTreeRope<32>>("btree 32 pooled", path);
+
+    unlink(path.c_str());
+}
+
+template<typename RopeType>
+void batch_bench(char const *label, RopeType const &document)
+{
+    for (uintptr_t count : { 10, 100, 10000 }) {
+        // Evenly spread keystrokes: inserts, deletes and replacements of an item
+        vector<Rope::RopeEdit<char>> edits;
+        for (uintptr_t i = 0; i < count; ++i) {
+            uintptr_t at = document.size() / count * i + (i * 7919) % (document.size() / count / 2);
+            edits.push_back(Rope::RopeEdit<char> { at, at + (i % 3 != 0), i % 3 == 1 ? "" : "x" });
+        }
+        uintptr_t rounds = std::max<uintptr_t>(20000 / count, 3);
+
+        for (int variant = 0; variant < 3; ++variant) {
+            auto start = std::chrono::steady_clock::now();
+            for (uintptr_t round = 0; round < rounds; ++round) {
+                RopeType rope = document;
+                if (variant == 2) {
+                    rope = rope.apply_edits(edits);
+                    continue;
+                }
+                // Back to front, so each edit's offsets still refer to the original items
+                for (auto it = edits.rbegin(); it != edits.rend(); ++it) {
+                    if (variant == 1) {
+                        rope = rope.replace(it->begin, it->end, it->items);
+                        continue;
+                    }
+                    auto head = rope.splitBefore(rope.begin_items() + it->begin);
+                    auto tail = get<1>(head).splitBefore(get<1>(head).begin_items() + (it->end - it->begin));
+                    rope = get<0>(head).concat(RopeType(it->items)).concat(get<1>(tail));
+                }
+            }
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            char const *name = variant == 0 ? "split + concat" : variant == 1 ? "replace" : "apply_edits";
+            cout << label << ", " << count << ", " << name << ", " << elapsed.count() / rounds << endl;
+        }
+    }
+}
+
+/**
+ *  Batches of sorted edits spread over a 16 MiB document, applied one by one and in a single pass
+ */
+void batch_bench()
+{
+    string text = bench_text(1 << 24);
+
+    cout << "variant, edits, method, us / batch" << endl;
+    batch_bench("binary", PRope(text));
+    batch_bench("btree 32", BTreeRope<32>(text));
+}
+
+template<typename MeasureType>
+void history_bench(char const *label, string const &path)
+{
+    using History = Rope::RopeHistory<char, MeasureType>;
+    using RopeType = typename History::RopeType;
+
+    uintptr_t versions = 10000;
+    intptr_t heap = allocated_bytes;
+    History history(RopeType::from_file(path));
+    uintptr_t document = history.current().size();
+    srand(41);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uintptr_t i = 0; i < versions; ++i) {
+        RopeType const &rope = history.current();
+        uintptr_t at = ((uintptr_t)rand() * RAND_MAX + rand()) % rope.size();
+        history.commit(i % 2 == 0 ? rope.insert(at, "x") : rope.erase(at, at + 1));
+    }
+    std::chrono::duration<double, std::micro> committing = std::chrono::steady_clock::now() - start;
+    double heap_per_version = (double)(allocated_bytes - heap) / versions;
+
+    start = std::chrono::steady_clock::now();
+    while (history.can_undo()) {
+        history.undo();
+    }
+    std::chrono::duration<double, std::nano> undoing = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (uintptr_t i = 0; i < versions; ++i) {
+        history.checkout(rand() % (versions + 1));
+    }
+    std::chrono::duration<double, std::nano> checking_out = std::chrono::steady_clock::now() - start;
+    history.checkout(versions);
+
+    start = std::chrono::steady_clock::now();
+    auto usage = history.usage();
+    std::chrono::duration<double, std::milli> measuring = std::chrono::steady_clock::now() - start;
+
+    cout << label << ", " << versions << ", " << document / 1e6 << ", " << usage.total / 1e6 << ", "
+         << usage.shared / 1e6 << ", " << (double)(usage.total - usage.shared) / versions << ", "
+         << heap_per_version << ", " << committing.count() / versions << ", " << undoing.count() / versions << ", "
+         << checking_out.count() / versions << ", " << measuring.count() << endl;
+
+    // Leave room for a quarter of what the older versions add to the latest one
+    uintptr_t latest = History(history.current()).usage().total;
+    for (auto pruning : { Rope::HistoryPruning::Coalesce, Rope::HistoryPruning::DropOldest }) {
+        History pruned = history;
+        uintptr_t budget = latest + (usage.total - latest) / 4;
+        start = std::chrono::steady_clock::now();
+        pruned.prune(budget, pruning);
+        std::chrono::duration<double, std::milli> pruning_time = std::chrono::steady_clock::now() - start;
+        cout << label << " prune " << (pruning == Rope::HistoryPruning::Coalesce ? "coalesce" : "drop oldest")
+             << " to " << budget / 1e6 << " MB, " << pruned.size() << " versions left, oldest "
+             << pruned.version_ids().front() << ", " << pruning_time.count() << " ms" << endl;
+    }
+}
+
+/**
+ *  Ten thousand single-item edits of a 50 MB file, each kept as a version
+ */
+void history_bench()
+{
+    string path = write_temporary(bench_text(50000000).substr(0, 50000000));
+
+    cout << "variant, versions, document MB, total MB, shared MB, unique bytes / version, heap bytes / version, "
+         << "us / edit + commit, ns / undo, ns / checkout, ms / usage" << endl;
+    history_bench<Rope::UTF8MeasurePolicy>("binary", path);
+    history_bench<Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>("binary pooled", path);
+    history_bench<Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 32>>("btree 32", path);
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Read random 4 KiB ranges of a document while one thread inserts into it, with the readers either holding a
+ *  mutex for each read, taking snapshots, or reading in place
+ */
+template<typename MeasureType>
+void concurrent_bench(char const *label, string const &text, unsigned readers, int method)
+{
+    using Concurrent = Rope::ConcurrentRope<char, MeasureType>;
+    using RopeType = typename Concurrent::RopeType;
+
+    Concurrent document((RopeType(text)));
+    RopeType locked_document(text);
+    std::mutex mutex;
+    std::atomic<bool> done(false);
+    std::atomic<uintptr_t> reads(0);
+    uintptr_t range = 4096;
+
+    auto scan = [range](RopeType const &rope, uint64_t &seed) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        uintptr_t begin = seed % (rope.size() - range);
+        uintptr_t lines = 0;
+        rope.each_chunk(begin, begin + range, [&lines](char const *items, uintptr_t count) {
+            lines += std::count(items, items + count, '\n');
+        });
+        return lines;
+    };
+
+    vector<std::thread> threads;
+    for (unsigned r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r] {
+            uint64_t seed = 0x9e3779b97f4a7c15 * (r + 1);
+            uintptr_t count = 0, lines = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                if (method == 0) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    lines += scan(locked_document, seed);
+                } else if (method == 1) {
+                    lines += scan(document.snapshot(), seed);
+                } else {
+                    lines += document.read([&](RopeType const &rope) { return scan(rope, seed); });
+                }
+                ++count;
+            }
+            reads += count + (lines == 0);
+        });
+    }
+
+    uintptr_t writes = 0;
+    srand(3);
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed(0);
+    while (elapsed.count() < 0.5) {
+        uintptr_t at = rand() % text.size();
+        if (method == 0) {
+            RopeType edited = [&] { std::lock_guard<std::mutex> lock(mutex); return locked_document; }().insert(at, "x");
+            std::lock_guard<std::mutex> lock(mutex);
+            locked_document = edited;
+        } else {
+            document.update([at](RopeType const &rope) { return rope.insert(at, "x"); });
+        }
+        ++writes;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    done = true;
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+
+    char const *name = method == 0 ? "mutex" : method == 1 ? "snapshot" : "read";
+    cout << label << ", " << name << ", " << readers << ", " << reads / elapsed.count() / 1e3 << ", "
+         << reads / elapsed.count() / 1e3 / readers << ", " << writes / elapsed.count() / 1e3 << endl;
+}
+
+void concurrent_bench()
+{
+    string text = bench_text(1 << 24);
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 4u);
+
+    cout << "variant, method, readers, k reads / s, k reads / s / reader, k writes / s" << endl;
+    for (unsigned readers = 1; readers <= threads; readers *= 2) {
+        for (int method = 0; method < 3; ++method) {
+            concurrent_bench<Rope::UTF8MeasurePolicy>("binary", text, readers, method);
+        }
+    }
+    for (unsigned readers = 1; readers <= threads; readers *= 2) {
+        concurrent_bench<Rope::PooledPolicy<Rope::UTF8MeasurePolicy>>("binary pooled", text, readers, 2);
+        concurrent_bench<Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 32>>("btree 32", text, readers, 2);
+    }
+}
+
+/**
+ *  Load a file, then read its first screen by offset, seek its first screen by code point, edit it, or measure
+ *  all of it, timing each from the load and counting the leaves measured
+ */
+template<typename Policy>
+void lazy_bench(char const *label, string const &path)
+{
+    using RopeType = Rope::Rope<char, Policy>;
+
+    for (int query = 0; query < 5; ++query) {
+        accumulate_count = 0;
+        auto start = std::chrono::steady_clock::now();
+        RopeType rope = RopeType::from_file(path);
+        string screen;
+        if (query == 1) {
+            screen = rope.to_string(0, 4000);
+        } else if (query == 2) {
+            auto first = rope.begin() + 2000;
+            screen = rope.to_string(first, first + 4000);
+        } else if (query == 3) {
+            srand(7);
+            for (uintptr_t i = 0; i < 1000; ++i) {
+                uintptr_t at = rand() % rope.size();
+                auto split = rope.splitBefore(rope.begin_items() + at);
+                rope = get<0>(split).concat(RopeType(string("x"))).concat(get<1>(split));
+            }
+        } else if (query == 4) {
+            rope.measure();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        char const *name = query == 0 ? "load" : query == 1 ? "first screen by offset"
+                         : query == 2 ? "first screen by code point" : query == 3 ? "1000 split + concat edits"
+                         : "measure all";
+        cout << label << ", " << name << ", " << elapsed.count() << ", " << accumulate_count << ", "
+             << rope.rootNode->weight << endl;
+    }
+}
+
+/**
+ *  Eager and lazy measures over a 100 MiB file
+ */
+void lazy_bench()
+{
+    string path = write_temporary(bench_text(100 << 20));
+    Rope::ThreadPool inline_pool(0);
+    Rope::ThreadPool::Scope scope(inline_pool);
+
+    cout << "variant, query, ms, leaves measured, leaves" << endl;
+    lazy_bench<CountingPolicy>("binary", path);
+    lazy_bench<Rope::LazyPolicy<CountingPolicy>>("binary lazy", path);
+    lazy_bench<Rope::BTreePolicy<CountingPolicy, 32>>("btree 32", path);
+    lazy_bench<Rope::BTreePolicy<Rope::LazyPolicy<CountingPolicy>, 32>>("btree 32 lazy", path);
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Allocations and time to balance a rope of 2^20 leaves, all slices of one shared piece of `leaf` items. Pieces of
+ *  at least half the leaf cap are kept as they are, and shorter ones are merged into full leaves first.
+ */
+template<typename RopeType>
+void balance_bench(char const *label, uintptr_t leaf)
+{
+    RopeType rope(bench_text(leaf).substr(0, leaf));
+    for (int i = 0; i < 20; ++i) {
+        rope = rope.concat(rope);
+    }
+
+    for (int run = 0; run < 3; ++run) {
+        RopeType balanced = rope;
+        uintptr_t allocations = allocation_count;
+        auto start = std::chrono::steady_clock::now();
+        balanced.balance();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        cout << label << ", " << rope.size() / rope.rootNode->weight << ", " << rope.rootNode->weight << ", " << balanced.rootNode->weight << ", "
+             << allocation_count - allocations << ", " << elapsed.count() << ", "
+             << node_depth(balanced.rootNode.get()) << endl;
+    }
+}
+
+void balance_bench()
+{
+    cout << "variant, leaf items, leaves, leaves after, allocations, ms, depth" << endl;
+    balance_bench<PRope>("binary shared_ptr", Rope::ROPE_GLOBAL_MAX_LEAF_CAP / 2 + 1);
+    balance_bench<PooledRope>("binary pool", Rope::ROPE_GLOBAL_MAX_LEAF_CAP / 2 + 1);
+    balance_bench<PRope>("binary shared_ptr", 64);
+    balance_bench<PooledRope>("binary pool", 64);
+}
+
+/**
+ *  Time the best of three calls to `f()`, printing its throughput over `bytes` bytes in GB/s
+ */
+template<typename F>
+void search_bench(string const &label, string const &query, uintptr_t bytes, F f)
+{
+    double best = 0;
+    uintptr_t result = 0;
+    for (int run = 0; run < 3; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        result = f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+    }
+    cout << label << ", " << query << ", " << best * 1000 << ", " << bytes / best / 1e9 << " (" << result << ")" << endl;
+}
+
+/**
+ *  Search a 1 GiB file-backed rope with each kernel, against memchr over the same leaves and std::string over a flat
+ *  copy. The needles are one that only occurs at the very end, and a near miss for every line of the text, whose
+ *  first and last bytes pass the prefilter once per line.
+ */
+void search_bench()
+{
+    string text = bench_text(1 << 30);
+    string line = text.substr(0, text.find('\n') + 1);
+    text += "Zebra crossing";
+    string path = write_temporary(text);
+
+    string end = "Zebra crossing";
+    string near_miss = line;
+    near_miss[near_miss.size() / 2] = '#';
+
+    cout << "variant, query, ms, GB/s" << endl;
+    PRope rope = PRope::from_file(path);
+    uintptr_t size = rope.size();
+    search_bench("memchr", "absent byte", size, [&] {
+        uintptr_t found = 0;
+        rope.each_chunk(0, size, [&](char const *items, uintptr_t count) {
+            found += memchr(items, '#', count) != nullptr;
+        });
+        return found;
+    });
+    search_bench("std::string", "find at end", size, [&] { return text.find(end); });
+    search_bench("std::string", "find near miss", size, [&] { return text.find(near_miss); });
+
+    char const *names[] = { "scalar", "sse2", "avx2" };
+    for (int isa = Rope::TextKernelScalar; isa <= Rope::best_text_kernel_isa(); ++isa) {
+        Rope::set_text_kernel_isa((Rope::TextKernelISA)isa);
+        search_bench(names[isa], "find at end", size, [&] { return rope.find(end); });
+        search_bench(names[isa], "find near miss", size, [&] { return rope.find(near_miss); });
+        search_bench(names[isa], "rfind near miss", size, [&] { return rope.rfind(near_miss); });
+        search_bench(names[isa], "find_all lines", size, [&] { return rope.find_all(line).size(); });
+    }
+    Rope::set_text_kernel_isa(Rope::best_text_kernel_isa());
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Checksum, count the words of and search a rope on `workers` threads besides the calling one
+ */
+template<typename RopeType>
+void parallel_bench(char const *label, RopeType const &rope, unsigned workers)
+{
+    Rope::ThreadPool pool(workers);
+    Rope::ThreadPool::Scope scope(pool);
+    string needle = "lazy dog";
+
+    for (int query = 0; query < 3; ++query) {
+        uintptr_t result = 0;
+        auto start = std::chrono::steady_clock::now();
+        if (query == 0) {
+            result = rope.parallel_reduce(0, rope.size(), Checksum::of, [](Checksum const &a, Checksum const &b) {
+                return a.then(b);
+            }).weighted;
+        } else if (query == 1) {
+            result = rope.parallel_reduce(0, rope.size(), WordCount::of, [](WordCount const &a, WordCount const &b) {
+                return a.then(b);
+            }).words;
+        } else {
+            result = rope.parallel_reduce(0, rope.size(), [&](char const *items, uintptr_t count) {
+                return Occurrences::of(needle, items, count);
+            }, [&](Occurrences const &a, Occurrences const &b) {
+                return a.then(needle, b);
+            }).count;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        char const *name = query == 0 ? "checksum" : query == 1 ? "word count" : "search";
+        cout << label << ", " << name << ", " << workers + 1 << ", " << elapsed.count() * 1000 << ", "
+             << rope.size() / elapsed.count() / 1e9 << " (" << result % 1000 << ")" << endl;
+    }
+}
+
+/**
+ *  Scaling of parallel reductions over a 1 GiB file-backed rope, from one thread up to one per core
+ */
+void parallel_bench()
+{
+    string path = write_temporary(bench_text(1 << 30));
+    PRope binary = PRope::from_file(path);
+    BTreeRope<32> btree = BTreeRope<32>::from_file(path);
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+    cout << "variant, query, threads, ms, GB/s" << endl;
+    for (unsigned threads = 1; threads <= cores; threads *= 2) {
+        parallel_bench("binary", binary, threads - 1);
+        parallel_bench("btree 32", btree, threads - 1);
+    }
+    if ((cores & (cores - 1)) != 0) {
+        parallel_bench("binary", binary, cores - 1);
+        parallel_bench("btree 32", btree, cores - 1);
+    }
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Compare ranges of two ropes chunk by chunk, copying the other rope's items out to compare each chunk against
+ */
+template<typename RopeType>
+bool chunk_equal(RopeType const &a, uintptr_t a_begin, RopeType const &b, uintptr_t b_begin, uintptr_t length)
+{
+    vector<char> buffer(Rope::ROPE_GLOBAL_MAX_LEAF_CAP);
+    bool equal = true;
+    uintptr_t offset = b_begin;
+    a.each_chunk(a_begin, a_begin + length, [&](char const *items, uintptr_t count) {
+        equal = equal && b.copy_to(buffer.data(), offset, offset + count) == count && memcmp(items, buffer.data(), count) == 0;
+        offset += count;
+    });
+    return equal;
+}
+
+/**
+ *  Build hashed ropes of 256 MiB, then compare whole ropes and 1 MiB ranges by hash against comparing their items.
+ *  The ropes compared are built separately, so they share no nodes, except for an edited copy which shares all but
+ *  one path.
+ */
+template<typename RopeType>
+RopeType hash_build_bench(char const *label, string const &text)
+{
+    auto start = std::chrono::steady_clock::now();
+    RopeType rope(text);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    cout << label << ", build, " << elapsed.count() << ", " << text.size() / elapsed.count() / 1e6 << " (" << rope.size() << ")" << endl;
+    return rope;
+}
+
+template<typename RopeType>
+void hash_bench(char const *label, string const &text)
+{
+    RopeType a = hash_build_bench<RopeType>(label, text);
+
+    RopeType b(text);
+    RopeType edited = a.replace(text.size() / 2, text.size() / 2 + 1, "#");
+    uintptr_t size = text.size(), range = 1 << 20;
+    uintptr_t shift = text.find('\n', range) + 1;
+    string name = label;
+    search_bench(name + " items", "whole, equal", size, [&] { return chunk_equal(a, 0, b, 0, size); });
+    search_bench(name + " hash", "whole, equal", size, [&] { return Rope::equal_ranges(a, 0, size, b, 0, size); });
+    search_bench(name + " items", "whole, one edit", size, [&] { return chunk_equal(a, 0, edited, 0, size); });
+    search_bench(name + " hash", "whole, one edit", size, [&] { return Rope::equal_ranges(a, 0, size, edited, 0, size); });
+
+    // Ranges at offsets a whole number of lines apart, so equal, but in different places relative to the leaves
+    uintptr_t ranges = 1000;
+    search_bench(name + " items", "1 MiB ranges", ranges * range, [&] {
+        uintptr_t equal = 0;
+        for (uintptr_t i = 0; i < ranges; ++i) {
+            uintptr_t at = (i * 7919 * 4099) % (size - range - shift);
+            equal += chunk_equal(a, at, b, at + shift, range);
+        }
+        return equal;
+    });
+    search_bench(name + " hash", "1 MiB ranges", ranges * range, [&] {
+        uintptr_t equal = 0;
+        for (uintptr_t i = 0; i < ranges; ++i) {
+            uintptr_t at = (i * 7919 * 4099) % (size - range - shift);
+            equal += Rope::equal_ranges(a, at, at + range, b, at + shift, at + shift + range);
+        }
+        return equal;
+    });
+}
+
+void hash_bench()
+{
+    string text = bench_text(1 << 28);
+
+    cout << "variant, query, ms, GB/s" << endl;
+    hash_build_bench<PRope>("binary unhashed", text);
+    hash_bench<Rope::Rope<char, Rope::HashedPolicy<Rope::UTF8MeasurePolicy>>>("binary", text);
+    hash_bench<HashedBTreeRope<32>>("btree 32", text);
+}
+
+/**
+ *  Compare 100 MB snapshots of a document: one version against the next, which differs in one line, and against a
+ *  copy built separately, which shares none of its nodes
+ */
+template<typename RopeType>
+void compare_bench(char const *label, string const &text)
+{
+    RopeType rope(text);
+    RopeType copy(text);
+    uintptr_t line = text.find('\n', text.size() / 2) + 1;
+    RopeType version = rope.replace(line, line + 10, "A new line");
+    uintptr_t size = text.size();
+    string name = label;
+    search_bench(name, "next version", size, [&] { return (uintptr_t)(rope.compare(version) < 0); });
+    search_bench(name, "same version", size, [&] { return (uintptr_t)(rope == rope); });
+    search_bench(name, "separate copy", size, [&] { return (uintptr_t)(rope == copy); });
+}
+
+void compare_bench()
+{
+    string text = bench_text(100 << 20);
+    string version = text;
+    uintptr_t line = text.find('\n', text.size() / 2) + 1;
+    version.replace(line, 10, "A new line");
+
+    cout << "variant, query, ms, GB/s" << endl;
+    search_bench("std::string", "next version", text.size(), [&] { return (uintptr_t)(text.compare(version) < 0); });
+    string copy = text;
+    search_bench("std::string", "separate copy", text.size(), [&] { return (uintptr_t)(text == copy); });
+    compare_bench<PRope>("binary", text);
+    compare_bench<BTreeRope<32>>("btree 32", text);
+}
+
+/**
+ *  Diff a 100 MB document against itself after a number of typing-sized edits, as saved versions sharing all but
+ *  the edited paths, and as a copy built separately that shares nothing
+ */
+template<typename RopeType>
+void diff_bench(char const *label, string const &text)
+{
+    RopeType rope(text);
+    srand(29);
+    for (uintptr_t edits : { 1, 10, 100, 1000 }) {
+        RopeType version = rope;
+        for (uintptr_t i = 0; i < edits; ++i) {
+            uintptr_t at = rand() % version.size();
+            version = version.replace(at, at + rand() % 8, "typed");
+        }
+        string query = std::to_string(edits) + " edits";
+        search_bench(label, query, text.size(), [&] { return Rope::diff(rope, version).size(); });
+        if (edits == 1) {
+            RopeType copy(version.to_string());
+            search_bench(label, query + ", unshared", text.size(), [&] { return Rope::diff(rope, copy).size(); });
+        }
+    }
+}
+
+void diff_bench()
+{
+    string text = bench_text(100 << 20);
+
+    cout << "variant, query, ms, GB/s" << endl;
+    diff_bench<PRope>("binary", text);
+    diff_bench<BTreeRope<32>>("btree 32", text);
+}
+
+/**
+ *  Time to open a 1 GB document: mapped with `from_file`, which measures every leaf, or loaded from a saved rope,
+ *  which reads the nodes' records and none of the items
+ */
+template<typename RopeType>
+void startup_bench(char const *label, string const &path)
+{
+    string saved = path + ".rope";
+    auto time = [](std::function<void ()> f) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    };
+
+    RopeType rope;
+    double mapping = time([&] { rope = RopeType::from_file(path); });
+    double saving = time([&] { rope.save(saved); });
+    intptr_t allocated = allocated_bytes;
+    RopeType loaded;
+    double loading = time([&] { loaded = RopeType::load(saved); });
+    assert(loaded.size() == rope.size());
+    cout << label << ", from_file, " << rope.rootNode->weight << ", " << mapping << endl;
+    cout << label << ", save, " << rope.rootNode->weight << ", " << saving << endl;
+    cout << label << ", load, " << loaded.rootNode->weight << ", " << loading << ", "
+         << (double)(allocated_bytes - allocated) / loaded.size() << endl;
+    unlink(saved.c_str());
+}
+
+void startup_bench()
+{
+    string path = write_temporary(bench_text(1 << 30));
+
+    cout << "variant, step, leaves, ms, heap bytes / byte" << endl;
+    startup_bench<PRope>("binary", path);
+    startup_bench<BTreeRope<32>>("btree 32", path);
+    startup_bench<TextRope>("text", path);
+
+    unlink(path.c_str());
+}
+
+/**
+ *  Ingest a 256 MB log into a rope: read line by line into a string that's then copied into the rope, or read a
+ *  block at a time by `RopeBuilder` from a file descriptor or an `istream`. Peak heap is the most held at once
+ *  while building, over the size of the input.
+ */
+template<typename Policy>
+void ingest_bench(char const *label, string const &path, uintptr_t size)
+{
+    using RopeType = Rope::Rope<char, Policy>;
+    using Builder = Rope::RopeBuilder<char, Policy>;
+    auto run = [&](char const *method, std::function<RopeType ()> build) {
+        intptr_t allocated = allocated_bytes;
+        peak_bytes = allocated;
+        auto start = std::chrono::steady_clock::now();
+        RopeType rope = build();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        assert(rope.size() == size);
+        cout << label << ", " << method << ", " << size / elapsed.count() / 1e6 << ", "
+             << (double)(peak_bytes - allocated) / size << ", " << (double)(allocated_bytes - allocated) / size << endl;
+    };
+
+    run("getline + string", [&] {
+        string contents;
+        ifstream file(path);
+        string line;
+        while (getline(file, line)) {
+            contents += line;
+            contents += '\n';
+        }
+        return RopeType(contents);
+    });
+    run("builder fd", [&] {
+        int fd = open(path.c_str(), O_RDONLY);
+        RopeType rope = Builder().read(fd).finish();
+        close(fd);
+        return rope;
+    });
+    run("builder istream", [&] {
+        ifstream file(path, std::ios::binary);
+        return Builder().read(file).finish();
+    });
+}
+
+void ingest_bench()
+{
+    uintptr_t size = 1 << 28;
+    string path = write_temporary(bench_text(size).substr(0, size));
+
+    cout << "variant, method, MB/s, peak heap bytes / byte, heap bytes / byte" << endl;
+    ingest_bench<Rope::UTF8MeasurePolicy>("binary", path, size);
+    ingest_bench<Rope::BTreePolicy<Rope::UTF8MeasurePolicy, 32>>("btree 32", path, size);
+    ingest_bench<Rope::TextMeasurePolicy>("text", path, size);
+
+    unlink(path.c_str());
+}
+
+struct Benchmark {
+    char const *name;
+    void (*run)();
+};
+
+static Benchmark benchmarks[] = {
+    { "policy", policy_bench },
+    { "multi", multi_measure_bench },
+    { "utf8", utf8_kernel_bench },
+    { "lines", line_kernel_bench },
+    { "text", text_kernel_bench },
+    { "btree", btree_bench },
+    { "alloc", allocation_bench },
+    { "iter", iteration_bench },
+    { "file", file_bench },
+    { "build", build_bench },
+    { "edit", edit_bench },
+    { "keystroke", keystroke_bench },
+    { "batch", batch_bench },
+    { "history", history_bench },
+    { "concurrent", concurrent_bench },
+    { "lazy", lazy_bench },
+    { "balance", balance_bench },
+    { "search", search_bench },
+    { "parallel", parallel_bench },
+    { "hash", hash_bench },
+    { "compare", compare_bench },
+    { "diff", diff_bench },
+    { "startup", startup_bench },
+    { "ingest", ingest_bench },
+};
+
+int main(int argc, char **argv)
+{
+    // file_speed_test(argc, argv);
+    
+    // speed_test();
+
+    if (argc > 1) {
+        for (auto &bench : benchmarks) {
+            if (string(argv[1]) == bench.name) {
+                bench.run();
+                return 0;
+            }
+        }
+        cerr << "Unknown benchmark " << argv[1] << endl;
+        return 1;
+    }
 
     run_tests();
 }
@@ -0,0 +1,54 @@
+#import "mapped_file.hpp"
+
+#import <system_error>
+#import <cerrno>
+
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/mman.h>
+#import <sys/stat.h>
+
+namespace Rope {
+
+    std::shared_ptr<MappedFile> MappedFile::open(std::string const &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+
+        size_t length = (size_t)info.st_size;
+        void *bytes = nullptr;
+        if (length > 0) {
+            bytes = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (bytes == MAP_FAILED) {
+                int error = errno;
+                close(fd);
+                throw std::system_error(error, std::generic_category(), path);
+            }
+        }
+
+        // The mapping outlives the descriptor
+        close(fd);
+        return std::shared_ptr<MappedFile>(new MappedFile(static_cast<char const *>(bytes), length));
+    }
+
+    MappedFile::MappedFile(char const *bytes, size_t length)
+    :   bytes(bytes),
+        length(length)
+    {}
+
+    MappedFile::~MappedFile()
+    {
+        if (bytes != nullptr) {
+            munmap(const_cast<char *>(bytes), length);
+        }
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef ROPE_MAPPED_FILE_H
+#define ROPE_MAPPED_FILE_H
+
+#import <memory>
+#import <string>
+#import <cstddef>
+
+namespace Rope {
+
+    /**
+     *  A file mapped read-only into memory, unmapped when the last reference goes.
+     *  Slices over the mapping hold a reference, so a rope built over a file keeps it mapped.
+     */
+    class MappedFile {
+    public:
+        /**
+         *  Map the file at `path`. Throws `std::system_error` if it can't be opened or mapped.
+         */
+        static std::shared_ptr<MappedFile> open(std::string const &path);
+
+        ~MappedFile();
+
+        MappedFile(MappedFile const &) = delete;
+        MappedFile &operator=(MappedFile const &) = delete;
+
+        /**
+         *  The mapped bytes, or null for an empty file
+         */
+        char const *data() const { return bytes; }
+
+        size_t size() const { return length; }
+
+    private:
+        MappedFile(char const *bytes, size_t length);
+
+        char const *bytes;
+        size_t length;
+    };
+};
+
+#endif // ROPE_MAPPED_FILE_H
@@ -2,10 +2,22 @@
 #define ROPE_MEASURE_H
 
 #import <functional>
+#import <memory>
+#import <type_traits>
+#import <tuple>
+#import <atomic>
+#import <new>
+#import <thread>
+#import <string>
+#import <utility>
+#import <cstring>
+#import <cstdint>
 
 #import "slice.hpp"
+#import "allocation.hpp"
 
 using std::function;
+using std::shared_ptr;
 
 namespace Rope {
 
@@ -16,6 +28,7 @@ namespace Rope {
     class MeasureCallbacks
     {
     public:
+        using measure_type = M;
         using joinf_type = function<M (M const &, M const &)>;
         using identityf_type = function<M ()>;
         using accumulatef_type = function<M (const Slice<T> &)>;
@@ -131,6 +144,421 @@ namespace Rope {
     public:
         virtual ~Measure<T>() {}
     };
+
+    /**
+     *  Base class for compile-time measure policies.
+     *
+     *  A policy provides the operations of both `MeasureCallbacks` and `IteratorCallbacks` as static members, so a
+     *  `Rope<Item, Policy>` resolves them at compile time instead of calling through `std::function`:
+     *
+     *      using measure_type = ...;
+     *      static measure_type join(measure_type const &, measure_type const &);
+     *      static measure_type identity();
+     *      static measure_type accumulate(Slice<T> const &);
+     *      static uintptr_t    index(Slice<T> const &, uintptr_t);
+     *      static uintptr_t    predicate(measure_type const &);
+     *
+     *  Policies are empty, so a default-constructed instance is passed wherever callbacks are expected.
+     *  `measure_type` must not be `uintptr_t`, which is reserved for iterating by item.
+     *
+     *  A policy may also declare `static constexpr bool incremental_index = true` when `index` can resume from an
+     *  earlier result: `index(s, a + b) == index(s, a) + index(rest of s from index(s, a), b)`. Iterators then step
+     *  through a leaf without rescanning it from the start.
+     *
+     *  A policy may also keep its measures in saved ropes (see `Rope::save`) by declaring
+     *
+     *      static void         serialize(measure_type const &, std::string &out);  // appends the measure's bytes
+     *      static measure_type deserialize(char const *&in);                       // reads one and steps past it
+     *
+     *  The leaves of ropes whose policy doesn't are measured again when they're loaded.
+     */
+    struct MeasurePolicy {};
+
+    template<typename T>
+    struct __MeasureVoid
+    {
+        using type = void;
+    };
+
+    /**
+     *  Whether a policy declares `incremental_index` (see `MeasurePolicy`)
+     */
+    template<typename P, typename = void>
+    struct __MeasureIncrementalIndex : std::false_type {};
+
+    template<typename P>
+    struct __MeasureIncrementalIndex<P, typename __MeasureVoid<decltype(P::incremental_index)>::type>
+    :   std::integral_constant<bool, P::incremental_index> {};
+
+    /**
+     *  Whether a policy declares `serialize` and `deserialize` (see `MeasurePolicy`)
+     */
+    template<typename P, typename = void>
+    struct __MeasureSerialized : std::false_type {};
+
+    template<typename P>
+    struct __MeasureSerialized<P, typename __MeasureVoid<decltype(P::deserialize(std::declval<char const *&>()))>::type>
+    :   std::true_type {};
+
+    /**
+     *  Append the bytes of a trivially copyable value to a serialized measure
+     */
+    template<typename T>
+    void __measureWrite(std::string &out, T const &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are written as bytes");
+        out.append(reinterpret_cast<char const *>(&value), sizeof(T));
+    }
+
+    /**
+     *  Read a value written by `__measureWrite`, stepping past it
+     */
+    template<typename T>
+    void __measureRead(char const *&in, T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain fields are read as bytes");
+        memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+    }
+
+    template<bool... B>
+    struct __MeasureBools {};
+
+    /**
+     *  Whether every one of `B` is true
+     */
+    template<bool... B>
+    struct __MeasureAll : std::is_same<__MeasureBools<true, B...>, __MeasureBools<B..., true>> {};
+
+    /**
+     *  Lifts a measure class with static `add`, `identity`, `accumulate`, `index` and `getCount` members
+     *  (such as `UTF8Measure`) into a measure policy.
+     */
+    template<typename M, typename T>
+    struct StaticMeasurePolicy : public MeasurePolicy
+    {
+        using measure_type = shared_ptr<M>;
+
+        static measure_type join(measure_type const &lhs, measure_type const &rhs) { return M::add(lhs, rhs); }
+        static measure_type identity() { return M::identity(); }
+        static measure_type accumulate(Slice<T> const &slice) { return M::accumulate(slice); }
+        static uintptr_t index(Slice<T> const &slice, uintptr_t target) { return M::index(slice, target); }
+        static uintptr_t predicate(measure_type const &m) { return M::getCount(m); }
+    };
+
+    /**
+     *  Policy used to iterate over a rope item by item
+     */
+    template<typename T>
+    struct ItemPolicy : public MeasurePolicy
+    {
+        using measure_type = uintptr_t;
+
+        static uintptr_t index(Slice<T> const &slice, uintptr_t target)
+        {
+            uintptr_t size = slice.size();
+            return target < size ? target : size;
+        }
+
+        static uintptr_t predicate(uintptr_t const &size) { return size; }
+    };
+
+    template<size_t... I>
+    struct __MeasureIndices {};
+
+    template<size_t N, size_t... I>
+    struct __MakeMeasureIndices : __MakeMeasureIndices<N - 1, N - 1, I...> {};
+
+    template<size_t... I>
+    struct __MakeMeasureIndices<0, I...>
+    {
+        using type = __MeasureIndices<I...>;
+    };
+
+    /**
+     *  Selects component `I` of a `CompositeMeasurePolicy` when iterating (e.g.: `rope.begin<I>()`)
+     */
+    template<size_t I>
+    struct MeasureComponent {};
+
+    /**
+     *  A measure policy made of several other policies, whose measures are stored together as a tuple.
+     *
+     *  Every component is accumulated from the same leaf slice and joined field by field, so one rope can be
+     *  seeked in any of the components' coordinates. Each component scans the slice again; a policy whose
+     *  components can be counted in one pass may derive from this one and replace `accumulate` (see
+     *  `TextMeasurePolicy`).
+     *
+     *  Iterating the rope without a selector uses the first component. Measures are serialized if every
+     *  component's are.
+     */
+    template<typename... Policies>
+    struct CompositeMeasurePolicy : public MeasurePolicy
+    {
+    private:
+        using Components = std::tuple<Policies...>;
+        using Primary = typename std::tuple_element<0, Components>::type;
+        using Indices = typename __MakeMeasureIndices<sizeof...(Policies)>::type;
+
+    public:
+        using measure_type = std::tuple<typename Policies::measure_type...>;
+
+        template<size_t I>
+        using component = typename std::tuple_element<I, Components>::type;
+
+        static constexpr bool incremental_index = __MeasureIncrementalIndex<Primary>::value;
+
+        static measure_type join(measure_type const &lhs, measure_type const &rhs)
+        {
+            return join(lhs, rhs, Indices());
+        }
+
+        static measure_type identity()
+        {
+            return measure_type(Policies::identity()...);
+        }
+
+        template<typename T>
+        static measure_type accumulate(Slice<T> const &slice)
+        {
+            return measure_type(Policies::accumulate(slice)...);
+        }
+
+        template<typename T>
+        static uintptr_t index(Slice<T> const &slice, uintptr_t target)
+        {
+            return Primary::index(slice, target);
+        }
+
+        static uintptr_t predicate(measure_type const &m)
+        {
+            return Primary::predicate(std::get<0>(m));
+        }
+
+        template<bool Serialized = __MeasureAll<__MeasureSerialized<Policies>::value...>::value>
+        static typename std::enable_if<Serialized>::type serialize(measure_type const &m, std::string &out)
+        {
+            serialize(m, out, Indices());
+        }
+
+        /**
+         *  Components are read in order: a braced list evaluates its elements left to right
+         */
+        template<bool Serialized = __MeasureAll<__MeasureSerialized<Policies>::value...>::value>
+        static typename std::enable_if<Serialized, measure_type>::type deserialize(char const *&in)
+        {
+            return measure_type { Policies::deserialize(in)... };
+        }
+
+    private:
+        template<size_t... I>
+        static measure_type join(measure_type const &lhs, measure_type const &rhs, __MeasureIndices<I...>)
+        {
+            return measure_type(Policies::join(std::get<I>(lhs), std::get<I>(rhs))...);
+        }
+
+        template<size_t... I>
+        static void serialize(measure_type const &m, std::string &out, __MeasureIndices<I...>)
+        {
+            int written[] = { (component<I>::serialize(std::get<I>(m), out), 0)... };
+            (void)written;
+        }
+    };
+
+    /**
+     *  The allocation policy named by a measure policy's `allocation_type` (see `PooledPolicy`), or
+     *  `SharedAllocation` if it doesn't name one
+     */
+    template<typename P, typename = void>
+    struct __MeasureAllocation
+    {
+        using type = SharedAllocation;
+    };
+
+    template<typename P>
+    struct __MeasureAllocation<P, typename __MeasureVoid<typename P::allocation_type>::type>
+    {
+        using type = typename P::allocation_type;
+    };
+
+    /**
+     *  Wraps a measure policy so each node computes its measure the first time it's read, rather than when it's
+     *  built (e.g.: `Rope<char, LazyPolicy<UTF8MeasurePolicy>>`).
+     *
+     *  Building, splitting and editing a rope then never measure anything, and neither does reading or seeking it
+     *  by item. Reading a node's measure measures the subtree below it, once: seeking by measure measures the
+     *  subtrees it passes on the way down, and `measure()` measures the whole rope. Nodes shared between threads
+     *  may be measured from any of them.
+     */
+    template<typename Policy>
+    struct LazyPolicy : public Policy
+    {
+        static constexpr bool lazy_measure = true;
+    };
+
+    /**
+     *  Whether a policy declares `lazy_measure` (see `LazyPolicy`)
+     */
+    template<typename P, typename = void>
+    struct __MeasureLazy : std::false_type {};
+
+    template<typename P>
+    struct __MeasureLazy<P, typename __MeasureVoid<decltype(P::lazy_measure)>::type>
+    :   std::integral_constant<bool, P::lazy_measure> {};
+
+    /**
+     *  Wraps a measure policy so each node also keeps a polynomial hash of its items, alongside its measure
+     *  (e.g.: `Rope<char, HashedPolicy<UTF8MeasurePolicy>>`). Ranges of such ropes can then be hashed, and compared
+     *  with ranges of any other hashed rope, in time logarithmic in their length (see `Rope::hash`).
+     *
+     *  Hashes are found when nodes are built, even under `LazyPolicy`, so building a leaf reads its items once more.
+     */
+    template<typename Policy>
+    struct HashedPolicy : public Policy
+    {
+        static constexpr bool hashed = true;
+    };
+
+    /**
+     *  Whether a policy declares `hashed` (see `HashedPolicy`)
+     */
+    template<typename P, typename = void>
+    struct __MeasureHashed : std::false_type {};
+
+    template<typename P>
+    struct __MeasureHashed<P, typename __MeasureVoid<decltype(P::hashed)>::type>
+    :   std::integral_constant<bool, P::hashed> {};
+
+    /**
+     *  A node's measure, set when the node is built
+     */
+    template<typename M, bool Lazy>
+    class __MeasureCell
+    {
+    public:
+        __MeasureCell() : value() {}
+
+        bool ready() const { return true; }
+
+        M const &get() const { return value; }
+
+        void set(M const &measure) { value = measure; }
+
+    private:
+        M value;
+    };
+
+    /**
+     *  A node's measure, computed on first use.
+     *
+     *  The first thread to ask computes it; any other thread asking meanwhile waits for it rather than computing
+     *  it again. A cell's measure only depends on the cells below it, so waiting can't deadlock.
+     */
+    template<typename M>
+    class __MeasureCell<M, true>
+    {
+    public:
+        __MeasureCell() : state(Empty) {}
+
+        __MeasureCell(__MeasureCell const &other)
+        :   state(Empty)
+        {
+            if (other.state.load(std::memory_order_acquire) == Ready) {
+                set(*other.value());
+            }
+        }
+
+        ~__MeasureCell()
+        {
+            if (state.load(std::memory_order_relaxed) == Ready) {
+                value()->~M();
+            }
+        }
+
+        __MeasureCell &operator=(__MeasureCell const &) = delete;
+
+        bool ready() const { return state.load(std::memory_order_acquire) == Ready; }
+
+        /**
+         *  The measure, calling `compute()` for it if no thread has yet
+         */
+        template<typename F>
+        M const &get(F const &compute) const
+        {
+            while (state.load(std::memory_order_acquire) != Ready) {
+                uint8_t expected = Empty;
+                if (state.compare_exchange_weak(expected, Computing, std::memory_order_acquire)) {
+                    try {
+                        new (&storage) M(compute());
+                    } catch (...) {
+                        state.store(Empty, std::memory_order_release);
+                        throw;
+                    }
+                    state.store(Ready, std::memory_order_release);
+                } else if (expected == Computing) {
+                    std::this_thread::yield();
+                }
+            }
+            return *value();
+        }
+
+        /**
+         *  Set the measure of a node no other thread can see yet
+         */
+        void set(M const &measure)
+        {
+            if (state.load(std::memory_order_relaxed) == Ready) {
+                value()->~M();
+            }
+            new (&storage) M(measure);
+            state.store(Ready, std::memory_order_release);
+        }
+
+    private:
+        enum : uint8_t { Empty, Computing, Ready };
+
+        M *value() const { return reinterpret_cast<M *>(&storage); }
+
+        mutable std::atomic<uint8_t> state;
+        mutable typename std::aligned_storage<sizeof(M), alignof(M)>::type storage;
+    };
+
+    /**
+     *  Resolves how a rope's second template parameter is used.
+     *  A plain measure type is stored through `shared_ptr` and driven by runtime callbacks;
+     *  a `MeasurePolicy` stores its own `measure_type` and is its own callbacks type, and may be measured lazily.
+     */
+    template<typename M, typename T, bool = std::is_base_of<MeasurePolicy, M>::value>
+    struct MeasureTraits
+    {
+        using measure_type = shared_ptr<M>;
+        using value_type = M;
+        using callbacks_type = MeasureCallbacks<measure_type, T>;
+        using iterator_callbacks_type = IteratorCallbacks<measure_type, T>;
+        using allocation_type = SharedAllocation;
+
+        static constexpr bool lazy_measure = false;
+        static constexpr bool hashed = false;
+        static constexpr bool serialized = false;
+
+        static value_type const &value(measure_type const &m) { return *m; }
+    };
+
+    template<typename P, typename T>
+    struct MeasureTraits<P, T, true>
+    {
+        using measure_type = typename P::measure_type;
+        using value_type = measure_type;
+        using callbacks_type = P;
+        using iterator_callbacks_type = P;
+        using allocation_type = typename __MeasureAllocation<P>::type;
+
+        static constexpr bool lazy_measure = __MeasureLazy<P>::value;
+        static constexpr bool hashed = __MeasureHashed<P>::value;
+        static constexpr bool serialized = __MeasureSerialized<P>::value;
+
+        static value_type const &value(measure_type const &m) { return m; }
+    };
 };
 
 #endif // ROPE_MEASURE_H
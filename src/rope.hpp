@@ -3,8 +3,18 @@
 
 #import <memory>
 #import <functional>
+#import <algorithm>
+#import <string>
+#import <vector>
+#import <cstdint>
 
 #import "rope_node.hpp"
+#import "rope_btree_node.hpp"
+#import "mapped_file.hpp"
+#import "rope_search.hpp"
+#import "rope_hash.hpp"
+#import "rope_compare.hpp"
+#import "rope_file.hpp"
 
 using std::shared_ptr;
 using std::function;
@@ -23,41 +33,304 @@ namespace Rope {
     private:
         using This     = Rope<Item, MeasureType>;
         using NodeType = RopeNode<Item, MeasureType>;
+        using Traits   = MeasureTraits<MeasureType, Item>;
+        using Allocation = typename Traits::allocation_type;
         
     public:
-        using MeasureIterType = MeasureIterator<Item, MeasureType, shared_ptr<MeasureType>>;
+        using NodePtr = typename Allocation::template pointer<NodeType>;
+        using MeasureStorage = typename Traits::measure_type;
+        using MeasureIterType = MeasureIterator<Item, MeasureType, MeasureStorage>;
         using ItemIterType = MeasureIterator<Item, MeasureType, uintptr_t>;
-        using CallbacksType = MeasureCallbacks<shared_ptr<MeasureType>, Item>;
-        using PredicateType = function<uintptr_t (const shared_ptr<MeasureType> &)>;
+        using CallbacksType = typename Traits::callbacks_type;
+        using IterCallbacksType = typename MeasureIterType::CallbacksType;
+        using PredicateType = function<uintptr_t (const MeasureStorage &)>;
 
-        shared_ptr<NodeType> rootNode;
+        template<size_t I>
+        using ComponentIterType = MeasureIterator<Item, MeasureType, MeasureComponent<I>>;
+
+        NodePtr rootNode;
         
-        Rope<Item, MeasureType>(CallbacksType const &callbacks)
-        :   rootNode(make_shared<NodeType>(callbacks))
+        /**
+         *  Construct an empty rope. Callbacks may be omitted when `MeasureType` is a `MeasurePolicy`.
+         */
+        Rope<Item, MeasureType>(CallbacksType const &callbacks = CallbacksType())
+        :   rootNode(Allocation::template make<NodeType>(callbacks))
         {}
         
         template<typename Container>
-        Rope<Item, MeasureType>(Container const &other, CallbacksType const &callbacks)
-        :   rootNode(make_shared<NodeType>(other, callbacks))
+        Rope<Item, MeasureType>(Container const &other, CallbacksType const &callbacks = CallbacksType())
+        :   rootNode(Allocation::template make<NodeType>(other, callbacks))
         {}
         
-        Rope<Item, MeasureType>(shared_ptr<NodeType> const &root)
+        Rope<Item, MeasureType>(NodePtr const &root)
         :   rootNode(root)
         {}
+
+        /**
+         *  Build a rope over the contents of the file at `path` without copying them.
+         *  The file is mapped read-only and the leaves point into the mapping, which stays mapped while any rope
+         *  refers to it; edits only copy the leaves they change. Throws `std::system_error` if the file can't be
+         *  opened or mapped.
+         */
+        static This from_file(std::string const &path, CallbacksType const &callbacks = CallbacksType())
+        {
+            auto file = MappedFile::open(path);
+            Item const *items = reinterpret_cast<Item const *>(file->data());
+            uintptr_t count = file->size() / sizeof(Item);
+            auto slice = Allocation::template make<Slice<Item>>(file, items, items + count);
+            return This(Allocation::template make<NodeType>(slice, callbacks));
+        }
         
+        /**
+         *  Load a rope written by `save`, mapping the file read-only as `from_file` does.
+         *
+         *  The tree is rebuilt node for node, with the measures of its leaves read from the file if the policy
+         *  serializes them (see `MeasurePolicy`), so no items are read and the time taken depends on the number of
+         *  nodes rather than their contents. Leaves are measured again if the rope was saved without measures, and
+         *  hashed again for hashed ropes, as hashes differ between processes. Throws `std::system_error` if the file
+         *  can't be opened or mapped, and `std::runtime_error` if it isn't a rope saved with the same item type and
+         *  node layout.
+         */
+        static This load(std::string const &path, CallbacksType const &callbacks = CallbacksType())
+        {
+            return This(__ropeLoad<Item, NodeType>(path, callbacks));
+        }
+
+        /**
+         *  Save the rope to `path` in a single sequential pass, each shared subtree once (see `__RopeFileTrailer`).
+         *  The file is written beside `path` and renamed over it, so a rope loaded from `path` may be saved back
+         *  there. Throws `std::system_error` if it can't be written.
+         */
+        void save(std::string const &path) const
+        {
+            __ropeSave<Item>(rootNode.get(), path);
+        }
+
         uintptr_t size() const {
             return rootNode->size;
         }
         
-        MeasureType const &measure() const {
-            return *rootNode->measure;
+        typename Traits::value_type const &measure() const {
+            return Traits::value(rootNode->measure());
         }
 
         void each_chunk(std::function<void (Item const *s, uintptr_t l)> f) {
             rootNode->each_chunk(f);
         }
 
-        MeasureIterType begin(typename MeasureIterType::CallbacksType const &callbacks) const
+        /**
+         *  Call `f(items, count)` with the items at offsets [begin, end), one span per leaf, without allocating.
+         *  The range is clamped to the rope.
+         */
+        template<typename F>
+        void each_chunk(uintptr_t begin, uintptr_t end, F f) const
+        {
+            end = std::min(end, size());
+            if (begin < end) {
+                rootNode->each_chunk(begin, end, f);
+            }
+        }
+
+        template<typename IterMeasureType, typename F>
+        void each_chunk(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end,
+            F f) const
+        {
+            each_chunk(begin.raw_index(), end.raw_index(), f);
+        }
+
+        /**
+         *  Map each chunk of the items at offsets [begin, end) with `map(items, count)`, and combine the results in
+         *  order with `combine(lhs, rhs)`. Ranges of more than `grain` items are split along the tree's branches and
+         *  reduced in parallel on the current `ThreadPool`.
+         *
+         *  `combine` must be associative for the result not to depend on the rope's shape, but it needn't be
+         *  commutative: the result is the same however the work was scheduled. `map` is also called with empty
+         *  chunks, whose results must leave what they're combined with unchanged; an empty range gives one.
+         */
+        template<typename Map, typename Combine>
+        auto parallel_reduce(
+            uintptr_t begin,
+            uintptr_t end,
+            Map map,
+            Combine combine,
+            uintptr_t grain = ROPE_GLOBAL_PARALLEL_MIN_LEAVES * ROPE_GLOBAL_MAX_LEAF_CAP) const
+            -> decltype(map(static_cast<Item const *>(nullptr), uintptr_t()))
+        {
+            using Result = decltype(map(static_cast<Item const *>(nullptr), uintptr_t()));
+            end = std::min(end, size());
+            if (begin >= end) {
+                return map(nullptr, 0);
+            }
+            auto chunk = [&map](Item const *items, uintptr_t count, uintptr_t) { return map(items, count); };
+            return rootNode->template reduce_chunks<Result>(begin, end, 0, chunk, combine, ThreadPool::current(), grain);
+        }
+
+        /**
+         *  Call `f(items, count, offset)` for each chunk of the items at offsets [begin, end), where `offset` is that
+         *  of `items` in the rope. Ranges of more than `grain` items are split along the tree's branches and visited
+         *  in parallel on the current `ThreadPool`, so `f` may be called concurrently and in any order.
+         */
+        template<typename F>
+        void parallel_for_each_chunk(
+            uintptr_t begin,
+            uintptr_t end,
+            F f,
+            uintptr_t grain = ROPE_GLOBAL_PARALLEL_MIN_LEAVES * ROPE_GLOBAL_MAX_LEAF_CAP) const
+        {
+            end = std::min(end, size());
+            if (begin >= end) {
+                return;
+            }
+            auto chunk = [&f](Item const *items, uintptr_t count, uintptr_t offset) {
+                if (count > 0) {
+                    f(items, count, offset);
+                }
+                return true;
+            };
+            auto combine = [](bool, bool) { return true; };
+            rootNode->template reduce_chunks<bool>(begin, end, 0, chunk, combine, ThreadPool::current(), grain);
+        }
+
+        /**
+         *  Copy the items at offsets [begin, end) to `out`, returning the number copied
+         */
+        uintptr_t copy_to(Item *out, uintptr_t begin, uintptr_t end) const
+        {
+            Item *cursor = out;
+            each_chunk(begin, end, [&cursor](Item const *items, uintptr_t count) {
+                cursor = std::copy(items, items + count, cursor);
+            });
+            return cursor - out;
+        }
+
+        template<typename IterMeasureType>
+        uintptr_t copy_to(
+            Item *out,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end) const
+        {
+            return copy_to(out, begin.raw_index(), end.raw_index());
+        }
+
+        std::basic_string<Item> to_string(uintptr_t begin, uintptr_t end) const
+        {
+            end = std::min(end, size());
+            std::basic_string<Item> ret(begin < end ? end - begin : 0, Item());
+            copy_to(&ret[0], begin, end);
+            return ret;
+        }
+
+        template<typename IterMeasureType>
+        std::basic_string<Item> to_string(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end) const
+        {
+            return to_string(begin.raw_index(), end.raw_index());
+        }
+
+        std::basic_string<Item> to_string() const
+        {
+            return to_string(0, size());
+        }
+
+        /**
+         *  Returned by the searches when there's no match
+         */
+        static constexpr uintptr_t npos = UINTPTR_MAX;
+
+        /**
+         *  The offset of the first occurrence of `needle` at or after `from`, or `npos`.
+         *  The leaves are searched in place, including for occurrences that span several of them, and ropes of
+         *  `char` are prefiltered by the text kernels.
+         */
+        uintptr_t find(std::basic_string<Item> const &needle, uintptr_t from = 0) const
+        {
+            if (needle.empty() || from >= size()) {
+                return needle.empty() && from <= size() ? from : npos;
+            }
+            uintptr_t found = npos;
+            auto stop = [&found](uintptr_t at) {
+                found = at;
+                return false;
+            };
+            __RopeForwardSearch<Item> search(needle, from);
+            auto chunk = [&](Item const *items, uintptr_t count) { return search.feed(items, count, stop); };
+            rootNode->template scan_chunks<false>(from, size(), chunk);
+            return found;
+        }
+
+        /**
+         *  The offset of the last occurrence of `needle` that starts at or before `before`, or `npos`
+         */
+        uintptr_t rfind(std::basic_string<Item> const &needle, uintptr_t before = npos) const
+        {
+            if (needle.size() > size()) {
+                return npos;
+            }
+            uintptr_t end = std::min(before, size() - needle.size()) + needle.size();
+            if (needle.empty()) {
+                return end;
+            }
+            uintptr_t found = npos;
+            auto stop = [&found](uintptr_t at) {
+                found = at;
+                return false;
+            };
+            __RopeReverseSearch<Item> search(needle, end);
+            auto chunk = [&](Item const *items, uintptr_t count) { return search.feed(items, count, stop); };
+            rootNode->template scan_chunks<true>(0, end, chunk);
+            return found;
+        }
+
+        /**
+         *  The offsets of every occurrence of `needle`, including overlapping ones, in order. An empty needle
+         *  occurs at every offset.
+         */
+        std::vector<uintptr_t> find_all(std::basic_string<Item> const &needle) const
+        {
+            std::vector<uintptr_t> found;
+            if (needle.empty()) {
+                for (uintptr_t at = 0; at <= size(); ++at) {
+                    found.push_back(at);
+                }
+                return found;
+            }
+            auto keep = [&found](uintptr_t at) {
+                found.push_back(at);
+                return true;
+            };
+            __RopeForwardSearch<Item> search(needle, 0);
+            each_chunk(0, size(), [&](Item const *items, uintptr_t count) { search.feed(items, count, keep); });
+            return found;
+        }
+
+        /**
+         *  The hash of the items at offsets [begin, end), clamped to the rope, for ropes whose policy is wrapped in
+         *  `HashedPolicy`. Only the leaves at either end of the range are read, so it takes time logarithmic in the
+         *  rope's size. The same items hash alike in any hashed rope, whatever its shape or layout.
+         */
+        RopeHash hash(uintptr_t begin = 0, uintptr_t end = npos) const
+        {
+            end = std::min(end, size());
+            return rootNode->hash(std::min(begin, end), end);
+        }
+
+        /**
+         *  Compare with `other` as `std::basic_string::compare` would, returning a negative number, 0 or a positive
+         *  number as this rope sorts before, equal to or after it.
+         *
+         *  Both trees are walked together a leaf span at a time. Subtrees the ropes share at the same offset, as
+         *  versions of a document split and joined from one another do, are skipped without being read, so
+         *  comparing two versions costs time in proportion to how much of them differs.
+         */
+        int compare(This const &other) const
+        {
+            return __ropeCompare(rootNode.get(), other.rootNode.get());
+        }
+
+        MeasureIterType begin(IterCallbacksType const &callbacks = IterCallbacksType()) const
         {
             return MeasureIterType(rootNode.get(), 0, callbacks);
         }
@@ -67,9 +340,9 @@ namespace Rope {
             return ItemIterType(rootNode.get(), 0);
         }
 
-        MeasureIterType end(typename MeasureIterType::CallbacksType const &callbacks) const
+        MeasureIterType end(IterCallbacksType const &callbacks = IterCallbacksType()) const
         {
-            return begin(callbacks) + callbacks.predicate(rootNode->measure) + 1;
+            return begin(callbacks) + callbacks.predicate(rootNode->measure()) + 1;
         }
 
         ItemIterType end_items() const
@@ -77,29 +350,134 @@ namespace Rope {
             auto lhs = begin_items();
             return lhs + rootNode->size + 1;
         }
+
+        /**
+         *  Iterate by component `I` of a `CompositeMeasurePolicy` (e.g.: `rope.begin<2>()` to seek by lines when the
+         *  third component is a `LineMeasurePolicy`)
+         */
+        template<size_t I>
+        ComponentIterType<I> begin() const
+        {
+            return ComponentIterType<I>(rootNode.get(), 0, typename ComponentIterType<I>::CallbacksType());
+        }
+
+        template<size_t I>
+        ComponentIterType<I> end() const
+        {
+            auto lhs = ComponentIterType<I>(rootNode.get(), 0, typename ComponentIterType<I>::CallbacksType());
+            return lhs + lhs.callbacks.predicate(lhs.get_measureable(*rootNode)) + 1;
+        }
         
-        This substr(MeasureIterType const &begin, MeasureIterType const &end, CallbacksType const &callbacks) const
+        template<typename IterMeasureType>
+        This substr(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end,
+            CallbacksType const &callbacks = CallbacksType()) const
         {
             return This(rootNode->substr(begin, end, callbacks));
         }
         
         
-        This concat(This const &other, CallbacksType const &callbacks) const {
-            return This(make_shared<NodeType>(rootNode, other.rootNode, callbacks));
+        This concat(This const &other, CallbacksType const &callbacks = CallbacksType()) const {
+            return This(NodeType::concat(rootNode, other.rootNode, callbacks));
+        }
+        
+        /**
+         *  Return a copy of the rope with the items at offsets [begin, end) replaced by `count` items. Only the
+         *  nodes above the edit are copied, and the new items are merged into a neighbouring leaf when they fit.
+         *  The range is clamped to the rope.
+         */
+        This replace(
+            uintptr_t begin,
+            uintptr_t end,
+            Item const *items,
+            uintptr_t count,
+            CallbacksType const &callbacks = CallbacksType()) const
+        {
+            end = std::min(end, size());
+            begin = std::min(begin, end);
+            return This(NodeType::replaced(rootNode, begin, end, items, count, callbacks));
+        }
+
+        This replace(
+            uintptr_t begin,
+            uintptr_t end,
+            std::basic_string<Item> const &items,
+            CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return replace(begin, end, items.data(), items.size(), callbacks);
+        }
+
+        template<typename IterMeasureType>
+        This replace(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end,
+            std::basic_string<Item> const &items,
+            CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return replace(begin.raw_index(), end.raw_index(), items.data(), items.size(), callbacks);
+        }
+
+        This insert(uintptr_t at, std::basic_string<Item> const &items, CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return replace(at, at, items.data(), items.size(), callbacks);
+        }
+
+        template<typename IterMeasureType>
+        This insert(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &at,
+            std::basic_string<Item> const &items,
+            CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return insert(at.raw_index(), items, callbacks);
+        }
+
+        This erase(uintptr_t begin, uintptr_t end, CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return replace(begin, end, nullptr, 0, callbacks);
+        }
+
+        template<typename IterMeasureType>
+        This erase(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &begin,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &end,
+            CallbacksType const &callbacks = CallbacksType()) const
+        {
+            return erase(begin.raw_index(), end.raw_index(), callbacks);
+        }
+        
+        /**
+         *  Return a copy of the rope with a batch of edits applied in a single pass. The edits must be sorted by
+         *  offset and must not overlap, and their offsets refer to this rope, before any of them apply; items
+         *  inserted at the same offset keep their order. Subtrees no edit touches are shared with this rope.
+         */
+        This apply_edits(vector<RopeEdit<Item>> const &edits, CallbacksType const &callbacks = CallbacksType()) const
+        {
+            for (uintptr_t i = 0; i < edits.size(); ++i) {
+                assert(edits[i].begin <= edits[i].end && edits[i].end <= size());
+                assert(i == 0 || edits[i - 1].end <= edits[i].begin);
+            }
+            return This(NodeType::edited(rootNode, edits.data(), edits.data() + edits.size(), callbacks));
         }
         
-        This &balance(CallbacksType const &callbacks) {
+        This &balance(CallbacksType const &callbacks = CallbacksType()) {
             rootNode = NodeType::balanced(rootNode, callbacks);
             return *this;
         }
         
-        tuple<This, This> splitAfter(MeasureIterType const &splitPoint, CallbacksType const &callbacks) const
+        template<typename IterMeasureType>
+        tuple<This, This> splitAfter(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &splitPoint,
+            CallbacksType const &callbacks = CallbacksType()) const
         {
             auto result = rootNode->splitAfter(splitPoint, callbacks);
             return make_tuple(This(get<0>(result)), This(get<1>(result)));
         }
 
-        tuple<This, This> splitBefore(MeasureIterType const &splitPoint, CallbacksType const &callbacks) const
+        template<typename IterMeasureType>
+        tuple<This, This> splitBefore(
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &splitPoint,
+            CallbacksType const &callbacks = CallbacksType()) const
         {
             auto result = rootNode->splitBefore(splitPoint, callbacks);
             return make_tuple(This(get<0>(result)), This(get<1>(result)));
@@ -114,6 +492,114 @@ namespace Rope {
     };
     
     
+    /**
+     *  The smallest node whose items include those at offsets [begin, end) of `node`, with the range rebased onto
+     *  it
+     */
+    template<typename Node>
+    Node const *__ropeCovering(Node const *node, uintptr_t &begin, uintptr_t &end)
+    {
+        while (node->node_type == RopeNodeTypeBranch) {
+            Node const *inner = nullptr;
+            uintptr_t start = 0;
+            node->each_child([&](Node const *child) {
+                if (inner == nullptr && begin >= start && end <= start + child->size) {
+                    inner = child;
+                    begin -= start;
+                    end -= start;
+                }
+                start += child->size;
+            });
+            if (inner == nullptr) {
+                break;
+            }
+            node = inner;
+        }
+        return node;
+    }
+
+    /**
+     *  Whether the items at offsets [a_begin, a_end) of `a` equal those at [b_begin, b_end) of `b`, where both
+     *  ropes are hashed (see `HashedPolicy`) and the ranges are clamped to them.
+     *
+     *  The ranges are compared by hash, in time logarithmic in the ropes' sizes, so different ranges compare equal
+     *  with probability under `n / 2^61` for ranges of `n` items. Ranges lying at the same offset of the same node,
+     *  as they do in ropes edited from a common one, are equal without hashing either.
+     */
+    template<typename Item, typename AMeasure, typename BMeasure>
+    bool equal_ranges(
+        Rope<Item, AMeasure> const &a,
+        uintptr_t a_begin,
+        uintptr_t a_end,
+        Rope<Item, BMeasure> const &b,
+        uintptr_t b_begin,
+        uintptr_t b_end)
+    {
+        a_end = std::min(a_end, a.size());
+        b_end = std::min(b_end, b.size());
+        a_begin = std::min(a_begin, a_end);
+        b_begin = std::min(b_begin, b_end);
+        if (a_end - a_begin != b_end - b_begin) {
+            return false;
+        }
+
+        auto a_node = __ropeCovering(a.rootNode.get(), a_begin, a_end);
+        auto b_node = __ropeCovering(b.rootNode.get(), b_begin, b_end);
+        if (static_cast<void const *>(a_node) == static_cast<void const *>(b_node) && a_begin == b_begin) {
+            return true;
+        }
+        return a_node->hash(a_begin, a_end) == b_node->hash(b_begin, b_end);
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator==(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator!=(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator<(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return lhs.compare(rhs) < 0;
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator>(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return rhs < lhs;
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator<=(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return !(rhs < lhs);
+    }
+
+    template<typename Item, typename MeasureType>
+    bool operator>=(Rope<Item, MeasureType> const &lhs, Rope<Item, MeasureType> const &rhs)
+    {
+        return !(lhs < rhs);
+    }
+
+    template<typename Item>
+    void __ropeWrite(ostream &stream, Item const *items, uintptr_t count)
+    {
+        for (uintptr_t i = 0; i < count; ++i) {
+            stream << items[i];
+        }
+    }
+
+    inline void __ropeWrite(ostream &stream, char const *items, uintptr_t count)
+    {
+        stream.write(items, count);
+    }
+
     template<
         typename    Item,
         typename    MeasureType>
@@ -121,13 +607,9 @@ namespace Rope {
     (   ostream &lhs,
         Rope<Item, MeasureType> const &rhs)
     {
-        auto it = rhs.begin_items();
-        auto end = rhs.end_items();
-        
-        for (; it < end; ++ it) {
-            auto r = *it;
-            lhs << r;
-        }
+        rhs.each_chunk(0, rhs.size(), [&lhs](Item const *items, uintptr_t count) {
+            __ropeWrite(lhs, items, count);
+        });
         return lhs;
     }
 };
@@ -0,0 +1,1223 @@
+#ifndef ROPE_ROPE_BTREE_NODE_HEADER
+#define ROPE_ROPE_BTREE_NODE_HEADER
+
+#import <memory>
+#import <functional>
+#import <vector>
+#import <string>
+#import <cstring>
+#import <iostream>
+#import <tuple>
+#import <new>
+#import <type_traits>
+#import <assert.h>
+
+#import "slice.hpp"
+#import "measure.hpp"
+#import "rope_iter.hpp"
+#import "rope_node.hpp"
+#import "rope_node_type.hpp"
+#import "rope_global_conf.hpp"
+#import "rope_hash.hpp"
+
+using std::get;
+using std::make_tuple;
+
+namespace Rope {
+
+    /**
+     *  Wraps a measure policy to select the B+-tree node layout: `Rope<Item, BTreePolicy<UTF8MeasurePolicy>>`
+     *  measures and iterates exactly as `Rope<Item, UTF8MeasurePolicy>`, but its branches hold up to `Fanout`
+     *  children instead of two.
+     */
+    template<typename Policy, size_t Fanout = 16>
+    struct BTreePolicy : public Policy
+    {
+        static_assert(std::is_base_of<MeasurePolicy, Policy>::value, "BTreePolicy wraps a MeasurePolicy");
+        static_assert(Fanout >= 4, "BTreePolicy needs a fanout of at least 4");
+
+        static constexpr size_t fanout = Fanout;
+    };
+
+    /**
+     *  A B+-tree rope node.
+     *
+     *  Every leaf is at the same depth. A branch keeps its children's sizes and measures, along with their running
+     *  totals, in contiguous arrays, so a descent scans one array per level rather than chasing a pointer per
+     *  binary level. Branches other than the root hold between `Fanout / 2` and `Fanout` children, and no two
+     *  adjacent leaves would fit in a single leaf together.
+     */
+    template<
+        typename    Item,
+        typename    Policy,
+        size_t      Fanout>
+    class RopeNode<Item, BTreePolicy<Policy, Fanout>>
+    :   public MeasureTraits<BTreePolicy<Policy, Fanout>, Item>::allocation_type::counted_base {
+    public:
+        using This = RopeNode<Item, BTreePolicy<Policy, Fanout>>;
+        using Traits = MeasureTraits<BTreePolicy<Policy, Fanout>, Item>;
+        using CallbacksType = typename Traits::callbacks_type;
+        using MeasureStorage = typename Traits::measure_type;
+        using Allocation = typename Traits::allocation_type;
+
+    private:
+        using Shared = typename Allocation::template pointer<This>;
+        using ItemSlice = typename Allocation::template pointer<Slice<Item>>;
+
+        struct BranchData {
+            uintptr_t count;
+            Shared children[Fanout];
+
+            uintptr_t sizes[Fanout];
+            uintptr_t offsets[Fanout];          // sizes of children [0, i]
+
+            MeasureStorage const &measures(uintptr_t i) const
+            {
+                return *reinterpret_cast<MeasureStorage const *>(&measure_storage[i]);
+            }
+
+            /**
+             *  The joined measures of children [0, i]
+             */
+            MeasureStorage const &prefixes(uintptr_t i) const
+            {
+                return *reinterpret_cast<MeasureStorage const *>(&prefix_storage[i]);
+            }
+
+            /**
+             *  Add a child, and its measures unless they're to be found when first read
+             */
+            void push(Shared const &child, CallbacksType const &callbacks)
+            {
+                children[count] = child;
+                sizes[count] = child->size;
+                offsets[count] = count > 0 ? offsets[count - 1] + child->size : child->size;
+                ++count;
+                if (!Traits::lazy_measure) {
+                    measure_children(callbacks);
+                }
+            }
+
+            /**
+             *  Fill in the measures and running totals of the children added since the last call
+             */
+            void measure_children(CallbacksType const &callbacks)
+            {
+                for (; measured < count; ++measured) {
+                    MeasureStorage const &measure = children[measured]->measure();
+                    new (&measure_storage[measured]) MeasureStorage(measure);
+                    new (&prefix_storage[measured]) MeasureStorage(measured > 0
+                                                                   ? callbacks.join(prefixes(measured - 1), measure)
+                                                                   : measure);
+                }
+            }
+
+            BranchData()
+            :   count(0),
+                measured(0)
+            {}
+
+            ~BranchData()
+            {
+                for (uintptr_t i = 0; i < measured; ++i) {
+                    reinterpret_cast<MeasureStorage *>(&measure_storage[i])->~MeasureStorage();
+                    reinterpret_cast<MeasureStorage *>(&prefix_storage[i])->~MeasureStorage();
+                }
+            }
+
+        private:
+            uintptr_t measured;
+
+            // Only the first `measured` measures are constructed, so wide branches don't pay for empty slots
+            using RawMeasure = typename std::aligned_storage<sizeof(MeasureStorage), alignof(MeasureStorage)>::type;
+
+            RawMeasure measure_storage[Fanout];
+            RawMeasure prefix_storage[Fanout];
+        };
+
+        struct BranchDelete {
+            void operator()(BranchData *branch) const { Allocation::destroy(branch); }
+        };
+
+        /**
+         *  At most two nodes of the same height, as produced by joining two subtrees
+         */
+        struct NodePair {
+            uintptr_t count;
+            Shared nodes[2];
+        };
+
+        /**
+         *  Group `count` children into one node, or two when they exceed the fanout
+         */
+        static NodePair
+        __btreePack(Shared const *const *children, uintptr_t count, CallbacksType const &callbacks)
+        {
+            NodePair ret;
+            if (count <= Fanout) {
+                ret.count = 1;
+                ret.nodes[0] = Allocation::template make<This>(children, count, callbacks);
+            } else {
+                uintptr_t half = count / 2;
+                ret.count = 2;
+                ret.nodes[0] = Allocation::template make<This>(children, half, callbacks);
+                ret.nodes[1] = Allocation::template make<This>(children + half, count - half, callbacks);
+            }
+            return ret;
+        }
+
+        /**
+         *  Join two non-empty subtrees, returning one or two nodes as tall as the taller of them.
+         *  The shorter subtree is merged into the taller one's edge, and the leaves on either side of the seam
+         *  are copied into one when they fit. Subtrees of equal height are only searched down to the seam when
+         *  `seam` is set; splitting leaves the seams between its pieces as they were in the original rope.
+         */
+        static NodePair
+        __btreeJoin(Shared const &left, Shared const &right, bool seam, CallbacksType const &callbacks)
+        {
+            if (left->height == right->height && left->node_type == RopeNodeTypeLeaf) {
+                NodePair ret;
+                if (left->size + right->size < ROPE_GLOBAL_MAX_LEAF_CAP) {
+                    std::list<ItemSlice> slices { left->leaf_data, right->leaf_data };
+                    ret.count = 1;
+                    ret.nodes[0] = Allocation::template make<This>(Allocation::template make<Slice<Item>>(slices), callbacks);
+                } else {
+                    ret.count = 2;
+                    ret.nodes[0] = left;
+                    ret.nodes[1] = right;
+                }
+                return ret;
+            }
+
+            Shared const *children[2 * Fanout];
+            uintptr_t count = 0;
+            NodePair mid;
+
+            if (left->height == right->height && !seam) {
+                BranchData const &lb = *left->branch_data;
+                BranchData const &rb = *right->branch_data;
+                for (uintptr_t i = 0; i < lb.count; ++i) {
+                    children[count++] = &lb.children[i];
+                }
+                for (uintptr_t i = 0; i < rb.count; ++i) {
+                    children[count++] = &rb.children[i];
+                }
+            } else if (left->height >= right->height) {
+                BranchData const &lb = *left->branch_data;
+                for (uintptr_t i = 0; i + 1 < lb.count; ++i) {
+                    children[count++] = &lb.children[i];
+                }
+                mid = left->height == right->height
+                    ? __btreeJoin(lb.children[lb.count - 1], right->branch_data->children[0], seam, callbacks)
+                    : __btreeJoin(lb.children[lb.count - 1], right, seam, callbacks);
+                for (uintptr_t i = 0; i < mid.count; ++i) {
+                    children[count++] = &mid.nodes[i];
+                }
+                if (left->height == right->height) {
+                    BranchData const &rb = *right->branch_data;
+                    for (uintptr_t i = 1; i < rb.count; ++i) {
+                        children[count++] = &rb.children[i];
+                    }
+                }
+            } else {
+                BranchData const &rb = *right->branch_data;
+                mid = __btreeJoin(left, rb.children[0], seam, callbacks);
+                for (uintptr_t i = 0; i < mid.count; ++i) {
+                    children[count++] = &mid.nodes[i];
+                }
+                for (uintptr_t i = 1; i < rb.count; ++i) {
+                    children[count++] = &rb.children[i];
+                }
+            }
+
+            return __btreePack(children, count, callbacks);
+        }
+
+        /**
+         *  Join two subtrees, either of which may be null, into a single subtree
+         */
+        static Shared
+        __btreeConcat(Shared const &left, Shared const &right, CallbacksType const &callbacks)
+        {
+            if (left == nullptr || left->size == 0) {
+                return right;
+            }
+            if (right == nullptr || right->size == 0) {
+                return left;
+            }
+
+            NodePair joined = __btreeJoin(left, right, true, callbacks);
+            Shared ret = joined.count == 1
+                       ? joined.nodes[0]
+                       : Allocation::template make<This>(joined.nodes, joined.count, callbacks);
+            while (ret->node_type == RopeNodeTypeBranch && ret->branch_data->count == 1) {
+                ret = ret->branch_data->children[0];
+            }
+            return ret;
+        }
+
+        /**
+         *  A subtree over `count` siblings, or null if there are none
+         */
+        static Shared
+        __btreeRange(Shared const *siblings, uintptr_t count, CallbacksType const &callbacks)
+        {
+            if (count == 0) {
+                return nullptr;
+            }
+            if (count == 1) {
+                return siblings[0];
+            }
+            return Allocation::template make<This>(siblings, count, callbacks);
+        }
+
+        /**
+         *  A subtree over `count` siblings followed by `tail`, which is no taller than they are.
+         *  `tail` is adopted as a sibling when it's full enough, and is merged into the last sibling otherwise.
+         */
+        static Shared
+        __btreeAppend(Shared const *siblings, uintptr_t count, Shared const &tail, CallbacksType const &callbacks)
+        {
+            if (tail == nullptr || count == 0) {
+                return tail == nullptr ? __btreeRange(siblings, count, callbacks) : tail;
+            }
+
+            Shared const *children[Fanout];
+            uintptr_t n = 0;
+            NodePair mid;
+
+            Shared const &last = siblings[count - 1];
+            for (uintptr_t i = 0; i + 1 < count; ++i) {
+                children[n++] = &siblings[i];
+            }
+            if (__btreeFull(tail, last->height)) {
+                children[n++] = &last;
+                children[n++] = &tail;
+            } else {
+                mid = __btreeJoin(last, tail, false, callbacks);
+                for (uintptr_t i = 0; i < mid.count; ++i) {
+                    children[n++] = &mid.nodes[i];
+                }
+            }
+            return n == 1 ? *children[0] : Allocation::template make<This>(children, n, callbacks);
+        }
+
+        /**
+         *  A subtree over `head` followed by `count` siblings, mirroring `__btreeAppend`
+         */
+        static Shared
+        __btreePrepend(Shared const &head, Shared const *siblings, uintptr_t count, CallbacksType const &callbacks)
+        {
+            if (head == nullptr || count == 0) {
+                return head == nullptr ? __btreeRange(siblings, count, callbacks) : head;
+            }
+
+            Shared const *children[Fanout];
+            uintptr_t n = 0;
+            NodePair mid;
+
+            Shared const &first = siblings[0];
+            if (__btreeFull(head, first->height)) {
+                children[n++] = &head;
+                children[n++] = &first;
+            } else {
+                mid = __btreeJoin(head, first, false, callbacks);
+                for (uintptr_t i = 0; i < mid.count; ++i) {
+                    children[n++] = &mid.nodes[i];
+                }
+            }
+            for (uintptr_t i = 1; i < count; ++i) {
+                children[n++] = &siblings[i];
+            }
+            return n == 1 ? *children[0] : Allocation::template make<This>(children, n, callbacks);
+        }
+
+        /**
+         *  Whether `node` can stand as a branch's child at `height` without being merged into a sibling
+         */
+        static bool
+        __btreeFull(Shared const &node, uintptr_t height)
+        {
+            return node->height == height
+                && node->node_type == RopeNodeTypeBranch
+                && node->branch_data->count >= Fanout / 2;
+        }
+
+        /**
+         *  Split a subtree before item `offset`. Either side may be null.
+         */
+        static tuple<Shared, Shared>
+        __btreeSplit(Shared const &node, uintptr_t offset, CallbacksType const &callbacks)
+        {
+            if (offset == 0) {
+                return make_tuple(Shared(nullptr), node);
+            }
+            if (offset >= node->size) {
+                return make_tuple(node, Shared(nullptr));
+            }
+
+            return node->__btreeSplitSelf(offset, callbacks);
+        }
+
+        /**
+         *  Split this node before item `offset`, which may be at either end, into new subtrees
+         */
+        tuple<Shared, Shared>
+        __btreeSplitSelf(uintptr_t offset, CallbacksType const &callbacks) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                auto &slice = *leaf_data;
+                return make_tuple(
+                    offset > 0
+                        ? Allocation::template make<This>(Allocation::template make<Slice<Item>>(slice, 0, offset), callbacks)
+                        : Shared(nullptr),
+                    offset < size
+                        ? Allocation::template make<This>(Allocation::template make<Slice<Item>>(slice, offset, size - offset), callbacks)
+                        : Shared(nullptr));
+            }
+
+            BranchData const &branch = *branch_data;
+            if (offset == 0) {
+                return make_tuple(Shared(nullptr), __btreeRange(branch.children, branch.count, callbacks));
+            }
+            if (offset >= size) {
+                return make_tuple(__btreeRange(branch.children, branch.count, callbacks), Shared(nullptr));
+            }
+
+            uintptr_t i = 0;
+            while (offset >= branch.offsets[i]) {
+                ++i;
+            }
+            auto split = __btreeSplit(branch.children[i], offset - (branch.offsets[i] - branch.sizes[i]), callbacks);
+
+            return make_tuple(
+                __btreeAppend(branch.children, i, get<0>(split), callbacks),
+                __btreePrepend(get<1>(split), branch.children + i + 1, branch.count - i - 1, callbacks));
+        }
+
+        /**
+         *  The size of the leaf at the start (`last` unset) or end (`last` set) of a subtree
+         */
+        static uintptr_t
+        __btreeEdgeLeafSize(This const *node, bool last)
+        {
+            while (node->node_type == RopeNodeTypeBranch) {
+                node = node->branch_data->children[last ? node->branch_data->count - 1 : 0].get();
+            }
+            return node->size;
+        }
+
+        /**
+         *  Replace items [begin, end) of `node` with `count` items, if the range lies within one leaf whose new
+         *  contents fill it or a pair of leaves that keep the rope's leaves full. `before` and `after` are the
+         *  subtrees on either side of `node`, or null at the ends of the rope.
+         *
+         *  Only the path down to the leaf is copied, and a branch that overflows is split in two, so this returns
+         *  one or two nodes as tall as `node`, or none if the edit needs the leaves around it repacked.
+         */
+        static NodePair
+        __btreeReplaceInLeaf(
+            Shared const &node,
+            This const *before,
+            This const *after,
+            uintptr_t begin,
+            uintptr_t end,
+            Item const *items,
+            uintptr_t count,
+            CallbacksType const &callbacks)
+        {
+            NodePair ret;
+            ret.count = 0;
+
+            if (node->node_type == RopeNodeTypeLeaf) {
+                uintptr_t leaf_cap = ROPE_GLOBAL_MAX_LEAF_CAP - 1;
+                uintptr_t length = node->size - (end - begin) + count;
+                if (end > node->size || length > 2 * leaf_cap) {
+                    return ret;
+                }
+
+                // A leaf that shrinks must still not fit alongside its neighbours
+                uintptr_t previous = before != nullptr ? __btreeEdgeLeafSize(before, true) : leaf_cap;
+                uintptr_t next = after != nullptr ? __btreeEdgeLeafSize(after, false) : leaf_cap;
+                if (length <= leaf_cap) {
+                    if (length < node->size && (previous + length <= leaf_cap || length + next <= leaf_cap)) {
+                        return ret;
+                    }
+                    ret.count = 1;
+                    ret.nodes[0] = Allocation::template make<This>(
+                        Allocation::template make<Slice<Item>>(*node->leaf_data, begin, end, items, count),
+                        callbacks);
+                    return ret;
+                }
+
+                // Split the overfull leaf as evenly as its neighbours allow
+                uintptr_t lo = std::max(length - leaf_cap, leaf_cap + 1 > next ? leaf_cap + 1 - next : 1);
+                uintptr_t hi = std::min(leaf_cap, previous + length - (leaf_cap + 1));
+                if (lo > hi) {
+                    return ret;
+                }
+                uintptr_t tail = std::min(std::max(length - length / 2, lo), hi);
+                auto spliced = Allocation::template make<Slice<Item>>(*node->leaf_data, begin, end, items, count);
+                ret.count = 2;
+                ret.nodes[0] = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*spliced, 0, length - tail), callbacks);
+                ret.nodes[1] = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*spliced, length - tail, tail), callbacks);
+                return ret;
+            }
+
+            // An insertion between two children goes to the end of the first if it can
+            BranchData const &branch = *node->branch_data;
+            for (uintptr_t i = 0; i < branch.count; ++i) {
+                if (begin > branch.offsets[i] || (begin == branch.offsets[i] && end > begin)) {
+                    continue;
+                }
+                if (end > branch.offsets[i]) {
+                    return ret;
+                }
+
+                uintptr_t start = branch.offsets[i] - branch.sizes[i];
+                NodePair edited = __btreeReplaceInLeaf(
+                    branch.children[i],
+                    i > 0 ? branch.children[i - 1].get() : before,
+                    i + 1 < branch.count ? branch.children[i + 1].get() : after,
+                    begin - start, end - start, items, count, callbacks);
+                if (edited.count > 0) {
+                    Shared const *children[Fanout + 1];
+                    uintptr_t n = 0;
+                    for (uintptr_t j = 0; j < branch.count; ++j) {
+                        if (j != i) {
+                            children[n++] = &branch.children[j];
+                            continue;
+                        }
+                        for (uintptr_t k = 0; k < edited.count; ++k) {
+                            children[n++] = &edited.nodes[k];
+                        }
+                    }
+                    return __btreePack(children, n, callbacks);
+                }
+                if (begin < branch.offsets[i]) {
+                    return ret;
+                }
+            }
+            return ret;
+        }
+
+        /**
+         *  Apply the edits in [first, last), which are sorted, don't overlap and all change `node`, to `node`. Its
+         *  items start at `start` in the rope the edits refer to. Runs of children the edits don't touch are
+         *  shared and joined to the rebuilt children either side, which merges leaves across each seam that fit
+         *  together. Returns null if no items are left.
+         */
+        static Shared
+        __btreeEdited(
+            Shared const &node,
+            uintptr_t start,
+            RopeEdit<Item> const *first,
+            RopeEdit<Item> const *last,
+            CallbacksType const &callbacks)
+        {
+            bool covered = __ropeEditsCover(first, start, start + node->size);
+            if (node->node_type == RopeNodeTypeLeaf || covered) {
+                Slice<Item> empty;
+                auto items = __ropeEditedItems(covered ? empty : *node->leaf_data, start, first, last);
+                if (items->empty()) {
+                    return nullptr;
+                }
+                return Allocation::template make<This>(Allocation::template make<Slice<Item>>(items, items->begin(), items->end()), callbacks);
+            }
+
+            BranchData const &branch = *node->branch_data;
+            Shared ret;
+            uintptr_t run = 0;
+            for (uintptr_t i = 0; i < branch.count && first != last; ++i) {
+                uintptr_t child_end = start + branch.offsets[i];
+                auto end = __ropeEditsEnd(first, last, child_end);
+                if (end != first) {
+                    ret = __btreeConcat(ret, __btreeRange(branch.children + run, i - run, callbacks), callbacks);
+                    ret = __btreeConcat(ret, __btreeEdited(branch.children[i], child_end - branch.sizes[i], first, end, callbacks), callbacks);
+                    run = i + 1;
+                }
+                first = __ropeEditsAfter(first, last, child_end);
+            }
+            return __btreeConcat(ret, __btreeRange(branch.children + run, branch.count - run, callbacks), callbacks);
+        }
+
+        /**
+         *  Group a list of subtrees of equal height under as few parents as possible, filling them evenly
+         */
+        static vector<Shared>
+        __btreeLevel(vector<Shared> const &level, CallbacksType const &callbacks)
+        {
+            uintptr_t count = level.size();
+            uintptr_t parents = (count + Fanout - 1) / Fanout;
+            vector<Shared> next;
+            next.reserve(parents);
+            for (uintptr_t p = 0; p < parents; ++p) {
+                uintptr_t begin = count * p / parents;
+                uintptr_t end = count * (p + 1) / parents;
+                next.push_back(Allocation::template make<This>(level.data() + begin, end - begin, callbacks));
+            }
+            return next;
+        }
+
+        /**
+         *  Build a tree over a list of subtrees of equal height
+         */
+        static Shared
+        __btreeBuild(vector<Shared> level, CallbacksType const &callbacks)
+        {
+            if (level.empty()) {
+                return Allocation::template make<This>(callbacks);
+            }
+            while (level.size() > 1) {
+                level = __btreeLevel(level, callbacks);
+            }
+            return level.front();
+        }
+
+        /**
+         *  Cut a slice into full leaves, measuring them on the current `ThreadPool` if the slice is long
+         */
+        static vector<Shared>
+        __btreeLeaves(ItemSlice const &slice, CallbacksType const &callbacks)
+        {
+            uintptr_t slice_size = slice->size();
+            uintptr_t leaf_cap = ROPE_GLOBAL_MAX_LEAF_CAP - 1;
+            vector<Shared> leaves((slice_size + leaf_cap - 1) / leaf_cap);
+            auto build = [&](uintptr_t begin, uintptr_t end) {
+                for (uintptr_t i = begin; i < end; ++i) {
+                    uintptr_t offset = i * leaf_cap;
+                    uintptr_t length = std::min(leaf_cap, slice_size - offset);
+                    leaves[i] = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*slice, offset, length), callbacks);
+                }
+            };
+
+            if (ThreadPool *pool = __ropeBuildPool(slice_size)) {
+                pool->parallel_for(leaves.size(), build, std::max<uintptr_t>(leaves.size() / (8 * (pool->size() + 1)), 1));
+            } else {
+                build(0, leaves.size());
+            }
+            return leaves;
+        }
+
+        static void
+        __btreeCollectLeaves(Shared const &node, vector<Shared> &leaves)
+        {
+            if (node->node_type == RopeNodeTypeLeaf) {
+                if (node->size > 0) {
+                    leaves.push_back(node);
+                }
+                return;
+            }
+            for (uintptr_t i = 0; i < node->branch_data->count; ++i) {
+                __btreeCollectLeaves(node->branch_data->children[i], leaves);
+            }
+        }
+
+        void initWithLeaf(ItemSlice const &slice, CallbacksType const &callbacks)
+        {
+            initLeafData(slice);
+            if (!Traits::lazy_measure) {
+                measure_cell.set(callbacks.accumulate(*slice));
+            }
+        }
+
+        void initWithLeaf(ItemSlice const &slice, MeasureStorage const &measure, CallbacksType const &)
+        {
+            initLeafData(slice);
+            measure_cell.set(measure);
+        }
+
+        void initLeafData(ItemSlice const &slice)
+        {
+            node_type = RopeNodeTypeLeaf;
+            leaf_data = slice;
+            size = slice->size();
+            weight = 1;
+            height = 0;
+            if (Traits::hashed) {
+                hash_cell.set(RopeHash::of(slice->data(), size));
+            }
+        }
+
+        __MeasureCell<MeasureStorage, Traits::lazy_measure> measure_cell;
+
+        __RopeHashCell<Traits::hashed> hash_cell;
+
+        MeasureStorage const &measure(std::false_type) const
+        {
+            return measure_cell.get();
+        }
+
+        MeasureStorage const &measure(std::true_type) const
+        {
+            return measure_cell.get([this]() -> MeasureStorage {
+                if (node_type == RopeNodeTypeLeaf) {
+                    return CallbacksType().accumulate(*leaf_data);
+                }
+                branch_data->measure_children(CallbacksType());
+                return branch_data->prefixes(branch_data->count - 1);
+            });
+        }
+
+        static Shared const &__btreeChild(Shared const *children, uintptr_t i) { return children[i]; }
+
+        static Shared const &__btreeChild(Shared const *const *children, uintptr_t i) { return *children[i]; }
+
+        template<typename Children>
+        void initWithChildren(Children children, uintptr_t count, CallbacksType const &callbacks)
+        {
+            assert(count > 0 && count <= Fanout);
+            node_type = RopeNodeTypeBranch;
+            branch_data.reset(Allocation::template create<BranchData>());
+            height = __btreeChild(children, 0)->height + 1;
+            weight = 0;
+            for (uintptr_t i = 0; i < count; ++i) {
+                Shared const &child = __btreeChild(children, i);
+                assert(child->height + 1 == height);
+                branch_data->push(child, callbacks);
+                weight += child->weight;
+            }
+            size = branch_data->offsets[count - 1];
+            if (!Traits::lazy_measure) {
+                measure_cell.set(branch_data->prefixes(count - 1));
+            }
+            if (Traits::hashed) {
+                RopeHash hash = branch_data->children[0]->hash_cell.get();
+                for (uintptr_t i = 1; i < count; ++i) {
+                    hash = RopeHash::join(hash, branch_data->children[i]->hash_cell.get());
+                }
+                hash_cell.set(hash);
+            }
+        }
+
+        void initWithSlice(ItemSlice const &slice, CallbacksType const &callbacks)
+        {
+            if (slice->size() < ROPE_GLOBAL_MAX_LEAF_CAP) {
+                initWithLeaf(slice, callbacks);
+                return;
+            }
+
+            vector<Shared> level = __btreeLeaves(slice, callbacks);
+            while (level.size() > Fanout) {
+                level = __btreeLevel(level, callbacks);
+            }
+            initWithChildren(level.data(), level.size(), callbacks);
+        }
+
+        void initWithVector(shared_ptr<vector<Item>> vector, CallbacksType const &callbacks)
+        {
+            initWithSlice(Allocation::template make<Slice<Item>>(vector, vector->begin(), vector->end()), callbacks);
+        }
+
+    public:
+        /**
+         *  The node type
+         */
+        RopeNodeType node_type;
+
+        /**
+         *  Branch data, if any
+         */
+        std::unique_ptr<BranchData, BranchDelete> branch_data;
+
+        /**
+         *  Leaf data, if any
+         */
+        ItemSlice leaf_data;
+
+        /**
+         *  The number of items stored within the scope of this node.
+         */
+        uintptr_t size;
+
+        /**
+         *  The number of leaf nodes contained within the scope of this node.
+         */
+        uintptr_t weight;
+
+        /**
+         *  The number of levels below this node. Leaves have height 0.
+         */
+        uintptr_t height;
+
+        /**
+         *  An arbitary measure of the items within the scope of this node.
+         */
+        MeasureStorage const &measure() const
+        {
+            return measure(std::integral_constant<bool, Traits::lazy_measure>());
+        }
+
+        /**
+         *  The hash of the items within the scope of this node, if the rope is hashed (see `HashedPolicy`)
+         */
+        RopeHash const &hash() const
+        {
+            static_assert(Traits::hashed, "Only ropes with a HashedPolicy keep hashes");
+            return hash_cell.get();
+        }
+
+        /**
+         *  The hash of the items at offsets [begin, end), where `begin <= end <= size`. Children wholly inside the
+         *  range contribute the hashes they keep, so only the leaves at either end are read.
+         */
+        RopeHash hash(uintptr_t begin, uintptr_t end) const
+        {
+            if (begin == 0 && end == size) {
+                return hash();
+            }
+            if (node_type == RopeNodeTypeLeaf) {
+                return RopeHash::of(leaf_data->data() + begin, end - begin);
+            }
+            if (begin == end) {
+                return RopeHash::identity();
+            }
+            BranchData const &branch = *branch_data;
+            uintptr_t i = 0;
+            while (branch.offsets[i] <= begin) {
+                ++i;
+            }
+            RopeHash hash = RopeHash::identity();
+            for (; i < branch.count && branch.offsets[i] - branch.sizes[i] < end; ++i) {
+                uintptr_t start = branch.offsets[i] - branch.sizes[i];
+                hash = RopeHash::join(hash, branch.children[i]->hash(begin > start ? begin - start : 0,
+                                                                     std::min(end, branch.offsets[i]) - start));
+            }
+            return hash;
+        }
+
+        /**
+         *  Choose the child of this branch containing `target`, as measured through the iterator traits
+         *  `IterTraits`, and rebase `target` onto that child.
+         *
+         *  The running totals make this a single scan: the child holding `target` is the first whose running total
+         *  passes it, and a measure which doesn't split cleanly across the children (such as a code point spanning
+         *  two leaves) is corrected by comparing the child's own measure with the running total that ends at it.
+         *
+         *  `bound`, the first target past this branch's part of the rope, is rebased the same way and narrowed to
+         *  the child's part. That is less than the child's own measure when joining the next child takes back the
+         *  last unit of the total, such as a CR the next child continues with LF: the target after it is found in
+         *  the next child, where the break ends. That is only checked for a target at that last unit; short of it,
+         *  the bound leaves the unit out, so an iterator reaching it comes back here to check.
+         */
+        template<typename IterTraits, typename IterCallbacksType>
+        This *descend(uintptr_t &target, uintptr_t &bound, IterCallbacksType const &callbacks) const
+        {
+            if (Traits::lazy_measure && !IterTraits::direct_index && !measure_cell.ready()) {
+                return descendUnmeasured<IterTraits>(target, bound, callbacks, std::integral_constant<bool, Traits::lazy_measure>());
+            }
+            BranchData const &branch = *branch_data;
+            uintptr_t last = branch.count - 1;
+            uintptr_t i = 0;
+            uintptr_t prefix = callbacks.predicate(IterTraits::select(branch.prefixes(0), branch.offsets[0]));
+            while (i < last) {
+                if (target < prefix && IterTraits::direct_index) {
+                    break;
+                }
+                if (target + 1 < prefix) {
+                    bound = std::min(bound, prefix - 1);
+                    break;
+                }
+                uintptr_t next = callbacks.predicate(IterTraits::select(branch.prefixes(i + 1), branch.offsets[i + 1]));
+                if (target < prefix) {
+                    uintptr_t ncap = callbacks.predicate(IterTraits::select(branch.measures(i + 1), branch.sizes[i + 1]));
+                    if (target + ncap <= next) {
+                        bound = std::min(bound, next + 1 - ncap);
+                        break;
+                    }
+                }
+                ++i;
+                prefix = next;
+            }
+            if (i > 0) {
+                uintptr_t before = prefix - callbacks.predicate(IterTraits::select(branch.measures(i), branch.sizes[i]));
+                target -= before;
+                bound -= before;
+            }
+            return branch.children[i].get();
+        }
+
+        /**
+         *  Descend a branch whose running totals haven't been found yet, joining the measures of only as many
+         *  children as it takes to pass `target`, so the children after it stay unmeasured. The next one is measured
+         *  too when `target` is the last unit of the total, as above.
+         */
+        template<typename IterTraits, typename IterCallbacksType>
+        This *descendUnmeasured(uintptr_t &target, uintptr_t &bound, IterCallbacksType const &callbacks, std::true_type) const
+        {
+            BranchData const &branch = *branch_data;
+            uintptr_t last = branch.count - 1;
+            uintptr_t i = 0;
+            MeasureStorage running = branch.children[0]->measure();
+            uintptr_t prefix = callbacks.predicate(IterTraits::select(running, branch.offsets[0]));
+            while (i < last) {
+                if (target + 1 < prefix) {
+                    bound = std::min(bound, prefix - 1);
+                    break;
+                }
+                MeasureStorage joined = CallbacksType().join(running, branch.children[i + 1]->measure());
+                uintptr_t next = callbacks.predicate(IterTraits::select(joined, branch.offsets[i + 1]));
+                if (target < prefix) {
+                    uintptr_t ncap = callbacks.predicate(IterTraits::select(branch.children[i + 1]->measure(), branch.sizes[i + 1]));
+                    if (target + ncap <= next) {
+                        bound = std::min(bound, next + 1 - ncap);
+                        break;
+                    }
+                }
+                ++i;
+                running = joined;
+                prefix = next;
+            }
+            if (i > 0) {
+                uintptr_t before = prefix - callbacks.predicate(IterTraits::select(branch.children[i]->measure(), branch.sizes[i]));
+                target -= before;
+                bound -= before;
+            }
+            return branch.children[i].get();
+        }
+
+        template<typename IterTraits, typename IterCallbacksType>
+        This *descendUnmeasured(uintptr_t &, uintptr_t &, IterCallbacksType const &, std::false_type) const
+        {
+            return nullptr;
+        }
+
+        /**
+         *  The number of items in this branch that precede `child`
+         */
+        uintptr_t size_before(This const *child) const
+        {
+            BranchData const &branch = *branch_data;
+            uintptr_t i = 0;
+            while (branch.children[i].get() != child) {
+                ++i;
+            }
+            return branch.offsets[i] - branch.sizes[i];
+        }
+
+        void each_chunk(std::function<void (Item const *s, uintptr_t l)> f) {
+            switch(node_type) {
+                case RopeNodeTypeLeaf: {
+                    f(leaf_data->data(), leaf_data->size());
+                    break;
+                }
+                case RopeNodeTypeBranch: {
+                    for (uintptr_t i = 0; i < branch_data->count; ++i) {
+                        branch_data->children[i]->each_chunk(f);
+                    }
+                }
+            }
+        }
+
+        /**
+         *  Call `f(child)` with each child of a branch
+         */
+        template<typename F>
+        void each_child(F f) const
+        {
+            if (node_type == RopeNodeTypeBranch) {
+                for (uintptr_t i = 0; i < branch_data->count; ++i) {
+                    f(branch_data->children[i].get());
+                }
+            }
+        }
+
+        /**
+         *  The bytes allocated for this node, its branch data and its leaf slice, not counting its children or the
+         *  slice's items
+         */
+        uintptr_t footprint() const
+        {
+            return sizeof(This) + (branch_data ? sizeof(BranchData) : 0) + (leaf_data ? sizeof(Slice<Item>) : 0);
+        }
+
+        /**
+         *  Call `f(items, count)` for the items at offsets [begin, end) of each leaf in turn, where
+         *  `begin <= end <= size`
+         */
+        template<typename F>
+        void each_chunk(uintptr_t begin, uintptr_t end, F &f) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                if (begin < end) {
+                    f(leaf_data->data() + begin, end - begin);
+                }
+                return;
+            }
+            BranchData const &branch = *branch_data;
+            for (uintptr_t i = 0; i < branch.count && branch.offsets[i] - branch.sizes[i] < end; ++i) {
+                uintptr_t start = branch.offsets[i] - branch.sizes[i];
+                if (branch.offsets[i] > begin) {
+                    branch.children[i]->each_chunk(begin > start ? begin - start : 0,
+                                                   std::min(end, branch.offsets[i]) - start,
+                                                   f);
+                }
+            }
+        }
+
+        /**
+         *  Call `f(items, count)` for the items at offsets [begin, end) of each leaf in turn, from the last leaf when
+         *  `Reverse` is set, until `f` returns false. Returns false if `f` stopped it.
+         */
+        template<bool Reverse, typename F>
+        bool scan_chunks(uintptr_t begin, uintptr_t end, F &f) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                return begin >= end || f(leaf_data->data() + begin, end - begin);
+            }
+            BranchData const &branch = *branch_data;
+            for (uintptr_t k = 0; k < branch.count; ++k) {
+                uintptr_t i = Reverse ? branch.count - 1 - k : k;
+                uintptr_t start = branch.offsets[i] - branch.sizes[i];
+                if (start < end && branch.offsets[i] > begin
+                    && !branch.children[i]->template scan_chunks<Reverse>(begin > start ? begin - start : 0,
+                                                                          std::min(end, branch.offsets[i]) - start,
+                                                                          f)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         *  Fold `map(items, count, offset)` over the chunks of the items at offsets [begin, end) with `combine`, in
+         *  order, where `begin < end <= size` and `offset` is that of the node's first item in the rope. Ranges of
+         *  more than `grain` items are split between the children, which are reduced as tasks on `pool`. The
+         *  results are combined along the tree's branches, so they don't depend on how the tasks were scheduled.
+         */
+        template<typename T, typename Map, typename Combine>
+        T reduce_chunks(
+            uintptr_t begin,
+            uintptr_t end,
+            uintptr_t offset,
+            Map &map,
+            Combine &combine,
+            ThreadPool &pool,
+            uintptr_t grain) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                return map(leaf_data->data() + begin, end - begin, offset + begin);
+            }
+            BranchData const &branch = *branch_data;
+            uintptr_t first = 0;
+            while (branch.offsets[first] <= begin) {
+                ++first;
+            }
+            uintptr_t last = first;
+            while (branch.offsets[last] < end) {
+                ++last;
+            }
+
+            // Reduce child `i`'s part of the range
+            auto reduce = [&](uintptr_t i) {
+                uintptr_t start = branch.offsets[i] - branch.sizes[i];
+                return branch.children[i]->template reduce_chunks<T>(begin > start ? begin - start : 0,
+                                                                     std::min(end, branch.offsets[i]) - start,
+                                                                     offset + start, map, combine, pool, grain);
+            };
+            if (end - begin <= grain || first == last) {
+                T result = reduce(first);
+                for (uintptr_t i = first + 1; i <= last; ++i) {
+                    result = combine(std::move(result), reduce(i));
+                }
+                return result;
+            }
+
+            // Wrapped so that a vector<bool> can't pack the tasks' results into shared words
+            struct Part { T value; };
+            std::vector<Part> parts(last - first + 1, Part { map(nullptr, 0, offset + begin) });
+            pool.parallel_for(parts.size(), [&](uintptr_t b, uintptr_t e) {
+                for (uintptr_t i = b; i < e; ++i) {
+                    parts[i].value = reduce(first + i);
+                }
+            });
+            T result = std::move(parts[0].value);
+            for (uintptr_t i = 1; i < parts.size(); ++i) {
+                result = combine(std::move(result), std::move(parts[i].value));
+            }
+            return result;
+        }
+
+        /**
+         *  Construct an empty rope
+         */
+        RopeNode(CallbacksType const &callbacks)
+        {
+            initWithLeaf(Allocation::template make<Slice<Item>>(), callbacks);
+        }
+
+        /**
+         *  Construct a rope from a slice
+         */
+        RopeNode(ItemSlice const &slice, CallbacksType const &callbacks)
+        {
+            initWithSlice(slice, callbacks);
+        }
+
+        /**
+         *  Construct a leaf over a slice whose measure is already known, as when loading a saved rope
+         */
+        RopeNode(ItemSlice const &slice, MeasureStorage const &measure, CallbacksType const &callbacks)
+        {
+            initWithLeaf(slice, measure, callbacks);
+        }
+
+        /**
+         *  Construct a rope from a container (e.g., a string or list)
+         */
+        template<typename Container>
+        RopeNode(Container const &other, CallbacksType const &callbacks)
+        {
+            initWithVector(make_shared<vector<Item>>(other.begin(), other.end()), callbacks);
+        }
+
+        /**
+         *  Construct a rope from a C array
+         */
+        RopeNode(Item const *buf, size_t const buflen, CallbacksType const &callbacks)
+        {
+            initWithVector(make_shared<vector<Item>>(buf, buf + buflen), callbacks);
+        }
+
+        RopeNode(string &other, CallbacksType const &callbacks)
+        :   RopeNode(other.c_str(), strlen(other.c_str()), callbacks)
+        {}
+
+        /**
+         *  Construct a branch over `count` subtrees of equal height
+         */
+        RopeNode(Shared const *children, uintptr_t count, CallbacksType const &callbacks)
+        {
+            initWithChildren(children, count, callbacks);
+        }
+
+        RopeNode(Shared const *const *children, uintptr_t count, CallbacksType const &callbacks)
+        {
+            initWithChildren(children, count, callbacks);
+        }
+
+        ~RopeNode() {}
+
+        template<typename IterMeasureType>
+        Shared
+        substr(
+            MeasureIterator<Item, BTreePolicy<Policy, Fanout>, IterMeasureType> const &begin,
+            MeasureIterator<Item, BTreePolicy<Policy, Fanout>, IterMeasureType> const &end,
+            CallbacksType const &callbacks)
+        {
+            uintptr_t lhs = std::min(begin.raw_index(), size);
+            uintptr_t rhs = std::min(end.raw_index(), size);
+            if (rhs <= lhs) {
+                return Allocation::template make<This>(callbacks);
+            }
+
+            auto prefix = get<0>(__btreeSplitSelf(rhs, callbacks));
+            auto ret = get<1>(__btreeSplit(prefix, lhs, callbacks));
+            return ret != nullptr ? ret : Allocation::template make<This>(callbacks);
+        }
+
+        template<typename IterMeasureType>
+        tuple<Shared, Shared>
+        splitAfter(
+            MeasureIterator<Item, BTreePolicy<Policy, Fanout>, IterMeasureType> const &it,
+            CallbacksType const &callbacks)
+        {
+            return splitBefore(it + 1, callbacks);
+        }
+
+        template<typename IterMeasureType>
+        tuple<Shared, Shared>
+        splitBefore(
+            MeasureIterator<Item, BTreePolicy<Policy, Fanout>, IterMeasureType> const &it,
+            CallbacksType const &callbacks)
+        {
+            auto split = __btreeSplitSelf(std::min(it.raw_index(), size), callbacks);
+            Shared left = get<0>(split), right = get<1>(split);
+            return make_tuple(left != nullptr ? left : Allocation::template make<This>(callbacks),
+                              right != nullptr ? right : Allocation::template make<This>(callbacks));
+        }
+
+        /**
+         *  Replace items [begin, end) of `rope` with `count` items.
+         *
+         *  An edit within one leaf copies that leaf, split in two if it overflows, and the path down to it. When
+         *  that would leave a leaf that fits alongside a neighbour, the rope is instead split around the range and
+         *  rejoined around the new items, which merges the leaves either side of each seam where they fit.
+         */
+        static Shared
+        replaced(
+            Shared const &rope,
+            uintptr_t begin,
+            uintptr_t end,
+            Item const *items,
+            uintptr_t count,
+            CallbacksType const &callbacks)
+        {
+            NodePair edited = __btreeReplaceInLeaf(rope, nullptr, nullptr, begin, end, items, count, callbacks);
+            if (edited.count > 0) {
+                return edited.count == 1 ? edited.nodes[0] : Allocation::template make<This>(edited.nodes, edited.count, callbacks);
+            }
+
+            auto head = __btreeSplit(rope, begin, callbacks);
+            Shared suffix = begin == end ? get<1>(head) : get<1>(__btreeSplit(get<1>(head), end - begin, callbacks));
+            Shared inserted = count > 0 ? Allocation::template make<This>(items, count, callbacks) : nullptr;
+            Shared ret = __btreeConcat(__btreeConcat(get<0>(head), inserted, callbacks), suffix, callbacks);
+            return ret != nullptr ? ret : Allocation::template make<This>(callbacks);
+        }
+
+        /**
+         *  Apply a batch of edits, sorted and not overlapping, in one pass over `rope`
+         */
+        static Shared
+        edited(
+            Shared const &rope,
+            RopeEdit<Item> const *first,
+            RopeEdit<Item> const *last,
+            CallbacksType const &callbacks)
+        {
+            if (first == last) {
+                return rope;
+            }
+            Shared ret = __btreeEdited(rope, 0, first, last, callbacks);
+            return ret != nullptr ? ret : Allocation::template make<This>(callbacks);
+        }
+
+        static Shared
+        concat(Shared const &left, Shared const &right, CallbacksType const &callbacks)
+        {
+            Shared ret = __btreeConcat(left, right, callbacks);
+            return ret != nullptr ? ret : left;
+        }
+
+        /**
+         *  B+-trees are always balanced; this repacks the branches above the existing leaves at full fanout
+         */
+        static Shared
+        balanced(Shared const &rope, CallbacksType const &callbacks)
+        {
+            if (rope->node_type == RopeNodeTypeLeaf) {
+                return rope;
+            }
+            vector<Shared> leaves;
+            leaves.reserve(rope->weight);
+            __btreeCollectLeaves(rope, leaves);
+            return __btreeBuild(leaves, callbacks);
+        }
+
+        void __log()
+        {
+            if (node_type == RopeNodeTypeBranch) {
+                for (uintptr_t i = 0; i < branch_data->count; ++i) {
+                    cout << "(";
+                    branch_data->children[i]->__log();
+                    cout << ")";
+                }
+            } else {
+                cout << "[ leaf of " << size << " ]";
+            }
+            fflush(stdout);
+        }
+    };
+};
+
+#endif // ROPE_ROPE_BTREE_NODE_HEADER
@@ -0,0 +1,242 @@
+#ifndef ROPE_ROPE_BUILDER_H
+#define ROPE_ROPE_BUILDER_H
+
+#import <memory>
+#import <vector>
+#import <istream>
+#import <ios>
+#import <system_error>
+#import <algorithm>
+#import <cstring>
+#import <cerrno>
+#import <cstdint>
+
+#import <unistd.h>
+
+#import "rope.hpp"
+
+namespace Rope {
+
+    /**
+     *  The bytes a `RopeBuilder` gathers before cutting them into leaves
+     */
+    static uintptr_t const __ropeBuilderBlock = 1 << 20;
+
+    /**
+     *  Whether a leaf may end before `items[at]`. Leaves of bytes end before the start of a UTF-8 sequence, so
+     *  each one decodes by itself.
+     */
+    template<typename Item>
+    bool __ropeBuilderCut(Item const *, uintptr_t)
+    {
+        return true;
+    }
+
+    inline bool __ropeBuilderCut(char const *items, uintptr_t at)
+    {
+        return (static_cast<unsigned char>(items[at]) & 0xC0) != 0x80;
+    }
+
+    /**
+     *  Builds a rope from items that arrive a run at a time, such as a stream being read, holding no more of them
+     *  than the block being filled besides the rope itself.
+     *
+     *  Items are gathered into a block, which once full is cut into full leaves that refer into it, so the items
+     *  are copied once. The leaves are added to a stack of subtrees with 1, 2, 4, ... leaves, joined like the
+     *  digits of a binary counter as each fills, so the tree stays balanced as it grows and each leaf costs a
+     *  constant number of joins on average.
+     *
+     *      RopeBuilder<char, UTF8MeasurePolicy> builder;
+     *      builder.read(fd);
+     *      Rope<char, UTF8MeasurePolicy> rope = builder.finish();
+     */
+    template<typename Item, typename MeasureType>
+    class RopeBuilder {
+    private:
+        using NodeType = RopeNode<Item, MeasureType>;
+        using Traits = MeasureTraits<MeasureType, Item>;
+        using Allocation = typename Traits::allocation_type;
+        using NodePtr = typename Allocation::template pointer<NodeType>;
+
+    public:
+        using RopeType = Rope<Item, MeasureType>;
+        using CallbacksType = typename Traits::callbacks_type;
+
+        /**
+         *  Gather items in blocks of `block` items, or of `__ropeBuilderBlock` bytes. Blocks hold at least two leaves.
+         */
+        explicit RopeBuilder(CallbacksType const &callbacks = CallbacksType(), uintptr_t block = 0)
+        :   callbacks(callbacks),
+            capacity(std::max<uintptr_t>(block > 0 ? block : __ropeBuilderBlock / sizeof(Item), 2 * ROPE_GLOBAL_MAX_LEAF_CAP)),
+            used(0),
+            count(0)
+        {}
+
+        /**
+         *  The number of items appended so far
+         */
+        uintptr_t size() const { return count; }
+
+        /**
+         *  Append `length` items
+         */
+        void append(Item const *items, uintptr_t length)
+        {
+            while (length > 0) {
+                uintptr_t space;
+                Item *into = reserve(space);
+                uintptr_t n = std::min(space, length);
+                std::copy(items, items + n, into);
+                filled(n);
+                items += n;
+                length -= n;
+            }
+        }
+
+        /**
+         *  Append what's left of `fd` until the end of the file, reading a block at a time straight into the
+         *  builder. Throws `std::system_error` if a read fails.
+         */
+        RopeBuilder &read(int fd)
+        {
+            static_assert(sizeof(Item) == 1, "Streams are read as bytes");
+            while (true) {
+                uintptr_t space;
+                Item *into = reserve(space);
+                ssize_t n = ::read(fd, into, space);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::generic_category(), "read");
+                }
+                if (n == 0) {
+                    return *this;
+                }
+                filled(n);
+            }
+        }
+
+        /**
+         *  Append what's left of `stream`, reading a block at a time straight into the builder. Throws
+         *  `std::ios_base::failure` if the stream goes bad.
+         */
+        RopeBuilder &read(std::istream &stream)
+        {
+            static_assert(sizeof(Item) == 1, "Streams are read as bytes");
+            while (stream) {
+                uintptr_t space;
+                Item *into = reserve(space);
+                stream.read(reinterpret_cast<char *>(into), space);
+                filled(stream.gcount());
+            }
+            if (stream.bad()) {
+                throw std::ios_base::failure("read");
+            }
+            return *this;
+        }
+
+        /**
+         *  The rope of every item appended, leaving the builder empty
+         */
+        RopeType finish()
+        {
+            // Leaves don't free what they don't use of a block, so the last is copied to fit first
+            if (block != nullptr && used < capacity) {
+                std::shared_ptr<Item> fitted(new Item[used], std::default_delete<Item[]>());
+                std::copy(block.get(), block.get() + used, fitted.get());
+                block = fitted;
+            }
+            cut(true);
+            block = nullptr;
+            used = 0;
+            count = 0;
+
+            NodePtr root;
+            for (auto &subtree : subtrees) {
+                if (subtree != nullptr) {
+                    root = root != nullptr ? NodeType::concat(subtree, root, callbacks) : subtree;
+                }
+            }
+            subtrees.clear();
+            return root != nullptr ? RopeType(root) : RopeType(callbacks);
+        }
+
+    private:
+        /**
+         *  The unfilled end of the block, starting a block if there's none to fill
+         */
+        Item *reserve(uintptr_t &space)
+        {
+            if (block == nullptr) {
+                block.reset(new Item[capacity], std::default_delete<Item[]>());
+                used = 0;
+            }
+            space = capacity - used;
+            return block.get() + used;
+        }
+
+        /**
+         *  Take `length` items written to the end of the block, and cut it once it's full
+         */
+        void filled(uintptr_t length)
+        {
+            used += length;
+            count += length;
+            if (used == capacity) {
+                cut(false);
+            }
+        }
+
+        /**
+         *  Cut the block into leaves. The items after the last full leaf start the next block, unless `last`.
+         */
+        void cut(bool last)
+        {
+            uintptr_t leaf_cap = ROPE_GLOBAL_MAX_LEAF_CAP - 1;
+            Item const *items = block.get();
+            uintptr_t start = 0;
+            while (used - start > leaf_cap || (last && used > start)) {
+                uintptr_t end = std::min(start + leaf_cap, used);
+                for (uintptr_t back = 0; back < 3 && end < used && end > start + 1 && !__ropeBuilderCut(items, end); ++back) {
+                    --end;
+                }
+                push(Allocation::template make<NodeType>(Allocation::template make<Slice<Item>>(block, items + start, items + end), callbacks));
+                start = end;
+            }
+            if (last) {
+                return;
+            }
+
+            std::shared_ptr<Item> next(new Item[capacity], std::default_delete<Item[]>());
+            std::copy(items + start, items + used, next.get());
+            block = next;
+            used -= start;
+        }
+
+        /**
+         *  Add a leaf after those already added, carrying full subtrees up to the next size
+         */
+        void push(NodePtr carry)
+        {
+            for (auto &subtree : subtrees) {
+                if (subtree == nullptr) {
+                    subtree = carry;
+                    return;
+                }
+                carry = NodeType::concat(subtree, carry, callbacks);
+                subtree = nullptr;
+            }
+            subtrees.push_back(carry);
+        }
+
+        CallbacksType callbacks;
+        uintptr_t capacity;
+        std::shared_ptr<Item> block;
+        uintptr_t used;
+        uintptr_t count;
+        std::vector<NodePtr> subtrees;
+    };
+};
+
+#endif // ROPE_ROPE_BUILDER_H
@@ -0,0 +1,174 @@
+#ifndef ROPE_ROPE_COMPARE_H
+#define ROPE_ROPE_COMPARE_H
+
+#import <vector>
+#import <algorithm>
+#import <cstring>
+#import <cstdint>
+
+#import "rope_node_type.hpp"
+
+namespace Rope {
+
+    /**
+     *  Compare `count` items of each run, returning the sign of the first difference, or 0
+     */
+    template<typename Item>
+    int __ropeCompareItems(Item const *lhs, Item const *rhs, uintptr_t count)
+    {
+        for (uintptr_t i = 0; i < count; ++i) {
+            if (lhs[i] < rhs[i]) {
+                return -1;
+            }
+            if (rhs[i] < lhs[i]) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     *  Bytes compare as unsigned, as `std::string::compare` does
+     */
+    inline int __ropeCompareItems(char const *lhs, char const *rhs, uintptr_t count)
+    {
+        return memcmp(lhs, rhs, count);
+    }
+
+    /**
+     *  A position in a rope, kept as the nodes that follow it in order: the first is the node the position is in,
+     *  `skip` items from its start, and each after it begins where the one before ends. Branches are only opened
+     *  when asked, so a cursor can step over a whole subtree at once.
+     */
+    template<typename Node>
+    class __RopeCursor {
+    public:
+        struct Frame {
+            Node const *node;
+            uintptr_t skip;
+        };
+
+        explicit __RopeCursor(Node const *root)
+        {
+            if (root->size > 0) {
+                stack.push_back({ root, 0 });
+            }
+        }
+
+        bool done() const { return stack.empty(); }
+
+        /**
+         *  The node the position is in, and how far into it the position is
+         */
+        Frame const &front() const { return stack.back(); }
+
+        /**
+         *  The items left in the node the position is in
+         */
+        uintptr_t remaining() const { return stack.back().node->size - stack.back().skip; }
+
+        /**
+         *  Replace the front branch with its children, dropping those wholly before the position
+         */
+        void open()
+        {
+            Frame frame = stack.back();
+            stack.pop_back();
+            uintptr_t base = stack.size();
+            uintptr_t skip = frame.skip;
+            frame.node->each_child([&](Node const *child) {
+                if (skip >= child->size) {
+                    skip -= child->size;
+                } else {
+                    stack.push_back({ child, skip });
+                    skip = 0;
+                }
+            });
+            std::reverse(stack.begin() + base, stack.end());
+        }
+
+        /**
+         *  Move the position `count` items on, where `count` is at most `remaining()`
+         */
+        void advance(uintptr_t count)
+        {
+            Frame &frame = stack.back();
+            frame.skip += count;
+            if (frame.skip == frame.node->size) {
+                stack.pop_back();
+            }
+        }
+
+    private:
+        std::vector<Frame> stack;
+    };
+
+    /**
+     *  Walk two ropes in lockstep from their starts, calling `differ(items, other_items, count)` on each pair of
+     *  leaf spans that have to be compared, until it returns true. Pairs of the same node at the same offset,
+     *  which ropes built from a common one share, are stepped over whole, and so are spans of the same items.
+     *
+     *  Returns the offset of the start of the span pair `differ` stopped at, or the length of the shorter rope.
+     */
+    template<typename Node, typename Differ>
+    uintptr_t __ropeLockstep(Node const *lhs, Node const *rhs, Differ &differ)
+    {
+        __RopeCursor<Node> a(lhs), b(rhs);
+        uintptr_t offset = 0;
+        while (!a.done() && !b.done()) {
+            auto const &x = a.front();
+            auto const &y = b.front();
+            if (x.node == y.node && x.skip == y.skip) {
+                uintptr_t count = a.remaining();
+                offset += count;
+                a.advance(count);
+                b.advance(count);
+                continue;
+            }
+
+            // Open the larger side first, so that a subtree both share turns up at the front of each
+            bool a_branch = x.node->node_type == RopeNodeTypeBranch;
+            bool b_branch = y.node->node_type == RopeNodeTypeBranch;
+            if (a_branch && (!b_branch || a.remaining() >= b.remaining())) {
+                a.open();
+                continue;
+            }
+            if (b_branch) {
+                b.open();
+                continue;
+            }
+
+            uintptr_t count = std::min(a.remaining(), b.remaining());
+            auto items = x.node->leaf_data->data() + x.skip;
+            auto other_items = y.node->leaf_data->data() + y.skip;
+            if (items != other_items && differ(items, other_items, count)) {
+                return offset;
+            }
+            offset += count;
+            a.advance(count);
+            b.advance(count);
+        }
+        return offset;
+    }
+
+    /**
+     *  Compare two ropes as `std::basic_string::compare` would, returning a negative number, 0 or a positive number
+     *  as `lhs` sorts before, equal to or after `rhs`. See `__ropeLockstep` for what's skipped.
+     */
+    template<typename Node>
+    int __ropeCompare(Node const *lhs, Node const *rhs)
+    {
+        int order = 0;
+        auto differ = [&order](decltype(lhs->leaf_data->data()) items, decltype(items) other_items, uintptr_t count) {
+            order = __ropeCompareItems(items, other_items, count);
+            return order != 0;
+        };
+        __ropeLockstep(lhs, rhs, differ);
+        if (order != 0) {
+            return order;
+        }
+        return lhs->size < rhs->size ? -1 : lhs->size > rhs->size ? 1 : 0;
+    }
+};
+
+#endif // ROPE_ROPE_COMPARE_H
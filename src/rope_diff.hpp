@@ -0,0 +1,397 @@
+#ifndef ROPE_ROPE_DIFF_H
+#define ROPE_ROPE_DIFF_H
+
+#import <vector>
+#import <queue>
+#import <unordered_map>
+#import <unordered_set>
+#import <algorithm>
+#import <string>
+#import <cstdint>
+
+#import "rope.hpp"
+#import "rope_edit.hpp"
+
+namespace Rope {
+
+    /**
+     *  The most insertions and deletions traced between two windows of items before they're replaced wholesale
+     */
+    constexpr uintptr_t __ropeDiffMaxTrace = 256;
+
+    /**
+     *  The most steps spent tracing one window, so long windows are traced less far
+     */
+    constexpr uintptr_t __ropeDiffMaxSteps = uintptr_t(1) << 24;
+
+    /**
+     *  A run of one rope's items: a subtree the other rope shares, or a leaf it doesn't
+     */
+    template<typename Node>
+    struct __RopeDiffRun {
+        Node const *node;
+        uintptr_t offset;
+    };
+
+    /**
+     *  A node waiting to be matched or opened, largest first, and of equal sizes the tallest, so that a branch is
+     *  opened before a subtree of the same size inside it is looked at
+     */
+    template<typename Node>
+    struct __RopeDiffPending {
+        uintptr_t size;
+        uintptr_t height;
+        int side;
+        Node const *node;
+
+        bool operator<(__RopeDiffPending const &other) const
+        {
+            return size != other.size ? size < other.size : height < other.height;
+        }
+    };
+
+    /**
+     *  Cut two ropes into runs, such that each is either a subtree both share or a leaf.
+     *
+     *  Each rope starts as its root. The largest node on either side is opened into its children, unless the other
+     *  side has the same node in its current cut, and so on down. A subtree shared by both is smaller than the
+     *  branches above it on either side, so they've been opened by the time it's looked at and it's found in the
+     *  other side's cut. Only the branches above an edit are opened, along with any subtree rebuilt rather than
+     *  shared, so this costs time in proportion to them and not to the ropes' sizes.
+     */
+    template<typename Node>
+    void __ropeDiffRuns(Node const *const roots[2], std::vector<__RopeDiffRun<Node>> runs[2])
+    {
+        std::priority_queue<__RopeDiffPending<Node>> pending;
+        std::unordered_map<Node const *, uintptr_t> cut[2];
+        std::unordered_set<Node const *> opened[2];
+        for (int side = 0; side < 2; ++side) {
+            if (roots[side]->size > 0) {
+                ++cut[side][roots[side]];
+                pending.push({ roots[side]->size, roots[side]->height, side, roots[side] });
+            }
+        }
+
+        while (!pending.empty()) {
+            auto next = pending.top();
+            pending.pop();
+            auto other = cut[1 - next.side].find(next.node);
+            if (other != cut[1 - next.side].end() || next.node->node_type == RopeNodeTypeLeaf) {
+                continue;
+            }
+            auto own = cut[next.side].find(next.node);
+            if (--own->second == 0) {
+                cut[next.side].erase(own);
+            }
+            opened[next.side].insert(next.node);
+            next.node->each_child([&](Node const *child) {
+                if (child->size > 0) {
+                    ++cut[next.side][child];
+                    pending.push({ child->size, child->height, next.side, child });
+                }
+            });
+        }
+
+        // Read each side's cut off in order, descending into the nodes that were opened
+        for (int side = 0; side < 2; ++side) {
+            std::vector<std::pair<Node const *, uintptr_t>> stack;
+            if (roots[side]->size > 0) {
+                stack.push_back({ roots[side], 0 });
+            }
+            while (!stack.empty()) {
+                auto top = stack.back();
+                stack.pop_back();
+                if (opened[side].count(top.first) == 0) {
+                    runs[side].push_back({ top.first, top.second });
+                    continue;
+                }
+                uintptr_t base = stack.size();
+                uintptr_t offset = top.second;
+                top.first->each_child([&](Node const *child) {
+                    if (child->size > 0) {
+                        stack.push_back({ child, offset });
+                        offset += child->size;
+                    }
+                });
+                std::reverse(stack.begin() + base, stack.end());
+            }
+        }
+    }
+
+    /**
+     *  Pair the runs both sides share, keeping the longest list of pairs in the same order on both sides
+     */
+    template<typename Node>
+    std::vector<std::pair<uintptr_t, uintptr_t>> __ropeDiffAnchors(std::vector<__RopeDiffRun<Node>> const runs[2])
+    {
+        std::unordered_map<Node const *, std::vector<uintptr_t>> positions;
+        for (uintptr_t i = runs[1].size(); i-- > 0;) {
+            positions[runs[1][i].node].push_back(i);
+        }
+        std::vector<std::pair<uintptr_t, uintptr_t>> pairs;
+        for (uintptr_t i = 0; i < runs[0].size(); ++i) {
+            auto found = positions.find(runs[0][i].node);
+            if (found != positions.end() && !found->second.empty()) {
+                pairs.push_back({ i, found->second.back() });
+                found->second.pop_back();
+            }
+        }
+
+        // Longest increasing run of positions in the new rope, for subtrees that were moved
+        std::vector<uintptr_t> tails, previous(pairs.size());
+        for (uintptr_t i = 0; i < pairs.size(); ++i) {
+            auto at = std::lower_bound(tails.begin(), tails.end(), i, [&](uintptr_t tail, uintptr_t) {
+                return pairs[tail].second < pairs[i].second;
+            });
+            previous[i] = at != tails.begin() ? *(at - 1) : UINTPTR_MAX;
+            if (at == tails.end()) {
+                tails.push_back(i);
+            } else {
+                *at = i;
+            }
+        }
+        std::vector<std::pair<uintptr_t, uintptr_t>> anchors;
+        for (uintptr_t i = tails.empty() ? UINTPTR_MAX : tails.back(); i != UINTPTR_MAX; i = previous[i]) {
+            anchors.push_back(pairs[i]);
+        }
+        std::reverse(anchors.begin(), anchors.end());
+        return anchors;
+    }
+
+    /**
+     *  The items of a run of one window, as spans of leaf storage
+     */
+    template<typename Item>
+    struct __RopeDiffSpan {
+        Item const *items;
+        uintptr_t count;
+    };
+
+    /**
+     *  The number of items the two lists of spans begin with in common, up to `limit`. Spans of the same storage
+     *  are passed over without reading them.
+     */
+    template<typename Item>
+    uintptr_t __ropeDiffCommonPrefix(
+        std::vector<__RopeDiffSpan<Item>> const &lhs,
+        std::vector<__RopeDiffSpan<Item>> const &rhs,
+        uintptr_t limit)
+    {
+        uintptr_t common = 0, i = 0, j = 0, x = 0, y = 0;
+        while (common < limit) {
+            uintptr_t count = std::min(std::min(lhs[i].count - x, rhs[j].count - y), limit - common);
+            Item const *a = lhs[i].items + x;
+            Item const *b = rhs[j].items + y;
+            if (a != b) {
+                uintptr_t same = std::mismatch(a, a + count, b).first - a;
+                if (same < count) {
+                    return common + same;
+                }
+            }
+            common += count;
+            x += count;
+            y += count;
+            if (x == lhs[i].count) {
+                ++i;
+                x = 0;
+            }
+            if (y == rhs[j].count) {
+                ++j;
+                y = 0;
+            }
+        }
+        return common;
+    }
+
+    /**
+     *  The number of items the two lists of spans end with in common, up to `limit`
+     */
+    template<typename Item>
+    uintptr_t __ropeDiffCommonSuffix(
+        std::vector<__RopeDiffSpan<Item>> const &lhs,
+        std::vector<__RopeDiffSpan<Item>> const &rhs,
+        uintptr_t limit)
+    {
+        uintptr_t common = 0, i = lhs.size(), j = rhs.size(), x = 0, y = 0;
+        while (common < limit) {
+            if (x == 0) {
+                x = lhs[--i].count;
+            }
+            if (y == 0) {
+                y = rhs[--j].count;
+            }
+            uintptr_t count = std::min(std::min(x, y), limit - common);
+            Item const *a = lhs[i].items + x;
+            Item const *b = rhs[j].items + y;
+            if (a != b) {
+                auto different = std::mismatch(std::reverse_iterator<Item const *>(a),
+                                               std::reverse_iterator<Item const *>(a - count),
+                                               std::reverse_iterator<Item const *>(b));
+                uintptr_t same = different.first - std::reverse_iterator<Item const *>(a);
+                if (same < count) {
+                    return common + same;
+                }
+            }
+            common += count;
+            x -= count;
+            y -= count;
+        }
+        return common;
+    }
+
+    /**
+     *  Append edits turning the `n` items at `a`, from offset `offset` of the old rope, into the `m` at `b`.
+     *
+     *  The shortest list of insertions and deletions is traced as Myers' algorithm does, one more change at a time,
+     *  for as many changes as `__ropeDiffMaxTrace` and `__ropeDiffMaxSteps` allow; past them, the items are
+     *  replaced in one edit. Neighbouring insertions and deletions are merged into one edit.
+     */
+    template<typename Item>
+    void __ropeDiffItems(Item const *a, intptr_t n, Item const *b, intptr_t m, uintptr_t offset, std::vector<RopeEdit<Item>> &edits)
+    {
+        intptr_t limit = std::min<intptr_t>(std::min<intptr_t>(n + m, __ropeDiffMaxTrace), __ropeDiffMaxSteps / (n + m + 1) + 1);
+        std::vector<std::vector<intptr_t>> trace;
+        std::vector<intptr_t> furthest(2 * limit + 3, 0);
+        intptr_t const middle = limit + 1;
+        intptr_t changes = -1;
+        for (intptr_t d = 0; d <= limit && changes < 0; ++d) {
+            trace.emplace_back(furthest.begin() + middle - d - 1, furthest.begin() + middle + d + 2);
+            for (intptr_t k = -d; k <= d; k += 2) {
+                intptr_t x = k == -d || (k != d && furthest[middle + k - 1] < furthest[middle + k + 1])
+                           ? furthest[middle + k + 1]
+                           : furthest[middle + k - 1] + 1;
+                intptr_t y = x - k;
+                while (x < n && y < m && a[x] == b[y]) {
+                    ++x;
+                    ++y;
+                }
+                furthest[middle + k] = x;
+                if (x >= n && y >= m) {
+                    changes = d;
+                    break;
+                }
+            }
+        }
+        if (changes < 0) {
+            edits.push_back({ offset, offset + n, std::basic_string<Item>(b, m) });
+            return;
+        }
+
+        // Walk back from the end, collecting each change as a step from the point before it
+        struct Step {
+            intptr_t x;
+            intptr_t y;
+            bool insert;
+        };
+        std::vector<Step> steps;
+        intptr_t x = n, y = m;
+        for (intptr_t d = changes; d > 0; --d) {
+            std::vector<intptr_t> const &before = trace[d];
+            auto at = [&](intptr_t k) { return before[k + d + 1]; };
+            intptr_t k = x - y;
+            bool insert = k == -d || (k != d && at(k - 1) < at(k + 1));
+            intptr_t start_x = insert ? at(k + 1) : at(k - 1);
+            intptr_t start_y = start_x - (insert ? k + 1 : k - 1);
+            steps.push_back({ start_x, start_y, insert });
+            x = start_x;
+            y = start_y;
+        }
+
+        for (auto step = steps.rbegin(); step != steps.rend(); ++step) {
+            uintptr_t at = offset + step->x;
+            if (edits.empty() || edits.back().end != at) {
+                edits.push_back({ at, at, std::basic_string<Item>() });
+            }
+            if (step->insert) {
+                edits.back().items.push_back(b[step->y]);
+            } else {
+                ++edits.back().end;
+            }
+        }
+    }
+
+    /**
+     *  Append edits turning one window of runs into the other, the first starting at offset `offset` of the old rope
+     */
+    template<typename Item, typename Node>
+    void __ropeDiffWindow(
+        __RopeDiffRun<Node> const *from,
+        __RopeDiffRun<Node> const *from_end,
+        __RopeDiffRun<Node> const *to,
+        __RopeDiffRun<Node> const *to_end,
+        uintptr_t offset,
+        std::vector<RopeEdit<Item>> &edits)
+    {
+        std::vector<__RopeDiffSpan<Item>> spans[2];
+        uintptr_t sizes[2] = { 0, 0 };
+        __RopeDiffRun<Node> const *bounds[2][2] = { { from, from_end }, { to, to_end } };
+        for (int side = 0; side < 2; ++side) {
+            auto span = [&](Item const *items, uintptr_t count) {
+                spans[side].push_back({ items, count });
+                sizes[side] += count;
+            };
+            for (auto run = bounds[side][0]; run != bounds[side][1]; ++run) {
+                run->node->each_chunk(0, run->node->size, span);
+            }
+        }
+
+        uintptr_t prefix = __ropeDiffCommonPrefix(spans[0], spans[1], std::min(sizes[0], sizes[1]));
+        uintptr_t suffix = __ropeDiffCommonSuffix(spans[0], spans[1], std::min(sizes[0], sizes[1]) - prefix);
+        if (prefix + suffix == sizes[0] && prefix + suffix == sizes[1]) {
+            return;
+        }
+
+        std::basic_string<Item> middles[2];
+        for (int side = 0; side < 2; ++side) {
+            uintptr_t at = 0;
+            for (auto const &span : spans[side]) {
+                uintptr_t begin = std::max(at, prefix), end = std::min(at + span.count, sizes[side] - suffix);
+                if (begin < end) {
+                    middles[side].append(span.items + (begin - at), end - begin);
+                }
+                at += span.count;
+            }
+        }
+        __ropeDiffItems(middles[0].data(), middles[0].size(), middles[1].data(), middles[1].size(), offset + prefix, edits);
+    }
+
+    /**
+     *  The edits that turn `from` into `to`: sorted, not overlapping and with offsets into `from`, so that
+     *  `from.apply_edits(diff(from, to))` equals `to`.
+     *
+     *  Subtrees the ropes share are matched by pointer without being read, even where the edits before them have
+     *  moved them, so versions of a document that share most of their nodes are diffed in time proportional to
+     *  what changed between them. The windows of items between the shared subtrees are trimmed of what they begin
+     *  and end with in common, skipping spans that are the same storage, and what's left is diffed item by item.
+     *  The edits are minimal within each window, for windows differing in up to `__ropeDiffMaxTrace` items.
+     */
+    template<typename Item, typename MeasureType>
+    std::vector<RopeEdit<Item>> diff(Rope<Item, MeasureType> const &from, Rope<Item, MeasureType> const &to)
+    {
+        using Node = RopeNode<Item, MeasureType>;
+        std::vector<RopeEdit<Item>> edits;
+        Node const *roots[2] = { from.rootNode.get(), to.rootNode.get() };
+        if (roots[0] == roots[1]) {
+            return edits;
+        }
+
+        std::vector<__RopeDiffRun<Node>> runs[2];
+        __ropeDiffRuns(roots, runs);
+        auto anchors = __ropeDiffAnchors(runs);
+        anchors.push_back({ runs[0].size(), runs[1].size() });
+
+        uintptr_t from_next = 0, to_next = 0;
+        for (auto const &anchor : anchors) {
+            if (anchor.first > from_next || anchor.second > to_next) {
+                uintptr_t offset = from_next < runs[0].size() ? runs[0][from_next].offset : from.size();
+                __ropeDiffWindow(runs[0].data() + from_next, runs[0].data() + anchor.first,
+                                 runs[1].data() + to_next, runs[1].data() + anchor.second, offset, edits);
+            }
+            from_next = anchor.first + 1;
+            to_next = anchor.second + 1;
+        }
+        return edits;
+    }
+};
+
+#endif // ROPE_ROPE_DIFF_H
@@ -0,0 +1,104 @@
+#ifndef ROPE_ROPE_EDIT_H
+#define ROPE_ROPE_EDIT_H
+
+#import <string>
+#import <vector>
+#import <memory>
+#import <algorithm>
+#import <cstdint>
+
+#import "slice.hpp"
+
+namespace Rope {
+
+    /**
+     *  Replace the items at offsets [begin, end) with `items`.
+     *  A batch of edits is given in the offsets of the rope before any of them apply.
+     */
+    template<typename Item>
+    struct RopeEdit {
+        uintptr_t begin;
+        uintptr_t end;
+        std::basic_string<Item> items;
+    };
+
+    /**
+     *  Given that `first` is the first edit to change a non-empty range of the original rope ending at `end`,
+     *  find the end of the run of edits that change it, by removing items from it or inserting items into it.
+     *
+     *  Items inserted at a boundary go to the end of the range before it, or to the start of the rope. Empty edits
+     *  at the end of the range are taken with it, so they can't separate the edits that follow them from it.
+     */
+    template<typename Item>
+    RopeEdit<Item> const *
+    __ropeEditsEnd(RopeEdit<Item> const *first, RopeEdit<Item> const *last, uintptr_t end)
+    {
+        while (first != last && (first->begin < end || (first->begin == end && (!first->items.empty() || first->end == end)))) {
+            ++first;
+        }
+        return first;
+    }
+
+    /**
+     *  Skip the edits in [first, last) that end within [0, end), which can't touch anything after it
+     */
+    template<typename Item>
+    RopeEdit<Item> const *
+    __ropeEditsAfter(RopeEdit<Item> const *first, RopeEdit<Item> const *last, uintptr_t end)
+    {
+        while (first != last && first->end <= end) {
+            ++first;
+        }
+        return first;
+    }
+
+    /**
+     *  Whether the first of a node's edits removes all of the node's items, [start, end) in the original rope. The
+     *  node then only contributes the items its edits insert, and needn't be visited.
+     */
+    template<typename Item>
+    bool
+    __ropeEditsCover(RopeEdit<Item> const *first, uintptr_t start, uintptr_t end)
+    {
+        return first->begin <= start && first->end >= end;
+    }
+
+    /**
+     *  Copy the items of a leaf covering [start, start + slice.size()) of the original rope into new storage, with
+     *  the edits in [first, last) applied
+     */
+    template<typename Item>
+    std::shared_ptr<std::vector<Item>>
+    __ropeEditedItems(
+        Slice<Item> const &slice,
+        uintptr_t start,
+        RopeEdit<Item> const *first,
+        RopeEdit<Item> const *last)
+    {
+        uintptr_t length = slice.size();
+        uintptr_t capacity = length;
+        for (auto edit = first; edit != last; ++edit) {
+            capacity += edit->items.size();
+        }
+
+        auto items = std::make_shared<std::vector<Item>>();
+        items->reserve(capacity);
+
+        uintptr_t cursor = 0;
+        for (auto edit = first; edit != last; ++edit) {
+            uintptr_t begin = std::min(std::max(edit->begin, start) - start, length);
+            uintptr_t end = std::min(std::max(edit->end, start) - start, length);
+            if (begin > cursor) {
+                items->insert(items->end(), slice.begin() + cursor, slice.begin() + begin);
+            }
+            if (edit->begin > start || edit->begin == 0) {
+                items->insert(items->end(), edit->items.begin(), edit->items.end());
+            }
+            cursor = std::max(cursor, end);
+        }
+        items->insert(items->end(), slice.begin() + cursor, slice.end());
+        return items;
+    }
+}
+
+#endif // ROPE_ROPE_EDIT_H
@@ -0,0 +1,297 @@
+#ifndef ROPE_ROPE_FILE_H
+#define ROPE_ROPE_FILE_H
+
+#import <string>
+#import <vector>
+#import <unordered_map>
+#import <stdexcept>
+#import <type_traits>
+#import <cstring>
+#import <cstdint>
+
+#import "rope_node.hpp"
+#import "rope_btree_node.hpp"
+#import "mapped_file.hpp"
+#import "file_writer.hpp"
+
+namespace Rope {
+
+    /**
+     *  The end of a saved rope. A saved rope is laid out as
+     *
+     *      items       every leaf's items, each leaf once however many times the rope refers to it
+     *      table       a record per node, every node's children before it and the root last
+     *      trailer     this
+     *
+     *  A leaf's record is its size, 0 and the index of its first item, followed by its measure if the rope's policy
+     *  serializes measures. A branch's record is its size, its number of children and the indices of their records.
+     *  Fields are 64 bits wide, in the byte order of the machine the rope was saved on.
+     */
+    struct __RopeFileTrailer {
+        char magic[8];
+        uint64_t version;
+        uint64_t item_size;
+        uint64_t fanout;        // 2 for binary ropes
+        uint64_t measured;
+        uint64_t nodes;
+        uint64_t items;
+        uint64_t table_size;
+    };
+
+    static char const __ropeFileMagic[8] = { 'R', 'O', 'P', 'E', 'F', 'I', 'L', 'E' };
+
+    /**
+     *  2: line measures count a CR at the end of a leaf
+     */
+    static uint64_t const __ropeFileVersion = 2;
+
+    /**
+     *  How a node layout's branches are saved and rebuilt
+     */
+    template<typename Node>
+    struct __RopeFileLayout {
+        using Shared = typename Node::Allocation::template pointer<Node>;
+
+        static constexpr uint64_t fanout = 2;
+
+        static bool fits(Shared const *children, uintptr_t count)
+        {
+            return count == 2;
+        }
+
+        static Shared branch(Shared const *children, uintptr_t count, typename Node::CallbacksType const &callbacks)
+        {
+            return Node::Allocation::template make<Node>(children[0], children[1], callbacks);
+        }
+    };
+
+    template<typename Item, typename Policy, size_t Fanout>
+    struct __RopeFileLayout<RopeNode<Item, BTreePolicy<Policy, Fanout>>> {
+        using Node = RopeNode<Item, BTreePolicy<Policy, Fanout>>;
+        using Shared = typename Node::Allocation::template pointer<Node>;
+
+        static constexpr uint64_t fanout = Fanout;
+
+        static bool fits(Shared const *children, uintptr_t count)
+        {
+            if (count == 0 || count > Fanout) {
+                return false;
+            }
+            for (uintptr_t i = 1; i < count; ++i) {
+                if (children[i]->height != children[0]->height) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        static Shared branch(Shared const *children, uintptr_t count, typename Node::CallbacksType const &callbacks)
+        {
+            return Node::Allocation::template make<Node>(children, count, callbacks);
+        }
+    };
+
+    template<typename Node>
+    void __ropeFileMeasure(Node const *leaf, std::string &table, std::true_type)
+    {
+        Node::CallbacksType::serialize(leaf->measure(), table);
+    }
+
+    template<typename Node>
+    void __ropeFileMeasure(Node const *, std::string &, std::false_type) {}
+
+    template<typename Node, typename ItemSlice>
+    typename Node::Allocation::template pointer<Node> __ropeFileLeaf(
+        ItemSlice const &slice,
+        char const *&in,
+        bool measured,
+        typename Node::CallbacksType const &callbacks,
+        std::true_type)
+    {
+        if (measured) {
+            return Node::Allocation::template make<Node>(slice, Node::CallbacksType::deserialize(in), callbacks);
+        }
+        return Node::Allocation::template make<Node>(slice, callbacks);
+    }
+
+    template<typename Node, typename ItemSlice>
+    typename Node::Allocation::template pointer<Node> __ropeFileLeaf(
+        ItemSlice const &slice,
+        char const *&,
+        bool,
+        typename Node::CallbacksType const &callbacks,
+        std::false_type)
+    {
+        return Node::Allocation::template make<Node>(slice, callbacks);
+    }
+
+    /**
+     *  Save the rope below `root` to `path`. Leaves' items are written as the walk reaches them, and the table,
+     *  which holds a few words per node, is kept in memory and written after them.
+     */
+    template<typename Item, typename Node>
+    void __ropeSave(Node const *root, std::string const &path)
+    {
+        static_assert(std::is_trivially_copyable<Item>::value, "Only ropes of plain items can be saved");
+        using Serialized = std::integral_constant<bool, Node::Traits::serialized>;
+
+        FileWriter file(path);
+        std::string table;
+        std::unordered_map<Node const *, uint64_t> indices;
+        uint64_t items = 0;
+
+        struct Frame {
+            Node const *node;
+            bool opened;
+        };
+        std::vector<Frame> stack { { root, false } };
+        std::vector<Node const *> children;
+        while (!stack.empty()) {
+            Node const *node = stack.back().node;
+            if (indices.count(node) > 0) {
+                stack.pop_back();
+                continue;
+            }
+
+            // Children go on the stack last first, so leaves are written in order
+            if (node->node_type == RopeNodeTypeBranch && !stack.back().opened) {
+                stack.back().opened = true;
+                children.clear();
+                node->each_child([&children](Node const *child) { children.push_back(child); });
+                for (auto child = children.rbegin(); child != children.rend(); ++child) {
+                    stack.push_back({ *child, false });
+                }
+                continue;
+            }
+            stack.pop_back();
+
+            __measureWrite(table, uint64_t(node->size));
+            if (node->node_type == RopeNodeTypeLeaf) {
+                __measureWrite(table, uint64_t(0));
+                __measureWrite(table, items);
+                __ropeFileMeasure(node, table, Serialized());
+                file.write(node->leaf_data->data(), node->size * sizeof(Item));
+                items += node->size;
+            } else {
+                uint64_t count = 0;
+                node->each_child([&count](Node const *) { ++count; });
+                __measureWrite(table, count);
+                node->each_child([&](Node const *child) { __measureWrite(table, indices.at(child)); });
+            }
+            uint64_t index = indices.size();
+            indices[node] = index;
+        }
+
+        __RopeFileTrailer trailer;
+        memcpy(trailer.magic, __ropeFileMagic, sizeof(trailer.magic));
+        trailer.version = __ropeFileVersion;
+        trailer.item_size = sizeof(Item);
+        trailer.fanout = __RopeFileLayout<Node>::fanout;
+        trailer.measured = Serialized::value;
+        trailer.nodes = indices.size();
+        trailer.items = items;
+        trailer.table_size = table.size();
+        file.write(table.data(), table.size());
+        file.write(&trailer, sizeof(trailer));
+        file.commit();
+    }
+
+    /**
+     *  Rebuild a rope saved by `__ropeSave` over a mapping of the file. Leaves are slices of the mapping, and
+     *  branches are built over them bottom up, so no items are read unless leaves have to be measured or hashed.
+     */
+    template<typename Item, typename Node>
+    typename Node::Allocation::template pointer<Node> __ropeLoad(
+        std::string const &path,
+        typename Node::CallbacksType const &callbacks)
+    {
+        static_assert(std::is_trivially_copyable<Item>::value, "Only ropes of plain items can be loaded");
+        using Allocation = typename Node::Allocation;
+        using Shared = typename Allocation::template pointer<Node>;
+        using Layout = __RopeFileLayout<Node>;
+        using Serialized = std::integral_constant<bool, Node::Traits::serialized>;
+
+        auto file = MappedFile::open(path);
+        auto fail = [&path](char const *reason) {
+            return std::runtime_error(path + ": " + reason);
+        };
+
+        __RopeFileTrailer trailer;
+        uint64_t length = file->size();
+        if (length < sizeof(trailer)) {
+            throw fail("not a saved rope");
+        }
+        memcpy(&trailer, file->data() + length - sizeof(trailer), sizeof(trailer));
+        if (memcmp(trailer.magic, __ropeFileMagic, sizeof(trailer.magic)) != 0 || trailer.version != __ropeFileVersion) {
+            throw fail("not a saved rope");
+        }
+        if (trailer.item_size != sizeof(Item) || trailer.fanout != Layout::fanout) {
+            throw fail("saved from a rope of another item type or node layout");
+        }
+        if (trailer.measured && !Serialized::value) {
+            throw fail("saved with measures this rope's policy can't read");
+        }
+        uint64_t body = length - sizeof(trailer);
+        if (trailer.table_size > body || trailer.items != (body - trailer.table_size) / sizeof(Item)
+                || trailer.items * sizeof(Item) + trailer.table_size != body) {
+            throw fail("damaged");
+        }
+
+        Item const *items = reinterpret_cast<Item const *>(file->data());
+        char const *in = file->data() + body - trailer.table_size;
+        char const *end = in + trailer.table_size;
+        uint64_t const field = sizeof(uint64_t);
+
+        std::vector<Shared> nodes;
+        nodes.reserve(std::min(trailer.nodes, trailer.table_size / (3 * field)));
+        std::vector<Shared> children;
+        while (in != end) {
+            uint64_t size, count;
+            if (uint64_t(end - in) < 3 * field) {
+                throw fail("damaged");
+            }
+            __measureRead(in, size);
+            __measureRead(in, count);
+
+            if (count == 0) {
+                uint64_t first;
+                __measureRead(in, first);
+                if (first > trailer.items || size > trailer.items - first) {
+                    throw fail("damaged");
+                }
+                auto slice = Allocation::template make<Slice<Item>>(file, items + first, items + first + size);
+                nodes.push_back(__ropeFileLeaf<Node>(slice, in, trailer.measured, callbacks, Serialized()));
+                if (in > end) {
+                    throw fail("damaged");
+                }
+                continue;
+            }
+
+            if (count > uint64_t(end - in) / field) {
+                throw fail("damaged");
+            }
+            children.clear();
+            uint64_t total = 0;
+            for (uint64_t i = 0; i < count; ++i) {
+                uint64_t index;
+                __measureRead(in, index);
+                if (index >= nodes.size()) {
+                    throw fail("damaged");
+                }
+                children.push_back(nodes[index]);
+                total += nodes[index]->size;
+            }
+            if (total != size || !Layout::fits(children.data(), count)) {
+                throw fail("damaged");
+            }
+            nodes.push_back(Layout::branch(children.data(), count, callbacks));
+        }
+
+        if (nodes.empty() || nodes.size() != trailer.nodes) {
+            throw fail("damaged");
+        }
+        return nodes.back();
+    }
+};
+
+#endif // ROPE_ROPE_FILE_H
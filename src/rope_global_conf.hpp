@@ -6,6 +6,11 @@
 namespace Rope
 {
     static uintptr_t ROPE_GLOBAL_MAX_LEAF_CAP = sysconf(_SC_PAGESIZE);
+
+    /**
+     *  Slices long enough for this many leaves have their leaves measured on the current `ThreadPool`
+     */
+    static uintptr_t const ROPE_GLOBAL_PARALLEL_MIN_LEAVES = 64;
 }
 
 #endif // ROPE_ROPE_GLOBAL_CONF_H
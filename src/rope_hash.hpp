@@ -0,0 +1,165 @@
+#ifndef ROPE_ROPE_HASH_H
+#define ROPE_ROPE_HASH_H
+
+#import <cstdint>
+#import <functional>
+#import <random>
+#import <type_traits>
+
+namespace Rope {
+
+    /**
+     *  Arithmetic modulo the Mersenne prime 2^61 - 1, which reduces with shifts and adds rather than a division
+     */
+    constexpr uint64_t __ropeHashPrime = (uint64_t(1) << 61) - 1;
+
+    inline uint64_t __ropeHashReduce(unsigned __int128 value)
+    {
+        unsigned __int128 folded = (value & __ropeHashPrime) + (value >> 61);
+        uint64_t reduced = uint64_t(folded & __ropeHashPrime) + uint64_t(folded >> 61);
+        return reduced >= __ropeHashPrime ? reduced - __ropeHashPrime : reduced;
+    }
+
+    inline uint64_t __ropeHashMul(uint64_t lhs, uint64_t rhs)
+    {
+        return __ropeHashReduce(static_cast<unsigned __int128>(lhs) * rhs);
+    }
+
+    inline uint64_t __ropeHashAdd(uint64_t lhs, uint64_t rhs)
+    {
+        uint64_t sum = lhs + rhs;
+        return sum >= __ropeHashPrime ? sum - __ropeHashPrime : sum;
+    }
+
+    /**
+     *  The base the hashes are polynomials in, with its first powers.
+     *
+     *  It's drawn at random once per process, so no fixed set of inputs collides more often than chance: two
+     *  different sequences of `n` items hash alike with probability under `n / 2^61`. Hashes are therefore only
+     *  comparable within one process.
+     */
+    struct __RopeHashKey {
+        static constexpr uintptr_t block = 8;
+
+        uint64_t powers[block + 1];
+
+        __RopeHashKey()
+        {
+            std::random_device device;
+            uint64_t base = (uint64_t(device()) << 32 | device()) % (__ropeHashPrime - 256) + 256;
+            powers[0] = 1;
+            for (uintptr_t i = 1; i <= block; ++i) {
+                powers[i] = __ropeHashMul(powers[i - 1], base);
+            }
+        }
+
+        static __RopeHashKey const &shared()
+        {
+            static __RopeHashKey const key;
+            return key;
+        }
+    };
+
+    /**
+     *  An item as a residue: integers by value, and anything else by `std::hash`
+     */
+    template<typename Item>
+    typename std::enable_if<std::is_integral<Item>::value, uint64_t>::type __ropeHashItem(Item item)
+    {
+        return static_cast<uint64_t>(static_cast<typename std::make_unsigned<Item>::type>(item)) % __ropeHashPrime;
+    }
+
+    template<typename Item>
+    typename std::enable_if<!std::is_integral<Item>::value, uint64_t>::type __ropeHashItem(Item const &item)
+    {
+        return static_cast<uint64_t>(std::hash<Item>()(item)) % __ropeHashPrime;
+    }
+
+    /**
+     *  The polynomial hash of a run of items, `x[0] * B^(n-1) + ... + x[n-1]` modulo 2^61 - 1, with `B^n` kept
+     *  alongside it so that the hash of two runs joined is found from theirs in constant time.
+     */
+    struct RopeHash {
+        uint64_t value;
+        uint64_t power;
+
+        /**
+         *  The hash of no items
+         */
+        static RopeHash identity()
+        {
+            return { 0, 1 };
+        }
+
+        /**
+         *  The hash of `lhs`'s items followed by `rhs`'s
+         */
+        static RopeHash join(RopeHash const &lhs, RopeHash const &rhs)
+        {
+            return { __ropeHashAdd(__ropeHashMul(lhs.value, rhs.power), rhs.value), __ropeHashMul(lhs.power, rhs.power) };
+        }
+
+        /**
+         *  Hash `count` items. Blocks of eight are summed against the base's powers in 128 bits and reduced once,
+         *  so the chain from one block to the next is a single multiplication.
+         */
+        template<typename Item>
+        static RopeHash of(Item const *items, uintptr_t count)
+        {
+            __RopeHashKey const &key = __RopeHashKey::shared();
+            uintptr_t const block = __RopeHashKey::block;
+            RopeHash hash = identity();
+            uintptr_t i = 0;
+            for (; i + block <= count; i += block) {
+                unsigned __int128 sum = 0;
+                for (uintptr_t j = 0; j < block; ++j) {
+                    sum += static_cast<unsigned __int128>(__ropeHashItem(items[i + j])) * key.powers[block - 1 - j];
+                }
+                hash.value = __ropeHashAdd(__ropeHashMul(hash.value, key.powers[block]), __ropeHashReduce(sum));
+                hash.power = __ropeHashMul(hash.power, key.powers[block]);
+            }
+            for (; i < count; ++i) {
+                hash.value = __ropeHashAdd(__ropeHashMul(hash.value, key.powers[1]), __ropeHashItem(items[i]));
+                hash.power = __ropeHashMul(hash.power, key.powers[1]);
+            }
+            return hash;
+        }
+
+        bool operator==(RopeHash const &other) const
+        {
+            return value == other.value && power == other.power;
+        }
+
+        bool operator!=(RopeHash const &other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    /**
+     *  A node's hash, kept for policies wrapped in `HashedPolicy` and absent otherwise
+     */
+    template<bool Hashed>
+    class __RopeHashCell
+    {
+    public:
+        RopeHash const &get() const { return hash; }
+
+        void set(RopeHash const &value) { hash = value; }
+
+    private:
+        RopeHash hash;
+    };
+
+    template<>
+    class __RopeHashCell<false>
+    {
+    public:
+        // Only compiled into branches that check `hashed` first, so never called
+        RopeHash get() const { return RopeHash::identity(); }
+
+        void set(RopeHash const &) {}
+    };
+};
+
+#endif // ROPE_ROPE_HASH_H
@@ -0,0 +1,310 @@
+#ifndef ROPE_ROPE_HISTORY_H
+#define ROPE_ROPE_HISTORY_H
+
+#import <vector>
+#import <unordered_map>
+#import <stdexcept>
+#import <algorithm>
+#import <cstdint>
+
+#import "rope.hpp"
+
+namespace Rope {
+
+    /**
+     *  How `RopeHistory::prune` makes room
+     */
+    enum class HistoryPruning {
+        DropOldest,     // forget the oldest versions
+        Coalesce,       // first thin out older versions, to reach further back with fewer of them
+    };
+
+    /**
+     *  The memory held by a history's versions, in bytes. Nodes and item storage reachable from more than one
+     *  version are counted once, as shared; the rest is unique to the one version that reaches it.
+     */
+    struct HistoryUsage {
+        uintptr_t total;
+        uintptr_t shared;
+        std::vector<uintptr_t> unique;      // by version, oldest first
+    };
+
+    /**
+     *  The versions of a document, as ropes sharing every node an edit didn't copy.
+     *
+     *  Committing, undoing, redoing and checking out a version only move a root, since ropes are never modified in
+     *  place; a version costs the nodes its edit copied. Versions are numbered in the order they're committed,
+     *  from 0 for the initial rope. Committing after an undo forgets the versions that could have been redone.
+     */
+    template<typename Item, typename MeasureType>
+    class RopeHistory {
+    public:
+        using RopeType = Rope<Item, MeasureType>;
+        using NodeType = RopeNode<Item, MeasureType>;
+        using VersionId = uint64_t;
+
+        explicit RopeHistory(RopeType const &initial)
+        :   next_id(1),
+            index(0)
+        {
+            versions.push_back(Version { 0, initial });
+        }
+
+        RopeType const &current() const { return versions[index].rope; }
+
+        VersionId current_version() const { return versions[index].id; }
+
+        /**
+         *  The number of versions held
+         */
+        uintptr_t size() const { return versions.size(); }
+
+        /**
+         *  The versions held, oldest first
+         */
+        std::vector<VersionId> version_ids() const
+        {
+            std::vector<VersionId> ids;
+            for (auto &version : versions) {
+                ids.push_back(version.id);
+            }
+            return ids;
+        }
+
+        /**
+         *  Record `rope` as a new version after the current one, and make it current
+         */
+        VersionId commit(RopeType const &rope)
+        {
+            versions.erase(versions.begin() + index + 1, versions.end());
+            versions.push_back(Version { next_id++, rope });
+            index = versions.size() - 1;
+            return versions[index].id;
+        }
+
+        bool can_undo() const { return index > 0; }
+
+        bool can_redo() const { return index + 1 < versions.size(); }
+
+        /**
+         *  Step back to the previous version, if there is one
+         */
+        RopeType const &undo()
+        {
+            if (can_undo()) {
+                --index;
+            }
+            return current();
+        }
+
+        /**
+         *  Step forward to the next version, if there is one
+         */
+        RopeType const &redo()
+        {
+            if (can_redo()) {
+                ++index;
+            }
+            return current();
+        }
+
+        /**
+         *  Make version `id` current. Throws `std::out_of_range` if it was pruned, forgotten or never committed.
+         */
+        RopeType const &checkout(VersionId id)
+        {
+            auto it = std::lower_bound(versions.begin(), versions.end(), id, [](Version const &version, VersionId id) {
+                return version.id < id;
+            });
+            if (it == versions.end() || it->id != id) {
+                throw std::out_of_range("RopeHistory: no such version");
+            }
+            index = it - versions.begin();
+            return current();
+        }
+
+        /**
+         *  Measure the memory held by the versions, and how much of it they share
+         */
+        HistoryUsage usage() const
+        {
+            Tally tally(versions.size());
+            for (uintptr_t i = 0; i < versions.size(); ++i) {
+                tally.add(i, versions[i].rope.rootNode.get());
+            }
+            return tally.usage;
+        }
+
+        /**
+         *  Forget versions until those left hold at most `budget` bytes, as measured by `usage`. The current version
+         *  and those after it are always kept, so they may still exceed the budget.
+         */
+        void prune(uintptr_t budget, HistoryPruning pruning = HistoryPruning::DropOldest)
+        {
+            if (pruning == HistoryPruning::Coalesce && usage().total > budget) {
+                coalesce();
+            }
+            drop_oldest(budget);
+        }
+
+    private:
+        struct Version {
+            VersionId id;
+            RopeType rope;
+        };
+
+        /**
+         *  Accumulates the memory reached by versions walked one at a time, in any order.
+         *
+         *  Each node and storage block remembers the first version to reach it. Reaching it from another version
+         *  makes it shared, along with everything below it, so a walk stops at anything already shared and each
+         *  node is visited at most twice however many versions reach it.
+         */
+        class Tally {
+        public:
+            HistoryUsage usage;
+
+            explicit Tally(uintptr_t version_count)
+            {
+                usage.total = 0;
+                usage.shared = 0;
+                usage.unique.assign(version_count, 0);
+            }
+
+            void add(uintptr_t version, NodeType const *root)
+            {
+                visit(version, root, false);
+            }
+
+        private:
+            struct Reach {
+                uintptr_t version;
+                bool shared;
+            };
+
+            struct StorageReach : Reach {
+                Item const *begin;          // the extent of the items any leaf refers to, which the storage retains
+                Item const *end;
+            };
+
+            std::unordered_map<NodeType const *, Reach> nodes;
+            std::unordered_map<void const *, StorageReach> storage;
+
+            /**
+             *  Count `bytes` more for whatever `reach` describes
+             */
+            void count(Reach &reach, uintptr_t bytes)
+            {
+                (reach.shared ? usage.shared : usage.unique[reach.version]) += bytes;
+            }
+
+            /**
+             *  Move the `bytes` counted for whatever `reach` describes from its first version to the shared total
+             */
+            void share(Reach &reach, uintptr_t bytes)
+            {
+                if (!reach.shared) {
+                    usage.unique[reach.version] -= bytes;
+                    usage.shared += bytes;
+                    reach.shared = true;
+                }
+            }
+
+            void visit(uintptr_t version, NodeType const *node, bool shared)
+            {
+                auto found = nodes.emplace(node, Reach { version, shared });
+                Reach &reach = found.first->second;
+                if (found.second) {
+                    count(reach, node->footprint());
+                    usage.total += node->footprint();
+                } else if (reach.shared || (reach.version == version && !shared)) {
+                    return;
+                } else {
+                    share(reach, node->footprint());
+                    shared = true;
+                }
+
+                if (node->leaf_data && node->leaf_data->size() > 0) {
+                    visit_storage(version, *node->leaf_data, shared);
+                }
+                node->each_child([&](NodeType const *child) {
+                    visit(version, child, shared);
+                });
+            }
+
+            void visit_storage(uintptr_t version, Slice<Item> const &slice, bool shared)
+            {
+                StorageReach initial;
+                initial.version = version;
+                initial.shared = shared;
+                initial.begin = slice.begin();
+                initial.end = slice.begin();
+                auto found = storage.emplace(slice.storage(), initial);
+                StorageReach &reach = found.first->second;
+                if (!found.second && (shared || reach.version != version)) {
+                    share(reach, (reach.end - reach.begin) * sizeof(Item));
+                }
+
+                uintptr_t before = reach.end - reach.begin;
+                reach.begin = std::min(reach.begin, slice.begin());
+                reach.end = std::max(reach.end, slice.end());
+                uintptr_t growth = (reach.end - reach.begin - before) * sizeof(Item);
+                count(reach, growth);
+                usage.total += growth;
+            }
+        };
+
+        std::vector<Version> versions;
+        VersionId next_id;
+        uintptr_t index;
+
+        /**
+         *  Thin out the versions before the current one, keeping fewer the older they are: all of the 8 before it,
+         *  and then 8 evenly spaced versions of each 2^k to 2^(k+1) steps back
+         */
+        void coalesce()
+        {
+            uintptr_t kept = 0;
+            uintptr_t current = index;
+            for (uintptr_t i = 0; i < versions.size(); ++i) {
+                uintptr_t distance = i < current ? current - i : 0;
+                uintptr_t band = distance;
+                while (band & (band - 1)) {
+                    band &= band - 1;
+                }
+                if (distance > 8 && distance % (band / 8) != 0) {
+                    continue;
+                }
+                if (i == current) {
+                    index = kept;
+                }
+                versions[kept++] = versions[i];
+            }
+            versions.erase(versions.begin() + kept, versions.end());
+        }
+
+        /**
+         *  Forget the oldest versions, walking back from the newest to find how many fit
+         */
+        void drop_oldest(uintptr_t budget)
+        {
+            Tally tally(versions.size());
+            tally.add(index, versions[index].rope.rootNode.get());
+            uintptr_t first = index;
+            for (uintptr_t i = versions.size(); i-- > 0;) {
+                if (i == index) {
+                    continue;
+                }
+                tally.add(i, versions[i].rope.rootNode.get());
+                if (tally.usage.total > budget) {
+                    break;
+                }
+                first = std::min(first, i);
+            }
+            versions.erase(versions.begin(), versions.begin() + first);
+            index -= first;
+        }
+    };
+};
+
+#endif // ROPE_ROPE_HISTORY_H
@@ -1,11 +1,12 @@
 #ifndef ROPE_ROPE_ITER_H
 #define ROPE_ROPE_ITER_H
 
-#import <list>
+#import <algorithm>
+#import <assert.h>
 
+#import "measure.hpp"
 #import "rope_node_type.hpp"
 
-using std::list;
 using std::function;
 using std::shared_ptr;
 
@@ -15,27 +16,205 @@ namespace Rope {
      */
     template<typename Item, typename MeasureType>
     class RopeNode;
+
+    /**
+     *  Selects the callbacks and the measureable value used by an iterator.
+     *  Iterators over `uintptr_t` move by item, iterators over `MeasureComponent<I>` move by one component of a
+     *  composite measure, and any other iterator moves by the node's measure.
+     */
+    template<typename Item, typename MeasureType, typename IterMeasureType>
+    struct MeasureIteratorTraits
+    {
+        using CallbacksType = typename MeasureTraits<MeasureType, Item>::iterator_callbacks_type;
+        using MeasureableType = IterMeasureType;
+
+        /**
+         *  `direct_index` iterators' targets are offsets into the leaf. Otherwise the callbacks' `index` finds the
+         *  offset, resuming from the last one found if `incremental_index` is set.
+         */
+        static constexpr bool direct_index = false;
+        static constexpr bool incremental_index = __MeasureIncrementalIndex<CallbacksType>::value;
+
+        /**
+         *  Pick the measureable value out of a node's (or a child slot's) measure and size
+         */
+        static MeasureableType const &select(IterMeasureType const &measure, uintptr_t const &size) { return measure; }
+
+        static MeasureableType const &measureable(const RopeNode<Item, MeasureType> &rope)
+        {
+            return select(rope.measure(), rope.size);
+        }
+    };
+
+    template<typename Item, typename MeasureType>
+    struct MeasureIteratorTraits<Item, MeasureType, uintptr_t>
+    {
+        using CallbacksType = ItemPolicy<Item>;
+        using MeasureableType = uintptr_t;
+
+        static constexpr bool direct_index = true;
+        static constexpr bool incremental_index = true;
+
+        template<typename M>
+        static MeasureableType const &select(M const &measure, uintptr_t const &size) { return size; }
+
+        static MeasureableType const &measureable(const RopeNode<Item, MeasureType> &rope)
+        {
+            return rope.size;
+        }
+    };
+
+    template<typename Item, typename MeasureType, size_t I>
+    struct MeasureIteratorTraits<Item, MeasureType, MeasureComponent<I>>
+    {
+        using CallbacksType = typename MeasureType::template component<I>;
+        using MeasureableType = typename CallbacksType::measure_type;
+
+        static constexpr bool direct_index = false;
+        static constexpr bool incremental_index = __MeasureIncrementalIndex<CallbacksType>::value;
+
+        static MeasureableType const &select(typename MeasureType::measure_type const &measure, uintptr_t const &size)
+        {
+            return std::get<I>(measure);
+        }
+
+        static MeasureableType const &measureable(const RopeNode<Item, MeasureType> &rope)
+        {
+            return select(rope.measure(), rope.size);
+        }
+    };
     
+    /**
+     *  Path from the root of a rope down to one of its nodes.
+     *  The first `Capacity` entries are held inline, so copying a path only allocates for very deep ropes.
+     */
+    template<typename Entry, size_t Capacity>
+    class __IterPath
+    {
+    public:
+        __IterPath()
+        :   entries(inline_entries),
+            count(0),
+            capacity(Capacity)
+        {}
+
+        __IterPath(__IterPath const &other)
+        :   __IterPath()
+        {
+            assign(other);
+        }
+
+        __IterPath &operator=(__IterPath const &other)
+        {
+            if (this != &other) {
+                assign(other);
+            }
+            return *this;
+        }
+
+        ~__IterPath()
+        {
+            if (entries != inline_entries) {
+                delete[] entries;
+            }
+        }
+
+        uintptr_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        Entry &front() { return entries[0]; }
+        Entry const &front() const { return entries[0]; }
+        Entry &back() { return entries[count - 1]; }
+        Entry const &back() const { return entries[count - 1]; }
+
+        Entry *begin() { return entries; }
+        Entry const *begin() const { return entries; }
+        Entry *end() { return entries + count; }
+        Entry const *end() const { return entries + count; }
+
+        void push_back(Entry const &entry)
+        {
+            if (count == capacity) {
+                reserve(capacity * 2);
+            }
+            entries[count++] = entry;
+        }
+
+        void pop_back() { --count; }
+
+        void pop_front()
+        {
+            std::copy(entries + 1, entries + count, entries);
+            --count;
+        }
+
+    private:
+        Entry *entries;
+        uintptr_t count;
+        uintptr_t capacity;
+        Entry inline_entries[Capacity];
+
+        void reserve(uintptr_t n)
+        {
+            if (n <= capacity) {
+                return;
+            }
+            Entry *grown = new Entry[n];
+            std::copy(entries, entries + count, grown);
+            if (entries != inline_entries) {
+                delete[] entries;
+            }
+            entries = grown;
+            capacity = n;
+        }
+
+        void assign(__IterPath const &other)
+        {
+            count = 0;
+            reserve(other.count);
+            std::copy(other.begin(), other.end(), entries);
+            count = other.count;
+        }
+    };
+
+    /**
+     *  Paths deeper than this spill to the heap. Balanced binary ropes of 2^20 leaves are about 29 nodes deep.
+     */
+    static size_t const ROPE_ITER_INLINE_DEPTH = 32;
+
+    /**
+     *  Cursor over a rope in the coordinates of `IterMeasureType`.
+     *
+     *  The iterator keeps its path from the root to the current leaf, and remembers the leaf's extent. Moving within
+     *  the leaf only changes `position`; the path is only walked when the iterator leaves it.
+     */
     template<typename Item, typename MeasureType, typename IterMeasureType>
     class MeasureIterator
     {
     private:
         using __RopeNode = RopeNode<Item, MeasureType>;
         using This = MeasureIterator<Item, MeasureType, IterMeasureType>;
+        using Traits = MeasureIteratorTraits<Item, MeasureType, IterMeasureType>;
 
         struct IterNode
         {
             __RopeNode *rope;
-            uintptr_t  target;
-            
-            IterNode(__RopeNode *rope, uintptr_t target)
+            uintptr_t  start;   // position of the node's first unit, so the target within it is `position - start`
+            uintptr_t  base;    // number of items preceding the node
+            uintptr_t  bound;   // target past which the rest of the rope takes over, if below the node's measure
+
+            IterNode() = default;
+
+            IterNode(__RopeNode *rope, uintptr_t start, uintptr_t base, uintptr_t bound)
             :   rope(rope),
-                target(target)
+                start(start),
+                base(base),
+                bound(bound)
             {}
         };
 
     public:
-        using CallbacksType = IteratorCallbacks<IterMeasureType, Item>;
+        using CallbacksType = typename Traits::CallbacksType;
 
         /**
          *  Callbacks used to create and join measures
@@ -43,121 +222,180 @@ namespace Rope {
         CallbacksType callbacks;
         
         /**
-         *  Callback used to get a measureable value from a rope node.
+         *  Get a measureable value from a rope node.
          */
-        function<IterMeasureType (const __RopeNode &)> get_measureable;
+        static typename Traits::MeasureableType const &get_measureable(const __RopeNode &rope)
+        {
+            return Traits::measureable(rope);
+        }
         
         /**
          *  Stack of iteration nodes marking the path through the tree to the current item.
          */
-        list<IterNode> nodes;
-        
+        __IterPath<IterNode, ROPE_ITER_INLINE_DEPTH> nodes;
+
+    private:
         /**
-         * Get the most concrete node in the
+         *  Target of the iterator, relative to the root it was created on
          */
-        IterNode current_node() const
+        uintptr_t position;
+
+        /**
+         *  The leaf at the end of `nodes` and its extent, or null until the iterator next descends
+         */
+        __RopeNode *leaf;
+        Item const *leaf_items;
+        uintptr_t leaf_size;
+        uintptr_t leaf_start;
+        uintptr_t leaf_cap;
+
+        /**
+         *  The last target looked up in the leaf, and its offset. A leaf may begin part way through an item's
+         *  encoding, so the first lookup in a leaf always starts from the leaf's first item.
+         */
+        mutable bool index_valid;
+        mutable uintptr_t index_target;
+        mutable uintptr_t index_offset;
+
+        uintptr_t cap(IterNode const &node) const
         {
-            return nodes.back();
+            return std::min(callbacks.predicate(get_measureable(*node.rope)), node.bound);
         }
-        
-        void push_to_leaf()
+
+        uintptr_t target(IterNode const &node) const
         {
-            __RopeNode *rope = nullptr;
-            uintptr_t target = 0;
-            assert(current_node().rope != nullptr);
-            while (rope = current_node().rope,
-                   target = current_node().target,
-                   rope->node_type == RopeNodeTypeBranch) {
-                int lcap =  rope->branch_data.left != nullptr
-                          ? callbacks.predicate(get_measureable(*rope->branch_data.left))
-                          : 0;
-                if (target < lcap) {
-                    // Push down left
-                    assert(rope->branch_data.left != nullptr);
-                    
-                    nodes.push_back(IterNode(rope->branch_data.left.get(), target));
-                } else {
-                    int ccap = callbacks.predicate(get_measureable(*rope));
-                    int rcap = rope->branch_data.right != nullptr ? callbacks.predicate(get_measureable(*rope->branch_data.right)) : 0;
-                    target -= lcap;
-                    target += (lcap + rcap) - ccap;
-
-                    // Push down right
-                    assert(rope->branch_data.right != nullptr);
-                    
-                    nodes.push_back(IterNode(rope->branch_data.right.get(), target));
-                }
-            }
+            return position - node.start;
         }
-        
-        uintptr_t raw_index() const
+
+        void __descend()
         {
-            uintptr_t ret = 0;
-            
-            for (auto it = nodes.begin(); it != nodes.end(); ++ it) {
-                if (it->rope->node_type == RopeNodeTypeBranch) {
-                    auto next = (++it)->rope;
-                    --it;
-                    if (next == it->rope->branch_data.right.get()) {
-                        ret += it->rope->branch_data.left->size;
-                    }
-                } else {
-                    int acc = callbacks.index(*current_node().rope->leaf_data, current_node().target);
-                    ret += acc > 0 ? acc : 0;
-                }
+            while (nodes.back().rope->node_type == RopeNodeTypeBranch) {
+                IterNode const &node = nodes.back();
+                uintptr_t before = target(node);
+                uintptr_t after = before;
+                uintptr_t bound = node.bound;
+                __RopeNode *child = node.rope->template descend<Traits>(after, bound, callbacks);
+                nodes.push_back(IterNode(child, node.start + (before - after), node.base + node.rope->size_before(child), bound));
             }
-            return ret;
+            leaf = nodes.back().rope;
+            leaf_items = leaf->leaf_data->data();
+            leaf_size = leaf->size;
+            leaf_start = nodes.back().start;
+            leaf_cap = cap(nodes.back());
+            index_valid = false;
         }
-        
-        void advance(int n)
+
+        void __advance(uintptr_t n)
         {
-            if (n == 0) {
-                return;
-            }
             push_to_leaf();
 
-            if (nodes.empty()) {
-                return;
-            }
-            
-            while (current_node().target + n >= callbacks.predicate(get_measureable(*current_node().rope))) {
+            while (target(nodes.back()) + n >= cap(nodes.back())) {
                 if (nodes.size() == 1) {
                     break;
                 }
                 nodes.pop_back();
             }
             
-            if (nodes.size() == 1 && current_node().target + n >= callbacks.predicate(get_measureable(*current_node().rope))) {
-                n = callbacks.predicate(get_measureable(*current_node().rope)) - current_node().target;
+            if (nodes.size() == 1 && target(nodes.back()) + n >= cap(nodes.back())) {
+                n = cap(nodes.back()) - target(nodes.back());
             }
-            
-            for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-                (*it).target += n;
-            }
-            
-            push_to_leaf();
+
+            position += n;
+            __descend();
         }
-        
-        void retreat(int n)
+
+        void __retreat(uintptr_t n)
         {
             push_to_leaf();
 
-            if (nodes.empty()) {
-                return;
-            }
-            
-            while (current_node().target < n) {
+            while (target(nodes.back()) < n) {
                 if (nodes.size() == 1) {
                     break;
                 }
                 nodes.pop_back();
             }
-            
-            for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-                (*it).target -= n;
+
+            position -= n;
+            __descend();
+        }
+
+    public:
+        /**
+         *  The target within the first node of the path
+         */
+        uintptr_t target() const
+        {
+            return target(nodes.front());
+        }
+
+        void push_to_leaf()
+        {
+            assert(nodes.back().rope != nullptr);
+            if (leaf == nullptr) {
+                __descend();
+            }
+        }
+
+        /**
+         *  Offset of the current item within the current leaf.
+         *  Must only be called while the path ends on a leaf.
+         */
+        uintptr_t leaf_offset() const
+        {
+            assert(leaf == nodes.back().rope);
+            uintptr_t t = position - leaf_start;
+            if (Traits::direct_index) {
+                return t < leaf_size ? t : leaf_size;
+            }
+            if (index_valid && t == index_target) {
+                return index_offset;
+            }
+            if (Traits::incremental_index && index_valid && t > index_target) {
+                Slice<Item> rest(*leaf->leaf_data, index_offset, leaf_size - index_offset);
+                index_offset += callbacks.index(rest, t - index_target);
+            } else {
+                index_offset = callbacks.index(*leaf->leaf_data, t);
+            }
+            index_valid = true;
+            index_target = t;
+            return index_offset;
+        }
+        
+        uintptr_t raw_index() const
+        {
+            if (leaf == nullptr) {
+                This pushed = *this;
+                pushed.push_to_leaf();
+                return pushed.raw_index();
+            }
+            return nodes.back().base - nodes.front().base + leaf_offset();
+        }
+
+        /**
+         *  Moves within the current leaf only change `position`
+         */
+        void advance(intptr_t n)
+        {
+            if (n <= 0) {
+                if (n < 0) {
+                    retreat(-n);
+                }
+            } else if (leaf != nullptr && position - leaf_start + n < leaf_cap) {
+                position += n;
+            } else {
+                __advance(n);
+            }
+        }
+        
+        void retreat(intptr_t n)
+        {
+            if (n < 0) {
+                advance(-n);
+            } else if (leaf != nullptr && position - leaf_start >= (uintptr_t)n) {
+                position -= n;
+            } else {
+                __retreat(n);
             }
-            
-            push_to_leaf();
         }
         
         This &operator++()
@@ -173,7 +411,7 @@ namespace Rope {
             return ret;
         }
         
-        This &operator+=(int n)
+        This &operator+=(intptr_t n)
         {
             advance(n);
             return *this;
@@ -206,7 +444,7 @@ namespace Rope {
             return ret;
         }
         
-        This &operator-=(int n)
+        This &operator-=(intptr_t n)
         {
             retreat(n);
             return *this;
@@ -229,22 +467,19 @@ namespace Rope {
         friend uintptr_t operator-(This &lhs, This &rhs)
         {
             assert(lhs.nodes.front().rope == rhs.nodes.front().rope);
-            return lhs.nodes.front().target - rhs.nodes.front().target;
+            return lhs.target() - rhs.target();
         }
         
         Item operator*()
         {
             push_to_leaf();
-            auto acc = callbacks.index(
-                            *(current_node().rope->leaf_data),
-                            current_node().target);
-            return *(current_node().rope->leaf_data->begin() + (int)acc);
+            return leaf_items[leaf_offset()];
         }
         
-        Item *operator->()
+        Item const *operator->()
         {
             push_to_leaf();
-            return &*(current_node().rope->leaf_data.begin() + current_node().target);
+            return leaf_items + leaf_offset();
         }
         
         friend bool operator==(const This &lhs, const This &rhs)
@@ -261,73 +496,62 @@ namespace Rope {
         friend bool operator<(const This &lhs, const This &rhs)
         {
             assert(lhs.nodes.front().rope == rhs.nodes.front().rope);
-            return lhs.nodes.front().target < rhs.nodes.front().target;
+            return lhs.target() < rhs.target();
         }
         
         friend bool operator>(const This &lhs, const This &rhs)
         {
             assert(lhs.nodes.front().rope == rhs.nodes.front().rope);
-            return lhs.nodes.front().target > rhs.nodes.front().target;
+            return lhs.target() > rhs.target();
         }
         
         friend bool operator<=(const This &lhs, const This &rhs)
         {
             assert(lhs.nodes.front().rope == rhs.nodes.front().rope);
-            return lhs.nodes.front().target <= rhs.nodes.front().target;
+            return lhs.target() <= rhs.target();
         }
         
         friend bool operator>=(const This &lhs, const This &rhs)
         {
             assert(lhs.nodes.front().rope == rhs.nodes.front().rope);
-            return lhs.nodes.front().target >= rhs.nodes.front().target;
+            return lhs.target() >= rhs.target();
         }
         
-        MeasureIterator<Item, MeasureType, shared_ptr<MeasureType>>(
+        MeasureIterator(
             __RopeNode *root,
             uintptr_t position,
-            IteratorCallbacks<shared_ptr<MeasureType>, Item> callbacks)
+            CallbacksType const &callbacks)
         :   callbacks(callbacks),
-            get_measureable([] (const __RopeNode &rope) -> shared_ptr<MeasureType> { return rope.measure; })
+            position(position),
+            leaf(nullptr),
+            leaf_items(nullptr),
+            leaf_size(0),
+            leaf_start(0),
+            leaf_cap(0),
+            index_valid(false),
+            index_target(0),
+            index_offset(0)
         {
-            nodes.push_back(IterNode(root, position));
+            nodes.push_back(IterNode(root, 0, 0, UINTPTR_MAX));
         }
         
-        MeasureIterator<Item, MeasureType, uintptr_t>(
+        MeasureIterator(
             __RopeNode *root,
             uintptr_t position)
-        :   callbacks(
-                // index
-                [] (const Slice<Item> &vec, int target) {
-                    int acc = -1;
-                    auto it = vec.begin();
-                    auto end = vec.end();
-                    auto accm = 0;
-                    while (accm - 1 < target) {
-                        if (it == end) {
-                            ++acc;
-                            break;
-                        }
-                        accm += 1;
-                        ++acc;
-                        ++it;
-                    }
-                    return acc;
-                },
-                // increment predicate
-                [] (const uintptr_t &size) -> uintptr_t { return size; }),
-            get_measureable([] (const __RopeNode &rope) -> uintptr_t { return rope.size; })
-        {
-            nodes.push_back(IterNode(root, 0));
+        :   callbacks(),
+            position(0),
+            leaf(nullptr),
+            leaf_items(nullptr),
+            leaf_size(0),
+            leaf_start(0),
+            leaf_cap(0),
+            index_valid(false),
+            index_target(0),
+            index_offset(0)
+        {
+            nodes.push_back(IterNode(root, 0, 0, UINTPTR_MAX));
             advance(position);
         }
-        
-        template<typename I, typename M, typename IMT>
-        MeasureIterator<I, M, IMT>
-        (MeasureIterator<I, M, IMT> &other)
-        :   callbacks(other.callbacks),
-            get_measureable(other.get_measureable),
-            nodes(other.nodes)
-        {}
     };
 };
 
@@ -5,12 +5,13 @@
 #import <functional>
 #import <vector>
 #import <string>
+#import <cstring>
 #import <iostream>
 #import <numeric>
 #import <tuple>
 #import <assert.h>
 #import <stack>
-#import <list>
+#import <algorithm>
 
 #import "slice.hpp"
 #import "fibonacci.hpp"
@@ -18,28 +19,49 @@
 #import "rope_iter.hpp"
 #import "rope_node_type.hpp"
 #import "rope_global_conf.hpp"
+#import "thread_pool.hpp"
+#import "rope_edit.hpp"
+#import "rope_hash.hpp"
 
 using std::vector;
 using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::tuple;
+using std::make_tuple;
+using std::get;
 using std::cout;
 using std::endl;
 
 namespace Rope {
+    /**
+     *  The pool to measure the leaves of a new `size`-item slice on, or null to build it on the calling thread.
+     *  Builds stay on the calling thread inside an arena scope, which other threads can't allocate from.
+     */
+    static inline ThreadPool *__ropeBuildPool(uintptr_t size)
+    {
+        if (size < ROPE_GLOBAL_PARALLEL_MIN_LEAVES * ROPE_GLOBAL_MAX_LEAF_CAP || RopeArena::current() != nullptr) {
+            return nullptr;
+        }
+        ThreadPool &pool = ThreadPool::current();
+        return pool.size() > 0 ? &pool : nullptr;
+    }
+
     template<
         typename    Item,
         typename    MeasureType>
-    class RopeNode {
+    class RopeNode : public MeasureTraits<MeasureType, Item>::allocation_type::counted_base {
     public:
         using This = RopeNode<Item, MeasureType>;
-        using CallbacksType = MeasureCallbacks<shared_ptr<MeasureType>, Item>;
+        using Traits = MeasureTraits<MeasureType, Item>;
+        using CallbacksType = typename Traits::callbacks_type;
+        using MeasureStorage = typename Traits::measure_type;
+        using Allocation = typename Traits::allocation_type;
         
     private:
         using ItemIterType = MeasureIterator<Item, MeasureType, uintptr_t>;
-        using Shared = shared_ptr<This>;
-        using ItemSlice = shared_ptr<Slice<Item>>;
+        using Shared = typename Allocation::template pointer<This>;
+        using ItemSlice = typename Allocation::template pointer<Slice<Item>>;
         
         //TODO: Move the branch/leaf data fields into a union to save memory
         struct BranchData {
@@ -65,139 +87,417 @@ namespace Rope {
         };
 
         /**
-         *  Return a balanced copy of `rope`
+         *  The buffers `__ropeNodeBalanced` works in, kept per thread between calls so they stop allocating once
+         *  they've grown to fit
+         */
+        struct BalanceBuffers {
+            vector<Shared const *> leaves;
+            vector<Shared const *> stack;
+            vector<Shared> merged;
+        };
+
+        /**
+         *  Return a balanced copy of `rope`.
+         *
+         *  Leaves averaging under half the leaf cap are first merged, in runs, into leaves just under it. Then each
+         *  leaf in turn goes into the slot for its Fibonacci weight, joined onto whatever is in the lighter slots,
+         *  and finally the slots are joined from lightest to heaviest. Every join makes a branch of the result, so
+         *  only the new branches and merged leaves are allocated.
          */
         static Shared
         __ropeNodeBalanced(
-            Shared rope,
-            CallbacksType callbacks)
+            Shared const &rope,
+            CallbacksType const &callbacks)
         {
             if (rope->node_type == RopeNodeTypeLeaf) {
                 return rope;
             }
-            list<Shared> *leaves = __ropeNodeLeafVector(rope);
-            
-            if (rope->size / leaves->size() < ROPE_GLOBAL_MAX_LEAF_CAP / 2) {
-                auto joinGroupStart = leaves->begin();
-                uintptr_t sumSize = leaves->begin() != leaves->end() ? (*(leaves->begin()))->size : 0;
-                for (auto it = leaves->begin(); it != leaves->end(); ++it) {
-                    auto current_size = (*it)->size;
-                    if (sumSize + current_size >= ROPE_GLOBAL_MAX_LEAF_CAP) {
-                        list<Shared> joinGroup(joinGroupStart, it);
-                        if (joinGroup.size() < 2) {
-                            joinGroupStart = it;
-                            sumSize = (*it)->leaf_data->size();
-                            continue;
-                        }
 
-                        list<shared_ptr<Slice<Item>>> slices;
-                        for (auto jt = joinGroup.begin(); jt != joinGroup.end(); ++jt) {
-                            slices.push_back((*jt)->leaf_data);
+            // Borrowed rather than used in place, in case the callbacks balance a rope of their own
+            static thread_local BalanceBuffers reusable;
+            BalanceBuffers buffers(std::move(reusable));
+            vector<Shared const *> &leaves = buffers.leaves;
+
+            __ropeNodeLeaves(rope, buffers);
+            if (!leaves.empty() && rope->size / leaves.size() < ROPE_GLOBAL_MAX_LEAF_CAP / 2) {
+                __ropeNodeMergeLeaves(buffers, callbacks);
+            }
+
+            Shared slots[fibCount];
+            for (auto leaf : leaves) {
+                Shared insert = *leaf;
+                while (true) {
+                    uintptr_t target = fibIndex(insert->weight);
+
+                    Shared lighter = nullptr;
+                    for (uintptr_t idx = 0; idx <= target; ++idx) {
+                        if (slots[idx] != nullptr) {
+                            lighter = lighter != nullptr
+                                    ? Allocation::template make<This>(slots[idx], lighter, callbacks)
+                                    : slots[idx];
+                            slots[idx] = nullptr;
                         }
-                        auto slice = make_shared<Slice<Item>>(slices);
-                        
-                        auto insert = make_shared<This>(slice, callbacks);
-                        assert(insert->weight == 1);
-                        leaves->erase(joinGroupStart, it);
-                        leaves->insert(it, make_shared<This>(slice, callbacks));
-                        
-                        joinGroupStart = it;
-                        sumSize = (*it)->leaf_data->size();
-                    } else {
-                        sumSize += (*it)->leaf_data->size();
                     }
+
+                    if (lighter == nullptr) {
+                        slots[target] = insert;
+                        break;
+                    }
+                    insert = Allocation::template make<This>(lighter, insert, callbacks);
                 }
             }
-            
-            uintptr_t numLeaves = leaves->size();
-            uintptr_t blistSize = fibIndex(numLeaves) + 1;
-            vector<Shared> blist(blistSize);
-            
-            uintptr_t j = 0;
-            for (auto it = leaves->begin(); it != leaves->end(); ++it, ++j) {
-                auto insert = *it;
-                bool inserted = false;
-                
-                while (!inserted) {
-                    uintptr_t targetIndex = fibIndex(insert->weight);
-                    
-                    Shared concatOfLighterNodes = nullptr;
-                    
-                    for (int i = targetIndex; i >= 0; i--) {
-                        uintptr_t idx = targetIndex - i;
-                        
-                        if (blist.at(idx) == nullptr) {
-                            continue;
-                        }
-                        
-                        if (concatOfLighterNodes != nullptr) {
-                            concatOfLighterNodes = make_shared<This>(blist.at(idx), concatOfLighterNodes, callbacks);
-                        } else {
-                            concatOfLighterNodes = blist.at(idx);
-                        }
-                        blist[idx] = nullptr;
-                    }
-                    
-                    if (concatOfLighterNodes == nullptr) {
-                        blist[targetIndex] = insert;
-                        inserted = true;
-                    } else {
-                        insert = make_shared<This>(concatOfLighterNodes, insert, callbacks);
+
+            Shared balanced = nullptr;
+            for (uintptr_t idx = 0; idx < fibCount; ++idx) {
+                if (slots[idx] != nullptr) {
+                    balanced = balanced != nullptr
+                             ? Allocation::template make<This>(slots[idx], balanced, callbacks)
+                             : slots[idx];
+                }
+            }
+
+            leaves.clear();
+            buffers.merged.clear();
+            reusable = std::move(buffers);
+            return balanced != nullptr ? balanced : rope;
+        }
+
+        /**
+         *  Collect the non-empty leaves of `rope` in order, as pointers to the references their parents hold
+         */
+        static void
+        __ropeNodeLeaves(
+            Shared const &rope,
+            BalanceBuffers &buffers)
+        {
+            buffers.stack.push_back(&rope);
+            while (!buffers.stack.empty()) {
+                Shared const *node = buffers.stack.back();
+                buffers.stack.pop_back();
+                if ((*node)->node_type == RopeNodeTypeLeaf) {
+                    if ((*node)->size > 0) {
+                        buffers.leaves.push_back(node);
                     }
+                    continue;
                 }
+                buffers.stack.push_back(&(*node)->branch_data.right);
+                buffers.stack.push_back(&(*node)->branch_data.left);
             }
-            
-            Shared balanced;
-            
-            for (uintptr_t i = blistSize; i > 0; i--) {
-                uintptr_t idx = blistSize - i;
-                if (blist.at(idx)) {
-                    if (balanced != nullptr) {
-                        balanced = make_shared<This>(blist.at(idx), balanced, callbacks);
-                    } else {
-                        balanced = blist.at(idx);
+        }
+
+        /**
+         *  Replace each run of leaves that fits under the leaf cap with one leaf holding a copy of their items. The
+         *  new leaves are held by `buffers.merged`, which never reallocates, since each replaces at least two.
+         */
+        static void
+        __ropeNodeMergeLeaves(
+            BalanceBuffers &buffers,
+            CallbacksType const &callbacks)
+        {
+            vector<Shared const *> &leaves = buffers.leaves;
+            buffers.merged.reserve(leaves.size() / 2);
+
+            auto kept = leaves.begin();
+            auto start = leaves.begin();
+            uintptr_t size = 0;
+            for (auto it = leaves.begin(); ; ++it) {
+                if (it != leaves.end() && size + (**it)->size < ROPE_GLOBAL_MAX_LEAF_CAP) {
+                    size += (**it)->size;
+                    continue;
+                }
+
+                if (it - start > 1) {
+                    auto items = std::make_shared<vector<Item>>();
+                    items->reserve(size);
+                    for (auto jt = start; jt != it; ++jt) {
+                        items->insert(items->end(), (**jt)->leaf_data->begin(), (**jt)->leaf_data->end());
                     }
-                    blist[idx] = nullptr;
+                    auto slice = Allocation::template make<Slice<Item>>(items, items->begin(), items->end());
+                    buffers.merged.push_back(Allocation::template make<This>(slice, callbacks));
+                    *kept++ = &buffers.merged.back();
+                } else if (it != start) {
+                    *kept++ = *start;
+                }
+
+                if (it == leaves.end()) {
+                    break;
                 }
+                start = it;
+                size = (**it)->size;
             }
-            
-            delete leaves;
-            
-            return balanced;
+            leaves.erase(kept, leaves.end());
         }
-        
+
         /**
-         *  Append all the leaf nodes of a rope to some vector
+         *  Join two ropes, keeping the result height-balanced.
          *
-         *  NOTE - this is NOT a shared_ptr, you must delete it yourself.
+         *  When the heights differ by more than one, the shorter rope is attached to the facing spine of the taller
+         *  one, next to a subtree of about its own height, and a rotation on the way back up restores the balance.
+         *  Only that spine is copied, so a join costs time proportional to the difference in heights. Empty ropes
+         *  are dropped rather than joined.
          */
-        static list<Shared> *
-        __ropeNodeLeafVector(
-            Shared rope,
-            list<Shared> *prepend)
+        static Shared
+        __ropeNodeJoin(
+            Shared const &left,
+            Shared const &right,
+            CallbacksType const &callbacks)
         {
-            if (rope->node_type == RopeNodeTypeLeaf) {
-                if (rope->size == 0) {
-                    return prepend;
+            if (left->size == 0) {
+                return right;
+            }
+            if (right->size == 0) {
+                return left;
+            }
+            if (left->height > right->height + 1) {
+                return __ropeNodeJoinRight(left, right, callbacks);
+            }
+            if (right->height > left->height + 1) {
+                return __ropeNodeJoinLeft(left, right, callbacks);
+            }
+            return Allocation::template make<This>(left, right, callbacks);
+        }
+
+        /**
+         *  Join `right` onto the right spine of `left`, which is more than one level taller
+         */
+        static Shared
+        __ropeNodeJoinRight(
+            Shared const &left,
+            Shared const &right,
+            CallbacksType const &callbacks)
+        {
+            Shared const &outer = left->branch_data.left;
+            Shared const &inner = left->branch_data.right;
+
+            if (inner->height <= right->height + 1) {
+                if (std::max(inner->height, right->height) <= outer->height) {
+                    return Allocation::template make<This>(outer, Allocation::template make<This>(inner, right, callbacks), callbacks);
                 }
-                prepend->push_back(rope);
-                return prepend;
+                // `inner` is taller than `outer`: share its children between them
+                return Allocation::template make<This>(
+                    Allocation::template make<This>(outer, inner->branch_data.left, callbacks),
+                    Allocation::template make<This>(inner->branch_data.right, right, callbacks),
+                    callbacks);
             }
-            __ropeNodeLeafVector(rope->branch_data.left, prepend);
-            __ropeNodeLeafVector(rope->branch_data.right, prepend);
-            return prepend;
+
+            Shared joined = __ropeNodeJoinRight(inner, right, callbacks);
+            if (joined->height <= outer->height + 1) {
+                return Allocation::template make<This>(outer, joined, callbacks);
+            }
+            return Allocation::template make<This>(
+                Allocation::template make<This>(outer, joined->branch_data.left, callbacks),
+                joined->branch_data.right,
+                callbacks);
         }
-        
+
         /**
-         *  Construct a vector of all the leaf nodes of a rope
-         *
-         *  NOTE - this is NOT a shared_ptr, you must delete it yourself.
+         *  Join `left` onto the left spine of `right`, which is more than one level taller
          */
-        static list<Shared> *
-        __ropeNodeLeafVector(Shared rope)
+        static Shared
+        __ropeNodeJoinLeft(
+            Shared const &left,
+            Shared const &right,
+            CallbacksType const &callbacks)
         {
-            auto vec = new list<Shared>;
-            return __ropeNodeLeafVector(rope, vec);
+            Shared const &inner = right->branch_data.left;
+            Shared const &outer = right->branch_data.right;
+
+            if (inner->height <= left->height + 1) {
+                if (std::max(inner->height, left->height) <= outer->height) {
+                    return Allocation::template make<This>(Allocation::template make<This>(left, inner, callbacks), outer, callbacks);
+                }
+                return Allocation::template make<This>(
+                    Allocation::template make<This>(left, inner->branch_data.left, callbacks),
+                    Allocation::template make<This>(inner->branch_data.right, outer, callbacks),
+                    callbacks);
+            }
+
+            Shared joined = __ropeNodeJoinLeft(left, inner, callbacks);
+            if (joined->height <= outer->height + 1) {
+                return Allocation::template make<This>(joined, outer, callbacks);
+            }
+            return Allocation::template make<This>(
+                joined->branch_data.left,
+                Allocation::template make<This>(joined->branch_data.right, outer, callbacks),
+                callbacks);
+        }
+
+        /**
+         *  Split `rope` before item `offset`, which is at most its size. The pieces off each side of the path down
+         *  to the split are joined from the leaf up, so each join meets a piece at least as tall as those before it.
+         */
+        static tuple<Shared, Shared>
+        __ropeNodeSplit(
+            Shared const &rope,
+            uintptr_t offset,
+            CallbacksType const &callbacks)
+        {
+            __IterPath<This const *, ROPE_ITER_INLINE_DEPTH> path;
+            This const *node = rope.get();
+            while (node->node_type == RopeNodeTypeBranch) {
+                path.push_back(node);
+                uintptr_t lsize = node->branch_data.left->size;
+                if (offset < lsize) {
+                    node = node->branch_data.left.get();
+                } else {
+                    offset -= lsize;
+                    node = node->branch_data.right.get();
+                }
+            }
+
+            Shared left = nullptr, right = nullptr;
+            if (offset > 0) {
+                left = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*node->leaf_data, 0, offset), callbacks);
+            }
+            if (offset < node->size) {
+                right = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*node->leaf_data, offset, node->size - offset), callbacks);
+            }
+            for (auto it = path.end(); it != path.begin(); ) {
+                This const *parent = *--it;
+                if (node == parent->branch_data.left.get()) {
+                    Shared const &rhs = parent->branch_data.right;
+                    right = right != nullptr ? __ropeNodeJoin(right, rhs, callbacks) : rhs;
+                } else {
+                    Shared const &lhs = parent->branch_data.left;
+                    left = left != nullptr ? __ropeNodeJoin(lhs, left, callbacks) : lhs;
+                }
+                node = parent;
+            }
+
+            return make_tuple(left != nullptr ? left : Allocation::template make<This>(callbacks),
+                              right != nullptr ? right : Allocation::template make<This>(callbacks));
+        }
+
+        /**
+         *  Replace items [begin, end) of `node` with `count` items, if the range lies within one leaf and the leaf's
+         *  new contents fill no more than two leaves. Only the path down to that leaf is copied. Returns null
+         *  otherwise, having built nothing that outlives the call.
+         */
+        static Shared
+        __ropeNodeReplaceInLeaf(
+            Shared const &node,
+            uintptr_t begin,
+            uintptr_t end,
+            Item const *items,
+            uintptr_t count,
+            CallbacksType const &callbacks)
+        {
+            if (node->node_type == RopeNodeTypeLeaf) {
+                uintptr_t length = node->size - (end - begin) + count;
+                if (end > node->size || length > 2 * (ROPE_GLOBAL_MAX_LEAF_CAP - 1)) {
+                    return nullptr;
+                }
+                auto spliced = Allocation::template make<Slice<Item>>(*node->leaf_data, begin, end, items, count);
+                if (length < ROPE_GLOBAL_MAX_LEAF_CAP) {
+                    return Allocation::template make<This>(spliced, callbacks);
+                }
+                return Allocation::template make<This>(
+                    Allocation::template make<This>(Allocation::template make<Slice<Item>>(*spliced, 0, length / 2), callbacks),
+                    Allocation::template make<This>(Allocation::template make<Slice<Item>>(*spliced, length / 2, length - length / 2), callbacks),
+                    callbacks);
+            }
+
+            Shared const &left = node->branch_data.left;
+            Shared const &right = node->branch_data.right;
+            uintptr_t lsize = left->size;
+
+            // An insertion between the children goes to the end of the left one if it fits there
+            if (end <= lsize) {
+                if (Shared edited = __ropeNodeReplaceInLeaf(left, begin, end, items, count, callbacks)) {
+                    return __ropeNodeJoin(edited, right, callbacks);
+                }
+                if (begin < lsize) {
+                    return nullptr;
+                }
+            }
+            if (begin >= lsize) {
+                if (Shared edited = __ropeNodeReplaceInLeaf(right, begin - lsize, end - lsize, items, count, callbacks)) {
+                    return __ropeNodeJoin(left, edited, callbacks);
+                }
+            }
+            return nullptr;
+        }
+
+        /**
+         *  Apply the edits in [first, last), which are sorted, don't overlap and all change `node`, to `node`. Its
+         *  items start at `start` in the rope the edits refer to. Subtrees the edits don't touch are shared, and
+         *  each rebuilt branch is joined back together with its balance restored.
+         */
+        static Shared
+        __ropeNodeEdited(
+            Shared const &node,
+            uintptr_t start,
+            RopeEdit<Item> const *first,
+            RopeEdit<Item> const *last,
+            CallbacksType const &callbacks)
+        {
+            bool covered = __ropeEditsCover(first, start, start + node->size);
+            if (node->node_type == RopeNodeTypeLeaf || covered) {
+                Slice<Item> empty;
+                auto items = __ropeEditedItems(covered ? empty : *node->leaf_data, start, first, last);
+                if (items->empty()) {
+                    return Allocation::template make<This>(callbacks);
+                }
+                return Allocation::template make<This>(Allocation::template make<Slice<Item>>(items, items->begin(), items->end()), callbacks);
+            }
+
+            Shared lhs = node->branch_data.left;
+            Shared rhs = node->branch_data.right;
+            uintptr_t middle = start + lhs->size;
+            if (lhs->size > 0) {
+                auto end = __ropeEditsEnd(first, last, middle);
+                if (end != first) {
+                    lhs = __ropeNodeEdited(lhs, start, first, end, callbacks);
+                }
+                first = __ropeEditsAfter(first, last, middle);
+            }
+            if (first != last && rhs->size > 0) {
+                rhs = __ropeNodeEdited(rhs, middle, first, last, callbacks);
+            }
+            return __ropeNodeJoin(lhs, rhs, callbacks);
+        }
+
+        __MeasureCell<MeasureStorage, Traits::lazy_measure> measure_cell;
+
+        MeasureStorage const &measure(std::false_type) const
+        {
+            return measure_cell.get();
+        }
+
+        MeasureStorage const &measure(std::true_type) const
+        {
+            return measure_cell.get([this]() -> MeasureStorage {
+                CallbacksType callbacks;
+                return node_type == RopeNodeTypeLeaf
+                     ? callbacks.accumulate(*leaf_data)
+                     : callbacks.join(branch_data.left->measure(), branch_data.right->measure());
+            });
+        }
+
+        __RopeHashCell<Traits::hashed> hash_cell;
+
+        /**
+         *  Measure a new leaf or branch, unless it's to be measured when first read, and hash it if the rope is
+         *  hashed
+         */
+        void measureLeaf(CallbacksType const &callbacks)
+        {
+            if (!Traits::lazy_measure) {
+                measure_cell.set(callbacks.accumulate(*leaf_data));
+            }
+            if (Traits::hashed) {
+                hash_cell.set(RopeHash::of(leaf_data->data(), leaf_data->size()));
+            }
+        }
+
+        void measureBranch(CallbacksType const &callbacks)
+        {
+            if (!Traits::lazy_measure) {
+                measure_cell.set(callbacks.join(branch_data.left->measure(), branch_data.right->measure()));
+            }
+            if (Traits::hashed) {
+                hash_cell.set(RopeHash::join(branch_data.left->hash_cell.get(), branch_data.right->hash_cell.get()));
+            }
         }
 
     public:
@@ -226,16 +526,103 @@ namespace Rope {
          */
         uintptr_t weight;
 
+        /**
+         *  The number of branches on the longest path from this node to a leaf.
+         */
+        uintptr_t height;
+
         /**
          *  An arbitary measure of the items within the scope of this node.
          */
-        shared_ptr<MeasureType> measure;
+        MeasureStorage const &measure() const
+        {
+            return measure(std::integral_constant<bool, Traits::lazy_measure>());
+        }
+
+        /**
+         *  The hash of the items within the scope of this node, if the rope is hashed (see `HashedPolicy`)
+         */
+        RopeHash const &hash() const
+        {
+            static_assert(Traits::hashed, "Only ropes with a HashedPolicy keep hashes");
+            return hash_cell.get();
+        }
 
+        /**
+         *  The hash of the items at offsets [begin, end), where `begin <= end <= size`. Subtrees wholly inside the
+         *  range contribute the hashes they keep, so only the leaves at either end are read.
+         */
+        RopeHash hash(uintptr_t begin, uintptr_t end) const
+        {
+            if (begin == 0 && end == size) {
+                return hash();
+            }
+            if (node_type == RopeNodeTypeLeaf) {
+                return RopeHash::of(leaf_data->data() + begin, end - begin);
+            }
+            uintptr_t lsize = branch_data.left->size;
+            if (end <= lsize) {
+                return branch_data.left->hash(begin, end);
+            }
+            if (begin >= lsize) {
+                return branch_data.right->hash(begin - lsize, end - lsize);
+            }
+            return RopeHash::join(branch_data.left->hash(begin, lsize), branch_data.right->hash(0, end - lsize));
+        }
+
+        /**
+         *  Choose the child of this branch containing `target`, as measured through the iterator traits
+         *  `IterTraits`, and rebase `target` onto that child.
+         *
+         *  `bound`, the first target past this branch's part of the rope, is rebased the same way and narrowed to
+         *  the child's part. That is less than the child's own measure when the join takes back the left child's
+         *  last unit, such as a CR the right child continues with LF: the target after it is found in the right
+         *  child, where the break ends. The right child is only measured to check that for a target at the left
+         *  child's last unit; short of it, the bound leaves that unit out, so an iterator reaching it comes back
+         *  here to check.
+         */
+        template<typename IterTraits, typename IterCallbacksType>
+        This *descend(uintptr_t &target, uintptr_t &bound, IterCallbacksType const &callbacks) const
+        {
+            uintptr_t lcap =  branch_data.left != nullptr
+                            ? callbacks.predicate(IterTraits::measureable(*branch_data.left))
+                            : 0;
+            if (target < lcap && (IterTraits::direct_index || branch_data.right == nullptr)) {
+                assert(branch_data.left != nullptr);
+                return branch_data.left.get();
+            }
+            if (target + 1 < lcap) {
+                bound = std::min(bound, lcap - 1);
+                return branch_data.left.get();
+            }
+
+            uintptr_t ccap = callbacks.predicate(IterTraits::measureable(*this));
+            uintptr_t rcap =  branch_data.right != nullptr
+                            ? callbacks.predicate(IterTraits::measureable(*branch_data.right))
+                            : 0;
+            if (target < lcap && target + rcap <= ccap) {
+                bound = std::min(bound, ccap + 1 - rcap);
+                return branch_data.left.get();
+            }
+            target -= ccap - rcap;
+            bound -= ccap - rcap;
+
+            assert(branch_data.right != nullptr);
+            return branch_data.right.get();
+        }
+
+        /**
+         *  The number of items in this branch that precede `child`
+         */
+        uintptr_t size_before(This const *child) const
+        {
+            return child == branch_data.right.get() ? branch_data.left->size : 0;
+        }
 
         void each_chunk(std::function<void (Item const *s, uintptr_t l)> f) {
             switch(node_type) {
                 case RopeNodeTypeLeaf: {
-                    f(&*leaf_data->begin(), leaf_data->size());
+                    f(leaf_data->data(), leaf_data->size());
                     break;
                 }
                 case RopeNodeTypeBranch: {
@@ -244,36 +631,199 @@ namespace Rope {
                 }
             }
         }
+
+        /**
+         *  Call `f(child)` with each child of a branch
+         */
+        template<typename F>
+        void each_child(F f) const
+        {
+            if (node_type == RopeNodeTypeBranch) {
+                if (branch_data.left) f(branch_data.left.get());
+                if (branch_data.right) f(branch_data.right.get());
+            }
+        }
+
+        /**
+         *  The bytes allocated for this node and its leaf slice, not counting its children or the slice's items
+         */
+        uintptr_t footprint() const
+        {
+            return sizeof(This) + (leaf_data ? sizeof(Slice<Item>) : 0);
+        }
+
+        /**
+         *  Call `f(items, count)` for the items at offsets [begin, end) of each leaf in turn, where
+         *  `begin <= end <= size`
+         */
+        template<typename F>
+        void each_chunk(uintptr_t begin, uintptr_t end, F &f) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                if (begin < end) {
+                    f(leaf_data->data() + begin, end - begin);
+                }
+                return;
+            }
+            uintptr_t lsize = branch_data.left ? branch_data.left->size : 0;
+            if (begin < lsize) {
+                branch_data.left->each_chunk(begin, std::min(end, lsize), f);
+            }
+            if (end > lsize) {
+                branch_data.right->each_chunk(begin > lsize ? begin - lsize : 0, end - lsize, f);
+            }
+        }
+
+        /**
+         *  Call `f(items, count)` for the items at offsets [begin, end) of each leaf in turn, from the last leaf when
+         *  `Reverse` is set, until `f` returns false. Returns false if `f` stopped it.
+         */
+        template<bool Reverse, typename F>
+        bool scan_chunks(uintptr_t begin, uintptr_t end, F &f) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                return begin >= end || f(leaf_data->data() + begin, end - begin);
+            }
+            uintptr_t lsize = branch_data.left ? branch_data.left->size : 0;
+            auto left = [&] {
+                return begin >= lsize || branch_data.left->template scan_chunks<Reverse>(begin, std::min(end, lsize), f);
+            };
+            auto right = [&] {
+                return end <= lsize
+                    || branch_data.right->template scan_chunks<Reverse>(begin > lsize ? begin - lsize : 0, end - lsize, f);
+            };
+            return Reverse ? right() && left() : left() && right();
+        }
+
+        /**
+         *  Fold `map(items, count, offset)` over the chunks of the items at offsets [begin, end) with `combine`, in
+         *  order, where `begin < end <= size` and `offset` is that of the node's first item in the rope. Ranges of
+         *  more than `grain` items are split between the children, which are reduced as tasks on `pool`. The
+         *  results are combined along the tree's branches, so they don't depend on how the tasks were scheduled.
+         */
+        template<typename T, typename Map, typename Combine>
+        T reduce_chunks(
+            uintptr_t begin,
+            uintptr_t end,
+            uintptr_t offset,
+            Map &map,
+            Combine &combine,
+            ThreadPool &pool,
+            uintptr_t grain) const
+        {
+            if (node_type == RopeNodeTypeLeaf) {
+                return map(leaf_data->data() + begin, end - begin, offset + begin);
+            }
+            uintptr_t lsize = branch_data.left->size;
+            if (end <= lsize) {
+                return branch_data.left->template reduce_chunks<T>(begin, end, offset, map, combine, pool, grain);
+            }
+            if (begin >= lsize) {
+                return branch_data.right->template reduce_chunks<T>(begin - lsize, end - lsize, offset + lsize, map, combine, pool, grain);
+            }
+
+            if (end - begin <= grain) {
+                T result = branch_data.left->template reduce_chunks<T>(begin, lsize, offset, map, combine, pool, grain);
+                return combine(std::move(result), branch_data.right->template reduce_chunks<T>(0, end - lsize, offset + lsize, map, combine, pool, grain));
+            }
+            T parts[2] = { map(nullptr, 0, offset + begin), map(nullptr, 0, offset + lsize) };
+            pool.parallel_for(2, [&](uintptr_t first, uintptr_t last) {
+                for (uintptr_t i = first; i < last; ++i) {
+                    parts[i] = i == 0
+                             ? branch_data.left->template reduce_chunks<T>(begin, lsize, offset, map, combine, pool, grain)
+                             : branch_data.right->template reduce_chunks<T>(0, end - lsize, offset + lsize, map, combine, pool, grain);
+                }
+            });
+            return combine(std::move(parts[0]), std::move(parts[1]));
+        }
+        
+        /**
+         *  Append the offsets at which halving `length` items from `offset` would start each leaf
+         */
+        static void halvedLeafOffsets(uintptr_t offset, uintptr_t length, vector<uintptr_t> &offsets)
+        {
+            if (length >= ROPE_GLOBAL_MAX_LEAF_CAP) {
+                halvedLeafOffsets(offset, length / 2, offsets);
+                halvedLeafOffsets(offset + length / 2, length - length / 2, offsets);
+            } else {
+                offsets.push_back(offset);
+            }
+        }
+        
+        /**
+         *  Cut a slice into the leaves halving would give it, measuring them on `pool`
+         */
+        static vector<Shared> parallelLeaves(ItemSlice const &slice, CallbacksType const &callbacks, ThreadPool &pool)
+        {
+            vector<uintptr_t> offsets;
+            offsets.reserve(2 * slice->size() / ROPE_GLOBAL_MAX_LEAF_CAP + 2);
+            halvedLeafOffsets(0, slice->size(), offsets);
+            offsets.push_back(slice->size());
+            
+            vector<Shared> leaves(offsets.size() - 1);
+            uintptr_t grain = std::max<uintptr_t>(leaves.size() / (8 * (pool.size() + 1)), 1);
+            pool.parallel_for(leaves.size(), [&](uintptr_t begin, uintptr_t end) {
+                for (uintptr_t i = begin; i < end; ++i) {
+                    auto leaf_slice = Allocation::template make<Slice<Item>>(*slice, offsets[i], offsets[i + 1] - offsets[i]);
+                    leaves[i] = Allocation::template make<This>(leaf_slice, callbacks);
+                }
+            }, grain);
+            return leaves;
+        }
+        
+        /**
+         *  Join the next leaves covering `length` items into the same shape of tree halving would build over them
+         */
+        static Shared joinHalvedLeaves(uintptr_t length, Shared const *&next, CallbacksType const &callbacks)
+        {
+            if (length < ROPE_GLOBAL_MAX_LEAF_CAP) {
+                return *next++;
+            }
+            auto lhs = joinHalvedLeaves(length / 2, next, callbacks);
+            auto rhs = joinHalvedLeaves(length - length / 2, next, callbacks);
+            return Allocation::template make<This>(lhs, rhs, callbacks);
+        }
         
         /**
-         *  Common logic for initialization once a slice has been created
+         *  Common logic for initialization once a slice has been created.
+         *  Long slices have their leaves measured in parallel; the tree is the same shape either way.
          */
         void initWithSlice(ItemSlice const &slice, CallbacksType const &callbacks)
         {
             uintptr_t slice_size = slice->size();
             if (slice_size >= ROPE_GLOBAL_MAX_LEAF_CAP) {
                 uintptr_t lcap = slice_size / 2;
+                Shared lhs, rhs;
                 
-                auto lhs_slice = make_shared<Slice<Item>>(*slice, 0, lcap);
-                auto rhs_slice = make_shared<Slice<Item>>(*slice, lcap, slice_size - lcap);
-                
-                auto lhs = make_shared<This>(lhs_slice, callbacks);
-                auto rhs = make_shared<This>(rhs_slice, callbacks);
+                if (ThreadPool *pool = __ropeBuildPool(slice_size)) {
+                    vector<Shared> leaves = parallelLeaves(slice, callbacks, *pool);
+                    Shared const *next = leaves.data();
+                    lhs = joinHalvedLeaves(lcap, next, callbacks);
+                    rhs = joinHalvedLeaves(slice_size - lcap, next, callbacks);
+                } else {
+                    auto lhs_slice = Allocation::template make<Slice<Item>>(*slice, 0, lcap);
+                    auto rhs_slice = Allocation::template make<Slice<Item>>(*slice, lcap, slice_size - lcap);
+                    
+                    lhs = Allocation::template make<This>(lhs_slice, callbacks);
+                    rhs = Allocation::template make<This>(rhs_slice, callbacks);
+                }
                 
                 leaf_data = nullptr;
                 branch_data = BranchData(lhs, rhs);
-                measure = callbacks.join(branch_data.left->measure, branch_data.right->measure);
+                measureBranch(callbacks);
                 size = lhs->size + rhs->size;
                 weight = branch_data.left->weight + branch_data.right->weight;
+                height = std::max(lhs->height, rhs->height) + 1;
                 node_type = RopeNodeTypeBranch;
                 return;
             }
             
             leaf_data = slice;
             branch_data = BranchData();
-            measure = callbacks.accumulate(*leaf_data);
+            measureLeaf(callbacks);
             size = leaf_data->size();
             weight = 1;
+            height = 0;
             node_type = RopeNodeTypeLeaf;
         }
 
@@ -283,7 +833,7 @@ namespace Rope {
          */
         void initWithVector(shared_ptr<vector<Item>> vector, CallbacksType const &callbacks)
         {
-            auto slice = make_shared<Slice<Item>>(
+            auto slice = Allocation::template make<Slice<Item>>(
                                                 vector,
                                                 vector->begin(),
                                                 vector->end());
@@ -301,11 +851,14 @@ namespace Rope {
         (   CallbacksType const &callbacks)
         :   node_type(RopeNodeTypeLeaf),
             branch_data(BranchData(nullptr, nullptr)),
-            leaf_data(make_shared<Slice<Item>>()),
+            leaf_data(Allocation::template make<Slice<Item>>()),
             size(0),
             weight(1),
-            measure(callbacks.identity())
-        {}
+            height(0)
+        {
+            measure_cell.set(callbacks.identity());
+            hash_cell.set(RopeHash::identity());
+        }
         
         /**
          *  Construct a rope from a slice
@@ -317,6 +870,26 @@ namespace Rope {
             initWithSlice(slice, callbacks);
         }
         
+        /**
+         *  Construct a leaf over a slice whose measure is already known, as when loading a saved rope
+         */
+        RopeNode<Item, MeasureType>(
+            ItemSlice const &slice,
+            MeasureStorage const &measure,
+            CallbacksType const &callbacks)
+        :   node_type(RopeNodeTypeLeaf),
+            branch_data(),
+            leaf_data(slice),
+            size(slice->size()),
+            weight(1),
+            height(0)
+        {
+            measure_cell.set(measure);
+            if (Traits::hashed) {
+                hash_cell.set(RopeHash::of(leaf_data->data(), leaf_data->size()));
+            }
+        }
+
         /**
          *  Construct a rope from a container (e.g., a string or list)
          */
@@ -367,8 +940,10 @@ namespace Rope {
             branch_data(left, right),
             size(left->size + right->size),
             weight(left->weight + right->weight),
-            measure(callbacks.join(left->measure, right->measure))
-        {}
+            height(std::max(left->height, right->height) + 1)
+        {
+            measureBranch(callbacks);
+        }
         
         /**
          *  Construct a rope from a substring, as specified by a pair of iterators
@@ -401,14 +976,15 @@ namespace Rope {
                     auto start = begin.raw_index();
                     auto length = end.raw_index() - start;
                     
-                    leaf_data = make_shared<Slice<Item>>(
+                    leaf_data = Allocation::template make<Slice<Item>>(
                         *src.leaf_data,
                         start,
                         length);
                     branch_data = BranchData(nullptr, nullptr);
                     size = leaf_data->size();
                     weight = 1;
-                    measure = callbacks.accumulate(*leaf_data);
+                    height = 0;
+                    measureLeaf(callbacks);
                     break;
                 }
                 
@@ -427,17 +1003,18 @@ namespace Rope {
                         lbegin.push_to_leaf();
                         auto lend = ItemIterType(begin_front.rope, begin_front.rope->size);
                         lend.push_to_leaf();
-                        branch_data.left = make_shared<This>(lbegin, lend, callbacks);
+                        branch_data.left = Allocation::template make<This>(lbegin, lend, callbacks);
                         
                         auto rbegin = ItemIterType(end_front.rope, 0);
                         rbegin.push_to_leaf();
                         auto rend = ItemIterType(end_front.rope, end.raw_index());
                         rend.push_to_leaf();
                         
-                        branch_data.right = make_shared<This>(rbegin, rend, callbacks);
-                        measure = callbacks.join(branch_data.left->measure, branch_data.right->measure);
+                        branch_data.right = Allocation::template make<This>(rbegin, rend, callbacks);
+                        measureBranch(callbacks);
                         size = branch_data.left->size + branch_data.right->size;
                         weight = branch_data.left->weight + branch_data.right->weight;
+                        height = std::max(branch_data.left->height, branch_data.right->height) + 1;
                         break;
                     } else {
                         end = ItemIterType(begin.nodes.front().rope,
@@ -463,7 +1040,7 @@ namespace Rope {
             
             begin.push_to_leaf();
             end.push_to_leaf();
-            return make_shared<This>(begin, end, callbacks);
+            return Allocation::template make<This>(begin, end, callbacks);
         }
         
         template<typename IterMeasureType>
@@ -478,63 +1055,100 @@ namespace Rope {
         template<typename IterMeasureType>
         tuple<Shared, Shared>
         splitBefore(
-            MeasureIterator<Item, MeasureType, IterMeasureType> const &it,
+            MeasureIterator<Item, MeasureType, IterMeasureType> const &_it,
             CallbacksType const &callbacks)
         {            
+            MeasureIterator<Item, MeasureType, IterMeasureType> it = _it;
+            it.push_to_leaf();
+
             Shared left = nullptr, right = nullptr;
             
-            for (auto nit = it.nodes.begin(); nit != it.nodes.end(); ++nit) {
-                This *src = nit->rope;
+            // Collect the pieces from the leaf up, so each join meets a piece at least as tall as those before it
+            // and the joins cost O(depth) in all
+            for (auto nit = it.nodes.end(); nit != it.nodes.begin(); ) {
+                This *src = (--nit)->rope;
 
                 if (src->node_type == RopeNodeTypeLeaf) {
-                    auto mid = src->leaf_data->begin() + it.callbacks.index(*src->leaf_data, nit->target);
-                    auto lhs_length = mid - src->leaf_data->begin();
-                    auto rhs_length = src->leaf_data->end() - mid;
+                    uintptr_t lhs_length = it.leaf_offset();
+                    uintptr_t rhs_length = src->size - lhs_length;
                     
-                    if (left != nullptr) {
-                        left = make_shared<This>(
-                            left,
-                            make_shared<This>(
-                                make_shared<Slice<Item>>(*src->leaf_data, 0, lhs_length),
-                                callbacks),
-                            callbacks);
-                    } else {
-                        left = make_shared<This>(make_shared<Slice<Item>>(*src->leaf_data, 0, lhs_length), callbacks);
+                    if (lhs_length > 0) {
+                        left = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*src->leaf_data, 0, lhs_length), callbacks);
                     }
-                    
-                    if (right != nullptr) {
-                        right = make_shared<This>(
-                            make_shared<This>(
-                                make_shared<Slice<Item>>(*src->leaf_data, lhs_length, rhs_length),
-                                callbacks),
-                            right,
-                            callbacks);
-                    } else {
-                        auto slice = *src->leaf_data;
-                        right = make_shared<This>(make_shared<Slice<Item>>(slice, lhs_length, rhs_length), callbacks);
+                    if (rhs_length > 0) {
+                        right = Allocation::template make<This>(Allocation::template make<Slice<Item>>(*src->leaf_data, lhs_length, rhs_length), callbacks);
                     }
+                } else if ((nit + 1)->rope == src->branch_data.left.get()) {
+                    Shared const &rhs = src->branch_data.right;
+                    right = right != nullptr ? __ropeNodeJoin(right, rhs, callbacks) : rhs;
                 } else {
-                    This *next = (++nit)->rope;
-                    --nit;
-
-                    if (next == src->branch_data.left.get()) {
-                        if (right != nullptr) {
-                            right = make_shared<This>(src->branch_data.right, right, callbacks);
-                        } else {
-                            right = src->branch_data.right;
-                        }
-                    } else {
-                        if (left != nullptr) {
-                            left = make_shared<This>(left, src->branch_data.left, callbacks);
-                        } else {
-                            left = src->branch_data.left;
-                        }
-                    }
+                    Shared const &lhs = src->branch_data.left;
+                    left = left != nullptr ? __ropeNodeJoin(lhs, left, callbacks) : lhs;
+                }
+            }
+
+            return make_tuple(left != nullptr ? left : Allocation::template make<This>(callbacks),
+                                   right != nullptr ? right : Allocation::template make<This>(callbacks));
+        }
+
+        /**
+         *  Replace items [begin, end) of `rope` with `count` items.
+         *
+         *  An edit within one leaf copies that leaf with the edit applied, along with the path down to it. Otherwise
+         *  the range is cut out, and the items are merged into the leaf on either side of the cut if they fit there,
+         *  or joined in as leaves of their own if not.
+         */
+        static Shared
+        replaced(
+            Shared const &rope,
+            uintptr_t begin,
+            uintptr_t end,
+            Item const *items,
+            uintptr_t count,
+            CallbacksType const &callbacks)
+        {
+            if (Shared edited = __ropeNodeReplaceInLeaf(rope, begin, end, items, count, callbacks)) {
+                return edited;
+            }
+
+            Shared root = rope;
+            if (begin < end) {
+                auto head = __ropeNodeSplit(rope, begin, callbacks);
+                auto tail = __ropeNodeSplit(rope, end, callbacks);
+                root = __ropeNodeJoin(get<0>(head), get<1>(tail), callbacks);
+                if (count == 0) {
+                    return root;
+                }
+                if (Shared edited = __ropeNodeReplaceInLeaf(root, begin, begin, items, count, callbacks)) {
+                    return edited;
                 }
             }
 
-            return make_tuple(left != nullptr ? left : make_shared<This>(callbacks),
-                                   right != nullptr ? right : make_shared<This>(callbacks));
+            auto split = __ropeNodeSplit(root, begin, callbacks);
+            auto inserted = Allocation::template make<This>(items, count, callbacks);
+            return __ropeNodeJoin(__ropeNodeJoin(get<0>(split), inserted, callbacks), get<1>(split), callbacks);
+        }
+
+        /**
+         *  Apply a batch of edits, sorted and not overlapping, in one pass over `rope`
+         */
+        static Shared
+        edited(
+            Shared const &rope,
+            RopeEdit<Item> const *first,
+            RopeEdit<Item> const *last,
+            CallbacksType const &callbacks)
+        {
+            return first != last ? __ropeNodeEdited(rope, 0, first, last, callbacks) : rope;
+        }
+
+        /**
+         *  Join two ropes, rebalancing along the spine where they meet
+         */
+        static Shared
+        concat(Shared const &left, Shared const &right, CallbacksType const &callbacks)
+        {
+            return __ropeNodeJoin(left, right, callbacks);
         }
 
         static Shared
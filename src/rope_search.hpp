@@ -0,0 +1,190 @@
+#ifndef ROPE_ROPE_SEARCH_H
+#define ROPE_ROPE_SEARCH_H
+
+#import <string>
+#import <algorithm>
+#import <cstdint>
+
+#import "text_kernels.hpp"
+
+namespace Rope {
+
+    /**
+     *  Offset of the first occurrence of the `m` items at `needle` wholly within `[p, p + n)`, or `n` if there is
+     *  none. `m` must be at least 1.
+     */
+    template<typename Item>
+    uintptr_t __ropeFindIn(Item const *p, uintptr_t n, Item const *needle, uintptr_t m)
+    {
+        for (uintptr_t i = 0; i + m <= n; ++i) {
+            if (p[i] == needle[0] && p[i + m - 1] == needle[m - 1] && std::equal(needle + 1, needle + m - 1, p + i + 1)) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    /**
+     *  Bytes are searched by the text kernels
+     */
+    inline uintptr_t __ropeFindIn(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        return text_find(p, n, needle, m);
+    }
+
+    /**
+     *  Offset of the last occurrence of the `m` items at `needle` wholly within `[p, p + n)`, or `n` if there is
+     *  none. `m` must be at least 1.
+     */
+    template<typename Item>
+    uintptr_t __ropeRFindIn(Item const *p, uintptr_t n, Item const *needle, uintptr_t m)
+    {
+        for (uintptr_t i = n >= m ? n - m + 1 : 0; i-- > 0;) {
+            if (p[i] == needle[0] && p[i + m - 1] == needle[m - 1] && std::equal(needle + 1, needle + m - 1, p + i + 1)) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    inline uintptr_t __ropeRFindIn(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        return text_rfind(p, n, needle, m);
+    }
+
+    /**
+     *  Searches a rope's chunks for a needle, front to back, calling `f(offset)` with each occurrence until it
+     *  returns false.
+     *
+     *  The last `m - 1` items seen are kept, so each chunk is first searched joined onto them for the occurrences
+     *  that begin before it, and then in place. Nothing else is copied, so occurrences straddling any number of
+     *  leaves are found without flattening the rope.
+     */
+    template<typename Item>
+    class __RopeForwardSearch {
+    public:
+        /**
+         *  Search for `needle`, which must not be empty, in chunks starting from offset `offset` of the rope
+         */
+        __RopeForwardSearch(std::basic_string<Item> const &needle, uintptr_t offset)
+        :   needle(needle),
+            offset(offset)
+        {}
+
+        /**
+         *  Search the next chunk, returning false if `f` stopped the search
+         */
+        template<typename F>
+        bool feed(Item const *items, uintptr_t count, F &f)
+        {
+            // Occurrences can only begin in the kept items if they hold the needle's first item
+            uintptr_t m = needle.size();
+            if (std::find(carry.begin(), carry.end(), needle[0]) != carry.end()) {
+                window.assign(carry);
+                window.append(items, std::min(count, m - 1));
+                uintptr_t length = std::min<uintptr_t>(window.size(), carry.size() + m - 1);
+                if (!each(window.data(), length, offset - carry.size(), f)) {
+                    return false;
+                }
+            }
+            if (!each(items, count, offset, f)) {
+                return false;
+            }
+
+            if (count >= m - 1) {
+                carry.assign(items + count - (m - 1), m - 1);
+            } else {
+                carry.append(items, count);
+                carry.erase(0, carry.size() - std::min<uintptr_t>(carry.size(), m - 1));
+            }
+            offset += count;
+            return true;
+        }
+
+    private:
+        std::basic_string<Item> const &needle;
+        std::basic_string<Item> carry;
+        std::basic_string<Item> window;
+        uintptr_t offset;
+
+        template<typename F>
+        bool each(Item const *items, uintptr_t count, uintptr_t base, F &f)
+        {
+            for (uintptr_t at = 0; at < count; ++at) {
+                at += __ropeFindIn(items + at, count - at, needle.data(), needle.size());
+                if (at < count && !f(base + at)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    /**
+     *  Searches a rope's chunks for a needle, back to front, calling `f(offset)` with each occurrence from the last
+     *  until it returns false. The first `m - 1` items of what follows each chunk are kept, as `__RopeForwardSearch`
+     *  keeps those before it.
+     */
+    template<typename Item>
+    class __RopeReverseSearch {
+    public:
+        /**
+         *  Search for `needle`, which must not be empty, in chunks ending at offset `offset` of the rope
+         */
+        __RopeReverseSearch(std::basic_string<Item> const &needle, uintptr_t offset)
+        :   needle(needle),
+            offset(offset)
+        {}
+
+        /**
+         *  Search the chunk before the last one searched, returning false if `f` stopped the search
+         */
+        template<typename F>
+        bool feed(Item const *items, uintptr_t count, F &f)
+        {
+            uintptr_t m = needle.size();
+            uintptr_t tail = std::min(count, m - 1);
+            if (!carry.empty() && std::find(items + count - tail, items + count, needle[0]) != items + count) {
+                window.assign(items + count - tail, tail);
+                window.append(carry);
+                uintptr_t length = std::min<uintptr_t>(window.size(), tail + m - 1);
+                if (!each(window.data(), length, offset - tail, f)) {
+                    return false;
+                }
+            }
+            if (!each(items, count, offset - count, f)) {
+                return false;
+            }
+
+            if (count >= m - 1) {
+                carry.assign(items, m - 1);
+            } else {
+                carry.insert(0, items, count);
+                carry.erase(std::min<uintptr_t>(carry.size(), m - 1));
+            }
+            offset -= count;
+            return true;
+        }
+
+    private:
+        std::basic_string<Item> const &needle;
+        std::basic_string<Item> carry;
+        std::basic_string<Item> window;
+        uintptr_t offset;
+
+        template<typename F>
+        bool each(Item const *items, uintptr_t count, uintptr_t base, F &f)
+        {
+            for (uintptr_t end = count; end >= needle.size();) {
+                uintptr_t at = __ropeRFindIn(items, end, needle.data(), needle.size());
+                if (at == end || !f(base + at)) {
+                    return at == end;
+                }
+                end = at + needle.size() - 1;
+            }
+            return true;
+        }
+    };
+}
+
+#endif // ROPE_ROPE_SEARCH_H
@@ -11,22 +11,30 @@
 
 #import <vector>
 #import <list>
+#import <memory>
+#import <iterator>
+#import <utility>
+
+#import "allocation.hpp"
 
 namespace Rope {
     
 
     /**
-     *  Provides easy slice behaviour over std::vector (i.e., subvectors)
+     *  Provides easy slice behaviour over a contiguous run of items (i.e., subvectors).
+     *
+     *  The items are kept alive by `owner`, which is usually the `std::vector` they were copied into, but may be any
+     *  other storage (such as a `MappedFile`). Slices of a slice share its owner.
      */
-    template<typename ItemType> class Slice {
+    template<typename ItemType> class Slice : public RefCounted {
     public:
         using Storage = std::vector<ItemType>;
-        using IterType = typename Storage::const_iterator;
+        using IterType = ItemType const *;
 
     private:
-        std::shared_ptr<Storage>    store;
-        IterType                    istart;     // iterator into `store` marking the beginning of the slice
-        IterType                    iend;       // iterator into `store` marking the end of the slice
+        std::shared_ptr<void const> owner;
+        IterType                    istart;     // first item of the slice
+        IterType                    iend;       // one past the last item of the slice
         
     public:
         
@@ -36,24 +44,46 @@ namespace Rope {
 
         typename std::iterator_traits<IterType>::difference_type
         size() const { return std::distance(istart, iend); }
+
+        /**
+         *  Pointer to the first item of the slice, suitable for scanning `size()` items in bulk
+         */
+        ItemType const *data() const { return istart; }
+
+        /**
+         *  The storage keeping the items alive, which may be shared with other slices
+         */
+        void const *storage() const { return owner.get(); }
         
         /**
-         *  Construct an empty slice with new storage
+         *  Construct an empty slice
          */
         Slice<ItemType> ()
-        :   store(std::make_shared<Storage>()),
-            istart(store->begin()),
-            iend(store->end())
+        :   owner(nullptr),
+            istart(nullptr),
+            iend(nullptr)
         {}
         
         /**
          *  Construct a new slice from existing storage
          */
         Slice<ItemType>
-        (   std::shared_ptr<Storage>   s,
-            IterType                   begin,
-            IterType                   end)
-        :   store(s),
+        (   std::shared_ptr<Storage>            s,
+            typename Storage::const_iterator    begin,
+            typename Storage::const_iterator    end)
+        :   owner(s),
+            istart(s->data() + (begin - s->cbegin())),
+            iend(s->data() + (end - s->cbegin()))
+        {}
+
+        /**
+         *  Construct a new slice over items kept alive by `owner`, without copying them
+         */
+        Slice<ItemType>
+        (   std::shared_ptr<void const> owner,
+            ItemType const *            begin,
+            ItemType const *            end)
+        :   owner(std::move(owner)),
             istart(begin),
             iend(end)
         {}
@@ -63,17 +93,21 @@ namespace Rope {
          */
         Slice<ItemType>
         (   Slice<ItemType> const & other,
-            int                     start_inset,
-            int                     length)
-        :   store(other.store),
+            uintptr_t               start_inset,
+            uintptr_t               length)
+        :   owner(other.owner),
             istart(other.istart + start_inset),
             iend(other.istart + start_inset + length)
         {}
         
+        /**
+         *  Construct a new slice by copying a list of slices (held through any pointer type) into new storage
+         */
+        template<typename SlicePointer>
         Slice<ItemType>
-        (   std::list<std::shared_ptr<Slice<ItemType>>> others)
-        :   store(std::make_shared<Storage>())
+        (   std::list<SlicePointer> const & others)
         {
+            auto store = std::make_shared<Storage>();
             uintptr_t total_size = 0;
             for (auto it = others.begin(); it != others.end(); ++it) {
                 total_size += (*it)->size();
@@ -84,8 +118,30 @@ namespace Rope {
             for (auto it = others.begin(); it != others.end(); ++it) {
                 store->insert(store->end(), (*it)->istart, (*it)->iend);
             };
-            istart = store->begin();
-            iend = store->end();
+            owner = store;
+            istart = store->data();
+            iend = store->data() + store->size();
+        }
+        
+        /**
+         *  Construct a new slice by copying `other` into new storage, with its items [begin, end) replaced by
+         *  `count` items
+         */
+        Slice<ItemType>
+        (   Slice<ItemType> const & other,
+            uintptr_t               begin,
+            uintptr_t               end,
+            ItemType const *        items,
+            uintptr_t               count)
+        {
+            auto store = std::make_shared<Storage>();
+            store->reserve(other.size() - (end - begin) + count);
+            store->insert(store->end(), other.istart, other.istart + begin);
+            store->insert(store->end(), items, items + count);
+            store->insert(store->end(), other.istart + end, other.iend);
+            owner = store;
+            istart = store->data();
+            iend = store->data() + store->size();
         }
         
         ~Slice<ItemType>()
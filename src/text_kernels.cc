@@ -0,0 +1,643 @@
+#import "text_kernels.hpp"
+
+#import <cstring>
+
+#if defined(__x86_64__)
+#define ROPE_TEXT_KERNELS_X86 1
+#import <immintrin.h>
+#endif
+
+namespace Rope {
+
+    /**
+     *  Whether `c` begins a UTF-8 sequence. Continuation bytes (10xxxxxx) and NUL do not.
+     */
+    static inline bool begins_point(char c)
+    {
+        return c != 0 && (c & 0xC0) != 0x80;
+    }
+
+    /**
+     *  Index of the `k`th (from 0) set bit of `mask`, which must have more than `k` bits set
+     */
+    static inline uintptr_t select_bit(uint64_t mask, uintptr_t k)
+    {
+        for (; k > 0; --k) {
+            mask &= mask - 1;
+        }
+        return __builtin_ctzll(mask);
+    }
+
+#pragma mark - Scalar
+
+    static uintptr_t utf8_count_points_scalar(char const *p, uintptr_t n)
+    {
+        uintptr_t count = 0;
+        for (uintptr_t i = 0; i < n; ++i) {
+            count += begins_point(p[i]);
+        }
+        return count;
+    }
+
+    static uintptr_t utf8_find_point_scalar(char const *p, uintptr_t n, uintptr_t target)
+    {
+        for (uintptr_t i = 0; i < n; ++i) {
+            if (begins_point(p[i])) {
+                if (target == 0) {
+                    return i;
+                }
+                --target;
+            }
+        }
+        return n;
+    }
+
+    /**
+     *  Whether position `i` of `[p, p + n)` ends a line break
+     */
+    static inline bool ends_break(char const *p, uintptr_t n, uintptr_t i)
+    {
+        return p[i] == '\n' || (p[i] == '\r' && (i + 1 == n || p[i + 1] != '\n'));
+    }
+
+    /**
+     *  Scalar count and search starting from `start`, also used for the tails of the vectorized kernels
+     */
+    static uintptr_t line_count_breaks_from(char const *p, uintptr_t n, uintptr_t start)
+    {
+        uintptr_t count = 0;
+        for (uintptr_t i = start; i < n; ++i) {
+            count += ends_break(p, n, i);
+        }
+        return count;
+    }
+
+    static uintptr_t line_find_break_from(char const *p, uintptr_t n, uintptr_t start, uintptr_t target)
+    {
+        for (uintptr_t i = start; i < n; ++i) {
+            if (ends_break(p, n, i)) {
+                if (target == 0) {
+                    return i;
+                }
+                --target;
+            }
+        }
+        return n;
+    }
+
+    static uintptr_t line_count_breaks_scalar(char const *p, uintptr_t n)
+    {
+        return line_count_breaks_from(p, n, 0);
+    }
+
+    static uintptr_t line_find_break_scalar(char const *p, uintptr_t n, uintptr_t target)
+    {
+        return line_find_break_from(p, n, 0, target);
+    }
+
+    /**
+     *  Whether `c` leads a four-byte sequence, which takes a surrogate pair in UTF-16
+     */
+    static inline bool leads_four(char c)
+    {
+        return (c & 0xF8) == 0xF0;
+    }
+
+    /**
+     *  Scalar counts from `start`, added to `counts`, also used for the tails of the vectorized kernels
+     */
+    static void text_count_from(char const *p, uintptr_t n, uintptr_t start, TextCounts &counts)
+    {
+        for (uintptr_t i = start; i < n; ++i) {
+            bool begins = (p[i] & 0xC0) != 0x80;
+            counts.points += begins && p[i] != 0;
+            counts.units += begins + leads_four(p[i]);
+            counts.breaks += ends_break(p, n, i);
+        }
+    }
+
+    static TextCounts text_count_scalar(char const *p, uintptr_t n)
+    {
+        TextCounts counts = { 0, 0, 0 };
+        text_count_from(p, n, 0, counts);
+        return counts;
+    }
+
+    /**
+     *  Whether the needle occurs at `p`, given that its first and last bytes already match
+     */
+    static inline bool matches_inside(char const *p, char const *needle, uintptr_t m)
+    {
+        return m < 3 || memcmp(p + 1, needle + 1, m - 2) == 0;
+    }
+
+    /**
+     *  Whether the needle occurs at `p`
+     */
+    static inline bool matches_at(char const *p, char const *needle, uintptr_t m)
+    {
+        return p[0] == needle[0] && p[m - 1] == needle[m - 1] && matches_inside(p, needle, m);
+    }
+
+    /**
+     *  Scalar search over the positions from `start`, also used for the tails of the vectorized kernels
+     */
+    static uintptr_t text_find_from(char const *p, uintptr_t n, uintptr_t start, char const *needle, uintptr_t m)
+    {
+        for (uintptr_t i = start; i + m <= n; ++i) {
+            if (matches_at(p + i, needle, m)) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    /**
+     *  Scalar reverse search over the positions below `end`, where `end + m - 1 <= n`
+     */
+    static uintptr_t text_rfind_below(char const *p, uintptr_t n, uintptr_t end, char const *needle, uintptr_t m)
+    {
+        for (uintptr_t i = end; i-- > 0;) {
+            if (matches_at(p + i, needle, m)) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    static uintptr_t text_find_scalar(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        if (m > n) {
+            return n;
+        }
+        // memchr skips to each candidate, and is vectorized by most C libraries
+        uintptr_t count = n - m + 1;
+        for (char const *candidate = p; ; ++candidate) {
+            candidate = static_cast<char const *>(memchr(candidate, needle[0], count - (candidate - p)));
+            if (candidate == nullptr) {
+                return n;
+            }
+            if (candidate[m - 1] == needle[m - 1] && matches_inside(candidate, needle, m)) {
+                return candidate - p;
+            }
+        }
+    }
+
+    static uintptr_t text_rfind_scalar(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        return text_rfind_below(p, n, m <= n ? n - m + 1 : 0, needle, m);
+    }
+
+#ifdef ROPE_TEXT_KERNELS_X86
+
+#pragma mark - SSE2
+
+    /**
+     *  0xff in each lane holding a byte that begins a sequence: signed bytes above -65 (0xbf), except NUL
+     */
+    static inline __m128i sse2_point_mask(__m128i v)
+    {
+        return _mm_andnot_si128(
+            _mm_cmpeq_epi8(v, _mm_setzero_si128()),
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(-65)));
+    }
+
+    static uintptr_t utf8_count_points_sse2(char const *p, uintptr_t n)
+    {
+        uintptr_t count = 0;
+        uintptr_t i = 0;
+        while (i + 16 <= n) {
+            // Lanes count down by one per match, so flush them into the total before they can wrap.
+            __m128i lanes = _mm_setzero_si128();
+            for (int j = 0; j < 255 && i + 16 <= n; ++j, i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+                lanes = _mm_sub_epi8(lanes, sse2_point_mask(v));
+            }
+            __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+            count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+        }
+        return count + utf8_count_points_scalar(p + i, n - i);
+    }
+
+    static uintptr_t utf8_find_point_sse2(char const *p, uintptr_t n, uintptr_t target)
+    {
+        uintptr_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+            uint32_t mask = _mm_movemask_epi8(sse2_point_mask(v));
+            uintptr_t found = __builtin_popcount(mask);
+            if (found > target) {
+                return i + select_bit(mask, target);
+            }
+            target -= found;
+        }
+        return i + utf8_find_point_scalar(p + i, n - i, target);
+    }
+
+    /**
+     *  0xff in each lane ending a line break, given the bytes at `p` and the bytes one position later at `p + 1`
+     */
+    static inline __m128i sse2_break_mask(char const *p)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + 1));
+        __m128i lf = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+        __m128i cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+        return _mm_or_si128(lf, _mm_andnot_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8('\n')), cr));
+    }
+
+    static uintptr_t line_count_breaks_sse2(char const *p, uintptr_t n)
+    {
+        uintptr_t count = 0;
+        uintptr_t i = 0;
+        // Each block also reads the byte after it, so stop one byte early.
+        while (i + 16 < n) {
+            __m128i lanes = _mm_setzero_si128();
+            for (int j = 0; j < 255 && i + 16 < n; ++j, i += 16) {
+                lanes = _mm_sub_epi8(lanes, sse2_break_mask(p + i));
+            }
+            __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+            count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+        }
+        return count + line_count_breaks_from(p, n, i);
+    }
+
+    static uintptr_t line_find_break_sse2(char const *p, uintptr_t n, uintptr_t target)
+    {
+        uintptr_t i = 0;
+        for (; i + 16 < n; i += 16) {
+            uint32_t mask = _mm_movemask_epi8(sse2_break_mask(p + i));
+            uintptr_t found = __builtin_popcount(mask);
+            if (found > target) {
+                return i + select_bit(mask, target);
+            }
+            target -= found;
+        }
+        return line_find_break_from(p, n, i, target);
+    }
+
+    /**
+     *  The sum of the byte lanes of `lanes`
+     */
+    static inline uintptr_t sse2_sum(__m128i lanes)
+    {
+        __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+        return _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+    }
+
+    /**
+     *  Every count from the same loads: bytes beginning a sequence (NUL included) above -65, NULs, four-byte
+     *  leads between -17 and -8 (0xf0 to 0xf7), and breaks as `sse2_break_mask`
+     */
+    static TextCounts text_count_sse2(char const *p, uintptr_t n)
+    {
+        TextCounts counts = { 0, 0, 0 };
+        uintptr_t i = 0;
+        while (i + 16 < n) {
+            __m128i begins = _mm_setzero_si128();
+            __m128i nuls = _mm_setzero_si128();
+            __m128i fours = _mm_setzero_si128();
+            __m128i breaks = _mm_setzero_si128();
+            for (int j = 0; j < 255 && i + 16 < n; ++j, i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+                __m128i next = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i + 1));
+                __m128i cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+                __m128i lf = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+                begins = _mm_sub_epi8(begins, _mm_cmpgt_epi8(v, _mm_set1_epi8(-65)));
+                nuls = _mm_sub_epi8(nuls, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+                fours = _mm_sub_epi8(fours, _mm_and_si128(
+                    _mm_cmpgt_epi8(v, _mm_set1_epi8(-17)),
+                    _mm_cmpgt_epi8(_mm_set1_epi8(-8), v)));
+                breaks = _mm_sub_epi8(breaks,
+                    _mm_or_si128(lf, _mm_andnot_si128(_mm_cmpeq_epi8(next, _mm_set1_epi8('\n')), cr)));
+            }
+            uintptr_t begun = sse2_sum(begins);
+            counts.points += begun - sse2_sum(nuls);
+            counts.units += begun + sse2_sum(fours);
+            counts.breaks += sse2_sum(breaks);
+        }
+        text_count_from(p, n, i, counts);
+        return counts;
+    }
+
+    /**
+     *  A bit for each of the 16 positions from `p` where the first and last bytes of a `m`-byte needle match. The
+     *  last bytes are only loaded once a first byte matches, so a rare first byte costs little more than memchr.
+     */
+    static inline uint32_t sse2_ends_mask(char const *p, uintptr_t m, __m128i first, __m128i last)
+    {
+        __m128i heads = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p)), first);
+        if (_mm_movemask_epi8(heads) == 0) {
+            return 0;
+        }
+        __m128i tails = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p + m - 1)), last);
+        return _mm_movemask_epi8(_mm_and_si128(heads, tails));
+    }
+
+    static uintptr_t text_find_sse2(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[m - 1]);
+        uintptr_t i = 0;
+        for (; i + m - 1 + 16 <= n; i += 16) {
+            for (uint32_t mask = sse2_ends_mask(p + i, m, first, last); mask != 0; mask &= mask - 1) {
+                uintptr_t at = i + __builtin_ctz(mask);
+                if (matches_inside(p + at, needle, m)) {
+                    return at;
+                }
+            }
+        }
+        return text_find_from(p, n, i, needle, m);
+    }
+
+    static uintptr_t text_rfind_sse2(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        __m128i first = _mm_set1_epi8(needle[0]);
+        __m128i last = _mm_set1_epi8(needle[m - 1]);
+        uintptr_t i = m <= n ? n - m + 1 : 0;
+        while (i >= 16) {
+            i -= 16;
+            for (uint32_t mask = sse2_ends_mask(p + i, m, first, last); mask != 0; mask &= ~(1u << (31 - __builtin_clz(mask)))) {
+                uintptr_t at = i + 31 - __builtin_clz(mask);
+                if (matches_inside(p + at, needle, m)) {
+                    return at;
+                }
+            }
+        }
+        return text_rfind_below(p, n, i, needle, m);
+    }
+
+#pragma mark - AVX2
+
+    __attribute__((target("avx2")))
+    static inline __m256i avx2_point_mask(__m256i v)
+    {
+        return _mm256_andnot_si256(
+            _mm256_cmpeq_epi8(v, _mm256_setzero_si256()),
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65)));
+    }
+
+    __attribute__((target("avx2")))
+    static uintptr_t utf8_count_points_avx2(char const *p, uintptr_t n)
+    {
+        uintptr_t count = 0;
+        uintptr_t i = 0;
+        while (i + 32 <= n) {
+            __m256i lanes = _mm256_setzero_si256();
+            for (int j = 0; j < 255 && i + 32 <= n; ++j, i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i));
+                lanes = _mm256_sub_epi8(lanes, avx2_point_mask(v));
+            }
+            __m256i sums = _mm256_sad_epu8(lanes, _mm256_setzero_si256());
+            count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+                   + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+        }
+        return count + utf8_count_points_sse2(p + i, n - i);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static uintptr_t utf8_find_point_avx2(char const *p, uintptr_t n, uintptr_t target)
+    {
+        uintptr_t i = 0;
+        for (; i + 64 <= n; i += 64) {
+            __m256i lo = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i));
+            __m256i hi = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i + 32));
+            uint64_t mask = (uint32_t)_mm256_movemask_epi8(avx2_point_mask(lo))
+                          | (uint64_t)(uint32_t)_mm256_movemask_epi8(avx2_point_mask(hi)) << 32;
+            uintptr_t found = __builtin_popcountll(mask);
+            if (found > target) {
+                return i + select_bit(mask, target);
+            }
+            target -= found;
+        }
+        return i + utf8_find_point_sse2(p + i, n - i, target);
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i avx2_break_mask(char const *p)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + 1));
+        __m256i lf = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+        __m256i cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+        return _mm256_or_si256(lf, _mm256_andnot_si256(_mm256_cmpeq_epi8(next, _mm256_set1_epi8('\n')), cr));
+    }
+
+    __attribute__((target("avx2")))
+    static uintptr_t line_count_breaks_avx2(char const *p, uintptr_t n)
+    {
+        uintptr_t count = 0;
+        uintptr_t i = 0;
+        while (i + 32 < n) {
+            __m256i lanes = _mm256_setzero_si256();
+            for (int j = 0; j < 255 && i + 32 < n; ++j, i += 32) {
+                lanes = _mm256_sub_epi8(lanes, avx2_break_mask(p + i));
+            }
+            __m256i sums = _mm256_sad_epu8(lanes, _mm256_setzero_si256());
+            count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+                   + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+        }
+        return count + line_count_breaks_from(p, n, i);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static uintptr_t line_find_break_avx2(char const *p, uintptr_t n, uintptr_t target)
+    {
+        uintptr_t i = 0;
+        for (; i + 64 < n; i += 64) {
+            uint64_t mask = (uint32_t)_mm256_movemask_epi8(avx2_break_mask(p + i))
+                          | (uint64_t)(uint32_t)_mm256_movemask_epi8(avx2_break_mask(p + i + 32)) << 32;
+            uintptr_t found = __builtin_popcountll(mask);
+            if (found > target) {
+                return i + select_bit(mask, target);
+            }
+            target -= found;
+        }
+        return line_find_break_from(p, n, i, target);
+    }
+
+    __attribute__((target("avx2")))
+    static inline uintptr_t avx2_sum(__m256i lanes)
+    {
+        __m256i sums = _mm256_sad_epu8(lanes, _mm256_setzero_si256());
+        return _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+             + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+    }
+
+    __attribute__((target("avx2")))
+    static TextCounts text_count_avx2(char const *p, uintptr_t n)
+    {
+        TextCounts counts = { 0, 0, 0 };
+        uintptr_t i = 0;
+        while (i + 32 < n) {
+            __m256i begins = _mm256_setzero_si256();
+            __m256i nuls = _mm256_setzero_si256();
+            __m256i fours = _mm256_setzero_si256();
+            __m256i breaks = _mm256_setzero_si256();
+            for (int j = 0; j < 255 && i + 32 < n; ++j, i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i));
+                __m256i next = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + i + 1));
+                __m256i cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+                __m256i lf = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+                begins = _mm256_sub_epi8(begins, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65)));
+                nuls = _mm256_sub_epi8(nuls, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+                fours = _mm256_sub_epi8(fours, _mm256_and_si256(
+                    _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-17)),
+                    _mm256_cmpgt_epi8(_mm256_set1_epi8(-8), v)));
+                breaks = _mm256_sub_epi8(breaks,
+                    _mm256_or_si256(lf, _mm256_andnot_si256(_mm256_cmpeq_epi8(next, _mm256_set1_epi8('\n')), cr)));
+            }
+            uintptr_t begun = avx2_sum(begins);
+            counts.points += begun - avx2_sum(nuls);
+            counts.units += begun + avx2_sum(fours);
+            counts.breaks += avx2_sum(breaks);
+        }
+        text_count_from(p, n, i, counts);
+        return counts;
+    }
+
+    /**
+     *  As `sse2_ends_mask`, for the 64 positions from `p`
+     */
+    __attribute__((target("avx2")))
+    static inline uint64_t avx2_ends_mask(char const *p, uintptr_t m, __m256i first, __m256i last)
+    {
+        __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)), first);
+        __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + 32)), first);
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_set1_epi8(-1))) {
+            return 0;
+        }
+        p += m - 1;
+        lo = _mm256_and_si256(lo, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)), last));
+        hi = _mm256_and_si256(hi, _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + 32)), last));
+        return (uint32_t)_mm256_movemask_epi8(lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32;
+    }
+
+    __attribute__((target("avx2")))
+    static uintptr_t text_find_avx2(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        __m256i first = _mm256_set1_epi8(needle[0]);
+        __m256i last = _mm256_set1_epi8(needle[m - 1]);
+        uintptr_t i = 0;
+        for (; i + m - 1 + 64 <= n; i += 64) {
+            for (uint64_t mask = avx2_ends_mask(p + i, m, first, last); mask != 0; mask &= mask - 1) {
+                uintptr_t at = i + __builtin_ctzll(mask);
+                if (matches_inside(p + at, needle, m)) {
+                    return at;
+                }
+            }
+        }
+        uintptr_t found = text_find_sse2(p + i, n - i, needle, m);
+        return found < n - i ? i + found : n;
+    }
+
+    __attribute__((target("avx2")))
+    static uintptr_t text_rfind_avx2(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        __m256i first = _mm256_set1_epi8(needle[0]);
+        __m256i last = _mm256_set1_epi8(needle[m - 1]);
+        uintptr_t i = m <= n ? n - m + 1 : 0;
+        while (i >= 64) {
+            i -= 64;
+            for (uint64_t mask = avx2_ends_mask(p + i, m, first, last); mask != 0; mask &= ~(1ull << (63 - __builtin_clzll(mask)))) {
+                uintptr_t at = i + 63 - __builtin_clzll(mask);
+                if (matches_inside(p + at, needle, m)) {
+                    return at;
+                }
+            }
+        }
+        // The positions below `i` are those a needle can start at within the first `i + m - 1` bytes
+        uintptr_t found = i > 0 ? text_rfind_sse2(p, i + m - 1, needle, m) : n;
+        return found < i ? found : n;
+    }
+
+#endif // ROPE_TEXT_KERNELS_X86
+
+#pragma mark - Dispatch
+
+    struct TextKernels {
+        uintptr_t (*count_points)(char const *, uintptr_t);
+        uintptr_t (*find_point)(char const *, uintptr_t, uintptr_t);
+        uintptr_t (*count_breaks)(char const *, uintptr_t);
+        uintptr_t (*find_break)(char const *, uintptr_t, uintptr_t);
+        uintptr_t (*find)(char const *, uintptr_t, char const *, uintptr_t);
+        uintptr_t (*rfind)(char const *, uintptr_t, char const *, uintptr_t);
+        TextCounts (*count)(char const *, uintptr_t);
+    };
+
+    static TextKernels const kernel_table[] = {
+        { utf8_count_points_scalar, utf8_find_point_scalar, line_count_breaks_scalar, line_find_break_scalar,
+          text_find_scalar, text_rfind_scalar, text_count_scalar },
+#ifdef ROPE_TEXT_KERNELS_X86
+        { utf8_count_points_sse2, utf8_find_point_sse2, line_count_breaks_sse2, line_find_break_sse2,
+          text_find_sse2, text_rfind_sse2, text_count_sse2 },
+        { utf8_count_points_avx2, utf8_find_point_avx2, line_count_breaks_avx2, line_find_break_avx2,
+          text_find_avx2, text_rfind_avx2, text_count_avx2 },
+#endif
+    };
+
+    static TextKernelISA &current_isa()
+    {
+        static TextKernelISA isa = best_text_kernel_isa();
+        return isa;
+    }
+
+    TextKernelISA best_text_kernel_isa()
+    {
+#ifdef ROPE_TEXT_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+            return TextKernelAVX2;
+        }
+        return TextKernelSSE2;
+#else
+        return TextKernelScalar;
+#endif
+    }
+
+    TextKernelISA text_kernel_isa()
+    {
+        return current_isa();
+    }
+
+    void set_text_kernel_isa(TextKernelISA isa)
+    {
+        TextKernelISA best = best_text_kernel_isa();
+        current_isa() = isa < best ? isa : best;
+    }
+
+    uintptr_t utf8_count_points(char const *p, uintptr_t n)
+    {
+        return kernel_table[current_isa()].count_points(p, n);
+    }
+
+    uintptr_t utf8_find_point(char const *p, uintptr_t n, uintptr_t target)
+    {
+        return kernel_table[current_isa()].find_point(p, n, target);
+    }
+
+    uintptr_t line_count_breaks(char const *p, uintptr_t n)
+    {
+        return kernel_table[current_isa()].count_breaks(p, n);
+    }
+
+    uintptr_t line_find_break(char const *p, uintptr_t n, uintptr_t target)
+    {
+        return kernel_table[current_isa()].find_break(p, n, target);
+    }
+
+    TextCounts text_count(char const *p, uintptr_t n)
+    {
+        return kernel_table[current_isa()].count(p, n);
+    }
+
+    uintptr_t text_find(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        return kernel_table[current_isa()].find(p, n, needle, m);
+    }
+
+    uintptr_t text_rfind(char const *p, uintptr_t n, char const *needle, uintptr_t m)
+    {
+        return kernel_table[current_isa()].rfind(p, n, needle, m);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef ROPE_TEXT_KERNELS_H
+#define ROPE_TEXT_KERNELS_H
+
+#import <cstdint>
+
+namespace Rope {
+
+    /**
+     *  Instruction sets the text scanning kernels can be built for
+     */
+    enum TextKernelISA : char {
+        TextKernelScalar = 0,
+        TextKernelSSE2 = 1,
+        TextKernelAVX2 = 2
+    };
+
+    /**
+     *  The best instruction set supported by the running CPU
+     */
+    TextKernelISA best_text_kernel_isa();
+
+    /**
+     *  The instruction set currently used by the kernels. Defaults to `best_text_kernel_isa()`.
+     */
+    TextKernelISA text_kernel_isa();
+
+    /**
+     *  Select the kernels to use (e.g.: for benchmarking). Requests beyond what the CPU supports are clamped.
+     */
+    void set_text_kernel_isa(TextKernelISA isa);
+
+    /**
+     *  Count the bytes in `[p, p + n)` that begin a UTF-8 sequence, that is ASCII and lead bytes other than NUL
+     */
+    uintptr_t utf8_count_points(char const *p, uintptr_t n);
+
+    /**
+     *  Offset of the byte beginning sequence number `target` (counting from 0) in `[p, p + n)`,
+     *  or `n` if there are not that many sequences
+     */
+    uintptr_t utf8_find_point(char const *p, uintptr_t n, uintptr_t target);
+
+    /**
+     *  Count the line breaks in `[p, p + n)`: every LF, and every CR that is not followed by an LF.
+     *  A CR in the last position is counted, though an LF beginning the text after it would make it a CRLF.
+     */
+    uintptr_t line_count_breaks(char const *p, uintptr_t n);
+
+    /**
+     *  Offset of the last byte of line break number `target` (counting from 0) in `[p, p + n)`,
+     *  or `n` if there are not that many breaks
+     */
+    uintptr_t line_find_break(char const *p, uintptr_t n, uintptr_t target);
+
+    /**
+     *  What one pass over some UTF-8 text counts
+     */
+    struct TextCounts {
+        uintptr_t points;   // as `utf8_count_points`
+        uintptr_t units;    // UTF-16 units: one per byte beginning a sequence (NUL included), two for 4-byte leads
+        uintptr_t breaks;   // as `line_count_breaks`
+    };
+
+    /**
+     *  Count the code points, UTF-16 units and line breaks in `[p, p + n)`, reading it once
+     */
+    TextCounts text_count(char const *p, uintptr_t n);
+
+    /**
+     *  Offset of the first occurrence of the `m` bytes at `needle` in `[p, p + n)`, or `n` if there is none. `m`
+     *  must be at least 1. Positions are first filtered by comparing the needle's first and last bytes with a whole
+     *  vector of positions at a time, and only the survivors are compared in full.
+     */
+    uintptr_t text_find(char const *p, uintptr_t n, char const *needle, uintptr_t m);
+
+    /**
+     *  Offset of the last occurrence of the `m` bytes at `needle` in `[p, p + n)`, or `n` if there is none
+     */
+    uintptr_t text_rfind(char const *p, uintptr_t n, char const *needle, uintptr_t m);
+}
+
+#endif // ROPE_TEXT_KERNELS_H
@@ -0,0 +1,184 @@
+#import "thread_pool.hpp"
+
+#import <algorithm>
+#import <exception>
+
+namespace Rope {
+
+    /**
+     *  The state shared by the tasks of one `parallel_for` call, on the calling thread's stack
+     */
+    struct ThreadPool::Job {
+        std::function<void (uintptr_t, uintptr_t)> const *body;
+        std::atomic<uintptr_t> remaining;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    static thread_local ThreadPool *pool_scope;
+
+#pragma mark - Lifetime
+
+    ThreadPool::ThreadPool(unsigned worker_count)
+    :   pending(0),
+        next_queue(0),
+        stopping(false)
+    {
+        for (unsigned i = 0; i < worker_count; ++i) {
+            queues.emplace_back(new Queue());
+        }
+        for (unsigned i = 0; i < worker_count; ++i) {
+            workers.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool &ThreadPool::current()
+    {
+        if (pool_scope != nullptr) {
+            return *pool_scope;
+        }
+        static ThreadPool shared(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+        return shared;
+    }
+
+    ThreadPool::Scope::Scope(ThreadPool &pool)
+    :   previous(pool_scope)
+    {
+        pool_scope = &pool;
+    }
+
+    ThreadPool::Scope::~Scope()
+    {
+        pool_scope = previous;
+    }
+
+#pragma mark - Scheduling
+
+    void ThreadPool::parallel_for(
+        uintptr_t count,
+        std::function<void (uintptr_t begin, uintptr_t end)> const &body,
+        uintptr_t grain)
+    {
+        grain = std::max<uintptr_t>(grain, 1);
+        uintptr_t task_count = (count + grain - 1) / grain;
+        if (task_count == 0) {
+            return;
+        }
+        if (workers.empty() || task_count == 1) {
+            body(0, count);
+            return;
+        }
+
+        Job job;
+        job.body = &body;
+        job.remaining = task_count;
+
+        unsigned queue_count = (unsigned)queues.size();
+        unsigned first = next_queue.fetch_add(1, std::memory_order_relaxed);
+        for (uintptr_t t = 0; t < task_count; ++t) {
+            Queue &queue = *queues[(first + t) % queue_count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task { &job, t * grain, std::min(count, (t + 1) * grain) });
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            pending.fetch_add((intptr_t)task_count, std::memory_order_relaxed);
+        }
+        wake.notify_all();
+
+        // Help rather than block, so a task that calls parallel_for can't starve the pool
+        Task task;
+        while (job.remaining.load(std::memory_order_acquire) > 0 && take(queue_count, task)) {
+            execute(task);
+        }
+
+        // Taking the job's lock orders our return after the last task has finished with the job
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&] { return job.remaining.load(std::memory_order_acquire) == 0; });
+        if (job.error) {
+            std::rethrow_exception(job.error);
+        }
+    }
+
+    void ThreadPool::run(unsigned index)
+    {
+        Task task;
+        while (true) {
+            if (take(index, task)) {
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [&] { return stopping || pending.load(std::memory_order_relaxed) > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    /**
+     *  Take a task from the back of queue `index`, or steal one from the front of another queue. The calling thread
+     *  of `parallel_for` owns no queue and passes the queue count.
+     */
+    bool ThreadPool::take(unsigned index, Task &task)
+    {
+        unsigned queue_count = (unsigned)queues.size();
+        if (index < queue_count) {
+            Queue &own = *queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        for (unsigned i = 1; i <= queue_count; ++i) {
+            unsigned victim = (index + i) % queue_count;
+            if (victim == index) {
+                continue;
+            }
+            Queue &queue = *queues[victim];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::execute(Task const &task)
+    {
+        Job &job = *task.job;
+        std::exception_ptr error;
+        try {
+            (*job.body)(task.begin, task.end);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (error && !job.error) {
+            job.error = error;
+        }
+        if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            job.done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ROPE_THREAD_POOL_H
+#define ROPE_THREAD_POOL_H
+
+#import <atomic>
+#import <condition_variable>
+#import <deque>
+#import <functional>
+#import <memory>
+#import <mutex>
+#import <thread>
+#import <vector>
+#import <cstdint>
+
+namespace Rope {
+
+    /**
+     *  Work-stealing thread pool for bulk rope operations.
+     *
+     *  Each worker keeps its own deque of tasks: it takes work from the back of its own deque and steals from the
+     *  front of the others' when it runs dry. A thread waiting on `parallel_for` runs queued tasks itself until its
+     *  job completes, so calls may nest inside tasks without deadlocking.
+     */
+    class ThreadPool {
+    public:
+        /**
+         *  Routes the current thread's parallel rope operations to a pool for the lifetime of the scope
+         */
+        class Scope {
+        public:
+            Scope(ThreadPool &pool);
+            ~Scope();
+
+        private:
+            ThreadPool *previous;
+        };
+
+        /**
+         *  Start `workers` threads. With none, work runs on the calling thread.
+         */
+        explicit ThreadPool(unsigned workers);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        /**
+         *  The number of worker threads; the calling thread works alongside them
+         */
+        unsigned size() const { return (unsigned)workers.size(); }
+
+        /**
+         *  The pool of the thread's innermost active scope, or else a shared pool with a worker per hardware thread
+         *  beyond the first
+         */
+        static ThreadPool &current();
+
+        /**
+         *  Call `body(begin, end)` over [0, count) in ranges of `grain` items, and return once every range is done.
+         *  Rethrows the first exception thrown by `body`.
+         */
+        void parallel_for(
+            uintptr_t count,
+            std::function<void (uintptr_t begin, uintptr_t end)> const &body,
+            uintptr_t grain = 1);
+
+    private:
+        struct Job;
+
+        struct Task {
+            Job *job;
+            uintptr_t begin;
+            uintptr_t end;
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void run(unsigned index);
+        bool take(unsigned index, Task &task);
+        void execute(Task const &task);
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<Queue>> queues;
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        std::atomic<intptr_t> pending;         // may dip below zero while tasks are being queued
+        std::atomic<unsigned> next_queue;
+        bool stopping;
+    };
+};
+
+#endif // ROPE_THREAD_POOL_H
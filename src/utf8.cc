@@ -1,4 +1,5 @@
 #import "utf8.hpp"
+#import "text_kernels.hpp"
 
 #import <sstream>
 #import <cstring>
@@ -7,6 +8,14 @@
 
 namespace Rope {
 
+    /**
+     *  Portable equivalent of BSD `fls`: the 1-based index of the most significant set bit, or 0 if no bits are set
+     */
+    static inline int find_last_set(int x)
+    {
+        return x != 0 ? 32 - __builtin_clz((unsigned)x) : 0;
+    }
+
     UTF8Measure::UTF8Measure()
     {
         memset(pre, 0, 4);
@@ -53,7 +62,7 @@ namespace Rope {
         
         // Search for a byte in 'extra' with at least two leading set bits.
         for (char *c = extra; *c != '\0'; c++) {
-            int leading = 8 - fls(~*c);
+            int leading = 8 - find_last_set(~*c);
             if (leading > 1) {
                 int llen = c - extra;
                 int rlen = extralen - llen - leading;
@@ -105,13 +114,59 @@ namespace Rope {
 
     UTF8Measure::Shared UTF8Measure::accumulate(const Slice<char> &vec)
     {
-        auto acc = identity();
-        auto tmp = identity();
+        return std::make_shared<UTF8Measure>(measure(vec));
+    }
 
-        for (auto it = vec.begin(); it != vec.end(); ++it) {
-            UTF8Measure rhs(*it);
-            new (acc.get()) UTF8Measure(*tmp, rhs);
-            new (tmp.get()) UTF8Measure(*acc);
+    /**
+     *  Whether `c` is counted by a UTF8Measure: ASCII and lead bytes, other than NUL
+     */
+    static inline bool begins_point(char c)
+    {
+        return c != 0 && (c & 0xC0) != 0x80;
+    }
+
+    /**
+     *  Equivalent to joining the single-byte measure of every item in `vec`, left to right.
+     *
+     *  That fold counts every byte that begins a sequence, keeps (up to 4 of) the continuation bytes before the
+     *  first counted byte in `pre`, and those after the last counted byte in `post`. Only the boundary bytes are
+     *  examined here; the count comes from the vectorized kernels.
+     */
+    UTF8Measure UTF8Measure::measure(const Slice<char> &vec)
+    {
+        return measure(vec, utf8_count_points(vec.data(), vec.size()));
+    }
+
+    UTF8Measure UTF8Measure::measure(const Slice<char> &vec, uintptr_t count)
+    {
+        char const *p = vec.data();
+        uintptr_t n = vec.size();
+        UTF8Measure acc;
+
+        acc.count = count;
+
+        uintptr_t len = 0;
+        for (uintptr_t i = 0; i < n && len < 4 && !begins_point(p[i]); ++i) {
+            if (p[i] != '\0') {
+                acc.pre[len++] = p[i];
+            }
+        }
+
+        if (acc.count == 0) {
+            memcpy(acc.post, acc.pre, 4);
+            return acc;
+        }
+
+        uintptr_t last = n;
+        while (!begins_point(p[last - 1])) {
+            --last;
+        }
+
+        len = 0;
+        for (uintptr_t i = last; i < n && len < 4; ++i) {
+            if (p[i] != '\0') {
+                acc.post[len++] = p[i];
+            }
         }
 
         return acc;
@@ -119,50 +174,44 @@ namespace Rope {
 
     uintptr_t UTF8Measure::index(const Slice<char> &vec, uintptr_t target)
     {
-        uintptr_t acc = -1;
-        auto it = vec.begin();
-        auto end = vec.end();
-        auto accm = identity();
-        auto tmp = identity();
-        
-        auto current = accm->count;
-        
-        while (current <= target) {
-            if (it == end) {
-                ++acc;
-                break;
-            }
-            new (accm.get()) UTF8Measure(*tmp, UTF8Measure(*it));
-            new (tmp.get()) UTF8Measure(*accm);
-            ++acc;
-            ++it;
-            current = accm->count;
-        } 
-        return acc;
+        return utf8_find_point(vec.data(), vec.size(), target);
     }
 
 #pragma mark - LineMeasure
 
-    LineMeasure::LineMeasure() : lpartial(true), count(0) {}
+    LineMeasure::LineMeasure() : lpartial(true), lfeed(false), rreturn(false), empty(true), count(0) {}
 
     LineMeasure::LineMeasure(const char &c) {
-        if (c == '\n') {
+        if (c == '\n' || c == '\r') {
             count = 1;
             lpartial = false;
         } else {
             count = 0;
             lpartial = true;
         }
+        lfeed = c == '\n';
+        rreturn = c == '\r';
+        empty = false;
     }
 
     LineMeasure::LineMeasure(int d) {
         count = d;
         lpartial = false;
+        lfeed = false;
+        rreturn = false;
+        empty = false;
     }
 
     LineMeasure::LineMeasure(LineMeasure const &left, LineMeasure const &right) {
         count = left.count + right.count;
+        if (left.rreturn && right.lfeed) {
+            // A CRLF split between the measures, counted by both
+            count -= 1;
+        }
         lpartial = left.lpartial;
+        lfeed = left.empty ? right.lfeed : left.lfeed;
+        rreturn = right.empty ? left.rreturn : right.rreturn;
+        empty = left.empty && right.empty;
     }
 
     uintptr_t LineMeasure::getCount(const LineMeasure::Shared &m) {
@@ -178,40 +227,80 @@ namespace Rope {
     }
 
     LineMeasure::Shared LineMeasure::accumulate(const Slice<char> &vec) {
-        auto acc = identity();
-        auto tmp = identity();
+        return std::make_shared<LineMeasure>(measure(vec));
+    }
 
-        for (auto it = vec.begin(); it != vec.end(); ++it) {
-            LineMeasure rhs(*it);
-            new (acc.get()) LineMeasure(*tmp, rhs);
-            new (tmp.get()) LineMeasure(*acc);
+    LineMeasure LineMeasure::measure(const Slice<char> &vec) {
+        return measure(vec, line_count_breaks(vec.data(), vec.size()));
+    }
+
+    LineMeasure LineMeasure::measure(const Slice<char> &vec, uintptr_t count) {
+        char const *p = vec.data();
+        uintptr_t n = vec.size();
+        LineMeasure acc;
+
+        if (n == 0) {
+            return acc;
         }
 
+        acc.count = count;
+        acc.lfeed = p[0] == '\n';
+        acc.rreturn = p[n - 1] == '\r';
+        acc.empty = false;
         return acc;
     }
 
     uintptr_t LineMeasure::index(const Slice<char> &vec, uintptr_t target) {
         if (target == 0) return 0;
-        uintptr_t acc = -1;
-        auto it = vec.begin();
-        auto end = vec.end();
-        auto accm = identity();
-        auto tmp = identity();
-
-        auto current = accm->count;
-
-        while (current < target) {
-            if (it == end) {
-                ++acc;
-                break;
+        // The byte after the break, or one past the end when there are too few breaks
+        return line_find_break(vec.data(), vec.size(), target - 1) + 1;
+    }
+
+#pragma mark - UTF16Measure
+
+    /**
+     *  The number of UTF-16 units contributed by a byte: one per sequence, or two for a four-byte sequence
+     */
+    static inline uintptr_t utf16_units(unsigned char c)
+    {
+        if ((c & 0xC0) == 0x80) {
+            return 0;
+        }
+        return (c & 0xF8) == 0xF0 ? 2 : 1;
+    }
+
+    UTF16Measure UTF16Measure::measure(const Slice<char> &vec)
+    {
+        uintptr_t count = 0;
+        for (auto it = vec.begin(); it != vec.end(); ++it) {
+            count += utf16_units(*it);
+        }
+        return UTF16Measure(count);
+    }
+
+    uintptr_t UTF16Measure::index(const Slice<char> &vec, uintptr_t target)
+    {
+        uintptr_t acc = 0;
+        uintptr_t i = 0;
+        for (auto it = vec.begin(); it != vec.end(); ++it, ++i) {
+            uintptr_t units = utf16_units(*it);
+            if (units != 0 && acc + units > target) {
+                return i;
             }
-            new (accm.get()) LineMeasure(*tmp, LineMeasure(*it));
-            new (tmp.get()) LineMeasure(*accm);
-            ++acc;
-            ++it;
-            current = accm->count;
+            acc += units;
         }
-        assert(acc != -1);
-        return acc + 1;
+        return i;
+    }
+
+#pragma mark - TextMeasurePolicy
+
+    TextMeasurePolicy::measure_type TextMeasurePolicy::accumulate(const Slice<char> &vec)
+    {
+        TextCounts counts = text_count(vec.data(), vec.size());
+        return measure_type(
+            BytesMeasure(vec.size()),
+            UTF8Measure::measure(vec, counts.points),
+            LineMeasure::measure(vec, counts.breaks),
+            UTF16Measure(counts.units));
     }
 };
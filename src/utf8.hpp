@@ -3,6 +3,7 @@
 
 #import <cstdint>
 #import <memory>
+#import <string>
 
 #import "measure.hpp"
 #import "slice.hpp"
@@ -71,12 +72,28 @@ namespace Rope {
         static Shared
         accumulate(const Slice<char> &vec);
 
+        /**
+         *  Measure a slice by value, without allocating
+         */
+        static UTF8Measure
+        measure(const Slice<char> &vec);
+
+        /**
+         *  Measure a slice whose code points have already been counted (e.g.: by `text_count`)
+         */
+        static UTF8Measure
+        measure(const Slice<char> &vec, uintptr_t count);
+
         static uintptr_t
         index(const Slice<char> &vec, uintptr_t target);
     };
 
     /**
-     *  Represents the number of line beginnings in a chunk of text
+     *  Represents the number of line beginnings in a chunk of text.
+     *
+     *  A line ends at LF, CRLF or a lone CR. A CR at the right edge of a measure is counted, so text ending in CR
+     *  has as many lines as text ending in LF, and the join takes it back if the next measure begins with the LF
+     *  of a CRLF, so a CRLF split across leaves counts once.
      */
     class LineMeasure : public Measure<char>
     {
@@ -85,6 +102,9 @@ namespace Rope {
 
     public:
         bool lpartial;
+        bool lfeed;     // the measured text begins with LF
+        bool rreturn;   // the measured text ends with CR, which an LF beginning the next measure continues
+        bool empty;
         uintptr_t count;
 
         /**
@@ -103,10 +123,9 @@ namespace Rope {
         LineMeasure(int d);
 
         /**
-         *  Construct a UTF8Measure by joining two existing measures
-         *  count = left.count + right.count + 1 (assuming left.post + right.post is a valid sequence)
-         *  pre = left.pre
-         *  post = right.post
+         *  Construct a LineMeasure by joining two existing measures
+         *  count = left.count + right.count - 1 if left ends with a CR that right continues with LF
+         *  lpartial = left.lpartial
          */
         LineMeasure(LineMeasure const &left, LineMeasure const &right);
 
@@ -133,6 +152,18 @@ namespace Rope {
         static Shared
         accumulate(const Slice<char> &vec);
 
+        /**
+         *  Measure a slice by value, without allocating
+         */
+        static LineMeasure
+        measure(const Slice<char> &vec);
+
+        /**
+         *  Measure a slice whose line breaks have already been counted (e.g.: by `text_count`)
+         */
+        static LineMeasure
+        measure(const Slice<char> &vec, uintptr_t count);
+
         static uintptr_t
         index(const Slice<char> &vec, uintptr_t target);
     };
@@ -144,6 +175,7 @@ namespace Rope {
         using Shared = std::shared_ptr<BytesMeasure>;
         
     public:
+        size_t size() const { return bytes; }
         
         BytesMeasure(BytesMeasure const &lhs, BytesMeasure const &rhs) : bytes(lhs.bytes + rhs.bytes) { }
         BytesMeasure(size_t bytes) : bytes(bytes) { }
@@ -171,6 +203,163 @@ namespace Rope {
         }
     };
 
+    /**
+     *  Represents the number of UTF-16 code units needed to encode a chunk of UTF-8 text.
+     *  Units are counted at the leading byte of each sequence, so a measure never straddles a split.
+     */
+    class UTF16Measure : public Measure<char>
+    {
+    public:
+        uintptr_t count;
+
+        UTF16Measure() : count(0) {}
+        UTF16Measure(uintptr_t count) : count(count) {}
+        UTF16Measure(UTF16Measure const &lhs, UTF16Measure const &rhs) : count(lhs.count + rhs.count) {}
+
+        static UTF16Measure
+        measure(const Slice<char> &vec);
+
+        /**
+         *  Locate the leading byte of the sequence containing UTF-16 unit `target`
+         */
+        static uintptr_t
+        index(const Slice<char> &vec, uintptr_t target);
+    };
+
+    /**
+     *  Compile-time policies for use with `Rope<char, Policy>`.
+     *  Measures are held by value in each node, so joining them never allocates.
+     */
+    struct UTF8MeasurePolicy : public MeasurePolicy
+    {
+        using measure_type = UTF8Measure;
+
+        static UTF8Measure join(UTF8Measure const &lhs, UTF8Measure const &rhs) { return UTF8Measure(lhs, rhs); }
+        static UTF8Measure identity() { return UTF8Measure(); }
+        static UTF8Measure accumulate(const Slice<char> &vec) { return UTF8Measure::measure(vec); }
+        static uintptr_t index(const Slice<char> &vec, uintptr_t target) { return UTF8Measure::index(vec, target); }
+        static uintptr_t predicate(UTF8Measure const &m) { return m.count; }
+        static constexpr bool incremental_index = true;
+
+        static void serialize(UTF8Measure const &m, std::string &out)
+        {
+            __measureWrite(out, m.pre);
+            __measureWrite(out, m.count);
+            __measureWrite(out, m.post);
+        }
+
+        static UTF8Measure deserialize(char const *&in)
+        {
+            UTF8Measure m;
+            __measureRead(in, m.pre);
+            __measureRead(in, m.count);
+            __measureRead(in, m.post);
+            return m;
+        }
+    };
+
+    struct LineMeasurePolicy : public MeasurePolicy
+    {
+        using measure_type = LineMeasure;
+
+        static LineMeasure join(LineMeasure const &lhs, LineMeasure const &rhs) { return LineMeasure(lhs, rhs); }
+        static LineMeasure identity() { return LineMeasure(); }
+        static LineMeasure accumulate(const Slice<char> &vec) { return LineMeasure::measure(vec); }
+        static uintptr_t index(const Slice<char> &vec, uintptr_t target) { return LineMeasure::index(vec, target); }
+        static uintptr_t predicate(LineMeasure const &m) { return m.count + (m.lpartial ? 1 : 0); }
+        static constexpr bool incremental_index = true;
+
+        static void serialize(LineMeasure const &m, std::string &out)
+        {
+            __measureWrite(out, m.lpartial);
+            __measureWrite(out, m.lfeed);
+            __measureWrite(out, m.rreturn);
+            __measureWrite(out, m.empty);
+            __measureWrite(out, m.count);
+        }
+
+        static LineMeasure deserialize(char const *&in)
+        {
+            LineMeasure m;
+            __measureRead(in, m.lpartial);
+            __measureRead(in, m.lfeed);
+            __measureRead(in, m.rreturn);
+            __measureRead(in, m.empty);
+            __measureRead(in, m.count);
+            return m;
+        }
+    };
+
+    struct BytesMeasurePolicy : public MeasurePolicy
+    {
+        using measure_type = BytesMeasure;
+
+        static BytesMeasure join(BytesMeasure const &lhs, BytesMeasure const &rhs) { return BytesMeasure(lhs, rhs); }
+        static BytesMeasure identity() { return BytesMeasure(); }
+        static BytesMeasure accumulate(const Slice<char> &vec) { return BytesMeasure(vec.size()); }
+        static uintptr_t index(const Slice<char> &vec, uintptr_t target) { return target; }
+        static uintptr_t predicate(BytesMeasure const &m) { return m.size(); }
+        static constexpr bool incremental_index = true;
+
+        static void serialize(BytesMeasure const &m, std::string &out) { __measureWrite(out, m.size()); }
+
+        static BytesMeasure deserialize(char const *&in)
+        {
+            size_t bytes;
+            __measureRead(in, bytes);
+            return BytesMeasure(bytes);
+        }
+    };
+
+    /**
+     *  Not `incremental_index`: a target between the units of a surrogate pair resolves to the pair's first byte
+     */
+    struct UTF16MeasurePolicy : public MeasurePolicy
+    {
+        using measure_type = UTF16Measure;
+
+        static UTF16Measure join(UTF16Measure const &lhs, UTF16Measure const &rhs) { return UTF16Measure(lhs, rhs); }
+        static UTF16Measure identity() { return UTF16Measure(); }
+        static UTF16Measure accumulate(const Slice<char> &vec) { return UTF16Measure::measure(vec); }
+        static uintptr_t index(const Slice<char> &vec, uintptr_t target) { return UTF16Measure::index(vec, target); }
+        static uintptr_t predicate(UTF16Measure const &m) { return m.count; }
+
+        static void serialize(UTF16Measure const &m, std::string &out) { __measureWrite(out, m.count); }
+
+        static UTF16Measure deserialize(char const *&in)
+        {
+            uintptr_t count;
+            __measureRead(in, count);
+            return UTF16Measure(count);
+        }
+    };
+
+    /**
+     *  Components of `TextMeasurePolicy`, for use as `rope.begin<TextMeasureLines>()`
+     */
+    enum TextMeasureComponent : size_t {
+        TextMeasureBytes = 0,
+        TextMeasureCodePoints = 1,
+        TextMeasureLines = 2,
+        TextMeasureUTF16 = 3
+    };
+
+    /**
+     *  Every text coordinate system in one measure: bytes, code points, lines and UTF-16 units.
+     *
+     *  Leaves are accumulated in one pass that counts code points, line breaks and four-byte leads together,
+     *  rather than a pass per component: a leaf's UTF-16 units are its code points, its NULs and its four-byte
+     *  leads, which take a surrogate pair each.
+     */
+    struct TextMeasurePolicy : public CompositeMeasurePolicy<
+        BytesMeasurePolicy,
+        UTF8MeasurePolicy,
+        LineMeasurePolicy,
+        UTF16MeasurePolicy>
+    {
+        static measure_type accumulate(const Slice<char> &vec);
+    };
+
 };
 
 #endif